@@ -0,0 +1,414 @@
+/*
+ * check.i --
+ *
+ * Tests of the YAML plugin.  They are run by "make check" (after the tests
+ * of the core) in the build directory with:
+ *
+ *     yorick -batch check.i
+ *
+ * Each test writes YAML files in the current directory, reads them back and
+ * compares the contents by their fingerprints (see yaml_hash) or by their
+ * values.  The failed checks are reported and the exit status is non-zero if
+ * there are any.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2018: Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * See LICENSE.md for details.
+ *
+ */
+
+/* Use the plugin of the build directory. */
+plug_dir, _(".", plug_dir());
+include, "yaml.i";
+
+_check_count = 0;
+_check_failures = 0;
+
+func check(cond, what)
+/* DOCUMENT check, cond, what;
+
+     Counts a check and reports it if condition COND is false.  WHAT is the
+     description of the check.
+ */
+{
+  extern _check_count, _check_failures;
+  ++_check_count;
+  if (! cond) {
+    ++_check_failures;
+    write, format="check failed: %s\n", what;
+  }
+}
+
+func check_file(name, text)
+/* DOCUMENT path = check_file(name);
+         or path = check_file(name, text);
+
+     Yields the path of the temporary file NAME and, if TEXT is given,
+     writes it into this file.
+ */
+{
+  path = "check-" + name + ".yaml";
+  if (! is_void(text)) {
+    file = create(path);
+    write, file, format="%s", text;
+    close, file;
+  }
+  return path;
+}
+
+func check_open(path)
+/* DOCUMENT emitter = check_open(path);
+
+     Yields an emitter writing file PATH, after the STREAM-START and
+     DOCUMENT-START events.
+ */
+{
+  emitter = yaml_open(path, "w");
+  yaml_emit, emitter, yaml_stream_start_event();
+  yaml_emit, emitter, yaml_document_start_event();
+  return emitter;
+}
+
+func check_close(emitter)
+/* DOCUMENT check_close, emitter;
+
+     Emits the DOCUMENT-END and STREAM-END events and closes EMITTER.
+ */
+{
+  yaml_emit, emitter, yaml_document_end_event();
+  yaml_emit, emitter, yaml_stream_end_event();
+  yaml_close, emitter;
+}
+
+func check_same(path, text)
+/* DOCUMENT bool = check_same(path, text);
+
+     Yields whether the contents of YAML file PATH are the same as those of
+     TEXT (a YAML document).
+ */
+{
+  return (yaml_hash(path) == yaml_hash(check_file("expected", text)));
+}
+
+/*---------------------------------------------------------------------------*/
+/* TABLES AND STRUCTURES */
+
+struct _check_struct {
+  long id;
+  double x;
+  string name;
+}
+
+s = array(_check_struct, 3);
+s.id = [1, 2, 3];
+s.x = [0.5, -1.25, 1e-7];
+s.name = ["a", "b c", "yes"];
+check, allof(_yaml_struct_members(s) == ["id", "x", "name"]),
+  "_yaml_struct_members";
+
+path = check_file("struct");
+emitter = check_open(path);
+yaml_emit_struct, emitter, s;
+check_close, emitter;
+check, check_same(path, ("- {id: 1, x: 0.5, name: a}\n" +
+                         "- {id: 2, x: -1.25, name: b c}\n" +
+                         "- {id: 3, x: 1e-7, name: 'yes'}\n")),
+  "yaml_emit_struct (rows)";
+doc = yaml_load(path);
+check, is_obj(doc) && doc(*) == 3, "yaml_load of yaml_emit_struct output";
+
+emitter = check_open(path);
+yaml_emit_struct, emitter, s, columns=1;
+check_close, emitter;
+check, check_same(path, ("id: [1, 2, 3]\n" +
+                         "x: [0.5, -1.25, 1e-7]\n" +
+                         "name: [a, b c, 'yes']\n")),
+  "yaml_emit_struct (columns)";
+
+list = yaml_columns(2);
+list, 1, [1.234, 2.0];
+list, 2, [[1, 2], [3, 4]];
+emitter = check_open(path);
+yaml_emit_table, emitter, ["x", "v"], list, format=["%.1f", ""];
+check_close, emitter;
+check, check_same(path, ("- {x: 1.2, v: [1, 2]}\n" +
+                         "- {x: 2.0, v: [3, 4]}\n")),
+  "yaml_emit_table with a list of columns and formats";
+
+x = [0.1, 1.0/3.0, -2.5e-300];
+types = [YAML_SEQUENCE_START_EVENT, YAML_SCALAR_EVENT, YAML_SCALAR_EVENT,
+         YAML_SCALAR_EVENT, YAML_SEQUENCE_END_EVENT];
+emitter = check_open(path);
+yaml_emit_events, emitter, types, grow(0.0, x, 0.0);
+check_close, emitter;
+paths = yaml_flatten(path, kinds, values);
+check, numberof(values) == 3 && allof(values == x),
+  "yaml_emit_events writes reals with round-trip precision";
+
+/*---------------------------------------------------------------------------*/
+/* ORDERED MAPPINGS */
+
+path = check_file("mapping", ("b: 1\n" +
+                              "a: [x, y]\n" +
+                              "base: &d {p: 1, q: [1, {r: 2}]}\n" +
+                              "m: {<<: *d, p: 9}\n" +
+                              "e: []\n"));
+doc = yaml_load(path, mapping=1);
+check, (typeof(doc) == "yaml_mapping" &&
+        allof(doc() == ["b", "a", "base", "m", "e"]) &&
+        doc("b") == "1" && allof(doc.a == ["x", "y"]) &&
+        doc.m("p") == "9" && doc.m.q(2).r == "2" && is_void(doc.e)),
+  "yaml_load with mapping";
+all = yaml_load_all(check_file("mapping-all", "[]\n---\n{k: v}\n"),
+                    mapping=1);
+check, all(*) == 2 && is_void(all(1)) && all(2).k == "v",
+  "yaml_load_all with mapping";
+yaml_save, check_file("saved"), doc;
+tmp = yaml_load(check_file("saved"), mapping=1);
+check, (allof(tmp() == doc()) && allof(tmp.m() == ["p", "q"]) &&
+        allof(tmp.a == doc.a) && tmp.m.q(2).r == "2"),
+  "yaml_save of ordered mappings";
+
+/*---------------------------------------------------------------------------*/
+/* DEDUPLICATION */
+
+func check_text(path)
+/* DOCUMENT text = check_text(path);
+
+     Yields the contents of text file PATH as a single string.
+ */
+{
+  return sum(rdfile(path) + "\n");
+}
+
+doc = save(a=save(x=[1, 2], y="z"), b=save(x=[1, 2], y="z"), c=[1, 2]);
+path = check_file("dedup");
+yaml_save, path, doc, dedup=1;
+text = check_text(path);
+check, (strmatch(text, "&id001") && strmatch(text, "&id002") &&
+        strmatch(text, "b: *id001") && strmatch(text, "c: *id002")),
+  "yaml_save with dedup gives anchors to the first occurrences";
+check, yaml_hash(path) == yaml_hash(doc), "yaml_save with dedup";
+
+/* The generated anchors skip the anchors of the document. */
+emitter = yaml_open(path, "w", dedup=1);
+yaml_emit, emitter, yaml_stream_start_event();
+yaml_emit, emitter, yaml_document_start_event();
+yaml_emit, emitter, yaml_sequence_start_event();
+yaml_emit_array, emitter, [1, 2];
+yaml_emit_array, emitter, [1, 2];
+yaml_emit, emitter, yaml_sequence_start_event(anchor="id001");
+yaml_emit, emitter, yaml_scalar_event(value="u");
+yaml_emit, emitter, yaml_sequence_end_event();
+yaml_emit, emitter, yaml_alias_event(anchor="id001");
+yaml_emit, emitter, yaml_sequence_end_event();
+check_close, emitter;
+text = check_text(path);
+check, strmatch(text, "*id002") && ! strmatch(text, "&id001 [1"),
+  "generated anchors do not collide with those of the document";
+check, check_same(path, "- [1, 2]\n- [1, 2]\n- &a [u]\n- *a\n"),
+  "yaml_open with dedup";
+
+/*---------------------------------------------------------------------------*/
+/* DIFFERENCES */
+
+a = check_file("diff-a", "a: 1\nb: {x: [1, 2], y: z}\nc: 0x10\n0x1F: k\n");
+b = check_file("diff-b", "a: 1\nb: {x: [1, 3], y: z}\nc: 16\n31: k\nd: new\n");
+chg = yaml_diff(a, b);
+check, (dimsof(chg)(1) == 2 && dimsof(chg)(2) == 4 && dimsof(chg)(3) == 4 &&
+        allof(chg(1,) == [".b.x[1]", ".0x1F", ".31", ".d"]) &&
+        allof(chg(2,) == ["changed", "removed", "added", "added"]) &&
+        chg(3,1) == "2" && chg(4,1) == "3" && chg(4,4) == "new"),
+  "yaml_diff (values by contents, keys by text)";
+check, is_void(yaml_diff(a, a)), "yaml_diff of identical documents";
+
+/*---------------------------------------------------------------------------*/
+/* MERGING OF LAYERS */
+
+a = check_file("merge-a", ("defaults: &d {x: 1, y: 2}\n" +
+                           "a: &s {<<: *d, y: 3}\n" +
+                           "b: *s\n" +
+                           "c: [1, 2]\n" +
+                           "d: gone\n"));
+b = check_file("merge-b", ("base: &b {p: 1}\n" +
+                           "a: {<<: *b, x: 9}\n" +
+                           "c: [3]\n" +
+                           "d: ~\n"));
+path = check_file("merge");
+emitter = yaml_open(path, "w");
+yaml_emit, emitter, yaml_stream_start_event();
+yaml_merge, a, b, emit=emitter;
+yaml_emit, emitter, yaml_stream_end_event();
+yaml_close, emitter;
+check, check_same(path, ("defaults: {x: 1, y: 2}\n" +
+                         "a: {y: 3, x: 9, p: 1}\n" +
+                         "b: {y: 3, x: 1}\n" +
+                         "c: [3]\n" +
+                         "base: {p: 1}\n")),
+  "yaml_merge resolves merge keys and keeps aliases apart";
+emitter = yaml_open(path, "w");
+yaml_emit, emitter, yaml_stream_start_event();
+yaml_merge, a, b, emit=emitter, append=1, delete=0;
+yaml_emit, emitter, yaml_stream_end_event();
+yaml_close, emitter;
+check, check_same(path, ("defaults: {x: 1, y: 2}\n" +
+                         "a: {y: 3, x: 9, p: 1}\n" +
+                         "b: {y: 3, x: 1}\n" +
+                         "c: [1, 2, 3]\n" +
+                         "d: ~\n" +
+                         "base: {p: 1}\n")),
+  "yaml_merge with append and without delete";
+emitter = yaml_open(path, "w");
+yaml_emit, emitter, yaml_stream_start_event();
+yaml_merge, a, b, emit=emitter, deep=0;
+yaml_emit, emitter, yaml_stream_end_event();
+yaml_close, emitter;
+check, check_same(path, ("base: {p: 1}\n" +
+                         "a: {x: 9, p: 1}\n" +
+                         "c: [3]\n" +
+                         "d: ~\n")),
+  "yaml_merge without deep (the last layer replaces the others)";
+
+/* Each distinct node of a layer is copied once. */
+text = "l0: &l0 [x, x, x, x, x, x, x, x, x, x]\n";
+for (i = 1; i < 30; ++i) {
+  text += swrite(format="l%d: &l%d [*l%d, *l%d, *l%d, *l%d]\n",
+                 i, i, i - 1, i - 1, i - 1, i - 1);
+}
+c = check_file("merge-c", text);
+doc = _yaml_merge([c, b]);
+check, numberof(_yaml_node_keys(doc)) == 32,
+  "yaml_merge of a layer with many aliases";
+
+/*---------------------------------------------------------------------------*/
+/* FLATTENED DOCUMENTS */
+
+src = check_file("flatten", ("name: test\n" +
+                             "\"odd key.x\": 1\n" +
+                             "nums: [1, 2.5, 0x10]\n" +
+                             "base: {x: 1, y: [true, ~]}\n" +
+                             "empty: []\n" +
+                             "emap: {}\n" +
+                             "q: \"123\"\n" +
+                             "nested:\n" +
+                             "  - [a, b]\n" +
+                             "  - {c: d}\n"));
+paths = yaml_flatten(src, kinds, values, texts);
+check, (numberof(paths) == 14 &&
+        allof(paths == [".name", "[\"odd key.x\"]", ".nums[0]", ".nums[1]",
+                        ".nums[2]", ".base.x", ".base.y[0]", ".base.y[1]",
+                        ".empty", ".emap", ".q", ".nested[0][0]",
+                        ".nested[0][1]", ".nested[1].c"])),
+  "yaml_flatten (paths)";
+check, allof(kinds == [YAML_STRING_VALUE, YAML_INT_VALUE, YAML_INT_VALUE,
+                       YAML_FLOAT_VALUE, YAML_INT_VALUE, YAML_INT_VALUE,
+                       YAML_BOOL_VALUE, YAML_NULL_VALUE, YAML_EMPTY_SEQUENCE,
+                       YAML_EMPTY_MAPPING, YAML_STRING_VALUE,
+                       YAML_STRING_VALUE, YAML_STRING_VALUE,
+                       YAML_STRING_VALUE]),
+  "yaml_flatten (kinds)";
+check, allof(values == [0, 1, 1, 2.5, 16, 1, 1, 0, 0, 0, 0, 0, 0, 0]),
+  "yaml_flatten (values)";
+check, texts(5) == "0x10" && texts(9) == "[]" && texts(11) == "123",
+  "yaml_flatten (texts)";
+
+/* Round trip with the textual values. */
+path = check_file("unflatten");
+emitter = yaml_open(path, "w");
+yaml_emit, emitter, yaml_stream_start_event();
+yaml_unflatten, emitter, paths, kinds, texts;
+yaml_emit, emitter, yaml_stream_end_event();
+yaml_close, emitter;
+check, yaml_hash(path) == yaml_hash(src), "yaml_unflatten of yaml_flatten";
+check, allof(yaml_flatten(path) == paths), "yaml_flatten of yaml_unflatten";
+
+/* Round trip with the numerical values. */
+src = check_file("flatten", "a: [1, 2.5, true, ~]\nb: {c: -3}\n");
+paths = yaml_flatten(src, kinds, values);
+emitter = yaml_open(path, "w");
+yaml_emit, emitter, yaml_stream_start_event();
+yaml_unflatten, emitter, paths, kinds, values;
+yaml_emit, emitter, yaml_stream_end_event();
+yaml_close, emitter;
+check, yaml_hash(path) == yaml_hash(src),
+  "yaml_unflatten with numerical values";
+
+/* Aliases are expanded. */
+src = check_file("flatten", "a: &a {x: 1}\nb: *a\n");
+check, allof(yaml_flatten(src) == [".a.x", ".b.x"]),
+  "yaml_flatten expands aliases";
+
+/*---------------------------------------------------------------------------*/
+/* QUERIES */
+
+src = check_file("query", ("runs:\n" +
+                           "  - id: 1\n" +
+                           "    detectors:\n" +
+                           "      - {id: a, gain: 1.5, tags: [x, y]}\n" +
+                           "      - {id: b, gain: 2.5, tags: [z]}\n" +
+                           "      - {gain: 3, id: c}\n" +
+                           "  - id: 2\n" +
+                           "    detectors:\n" +
+                           "      - {id: \"d e\", gain: 4, ok: true}\n" +
+                           "      - {id: e, gain: .inf}\n" +
+                           "---\n" +
+                           "runs:\n" +
+                           "  - id: 3\n" +
+                           "    detectors:\n" +
+                           "      - {id: f, gain: 10,\n" +
+                           "         sub: {gain: 7, id: g}}\n"));
+q = yaml_query("runs[*].detectors[?gain > 2].id");
+res = yaml_select(q, src, paths, docs);
+check, (numberof(res) == 5 && allof(res == ["b", "c", "d e", "e", "f"]) &&
+        allof(docs == [1, 1, 1, 1, 2]) &&
+        paths(1) == ".runs[0].detectors[1].id" &&
+        paths(5) == ".runs[0].detectors[0].id"),
+  "yaml_select with a filter";
+check, allof(yaml_select(q, [src, src]) == ["b", "c", "d e", "e", "f",
+                                            "b", "c", "d e", "e", "f"]),
+  "yaml_select of a compiled query over several files";
+res = yaml_select("..id", src, paths);
+check, numberof(res) == 10 && res(10) == "g" &&
+  paths(10) == ".runs[0].detectors[0].sub.id",
+  "yaml_select at any depth";
+check, allof(yaml_select("$.runs[0].detectors[1]", src) ==
+             "{id: b, gain: 2.5, tags: [z]}"),
+  "yaml_select of a collection";
+check, allof(yaml_select("runs[*].detectors[?id == \"d e\"].gain", src) ==
+             "4"),
+  "yaml_select with a string comparison";
+check, allof(yaml_select("runs[*].detectors[?ok].id", src) == "d e"),
+  "yaml_select with an existence condition";
+check, allof(yaml_select("runs[*].detectors[*].tags[?@ != 'x']", src) ==
+             ["y", "z"]),
+  "yaml_select with a condition on the node itself";
+check, is_void(yaml_select("nope", src)), "yaml_select without matches";
+parser = yaml_open(src);
+check, allof(yaml_select("runs[*].id", parser) == ["1", "2", "3"]),
+  "yaml_select of a parser";
+parser = [];
+
+/*---------------------------------------------------------------------------*/
+
+remove, check_file("diff-a");
+remove, check_file("diff-b");
+remove, check_file("dedup");
+remove, check_file("expected");
+remove, check_file("flatten");
+remove, check_file("mapping");
+remove, check_file("mapping-all");
+remove, check_file("merge");
+remove, check_file("merge-a");
+remove, check_file("merge-b");
+remove, check_file("merge-c");
+remove, check_file("query");
+remove, check_file("saved");
+remove, check_file("struct");
+remove, check_file("unflatten");
+write, format="%d checks, %d failures\n", _check_count, _check_failures;
+if (_check_failures > 0) {
+  error, "some checks failed";
+}
+quit;
@@ -11,18 +11,29 @@
  *
  */
 
+#ifndef _FILE_OFFSET_BITS
+#  define _FILE_OFFSET_BITS 64 /* for files larger than 2 GiB */
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
 #include <float.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <yaml.h>
 
 #include <pstdlib.h>
 #include <play.h>
 #include <yapi.h>
+#include <ydata.h>
+
+#include "yaml_core.h"
 
 /* Define some macros to get rid of some GNU extensions when not compiling
    with GCC. */
@@ -42,6 +53,7 @@ PLUG_API void y_error(const char *) __attribute__ ((noreturn));
 
 static void push_string(const char* str);
 static void push_ustring(const yaml_char_t* str);
+static char* new_string(const char* str, size_t len);
 static void define_int_const(const char* name, int value);
 
 /* Parse literal integer, return NULL on error, pointer to next unparsed
@@ -65,15 +77,46 @@ define_int_const(const char* name, int value)
   yarg_drop(1);
 }
 
+/* Grow an array so that it has room for at least N elements of size
+   ELSIZE. */
+static void
+grow_array(void** ptr, size_t* size, size_t n, size_t elsize)
+{
+  if (! ycore_grow_array(ptr, size, n, elsize)) {
+    y_error("insufficient memory");
+  }
+}
+
 static int initialized = FALSE;
 
 static long anchor_index = -1L;
+static long anchors_index = -1L;
+static long bufsize_index = -1L;
+static long columns_index = -1L;
+static long dedup_index = -1L;
+static long dupkeys_index = -1L;
+static long hash_index = -1L;
+static long canonical_index = -1L;
+static long checkpoint_index = -1L;
+static long lcs_index = -1L;
+static long deep_index = -1L;
+static long append_index = -1L;
+static long atomic_index = -1L;
+static long delete_index = -1L;
+static long emit_index = -1L;
 static long encoding_index = -1L;
+static long follow_index = -1L;
+static long format_index = -1L;
 static long implicit_index = -1L;
+static long keep_index = -1L;
+static long mapping_index = -1L;
 static long plain_implicit_index = -1L;
 static long quoted_implicit_index = -1L;
 static long style_index = -1L;
+static long sync_index = -1L;
 static long tag_index = -1L;
+static long tags_index = -1L;
+static long timeout_index = -1L;
 static long value_index = -1L;
 static long version_index = -1L;
 
@@ -83,12 +126,33 @@ initialize()
   /* Initialize all keyword indexes. */
 #define INIT(s) if (s##_index == -1L) s##_index = yget_global(#s, 0)
   INIT(anchor);
+  INIT(anchors);
+  INIT(bufsize);
+  INIT(columns);
+  INIT(dedup);
+  INIT(dupkeys);
+  INIT(hash);
+  INIT(canonical);
+  INIT(checkpoint);
+  INIT(lcs);
+  INIT(deep);
+  INIT(append);
+  INIT(atomic);
+  INIT(delete);
+  INIT(emit);
   INIT(encoding);
+  INIT(follow);
+  INIT(format);
   INIT(implicit);
+  INIT(keep);
+  INIT(mapping);
   INIT(plain_implicit);
   INIT(quoted_implicit);
   INIT(style);
+  INIT(sync);
   INIT(tag);
+  INIT(tags);
+  INIT(timeout);
   INIT(value);
   INIT(version);
 #undef INIT
@@ -177,6 +241,15 @@ initialize()
   DEFINE_INT_CONST(YAML_SEQUENCE_NODE);
   DEFINE_INT_CONST(YAML_MAPPING_NODE);
 
+  /* Kinds of leaves. */
+  define_int_const("YAML_NULL_VALUE", YCORE_NULL_VALUE);
+  define_int_const("YAML_BOOL_VALUE", YCORE_BOOL_VALUE);
+  define_int_const("YAML_INT_VALUE", YCORE_INT_VALUE);
+  define_int_const("YAML_FLOAT_VALUE", YCORE_FLOAT_VALUE);
+  define_int_const("YAML_STRING_VALUE", YCORE_STRING_VALUE);
+  define_int_const("YAML_EMPTY_SEQUENCE", YCORE_EMPTY_SEQUENCE);
+  define_int_const("YAML_EMPTY_MAPPING", YCORE_EMPTY_MAPPING);
+
   /* Parser states. */
   DEFINE_INT_CONST(YAML_PARSE_STREAM_START_STATE);
   DEFINE_INT_CONST(YAML_PARSE_IMPLICIT_DOCUMENT_START_STATE);
@@ -240,6 +313,39 @@ push_ustring(const yaml_char_t* str)
   push_string((const char*)str);
 }
 
+/* Yield a Yorick string with the LEN first bytes of STR. */
+static char*
+new_string(const char* str, size_t len)
+{
+  char* dst = (char*)p_malloc(len + 1);
+  memcpy(dst, str, len);
+  dst[len] = '\0';
+  return dst;
+}
+
+/* Check that a scalar VALUE of LENGTH bytes can be stored in a Yorick
+   string.  Only double-quoted scalars can have embedded null characters
+   (written as escape sequences), such scalars are rejected because Yorick
+   strings are null-terminated. */
+static void
+check_scalar(const yaml_char_t* value, size_t length,
+             yaml_scalar_style_t style)
+{
+  if (style == YAML_DOUBLE_QUOTED_SCALAR_STYLE &&
+      memchr(value, '\0', length) != NULL) {
+    y_error("scalar with embedded null character");
+  }
+}
+
+/* Yield a Yorick string with the LENGTH bytes of a scalar VALUE. */
+static char*
+scalar_string(const yaml_char_t* value, size_t length,
+              yaml_scalar_style_t style)
+{
+  check_scalar(value, length, style);
+  return new_string((const char*)value, length);
+}
+
 static const char*
 parse_integer(const char* str, long* ptr, unsigned int flags)
 {
@@ -286,6 +392,26 @@ parse_integer(const char* str, long* ptr, unsigned int flags)
   return str;
 }
 
+/*---------------------------------------------------------------------------*/
+/* PARALLEL LOOPS */
+
+void
+Y_yaml_threads(int argc)
+{
+  long n;
+  if (argc > 1) {
+    y_error("expecting at most one argument");
+  }
+  if (argc == 1 && ! yarg_nil(0)) {
+    n = ygets_l(0);
+    if (n < 0 || n > YCORE_MAXIMUM_THREADS) {
+      y_error("invalid number of threads");
+    }
+    ycore_set_parallel_threads(n);
+  }
+  ypush_long(ycore_parallel_threads());
+}
+
 /*---------------------------------------------------------------------------*/
 /* YAML EVENT OBJECT */
 
@@ -418,7 +544,12 @@ extract_event(void* ptr, char* name)
     case YAML_SCALAR_EVENT:
       EXTRACT_STR(anchor,          event.data.scalar.anchor);
       EXTRACT_STR(tag,             event.data.scalar.tag);
-      EXTRACT_STR(value,           event.data.scalar.value);
+      if (strcmp(name, "value") == 0) {
+        ypush_q(NULL)[0] = scalar_string(obj->event.data.scalar.value,
+                                         obj->event.data.scalar.length,
+                                         obj->event.data.scalar.style);
+        return;
+      }
       EXTRACT_LONG(length,         event.data.scalar.length);
       EXTRACT_INT(plain_implicit,  event.data.scalar.plain_implicit);
       EXTRACT_INT(quoted_implicit, event.data.scalar.quoted_implicit);
@@ -476,60 +607,44 @@ static y_userobj_t parser_type = {
   /* uo_ops:     */ (void *)0
 };
 
-/* An application must not alternate the calls of yaml_parser_scan() with
- * the calls of yaml_parser_parse() or yaml_parser_load(). Doing this will
- * break the parser.
- */
-typedef enum _parsing {
-  ANY,   /* parser type not yet decided */
-  SCAN,  /* only calls yaml_parser_scan() are allowed */
-  PARSE, /* only calls yaml_parser_parse() are allowed */
-  LOAD   /* only calls yaml_parser_load() are allowed */
-} parsing_t;
+/* A parser object is a reader of the core (input, checkpoints, follow mode
+   and lookahead are implemented by the core). */
+typedef ycore_reader_t parser_t;
 
 static const char*
-parsing_name(parsing_t parsing)
+parsing_name(ycore_parsing_t parsing)
 {
   switch (parsing) {
-  case ANY:   return "any";
-  case SCAN:  return "scan";
-  case PARSE: return "parse";
-  case LOAD:  return "load";
-  default:    return "unknown";
+  case YCORE_ANY:   return "any";
+  case YCORE_SCAN:  return "scan";
+  case YCORE_PARSE: return "parse";
+  case YCORE_LOAD:  return "load";
+  default:          return "unknown";
   }
 }
 
-typedef struct _parser_t parser_t;
-struct _parser_t {
-  yaml_parser_t parser; /* parser data */
-  int init; /* parser has been initialized? */
-  parsing_t parsing;
-  FILE* input; /* input file */
-};
-
 static parser_t* push_parser()
 {
   parser_t* obj = (parser_t*)ypush_obj(&parser_type, sizeof(parser_t));
-  obj->init = FALSE;
-  obj->parsing = ANY;
+  ycore_reader_init(obj);
   return obj;
 }
 
 static void free_parser(void* ptr)
 {
-  parser_t* obj = (parser_t*)ptr;
-  if (obj->init) {
-    yaml_parser_delete(&obj->parser);
-  }
-  if (obj->input != NULL && obj->input != stdin) {
-    fclose(obj->input);
-  }
+  ycore_reader_destroy((parser_t*)ptr);
 }
 
 static void print_parser(void* ptr)
 {
   parser_t* obj = (parser_t*)ptr;
-  if (obj->init) {
+  if (obj->follow) {
+    char buf[64];
+    sprintf(buf, "%lld", (long long)obj->limit);
+    y_print("YAML parser in follow mode (complete documents up to byte ", 0);
+    y_print(buf, 0);
+    y_print(")", 1);
+  } else if (obj->init) {
     y_print("initialized YAML parser (parsing=", 0);
     y_print(parsing_name(obj->parsing), 0);
     y_print(")", 1);
@@ -553,6 +668,124 @@ static void extract_parser(void* ptr, char* name)
   }
 }
 
+/* Push a new parser reading file FILENAME. */
+static parser_t*
+open_parser(const char* filename)
+{
+  parser_t* p = push_parser();
+  const char* errmsg = ycore_reader_open(p, filename);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+  return p;
+}
+
+/* Deliver the next event of parser P (see ycore_reader_next).  Returns
+   false if no event is available after the timeout in follow mode. */
+static int
+parse_event(parser_t* p, yaml_event_t* event)
+{
+  int status = ycore_reader_next(p, event);
+  if (status < 0) {
+    y_error(p->error);
+  }
+  return status;
+}
+
+/* Yield the K-th next buffered event (K >= 1) of parser P, NULL if not
+   available before the timeout in follow mode. */
+static ycore_ahead_t*
+peek_event(parser_t* p, size_t k)
+{
+  ycore_ahead_t* a;
+  int status = ycore_reader_peek(p, k, &a);
+  if (status < 0) {
+    y_error(p->error);
+  }
+  return (status > 0 ? a : NULL);
+}
+
+/* Measure the sequence whose SEQUENCE-START event has just been delivered
+   by parser P (see ycore_reader_measure).  Returns false if the events are
+   not available before the timeout in follow mode. */
+static int
+measure_sequence(parser_t* p)
+{
+  int status = ycore_reader_measure(p);
+  if (status < 0) {
+    y_error(p->error);
+  }
+  return status;
+}
+
+/*---------------------------------------------------------------------------*/
+/* CHECKPOINTS */
+
+/* Get a checkpoint from argument IARG and initialize parser P to resume
+   from it.  The checkpoint may also be a true scalar to only enable
+   checkpoints. */
+static void
+init_checkpoint(parser_t* p, int iarg)
+{
+  const char* errmsg;
+  int64_t cp[5];
+  long i, ntot, *arg;
+  if (yarg_rank(iarg) == 0) {
+    if (yarg_true(iarg)) {
+      ycore_reader_resume(p, NULL);
+    }
+    return;
+  }
+  arg = ygeta_l(iarg, &ntot, NULL);
+  if (ntot != 5) {
+    y_error("invalid checkpoint");
+  }
+  for (i = 0; i < 5; ++i) {
+    cp[i] = arg[i];
+  }
+  errmsg = ycore_reader_resume(p, cp);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+}
+
+void
+Y_yaml_checkpoint(int argc)
+{
+  parser_t* p;
+  long dims[2], *cp;
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  p = (parser_t*)yget_obj(0, &parser_type);
+  if (! p->track) {
+    y_error("checkpoints have not been enabled for this parser");
+  }
+  if (p->cpbyte > LONG_MAX) {
+    y_error("checkpoint offset overflows a Yorick long");
+  }
+  dims[0] = 1;
+  dims[1] = 5;
+  cp = ypush_l(dims);
+  cp[0] = (long)p->cpbyte;
+  cp[1] = p->cpchar;
+  cp[2] = p->cpline;
+  cp[3] = p->cpcolumn;
+  cp[4] = p->cpdoc;
+}
+
+/*---------------------------------------------------------------------------*/
+/* CANONICAL HASHING */
+
+static void
+push_digest(const uint64_t d[2])
+{
+  char hex[33];
+  sprintf(hex, "%016llx%016llx",
+          (unsigned long long)d[0], (unsigned long long)d[1]);
+  push_string(hex);
+}
+
 /*---------------------------------------------------------------------------*/
 /* YAML EMITTER OBJECT */
 
@@ -570,37 +803,103 @@ static y_userobj_t emitter_type = {
   /* uo_ops:     */ (void *)0
 };
 
+/* Levels of the stream of emitted events. */
+#define LEVEL_START   0 /* expecting STREAM-START */
+#define LEVEL_STREAM  1 /* expecting DOCUMENT-START or STREAM-END */
+#define LEVEL_ROOT    2 /* expecting the root node of a document */
+#define LEVEL_CONTENT 3 /* in the root node of a document */
+#define LEVEL_END     4 /* expecting DOCUMENT-END */
+#define LEVEL_DONE    5 /* after STREAM-END */
+
+/* Nesting of the emitted events.  The open collections are 'S' for a
+   sequence, 'K' for a mapping expecting a key and 'V' for a mapping
+   expecting a value. */
+typedef struct _nesting_t nesting_t;
+struct _nesting_t {
+  int level;
+  char* stack; /* open collections */
+  size_t depth, size; /* number of open collections and size of stack */
+};
+
+typedef struct _subtree_t subtree_t;
+typedef struct _dframe_t dframe_t;
+
 typedef struct _emitter_t emitter_t;
 struct _emitter_t {
   yaml_emitter_t emitter; /* emitter data */
   int init; /* emitter has been initialized? */
-  int open; /* output file is open and has to be closed */
-  FILE* output; /* output file */
+  ycore_output_t output; /* output file */
+  int dedup; /* replace repeated subtrees by aliases? */
+  yaml_event_t* queue; /* queued events of the current document */
+  subtree_t* info; /* information about the queued events */
+  size_t count; /* number of queued events */
+  size_t size; /* number of allocated events in the queue */
+  size_t maxinfo; /* number of allocated information entries */
+  dframe_t* frame; /* open collections of the queued events */
+  size_t depth; /* number of open collections */
+  size_t nframes; /* number of allocated frames */
+  ycore_hasher_t scratch; /* headers and digests of open collections */
+  size_t* table; /* first occurrences of the queued subtrees (index + 1) */
+  size_t mask; /* size of the table minus one */
+  size_t used; /* number of entries in the table */
+  ycore_hasher_t* hasher; /* hasher for a hashing emitter or NULL */
+  nesting_t nesting; /* nesting of the emitted events */
 };
 
 static emitter_t* push_emitter()
 {
   emitter_t* obj = (emitter_t*)ypush_obj(&emitter_type, sizeof(emitter_t));
   obj->init = FALSE;
-  obj->open = FALSE;
+  obj->output.fd = -1;
+  obj->dedup = FALSE;
+  obj->queue = NULL;
+  obj->info = NULL;
+  obj->count = 0;
+  obj->size = 0;
+  obj->maxinfo = 0;
+  obj->frame = NULL;
+  obj->depth = 0;
+  obj->nframes = 0;
+  ycore_hasher_init(&obj->scratch);
+  obj->table = NULL;
+  obj->mask = 0;
+  obj->used = 0;
+  obj->hasher = NULL;
+  obj->nesting.level = LEVEL_START;
+  obj->nesting.stack = NULL;
+  obj->nesting.depth = 0;
+  obj->nesting.size = 0;
   return obj;
 }
 
+static void reset_dedup(emitter_t* obj);
+
 static void free_emitter(void* ptr)
 {
   emitter_t* obj = (emitter_t*)ptr;
+  reset_dedup(obj);
+  free(obj->queue);
+  free(obj->info);
+  free(obj->frame);
+  free(obj->table);
+  ycore_hasher_destroy(&obj->scratch);
+  if (obj->hasher != NULL) {
+    ycore_hasher_destroy(obj->hasher);
+    free(obj->hasher);
+  }
   if (obj->init) {
     yaml_emitter_delete(&obj->emitter);
   }
-  if (obj->output != NULL && obj->open) {
-    fclose(obj->output);
-  }
+  ycore_free_output(&obj->output);
+  free(obj->nesting.stack);
 }
 
 static void print_emitter(void* ptr)
 {
   emitter_t* obj = (emitter_t*)ptr;
-  if (obj->init) {
+  if (obj->hasher != NULL) {
+    y_print("YAML hashing emitter", 1);
+  } else if (obj->init) {
     y_print("initialized YAML emitter", 1);
   } else {
     y_print("uninitialized YAML emitter", 1);
@@ -615,7 +914,7 @@ static void eval_emitter(void* ptr, int argc)
 static void extract_emitter(void* ptr, char* name)
 {
   emitter_t* obj = (emitter_t*)ptr;
-  if (obj->init) {
+  if (obj->init || obj->hasher != NULL) {
     y_error("unknown YAML emitter member");
   } else {
     y_error("uninitialized YAML emitter");
@@ -623,240 +922,642 @@ static void extract_emitter(void* ptr, char* name)
 }
 
 /*---------------------------------------------------------------------------*/
+/* OUTPUT */
 
+/* Set the output of emitter OBJ to be file descriptor FD with BUFSIZE
+   bytes of buffers (a default size if less or equal zero). */
 static void
-debug(int argc)
+set_output(emitter_t* obj, int fd, int closefd, long bufsize, int sync)
 {
-  int iarg;
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    const char* name = yget_obj(iarg, NULL);
-    fprintf(stderr, "arg[%d] -> %s\n", iarg, name);
+  const char* errmsg = ycore_output_init(&obj->output, fd, closefd, bufsize,
+                                         sync);
+  if (errmsg != NULL) {
+    y_error(errmsg);
   }
+  if (! yaml_emitter_initialize(&obj->emitter)) {
+    y_error("failed to initialize emitter");
+  }
+  obj->init = TRUE;
+  yaml_emitter_set_output(&obj->emitter, ycore_output_write, &obj->output);
 }
 
-void
-Y_yaml_debug(int argc)
+/* Get the synchronization policy from argument IARG. */
+static int
+get_sync(int iarg)
 {
-  debug(argc);
+  const char* str;
+  if (yarg_nil(iarg)) {
+    return YCORE_SYNC_NEVER;
+  }
+  str = ygets_q(iarg);
+  if (str != NULL) {
+    if (strcmp(str, "never") == 0) return YCORE_SYNC_NEVER;
+    if (strcmp(str, "document") == 0) return YCORE_SYNC_DOCUMENT;
+    if (strcmp(str, "close") == 0) return YCORE_SYNC_CLOSE;
+  }
+  y_error("SYNC must be \"never\", \"document\" or \"close\"");
+  return -1;
 }
 
-void
-Y___yaml_init__(int argc)
+/*---------------------------------------------------------------------------*/
+/* DEDUPLICATION OF EMITTED SUBTREES */
+
+/*
+ * When an emitter has been created with the DEDUP option, the node events of
+ * a document are queued until the DOCUMENT-END event.  A 128-bit digest of
+ * every subtree is computed on the fly as its events are queued: the open
+ * collections keep, in a scratch buffer, their header followed by the
+ * digests of their completed children.  When a collection is completed and
+ * is identical to a previous one, its events are removed from the queue and
+ * replaced by an alias to the first occurrence; hence the queue holds the
+ * deduplicated document, not the emitted one.  When the document is
+ * complete, anchors are given to the first occurrences which are referenced
+ * and the queue is emitted.  Only non-empty collections are considered and
+ * subtrees with anchors or aliases of their own are left unchanged.
+ */
+
+/* Information about a queued event. */
+struct _subtree_t {
+  uint64_t digest[2]; /* digest of the collection started by the event */
+  long target; /* index of the first occurrence of a replaced subtree (the
+                  event is then an alias), -1 otherwise */
+  long refs; /* number of aliases to the collection */
+  long anchor; /* number of the generated anchor, 0 if none */
+};
+
+/* An open collection of the queued events. */
+struct _dframe_t {
+  size_t start; /* index of the start event in the queue */
+  size_t offset; /* offset of the collection in the scratch buffer */
+  int eligible; /* subtree has no anchors nor aliases? */
+};
+
+static int
+same_string(const yaml_char_t* a, const yaml_char_t* b)
 {
-  initialize();
+  if (a == NULL || b == NULL) {
+    return (a == b);
+  }
+  return (strcmp((const char*)a, (const char*)b) == 0);
 }
 
-void
-Y_yaml_version(int argc)
+/* Append the string STR (which may be NULL) to the scratch buffer. */
+static int
+put_string(ycore_hasher_t* h, const yaml_char_t* str)
 {
-  push_string(yaml_get_version_string());
+  uint64_t len = (str == NULL ? 0 : strlen((const char*)str) + 1);
+  return (ycore_buf_put(h, &len, sizeof(len)) &&
+          (len == 0 || ycore_buf_put(h, str, (size_t)len)));
 }
 
-void
-Y_yaml_open(int argc)
+/* Append the contents of a node event (not accounting for its anchor nor
+   for its children) to the scratch buffer. */
+static int
+put_event(ycore_hasher_t* h, const yaml_event_t* ev)
 {
-  const char* filename;
-  const char* mode;
+  int32_t flags[2];
+  uint64_t len;
+  flags[0] = ev->type;
+  switch (ev->type) {
+  case YAML_ALIAS_EVENT:
+    flags[1] = 0;
+    return (ycore_buf_put(h, flags, sizeof(flags)) &&
+            put_string(h, ev->data.alias.anchor));
+  case YAML_SCALAR_EVENT:
+    flags[1] = ((ev->data.scalar.style << 2) |
+                (ev->data.scalar.plain_implicit ? 2 : 0) |
+                (ev->data.scalar.quoted_implicit ? 1 : 0));
+    len = ev->data.scalar.length;
+    return (ycore_buf_put(h, flags, sizeof(flags)) &&
+            put_string(h, ev->data.scalar.tag) &&
+            ycore_buf_put(h, &len, sizeof(len)) &&
+            ycore_buf_put(h, ev->data.scalar.value, (size_t)len));
+  case YAML_SEQUENCE_START_EVENT:
+    flags[1] = ((ev->data.sequence_start.style << 1) |
+                (ev->data.sequence_start.implicit ? 1 : 0));
+    return (ycore_buf_put(h, flags, sizeof(flags)) &&
+            put_string(h, ev->data.sequence_start.tag));
+  case YAML_MAPPING_START_EVENT:
+    flags[1] = ((ev->data.mapping_start.style << 1) |
+                (ev->data.mapping_start.implicit ? 1 : 0));
+    return (ycore_buf_put(h, flags, sizeof(flags)) &&
+            put_string(h, ev->data.mapping_start.tag));
+  default:
+    return FALSE;
+  }
+}
 
-  if (argc < 1 || argc > 2) {
-    y_error("expecting one or two arguments");
+static const yaml_char_t*
+get_anchor(const yaml_event_t* ev)
+{
+  switch (ev->type) {
+  case YAML_SCALAR_EVENT:         return ev->data.scalar.anchor;
+  case YAML_SEQUENCE_START_EVENT: return ev->data.sequence_start.anchor;
+  case YAML_MAPPING_START_EVENT:  return ev->data.mapping_start.anchor;
+  default:                        return NULL;
   }
-  filename = ygets_q(argc - 1); /* FIXME: parse tilde */
-  if (argc >= 2) {
-    mode = ygets_q(argc - 2);
-  } else {
-    mode = "r";
+}
+
+static void
+anchor_name(char* buf, long number)
+{
+  sprintf(buf, "id%03ld", number);
+}
+
+/* Yield the number of the generated anchor which has the same name as
+   anchor STR, 0 if none. */
+static long
+anchor_number(const yaml_char_t* str)
+{
+  const char* s = (const char*)str;
+  char name[32];
+  long number;
+  if (s == NULL || s[0] != 'i' || s[1] != 'd' ||
+      ! isdigit((unsigned char)s[2]) ||
+      strlen(s) > 20) {
+    return 0;
   }
-  if (mode[0] == 'r' && mode[1] == '\0') {
-    /* Create a parser. */
-    parser_t* obj = push_parser();
-    obj->input = fopen(filename, "r");
-    if (obj->input == NULL) {
-      y_error("failed to open file for reading");
+  number = strtol(s + 2, NULL, 10);
+  anchor_name(name, number);
+  return (strcmp(name, s) == 0 ? number : 0);
+}
+
+static int
+compare_longs(const void* a, const void* b)
+{
+  long x = *(const long*)a, y = *(const long*)b;
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+/* Remove the queued events from index START. */
+static void
+drop_events(emitter_t* obj, size_t start)
+{
+  while (obj->count > start) {
+    size_t i = --obj->count;
+    if (obj->info[i].target >= 0) {
+      --obj->info[obj->info[i].target].refs;
     }
-    if (! yaml_parser_initialize(&obj->parser)) {
-      y_error("failed to initialize parser");
+    yaml_event_delete(&obj->queue[i]);
+  }
+}
+
+/* Insert the collection starting at index I of the queue in the table of
+   first occurrences. */
+static int
+insert_subtree(emitter_t* obj, size_t i)
+{
+  size_t h, j;
+  if (2*(obj->used + 1) > obj->mask + 1) {
+    size_t mask = (obj->mask < 15 ? 15 : 2*obj->mask + 1);
+    size_t* table = (size_t*)calloc(mask + 1, sizeof(size_t));
+    if (table == NULL) {
+      return FALSE;
     }
-    obj->init = TRUE;
-    yaml_parser_set_input_file(&obj->parser, obj->input);
-  } else if ((mode[0] == 'r' || mode [0] == 'a') && mode[1] == '\0') {
-    /* Create an emitter. */
-    emitter_t* obj = push_emitter();
-    if (filename == NULL || filename[0] == '\0') {
-      obj->output = stdout;
-      obj->open = FALSE;
-    } else {
-      obj->output = fopen(filename, mode);
-      if (obj->output == NULL) {
-        y_error("failed to open file for writing");
+    for (h = 0; obj->table != NULL && h <= obj->mask; ++h) {
+      if ((j = obj->table[h]) != 0) {
+        size_t k = (size_t)obj->info[j - 1].digest[0] & mask;
+        while (table[k] != 0) {
+          k = (k + 1) & mask;
+        }
+        table[k] = j;
       }
-      obj->open = TRUE;
     }
-    if (! yaml_emitter_initialize(&obj->emitter)) {
-      y_error("failed to initialize emitter");
-    }
-    obj->init = TRUE;
-    yaml_emitter_set_output_file(&obj->emitter, obj->output);
-  } else {
-    y_error("invalid file access mode");
+    free(obj->table);
+    obj->table = table;
+    obj->mask = mask;
+  }
+  h = (size_t)obj->info[i].digest[0] & obj->mask;
+  while (obj->table[h] != 0) {
+    h = (h + 1) & obj->mask;
   }
+  obj->table[h] = i + 1;
+  ++obj->used;
+  return TRUE;
 }
 
-#define NIL_OK (1U << 0)
-#define FRESH  (1U << 1)
-
-static event_t*
-get_event(int iarg, unsigned int flags)
+/* Yield the index of the first occurrence of the collection starting at
+   index I of the queue, -1 if none. */
+static long
+find_subtree(const emitter_t* obj, size_t i)
 {
-  event_t* obj;
-
-  if ((flags & NIL_OK) != 0 && yarg_nil(iarg)) {
-    obj = push_event();
-  } else {
-    obj = (event_t*)yget_obj(iarg, &event_type);
-    if ((flags & FRESH) != 0 && obj->init) {
-      obj->init = FALSE;
-      yaml_event_delete(&obj->event);
+  const uint64_t* d = obj->info[i].digest;
+  size_t h, j;
+  if (obj->table == NULL) {
+    return -1;
+  }
+  for (h = (size_t)d[0] & obj->mask; (j = obj->table[h]) != 0;
+       h = (h + 1) & obj->mask) {
+    if (ycore_compare_digests(obj->info[j - 1].digest, d) == 0) {
+      return (long)(j - 1);
     }
   }
-  return  obj;
+  return -1;
 }
 
+/* Account for a completed node with digest D in its parent, if any. */
+static int
+close_node(emitter_t* obj, const uint64_t d[2], int eligible)
+{
+  if (obj->depth > 0) {
+    obj->frame[obj->depth - 1].eligible &= eligible;
+    return ycore_buf_put(&obj->scratch, d, 2*sizeof(uint64_t));
+  }
+  return TRUE;
+}
 
-void
-Y_yaml_parse(int argc)
+/* Queue a node event of the current document (the queue takes the
+   responsibility of its contents).  Returns NULL on success or an error
+   message. */
+static const char*
+queue_event(emitter_t* obj, yaml_event_t* event)
 {
-  parser_t* src = NULL;
-  event_t* dst = NULL;
+  ycore_hasher_t* h = &obj->scratch;
+  const yaml_char_t* anchor = get_anchor(event);
+  dframe_t* f;
+  uint64_t d[2];
+  size_t i, n = obj->count;
+  long j;
 
-  if (argc < 1 || argc > 2) {
-    y_error("expecting one or two arguments");
-  }
-  src = yget_obj(argc - 1, &parser_type);
-  if (src->parsing == ANY) {
-    src->parsing = PARSE;
-  } else if (src->parsing != PARSE) {
-    /*
-     * An application must not alternate the calls of yaml_parser_scan() with
-     * the calls of yaml_parser_parse() or yaml_parser_load(). Doing this will
-     * break the parser.
-     */
-    y_error("not an event-based parser");
+  if (! ycore_grow_array((void**)&obj->queue, &obj->size, n + 1,
+                         sizeof(yaml_event_t)) ||
+      ! ycore_grow_array((void**)&obj->info, &obj->maxinfo, n + 1,
+                         sizeof(subtree_t))) {
+    yaml_event_delete(event);
+    return "insufficient memory";
   }
-  if (argc >= 2) {
-    /* Re-use existing event. */
-    dst = yget_obj(argc - 2, &event_type);
-    if (dst->init) {
-      dst->init = FALSE;
-      yaml_event_delete(&dst->event);
+  obj->queue[n] = *event;
+  obj->info[n].target = -1;
+  obj->info[n].refs = 0;
+  obj->info[n].anchor = 0;
+  obj->count = n + 1;
+  switch (event->type) {
+  case YAML_SEQUENCE_START_EVENT:
+  case YAML_MAPPING_START_EVENT:
+    if (! ycore_grow_array((void**)&obj->frame, &obj->nframes,
+                           obj->depth + 1, sizeof(dframe_t))) {
+      return "insufficient memory";
     }
-  } else {
-    /* Create new event. */
-    dst = push_event();
+    f = &obj->frame[obj->depth++];
+    f->start = n;
+    f->offset = h->length;
+    f->eligible = (anchor == NULL);
+    return (put_event(h, event) ? NULL : "insufficient memory");
+  case YAML_SEQUENCE_END_EVENT:
+  case YAML_MAPPING_END_EVENT:
+    if (obj->depth < 1) {
+      return "unbalanced collection events";
+    }
+    f = &obj->frame[--obj->depth];
+    i = f->start;
+    ycore_murmur3_128(h->buffer + f->offset, h->length - f->offset,
+                      obj->info[i].digest);
+    h->length = f->offset;
+    memcpy(d, obj->info[i].digest, sizeof(d));
+    if (f->eligible && n > i + 1) {
+      j = find_subtree(obj, i);
+      if (j >= 0) {
+        /* Replace the repetition by an alias to the first occurrence. */
+        drop_events(obj, i);
+        memset(&obj->queue[i], 0, sizeof(yaml_event_t));
+        obj->queue[i].type = YAML_ALIAS_EVENT;
+        obj->info[i].target = j;
+        obj->info[i].refs = 0;
+        obj->info[i].anchor = 0;
+        obj->count = i + 1;
+        ++obj->info[j].refs;
+      } else if (! insert_subtree(obj, i)) {
+        return "insufficient memory";
+      }
+    }
+    return (close_node(obj, d, f->eligible) ? NULL : "insufficient memory");
+  default:
+    i = h->length;
+    if (! put_event(h, event)) {
+      return "insufficient memory";
+    }
+    ycore_murmur3_128(h->buffer + i, h->length - i, d);
+    h->length = i;
+    return (close_node(obj, d, (anchor == NULL &&
+                              event->type != YAML_ALIAS_EVENT)) ?
+            NULL : "insufficient memory");
   }
-  if (! yaml_parser_parse(&src->parser, &dst->event)) {
-    y_error("parser error");
+}
+
+/* Delete the queued events and the state of the current document. */
+static void
+reset_dedup(emitter_t* obj)
+{
+  drop_events(obj, 0);
+  obj->depth = 0;
+  obj->scratch.length = 0;
+  if (obj->table != NULL) {
+    memset(obj->table, 0, (obj->mask + 1)*sizeof(size_t));
   }
-  dst->init = TRUE;
+  obj->used = 0;
 }
 
-void
-Y_yaml_emit(int argc)
+/* Emit the queued events, giving anchors to the subtrees which have been
+   replaced by aliases.  The generated anchors ("id001", "id002", etc.)
+   skip the names of the anchors of the document.  The queue is emptied in
+   any case.  Returns NULL on success or an error message. */
+static const char*
+flush_document(emitter_t* obj)
 {
-  emitter_t* dst = NULL;
-  int iarg;
+  yaml_event_t* queue = obj->queue;
+  size_t i, n = obj->count;
+  long* taken = NULL;
+  const char* errmsg = NULL;
+  char name[32];
+  long k, ntaken = 0, number = 0;
 
-  if (argc < 1) {
-    y_error("expecting at least one argument");
+  if (obj->depth != 0) {
+    errmsg = "unbalanced collection events";
+    goto done;
   }
-  iarg = argc;
-  dst = yget_obj(--iarg, &emitter_type);
 
-  /*
-   * Emit the event(s).  The emitter takes the responsibility for the event
-   * object and destroys its content after it is emitted. The event object is
-   * destroyed even if the function fails.
-   */
-  while (iarg > 0) {
-    event_t* src = yget_obj(--iarg, &event_type);
-    if (! src->init) {
-      y_error("unintialized event");
+  /* Numbers of the generated anchors which are used by the document. */
+  for (i = 0; i < n; ++i) {
+    if (anchor_number(get_anchor(&queue[i])) > 0) {
+      ++ntaken;
     }
-    src->init = FALSE; /* before calling yaml_emitter_emit() */
-    if (! yaml_emitter_emit(&dst->emitter, &src->event)) {
-      y_error("emitter error");
+  }
+  if (ntaken > 0) {
+    taken = (long*)malloc(ntaken*sizeof(long));
+    if (taken == NULL) {
+      errmsg = "insufficient memory";
+      goto done;
+    }
+    ntaken = 0;
+    for (i = 0; i < n; ++i) {
+      if ((k = anchor_number(get_anchor(&queue[i]))) > 0) {
+        taken[ntaken++] = k;
+      }
+    }
+    qsort(taken, ntaken, sizeof(long), compare_longs);
+  }
+  k = 0;
+  for (i = 0; i < n; ++i) {
+    if (obj->info[i].refs > 0) {
+      do {
+        ++number;
+        while (k < ntaken && taken[k] < number) {
+          ++k;
+        }
+      } while (k < ntaken && taken[k] == number);
+      obj->info[i].anchor = number;
     }
   }
 
-  /* Return nothing. */
-  ypush_nil();
+  /* Emit the events. */
+  for (i = 0; i < n; ++i) {
+    yaml_event_t* ev = &queue[i];
+    yaml_event_t tmp;
+    int status;
+    if (obj->info[i].target >= 0) {
+      anchor_name(name, obj->info[obj->info[i].target].anchor);
+      if (! yaml_alias_event_initialize(&tmp, (yaml_char_t*)name)) {
+        errmsg = "failed to initialize ALIAS event";
+        break;
+      }
+      ev = &tmp;
+    } else if (obj->info[i].anchor > 0) {
+      anchor_name(name, obj->info[i].anchor);
+      if (ev->type == YAML_SEQUENCE_START_EVENT) {
+        status = yaml_sequence_start_event_initialize(
+            &tmp, (yaml_char_t*)name, ev->data.sequence_start.tag,
+            ev->data.sequence_start.implicit,
+            ev->data.sequence_start.style);
+      } else {
+        status = yaml_mapping_start_event_initialize(
+            &tmp, (yaml_char_t*)name, ev->data.mapping_start.tag,
+            ev->data.mapping_start.implicit,
+            ev->data.mapping_start.style);
+      }
+      if (! status) {
+        errmsg = "failed to initialize collection event";
+        break;
+      }
+      ev = &tmp;
+    }
+    status = yaml_emitter_emit(&obj->emitter, ev);
+    if (ev == &tmp) {
+      yaml_event_delete(&queue[i]);
+    }
+    memset(&queue[i], 0, sizeof(yaml_event_t));
+    if (! status) {
+      errmsg = "emitter error";
+      break;
+    }
+  }
+
+ done:
+  free(taken);
+  reset_dedup(obj);
+  return errmsg;
 }
 
-void
-Y_yaml_stream_start_event(int argc)
+/* Update the nesting N of a stream for an event of type TYPE.  Returns
+   NULL on success, an error message if the event is not expected at this
+   point of the stream (N is then left unchanged). */
+static const char*
+nest_event(nesting_t* n, yaml_event_type_t type)
 {
-  event_t* obj = NULL;
-  yaml_encoding_t encoding = YAML_ANY_ENCODING;
-  int iarg, drop = 0;
-
-  if (! initialized) {
-    initialize();
-  }
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    long index = yarg_key(iarg);
-    if (index < 0) {
-      /* Positional argument. */
-      if (obj == NULL) {
-        obj = get_event(iarg, NIL_OK|FRESH);
-        drop = iarg;
-      } else {
-        y_error("too many arguments");
+  char top = (n->depth > 0 ? n->stack[n->depth - 1] : '\0');
+  switch (type) {
+  case YAML_STREAM_START_EVENT:
+    if (n->level != LEVEL_START) {
+      return "unexpected STREAM-START event";
+    }
+    n->level = LEVEL_STREAM;
+    return NULL;
+  case YAML_STREAM_END_EVENT:
+    if (n->level != LEVEL_STREAM) {
+      return "unexpected STREAM-END event";
+    }
+    n->level = LEVEL_DONE;
+    return NULL;
+  case YAML_DOCUMENT_START_EVENT:
+    if (n->level != LEVEL_STREAM) {
+      return "unexpected DOCUMENT-START event";
+    }
+    n->level = LEVEL_ROOT;
+    return NULL;
+  case YAML_DOCUMENT_END_EVENT:
+    if (n->level != LEVEL_END) {
+      return "unexpected DOCUMENT-END event";
+    }
+    n->level = LEVEL_STREAM;
+    return NULL;
+  case YAML_ALIAS_EVENT:
+  case YAML_SCALAR_EVENT:
+  case YAML_SEQUENCE_START_EVENT:
+  case YAML_MAPPING_START_EVENT:
+    if (n->level != LEVEL_ROOT && n->level != LEVEL_CONTENT) {
+      return "unexpected node event";
+    }
+    if (type == YAML_SEQUENCE_START_EVENT ||
+        type == YAML_MAPPING_START_EVENT) {
+      if (n->depth >= n->size) {
+        size_t size = (n->size < 16 ? 16 : 2*n->size);
+        char* stack = (char*)realloc(n->stack, size);
+        if (stack == NULL) {
+          return "insufficient memory";
+        }
+        n->stack = stack;
+        n->size = size;
       }
-    } else {
-      /* Keyword argument. */
-      if (index == encoding_index) {
-        encoding = ygets_i(--iarg);
-      } else {
-        y_error("unknown keyword");
+      n->stack[n->depth++] = (type == YAML_SEQUENCE_START_EVENT ? 'S' : 'K');
+      if (n->level == LEVEL_ROOT) {
+        n->level = LEVEL_CONTENT;
+        return NULL;
       }
+    } else if (n->level == LEVEL_ROOT) {
+      n->level = LEVEL_END;
+      return NULL;
+    }
+    break;
+  case YAML_SEQUENCE_END_EVENT:
+  case YAML_MAPPING_END_EVENT:
+    if (n->level != LEVEL_CONTENT ||
+        top != (type == YAML_SEQUENCE_END_EVENT ? 'S' : 'K')) {
+      return (type == YAML_SEQUENCE_END_EVENT ?
+              "unexpected SEQUENCE-END event" :
+              "unexpected MAPPING-END event");
+    }
+    if (--n->depth == 0) {
+      n->level = LEVEL_END;
+    }
+    return NULL;
+  default:
+    return "invalid event type";
+  }
+  /* The new node is an item of the parent collection. */
+  if (n->depth == 0) {
+    n->level = LEVEL_END;
+  } else {
+    size_t i = n->depth - 1;
+    if (type == YAML_SEQUENCE_START_EVENT ||
+        type == YAML_MAPPING_START_EVENT) {
+      --i; /* the new collection is not the root one */
+    }
+    if (n->stack[i] == 'K') {
+      n->stack[i] = 'V';
+    } else if (n->stack[i] == 'V') {
+      n->stack[i] = 'K';
     }
   }
+  return NULL;
+}
 
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
-    obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
+/* Emit an event with an emitter.  The emitter takes the responsibility of
+   the event contents, even if it fails. */
+static void
+emit_event(emitter_t* obj, yaml_event_t* event)
+{
+  yaml_event_type_t type;
+  const char* errmsg = nest_event(&obj->nesting, event->type);
+  if (errmsg != NULL) {
+    yaml_event_delete(event);
+    y_error(errmsg);
   }
-  if (! yaml_stream_start_event_initialize(&obj->event, encoding)) {
-    y_error("failed to initialize STREAM-START event");
+  if (obj->hasher != NULL) {
+    errmsg = ycore_hasher_feed(obj->hasher, event);
+    yaml_event_delete(event);
+    if (errmsg != NULL) {
+      y_error(errmsg);
+    }
+    return;
+  }
+  if (obj->dedup) {
+    switch (event->type) {
+    case YAML_STREAM_START_EVENT:
+    case YAML_STREAM_END_EVENT:
+    case YAML_DOCUMENT_START_EVENT:
+      break;
+    case YAML_DOCUMENT_END_EVENT:
+      errmsg = flush_document(obj);
+      if (errmsg != NULL) {
+        yaml_event_delete(event);
+        y_error(errmsg);
+      }
+      break;
+    default:
+      errmsg = queue_event(obj, event);
+      if (errmsg != NULL) {
+        y_error(errmsg);
+      }
+      return;
+    }
+  }
+  type = event->type;
+  if (! yaml_emitter_emit(&obj->emitter, event)) {
+    y_error("emitter error");
+  }
+  if (type == YAML_DOCUMENT_END_EVENT &&
+      obj->output.sync == YCORE_SYNC_DOCUMENT) {
+    if (! ycore_sync_output(&obj->output)) {
+      y_error("failed to write output");
+    }
+  } else if (type == YAML_STREAM_END_EVENT) {
+    obj->output.ended = TRUE;
+    if (! ycore_flush_output(&obj->output)) {
+      y_error("failed to write output");
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static void
+debug(int argc)
+{
+  int iarg;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    const char* name = yget_obj(iarg, NULL);
+    fprintf(stderr, "arg[%d] -> %s\n", iarg, name);
   }
-  obj->init = TRUE;
 }
 
 void
-Y_yaml_stream_end_event(int argc)
+Y_yaml_debug(int argc)
 {
-  event_t* obj;
+  debug(argc);
+}
 
-  if (argc != 1) {
-    y_error("expecting exactly one argument");
-  }
-  obj = get_event(0, NIL_OK|FRESH);
-  if (! yaml_stream_end_event_initialize(&obj->event)) {
-    y_error("failed to initialize STREAM-END event");
-  }
-  obj->init = TRUE;
+void
+Y___yaml_init__(int argc)
+{
+  initialize();
 }
 
 void
-Y_yaml_document_start_event(int argc)
+Y_yaml_version(int argc)
 {
-  event_t* obj = NULL;
-  yaml_version_directive_t version_directive;
-  yaml_version_directive_t* version = NULL;
-  int implicit = TRUE;
-  int iarg, drop = 0;
+  push_string(yaml_get_version_string());
+}
+
+/* Bits for the keywords given to yaml_open. */
+#define OPEN_FOLLOW     (1U << 0)
+#define OPEN_TIMEOUT    (1U << 1)
+#define OPEN_CHECKPOINT (1U << 2)
+#define OPEN_BUFSIZE    (1U << 3)
+#define OPEN_SYNC       (1U << 4)
+#define OPEN_DEDUP      (1U << 5)
+#define OPEN_HASH       (1U << 6)
+#define OPEN_ATOMIC     (1U << 7)
+
+void
+Y_yaml_open(int argc)
+{
+  const char* filename = NULL;
+  const char* mode = NULL;
+  const char* errmsg;
+  double timeout = -1;
+  long fd = -1, bufsize = 0;
+  int iarg, pos = 0, dedup = FALSE, hash = FALSE, follow = FALSE;
+  int checkpoint = -1, sync = YCORE_SYNC_NEVER, atomic = 0;
+  unsigned int given = 0, bit;
 
   if (! initialized) {
     initialize();
@@ -865,107 +1566,538 @@ Y_yaml_document_start_event(int argc)
     long index = yarg_key(iarg);
     if (index < 0) {
       /* Positional argument. */
-      if (obj == NULL) {
-        obj = get_event(iarg, NIL_OK|FRESH);
-        drop = iarg;
+      if (pos == 0) {
+        if (yarg_number(iarg) == 1) {
+          fd = ygets_l(iarg);
+          if (fd < 0) {
+            y_error("invalid file descriptor");
+          }
+        } else {
+          filename = ygets_q(iarg); /* FIXME: parse tilde */
+        }
+      } else if (pos == 1) {
+        mode = ygets_q(iarg);
       } else {
-        y_error("too many arguments");
+        y_error("expecting one or two arguments");
       }
+      ++pos;
     } else {
-      /* Keyword argument. */
-      if (index == implicit_index) {
-        implicit = yarg_true(--iarg);
-      } else if (index == version_index) {
+      /* Keyword argument (a nil value is as if not given). */
+      bit = 0;
+      if (index == dedup_index) {
+        dedup = yarg_true(--iarg);
+        bit = OPEN_DEDUP;
+      } else if (index == hash_index) {
+        hash = yarg_true(--iarg);
+        bit = OPEN_HASH;
+      } else if (index == follow_index) {
+        follow = yarg_true(--iarg);
+        bit = OPEN_FOLLOW;
+      } else if (index == checkpoint_index) {
+        checkpoint = --iarg;
+        bit = OPEN_CHECKPOINT;
+      } else if (index == timeout_index) {
         --iarg;
-        if (! yarg_nil(iarg)) {
-          long major, minor;
-          const char* str = ygets_q(iarg);
-          if (str == NULL) {
-          bad_version:
-            y_error("bad version number");
-          }
-          str = parse_integer(str, &major, NO_SIGN);
-          if (str == NULL || str[0] != '.') {
-            goto bad_version;
-          }
-          str = parse_integer(str + 1, &minor, NO_SIGN);
-          if (str == NULL || str[0] != '\0') {
-            goto bad_version;
-          }
-          version_directive.major = major;
-          version_directive.minor = minor;
-          version = &version_directive;
+        timeout = (yarg_nil(iarg) ? -1 : ygets_d(iarg));
+        bit = OPEN_TIMEOUT;
+      } else if (index == bufsize_index) {
+        bufsize = ygets_l(--iarg);
+        bit = OPEN_BUFSIZE;
+      } else if (index == sync_index) {
+        sync = get_sync(--iarg);
+        bit = OPEN_SYNC;
+      } else if (index == atomic_index) {
+        atomic = (yarg_nil(--iarg) ? 0 : ygets_l(iarg));
+        if (atomic < 0 || atomic > YCORE_ATOMIC_BATCH) {
+          y_error("ATOMIC must be 0, 1 or 2");
         }
+        bit = OPEN_ATOMIC;
       } else {
         y_error("unknown keyword");
       }
+      if (! yarg_nil(iarg)) {
+        given |= bit;
+      }
+    }
+  }
+  if (pos < 1) {
+    y_error("expecting one or two arguments");
+  }
+  if (mode == NULL) {
+    mode = "r";
+  }
+  if (mode[0] == 'r' && mode[1] == '\0') {
+    /* Create a parser. */
+    parser_t* obj;
+    if ((given & (OPEN_SYNC | OPEN_DEDUP | OPEN_HASH | OPEN_ATOMIC)) != 0) {
+      y_error("keywords SYNC, DEDUP, HASH and ATOMIC are only for emitters");
+    }
+    obj = push_parser();
+    if (checkpoint >= 0) {
+      init_checkpoint(obj, checkpoint + 1); /* +1 for the parser object */
+    }
+    if (fd < 0) {
+      if (filename == NULL) {
+        y_error("invalid file name");
+      }
+      fd = open(filename, O_RDONLY);
+      if (fd < 0) {
+        y_error("failed to open file for reading");
+      }
+      obj->fd = fd;
+      obj->closefd = TRUE;
+    }
+    if (follow) {
+      if (filename == NULL) {
+        y_error("follow mode requires a file name");
+      }
+      ycore_reader_follow(obj, filename, timeout);
+      return;
+    }
+    errmsg = ycore_reader_set_input(obj, fd, (filename != NULL), obj->cpbyte,
+                                    bufsize);
+    if (errmsg == NULL) {
+      errmsg = ycore_reader_start(obj);
+    }
+    if (errmsg != NULL) {
+      y_error(errmsg);
+    }
+  } else if ((mode[0] == 'w' || mode [0] == 'a') && mode[1] == '\0') {
+    /* Create an emitter. */
+    emitter_t* obj;
+    if ((given & (OPEN_FOLLOW | OPEN_TIMEOUT | OPEN_CHECKPOINT)) != 0) {
+      y_error("keywords FOLLOW, TIMEOUT and CHECKPOINT are only for parsers");
+    }
+    obj = push_emitter();
+    if (hash) {
+      if ((given & (OPEN_BUFSIZE | OPEN_SYNC)) != 0) {
+        y_error("keywords BUFSIZE and SYNC are not for hashing emitters");
+      }
+      if (atomic) {
+        y_error("atomic mode is not available for hashing emitters");
+      }
+      /* Create a hashing emitter, the file (if any) is for the canonical
+         form. */
+      obj->hasher = (ycore_hasher_t*)malloc(sizeof(ycore_hasher_t));
+      if (obj->hasher == NULL) {
+        y_error("insufficient memory");
+      }
+      ycore_hasher_init(obj->hasher);
+      if (filename != NULL && filename[0] != '\0') {
+        obj->hasher->output = fopen(filename, mode);
+        if (obj->hasher->output == NULL) {
+          y_error("failed to open file for writing");
+        }
+        obj->hasher->open = TRUE;
+      }
+      return;
+    }
+    if (atomic) {
+      if (filename == NULL || filename[0] == '\0') {
+        y_error("atomic mode requires a file name");
+      }
+      if (mode[0] != 'w') {
+        y_error("atomic mode requires mode \"w\"");
+      }
+      errmsg = ycore_open_atomic(&obj->output, filename, atomic);
+      if (errmsg != NULL) {
+        y_error(errmsg);
+      }
+      set_output(obj, obj->output.fd, TRUE, bufsize, sync);
+    } else if (fd >= 0) {
+      set_output(obj, fd, FALSE, bufsize, sync);
+    } else if (filename == NULL || filename[0] == '\0') {
+      set_output(obj, STDOUT_FILENO, FALSE, bufsize, sync);
+    } else {
+      fd = open(filename, O_WRONLY | O_CREAT |
+                (mode[0] == 'a' ? O_APPEND : O_TRUNC), 0666);
+      if (fd < 0) {
+        y_error("failed to open file for writing");
+      }
+      obj->output.fd = fd;
+      obj->output.closefd = TRUE;
+      set_output(obj, fd, TRUE, bufsize, sync);
     }
+    obj->dedup = dedup;
+  } else {
+    y_error("invalid file access mode");
   }
+}
 
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
+#define NIL_OK (1U << 0)
+#define FRESH  (1U << 1)
+
+static event_t*
+get_event(int iarg, unsigned int flags)
+{
+  event_t* obj;
+
+  if ((flags & NIL_OK) != 0 && yarg_nil(iarg)) {
     obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
-  }
-  if (! yaml_document_start_event_initialize(&obj->event, version,
-                                             NULL, NULL, implicit)) {
-    y_error("failed to initialize DOCUMENT-START event");
+  } else {
+    obj = (event_t*)yget_obj(iarg, &event_type);
+    if ((flags & FRESH) != 0 && obj->init) {
+      obj->init = FALSE;
+      yaml_event_delete(&obj->event);
+    }
   }
-  obj->init = TRUE;
+  return  obj;
 }
 
+
 void
-Y_yaml_document_end_event(int argc)
+Y_yaml_parse(int argc)
 {
-  event_t* obj = NULL;
-  int implicit = TRUE;
-  int iarg, drop = 0;
+  parser_t* src = NULL;
+  event_t* dst = NULL;
 
-  if (! initialized) {
-    initialize();
+  if (argc < 1 || argc > 2) {
+    y_error("expecting one or two arguments");
   }
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    long index = yarg_key(iarg);
-    if (index < 0) {
-      /* Positional argument. */
-      if (obj == NULL) {
-        obj = get_event(iarg, NIL_OK|FRESH);
-        drop = iarg;
-      } else {
-        y_error("too many arguments");
-      }
-    } else {
-      /* Keyword argument. */
-      if (index == implicit_index) {
-        implicit = yarg_true(--iarg);
-      } else {
-        y_error("unknown keyword");
-      }
-    }
+  src = yget_obj(argc - 1, &parser_type);
+  if (src->parsing == YCORE_ANY) {
+    src->parsing = YCORE_PARSE;
+  } else if (src->parsing != YCORE_PARSE) {
+    /*
+     * An application must not alternate the calls of yaml_parser_scan() with
+     * the calls of yaml_parser_parse() or yaml_parser_load(). Doing this will
+     * break the parser.
+     */
+    y_error("not an event-based parser");
   }
-
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
-    obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
+  if (argc >= 2) {
+    /* Re-use existing event. */
+    dst = yget_obj(argc - 2, &event_type);
+    if (dst->init) {
+      dst->init = FALSE;
+      yaml_event_delete(&dst->event);
+    }
+  } else {
+    /* Create new event. */
+    dst = push_event();
   }
-  if (! yaml_document_end_event_initialize(&obj->event, implicit)) {
-    y_error("failed to initialize DOCUMENT-END event");
+  if (! parse_event(src, &dst->event)) {
+    /* No new documents in follow mode. */
+    ypush_nil();
+    return;
   }
-  obj->init = TRUE;
+  dst->init = TRUE;
 }
 
 void
-Y_yaml_alias_event(int argc)
+Y_yaml_peek(int argc)
 {
-  event_t* obj = NULL;
-  yaml_char_t* anchor = NULL;
-  int iarg, drop = 0;
+  parser_t* src;
+  const ycore_ahead_t* ahead;
+  const yaml_event_t* ev;
+  event_t* dst;
+  long k = 1;
 
-  if (! initialized) {
-    initialize();
+  if (argc < 1 || argc > 2) {
+    y_error("expecting one or two arguments");
+  }
+  src = yget_obj(argc - 1, &parser_type);
+  if (argc >= 2 && ! yarg_nil(argc - 2)) {
+    k = ygets_l(argc - 2);
+    if (k < 1) {
+      y_error("invalid lookahead");
+    }
+  }
+  if (src->parsing == YCORE_ANY) {
+    src->parsing = YCORE_PARSE;
+  } else if (src->parsing != YCORE_PARSE) {
+    y_error("not an event-based parser");
+  }
+  ahead = peek_event(src, k);
+  if (ahead == NULL) {
+    /* No new documents in follow mode. */
+    ypush_nil();
+    return;
+  }
+  ev = &ahead->event;
+  dst = push_event();
+  if (ev->type == YAML_NO_EVENT) {
+    /* Beyond the end of the stream. */
+    memset(&dst->event, 0, sizeof(dst->event));
+  } else if (! ycore_copy_event(&dst->event, ev)) {
+    y_error("failed to copy event");
+  }
+  dst->event.start_mark = ev->start_mark;
+  dst->event.end_mark = ev->end_mark;
+  dst->init = TRUE;
+}
+
+void
+Y__yaml_sequence(int argc)
+{
+  parser_t* src;
+  yaml_event_t event;
+  ystring_t* out;
+  long i, n, dims[2];
+
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  src = yget_obj(0, &parser_type);
+  if (src->parsing != YCORE_PARSE) {
+    y_error("not an event-based parser");
+  }
+  if (! measure_sequence(src)) {
+    y_error("incomplete sequence");
+  }
+  n = src->items;
+  if (n < 0 || ! src->scalars) {
+    ypush_long(n);
+    return;
+  }
+
+  /* Sequence of scalars: fill the array from the buffered events, then
+     consume them and the SEQUENCE-END event. */
+  if (n < 1) {
+    ypush_nil();
+  } else {
+    dims[0] = 1;
+    dims[1] = n;
+    out = ypush_q(dims);
+    for (i = 0; i < n; ++i) {
+      const yaml_event_t* ev = &peek_event(src, i + 1)->event;
+      out[i] = scalar_string(ev->data.scalar.value, ev->data.scalar.length,
+                             ev->data.scalar.style);
+    }
+  }
+  for (i = 0; i <= n; ++i) {
+    parse_event(src, &event);
+    yaml_event_delete(&event);
+  }
+}
+
+void
+Y_yaml_emit(int argc)
+{
+  emitter_t* dst = NULL;
+  yaml_event_t copy;
+  int iarg, keep = FALSE, first = -1;
+
+  if (! initialized) {
+    initialize();
+  }
+
+  /* First parse keywords, the events are emitted in a second pass. */
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (first < 0) {
+        first = iarg;
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == keep_index) {
+        keep = yarg_true(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+  if (first < 0) {
+    y_error("expecting at least one argument");
+  }
+  dst = yget_obj(first, &emitter_type);
+
+  /*
+   * Emit the event(s).  The emitter takes the responsibility for the event
+   * object and destroys its content after it is emitted. The event object is
+   * destroyed even if the function fails.  If KEEP is true, a deep copy of
+   * the event is emitted instead and the event object is left unchanged so
+   * that it can be emitted again.
+   */
+  for (iarg = first - 1; iarg >= 0; --iarg) {
+    event_t* src;
+    if (yarg_key(iarg) >= 0) {
+      --iarg;
+      continue;
+    }
+    src = yget_obj(iarg, &event_type);
+    if (! src->init) {
+      y_error("unintialized event");
+    }
+    if (keep) {
+      if (! ycore_copy_event(&copy, &src->event)) {
+        y_error("failed to copy event");
+      }
+      emit_event(dst, &copy);
+    } else {
+      src->init = FALSE; /* before calling emit_event() */
+      emit_event(dst, &src->event);
+    }
+  }
+
+  /* Return nothing. */
+  ypush_nil();
+}
+
+void
+Y_yaml_close(int argc)
+{
+  emitter_t* obj;
+  const char* errmsg;
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  obj = (emitter_t*)yget_obj(0, &emitter_type);
+  errmsg = ycore_close_output(&obj->output);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+  ypush_nil();
+}
+
+void
+Y_yaml_commit(int argc)
+{
+  const char* errmsg;
+  if (argc > 1 || (argc == 1 && ! yarg_nil(0))) {
+    y_error("expecting no arguments");
+  }
+  errmsg = ycore_commit_pending();
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+  ypush_nil();
+}
+
+void
+Y_yaml_stream_start_event(int argc)
+{
+  event_t* obj = NULL;
+  yaml_encoding_t encoding = YAML_ANY_ENCODING;
+  int iarg, drop = 0;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = get_event(iarg, NIL_OK|FRESH);
+        drop = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == encoding_index) {
+        encoding = ygets_i(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! yaml_stream_start_event_initialize(&obj->event, encoding)) {
+    y_error("failed to initialize STREAM-START event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_stream_end_event(int argc)
+{
+  event_t* obj;
+
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  obj = get_event(0, NIL_OK|FRESH);
+  if (! yaml_stream_end_event_initialize(&obj->event)) {
+    y_error("failed to initialize STREAM-END event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_document_start_event(int argc)
+{
+  event_t* obj = NULL;
+  yaml_version_directive_t version_directive;
+  yaml_version_directive_t* version = NULL;
+  int implicit = TRUE;
+  int iarg, drop = 0;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = get_event(iarg, NIL_OK|FRESH);
+        drop = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == implicit_index) {
+        implicit = yarg_true(--iarg);
+      } else if (index == version_index) {
+        --iarg;
+        if (! yarg_nil(iarg)) {
+          long major, minor;
+          const char* str = ygets_q(iarg);
+          if (str == NULL) {
+          bad_version:
+            y_error("bad version number");
+          }
+          str = parse_integer(str, &major, NO_SIGN);
+          if (str == NULL || str[0] != '.') {
+            goto bad_version;
+          }
+          str = parse_integer(str + 1, &minor, NO_SIGN);
+          if (str == NULL || str[0] != '\0') {
+            goto bad_version;
+          }
+          version_directive.major = major;
+          version_directive.minor = minor;
+          version = &version_directive;
+        }
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! yaml_document_start_event_initialize(&obj->event, version,
+                                             NULL, NULL, implicit)) {
+    y_error("failed to initialize DOCUMENT-START event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_document_end_event(int argc)
+{
+  event_t* obj = NULL;
+  int implicit = TRUE;
+  int iarg, drop = 0;
+
+  if (! initialized) {
+    initialize();
   }
   for (iarg = argc - 1; iarg >= 0; --iarg) {
     long index = yarg_key(iarg);
@@ -978,247 +2110,4870 @@ Y_yaml_alias_event(int argc)
         y_error("too many arguments");
       }
     } else {
-      /* Keyword argument. */
-      if (index == anchor_index) {
-        anchor = (yaml_char_t*)ygets_q(--iarg);
-      } else {
-        y_error("unknown keyword");
+      /* Keyword argument. */
+      if (index == implicit_index) {
+        implicit = yarg_true(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! yaml_document_end_event_initialize(&obj->event, implicit)) {
+    y_error("failed to initialize DOCUMENT-END event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_alias_event(int argc)
+{
+  event_t* obj = NULL;
+  yaml_char_t* anchor = NULL;
+  int iarg, drop = 0;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = get_event(iarg, NIL_OK|FRESH);
+        drop = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == anchor_index) {
+        anchor = (yaml_char_t*)ygets_q(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! yaml_alias_event_initialize(&obj->event, anchor)) {
+    y_error("failed to initialize ALIAS event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_scalar_event(int argc)
+{
+  char buffer[64];
+  event_t* obj = NULL;
+  yaml_char_t* anchor = NULL;
+  yaml_char_t* tag = NULL;
+  yaml_char_t* value = NULL;
+  int plain_implicit = TRUE;
+  int quoted_implicit = TRUE;
+  yaml_scalar_style_t style = YAML_ANY_SCALAR_STYLE;
+  size_t length = 0;
+  int iarg, drop = 0, number;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = get_event(iarg, NIL_OK|FRESH);
+        drop = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == anchor_index) {
+        anchor = (yaml_char_t*)ygets_q(--iarg);
+      } else if (index == tag_index) {
+        tag = (yaml_char_t*)ygets_q(--iarg);
+      } else if (index == value_index) {
+        --iarg;
+        number = yarg_number(iarg);
+        if (number == 1) {
+          /* Integer. */
+          long val = ygets_l(iarg);
+          length = sprintf(buffer, "%ld", val);
+          value = (yaml_char_t*)buffer;
+        } else if (number == 2) {
+          /* Floating-point. */
+          double val = ygets_d(iarg);
+          length = sprintf(buffer, "%g", val);
+          value = (yaml_char_t*)buffer;
+        } else if (number == 3) {
+          /* Complex. */
+          double* arr = ygeta_z(iarg, NULL, NULL);
+          length = sprintf(buffer, "%g %s %gim", arr[0],
+                           (arr[1] >= 0 ? "+" : "-"), fabs(arr[1]));
+          value = (yaml_char_t*)buffer;
+        } else if (yarg_string(iarg)) {
+          value = (yaml_char_t*)ygets_q(iarg);
+          length = (size_t)-1; /* computed once by scalar_event_initialize */
+        } else {
+          y_error("value must be a string or a numerical scalar");
+        }
+      } else if (index == plain_implicit_index) {
+        plain_implicit = yarg_true(--iarg);
+      } else if (index == quoted_implicit_index) {
+        quoted_implicit = yarg_true(--iarg);
+      } else if (index == style_index) {
+        style = ygets_i(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+  if (value == NULL) {
+    value = (yaml_char_t*)"";
+    length = 0;
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! ycore_scalar_event_initialize(&obj->event, anchor, tag, value,
+                                      length, plain_implicit,
+                                      quoted_implicit, style)) {
+    y_error("failed to initialize SCALAR event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_sequence_start_event(int argc)
+{
+  event_t* obj = NULL;
+  yaml_char_t* anchor = NULL;
+  yaml_char_t* tag = NULL;
+  int implicit = TRUE;
+  yaml_sequence_style_t style = YAML_ANY_SEQUENCE_STYLE;
+  int iarg, drop = 0;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = get_event(iarg, NIL_OK|FRESH);
+        drop = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == anchor_index) {
+        anchor = (yaml_char_t*)ygets_q(--iarg);
+      } else if (index == tag_index) {
+        tag = (yaml_char_t*)ygets_q(--iarg);
+      } else if (index == style_index) {
+        style = ygets_i(--iarg);
+      } else if (index == implicit_index) {
+        implicit = yarg_true(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! yaml_sequence_start_event_initialize(&obj->event, anchor, tag,
+                                             implicit, style)) {
+    y_error("failed to initialize SEQUENCE-START event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_sequence_end_event(int argc)
+{
+  event_t* obj;
+
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  obj = get_event(0, NIL_OK|FRESH);
+  if (! yaml_sequence_end_event_initialize(&obj->event)) {
+    y_error("failed to initialize SEQUENCE-END event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_mapping_start_event(int argc)
+{
+  event_t* obj = NULL;
+  yaml_char_t* anchor = NULL;
+  yaml_char_t* tag = NULL;
+  int implicit = TRUE;
+  yaml_mapping_style_t style = YAML_ANY_MAPPING_STYLE;
+  int iarg, drop = 0;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (obj == NULL) {
+        obj = get_event(iarg, NIL_OK|FRESH);
+        drop = iarg;
+      } else {
+        y_error("too many arguments");
+      }
+    } else {
+      /* Keyword argument. */
+      if (index == anchor_index) {
+        anchor = (yaml_char_t*)ygets_q(--iarg);
+      } else if (index == tag_index) {
+        tag = (yaml_char_t*)ygets_q(--iarg);
+      } else if (index == style_index) {
+        style = ygets_i(--iarg);
+      } else if (index == implicit_index) {
+        implicit = yarg_true(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+
+  /* Manage to push/let the result on top of the stack. */
+  if (obj == NULL) {
+    obj = push_event();
+  } else if (drop > 0) {
+    yarg_drop(drop);
+  }
+  if (! yaml_mapping_start_event_initialize(&obj->event, anchor, tag,
+                                             implicit, style)) {
+    y_error("failed to initialize MAPPING-START event");
+  }
+  obj->init = TRUE;
+}
+
+void
+Y_yaml_mapping_end_event(int argc)
+{
+  event_t* obj;
+
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  obj = get_event(0, NIL_OK|FRESH);
+  if (! yaml_mapping_end_event_initialize(&obj->event)) {
+    y_error("failed to initialize MAPPING-END event");
+  }
+  obj->init = TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+/* BATCHED EMISSION OF EVENTS */
+
+/* Get the I-th string of array ARR (may be NULL), NULL if empty. */
+static const yaml_char_t*
+get_item(ystring_t* arr, long i)
+{
+  return ((arr == NULL || arr[i] == NULL || arr[i][0] == '\0') ? NULL :
+          (const yaml_char_t*)arr[i]);
+}
+
+/* Get an optional array of N elements at argument IARG. */
+static void*
+get_optional_array(int iarg, long n, const char* name, int type)
+{
+  void* arr;
+  long ntot;
+  if (iarg < 0 || yarg_nil(iarg)) {
+    return NULL;
+  }
+  arr = (type == Y_STRING ? (void*)ygeta_q(iarg, &ntot, NULL) :
+         (void*)ygeta_l(iarg, &ntot, NULL));
+  if (ntot != n) {
+    y_errorq("%s must have as many elements as TYPES", name);
+  }
+  return arr;
+}
+
+void
+Y_yaml_emit_events(int argc)
+{
+  emitter_t* dst = NULL;
+  long* types;
+  ystring_t* svalues = NULL;
+  long* lvalues = NULL;
+  double* dvalues = NULL;
+  const char* dformat = "%.17g";
+  long* styles;
+  ystring_t* tags;
+  ystring_t* anchors;
+  int iarg, pos = 0, number;
+  int arg[4] = {-1, -1, -1, -1};
+  int tags_arg = -1, anchors_arg = -1;
+  long i, n;
+  char buffer[64];
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (pos > 3) {
+        y_error("expecting at most four positional arguments");
+      }
+      arg[pos++] = iarg;
+    } else {
+      /* Keyword argument. */
+      if (index == tags_index) {
+        tags_arg = --iarg;
+      } else if (index == anchors_index) {
+        anchors_arg = --iarg;
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+  if (pos < 2) {
+    y_error("expecting at least two arguments");
+  }
+  dst = (emitter_t*)yget_obj(arg[0], &emitter_type);
+  types = ygeta_l(arg[1], &n, NULL);
+  if (arg[2] >= 0 && ! yarg_nil(arg[2])) {
+    long ntot;
+    number = yarg_number(arg[2]);
+    if (number == 1) {
+      lvalues = ygeta_l(arg[2], &ntot, NULL);
+    } else if (number == 2) {
+      /* Reals are written with enough digits to be read back exactly. */
+      if (yarg_typeid(arg[2]) == Y_FLOAT) {
+        dformat = "%.9g";
+      }
+      dvalues = ygeta_d(arg[2], &ntot, NULL);
+    } else if (yarg_string(arg[2])) {
+      svalues = ygeta_q(arg[2], &ntot, NULL);
+    } else {
+      y_error("VALUES must be an array of strings, integers or reals");
+    }
+    if (ntot != n) {
+      y_error("VALUES must have as many elements as TYPES");
+    }
+  }
+  styles = (long*)get_optional_array(arg[3], n, "STYLES", Y_LONG);
+  tags = (ystring_t*)get_optional_array(tags_arg, n, "TAGS", Y_STRING);
+  anchors = (ystring_t*)get_optional_array(anchors_arg, n, "ANCHORS",
+                                           Y_STRING);
+
+  /* Check all the events before emitting any of them: their arguments and
+     their nesting, starting from the current nesting of the emitter. */
+  for (i = 0; i < n; ++i) {
+    long style = (styles != NULL ? styles[i] : 0);
+    switch (types[i]) {
+    case YAML_STREAM_START_EVENT:
+    case YAML_STREAM_END_EVENT:
+    case YAML_DOCUMENT_START_EVENT:
+    case YAML_DOCUMENT_END_EVENT:
+    case YAML_SEQUENCE_END_EVENT:
+    case YAML_MAPPING_END_EVENT:
+      break;
+    case YAML_SEQUENCE_START_EVENT:
+      if (style < YAML_ANY_SEQUENCE_STYLE ||
+          style > YAML_FLOW_SEQUENCE_STYLE) {
+        y_error("invalid style for a SEQUENCE-START event");
+      }
+      break;
+    case YAML_MAPPING_START_EVENT:
+      if (style < YAML_ANY_MAPPING_STYLE ||
+          style > YAML_FLOW_MAPPING_STYLE) {
+        y_error("invalid style for a MAPPING-START event");
+      }
+      break;
+    case YAML_ALIAS_EVENT:
+      if (get_item(svalues, i) == NULL) {
+        y_error("ALIAS events require the name of an anchor in VALUES");
+      }
+      break;
+    case YAML_SCALAR_EVENT:
+      if (svalues == NULL && lvalues == NULL && dvalues == NULL) {
+        y_error("SCALAR events require VALUES");
+      }
+      if (style < YAML_ANY_SCALAR_STYLE ||
+          style > YAML_FOLDED_SCALAR_STYLE) {
+        y_error("invalid style for a SCALAR event");
+      }
+      break;
+    default:
+      y_error("invalid event type");
+    }
+  }
+  {
+    nesting_t tmp;
+    const char* errmsg = NULL;
+    tmp.level = dst->nesting.level;
+    tmp.depth = dst->nesting.depth;
+    tmp.size = dst->nesting.depth;
+    tmp.stack = NULL;
+    if (tmp.size > 0) {
+      tmp.stack = (char*)malloc(tmp.size);
+      if (tmp.stack == NULL) {
+        y_error("insufficient memory");
+      }
+      memcpy(tmp.stack, dst->nesting.stack, tmp.size);
+    }
+    for (i = 0; errmsg == NULL && i < n; ++i) {
+      errmsg = nest_event(&tmp, (yaml_event_type_t)types[i]);
+    }
+    free(tmp.stack);
+    if (errmsg != NULL) {
+      y_errorq("%s in TYPES", errmsg);
+    }
+  }
+
+  for (i = 0; i < n; ++i) {
+    yaml_event_t event;
+    const yaml_char_t* tag = get_item(tags, i);
+    const yaml_char_t* anchor = get_item(anchors, i);
+    int style = (styles != NULL ? (int)styles[i] : 0);
+    int status;
+    switch (types[i]) {
+    case YAML_STREAM_START_EVENT:
+      status = yaml_stream_start_event_initialize(&event, YAML_ANY_ENCODING);
+      break;
+    case YAML_STREAM_END_EVENT:
+      status = yaml_stream_end_event_initialize(&event);
+      break;
+    case YAML_DOCUMENT_START_EVENT:
+      status = yaml_document_start_event_initialize(&event, NULL, NULL, NULL,
+                                                    TRUE);
+      break;
+    case YAML_DOCUMENT_END_EVENT:
+      status = yaml_document_end_event_initialize(&event, TRUE);
+      break;
+    case YAML_ALIAS_EVENT:
+      status = yaml_alias_event_initialize(&event, get_item(svalues, i));
+      break;
+    case YAML_SCALAR_EVENT:
+      if (svalues != NULL) {
+        status = ycore_scalar_event_initialize(
+            &event, anchor, tag, (const yaml_char_t*)(svalues[i] != NULL ?
+                                                      svalues[i] : ""),
+            (size_t)-1, (tag == NULL), (tag == NULL),
+            (yaml_scalar_style_t)style);
+      } else {
+        int length = (lvalues != NULL ?
+                      sprintf(buffer, "%ld", lvalues[i]) :
+                      sprintf(buffer, dformat, dvalues[i]));
+        status = ycore_scalar_event_initialize(
+            &event, anchor, tag, (const yaml_char_t*)buffer, length,
+            (tag == NULL), (tag == NULL), (yaml_scalar_style_t)style);
+      }
+      break;
+    case YAML_SEQUENCE_START_EVENT:
+      status = yaml_sequence_start_event_initialize(
+          &event, anchor, tag, (tag == NULL), (yaml_sequence_style_t)style);
+      break;
+    case YAML_SEQUENCE_END_EVENT:
+      status = yaml_sequence_end_event_initialize(&event);
+      break;
+    case YAML_MAPPING_START_EVENT:
+      status = yaml_mapping_start_event_initialize(
+          &event, anchor, tag, (tag == NULL), (yaml_mapping_style_t)style);
+      break;
+    default: /* YAML_MAPPING_END_EVENT */
+      status = yaml_mapping_end_event_initialize(&event);
+    }
+    if (! status) {
+      y_error("failed to initialize event");
+    }
+    emit_event(dst, &event);
+  }
+  ypush_nil();
+}
+
+/*---------------------------------------------------------------------------*/
+/* BULK EMISSION OF ARRAYS */
+
+/* Numerical arrays longer than this are emitted in flow style by default. */
+#define FLOW_MIN_LENGTH 8
+
+/* Kinds of formats for numerical values. */
+#define INTEGER_FORMAT 1
+#define FLOAT_FORMAT   2
+
+/* Check and normalize a format for a numerical value.  The format must have
+   exactly one conversion for an integer or a floating-point value, the
+   length modifier is fixed so that the value can be printed as a long or as
+   a double.  Returns the kind of format or 0 on error. */
+static int
+parse_format(const char* fmt, char* buf, size_t size)
+{
+  size_t n = 0;
+  int c, kind = 0;
+
+#define PUT(c) do { if (n + 1 >= size) return 0; buf[n++] = (c); } while (0)
+  while ((c = *fmt++) != '\0') {
+    PUT(c);
+    if (c != '%') {
+      continue;
+    }
+    if (*fmt == '%') {
+      PUT(*fmt++);
+      continue;
+    }
+    if (kind != 0) {
+      return 0; /* more than one conversion */
+    }
+    while (*fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '#' ||
+           *fmt == '0') {
+      PUT(*fmt++);
+    }
+    while (isdigit(*fmt)) {
+      PUT(*fmt++);
+    }
+    if (*fmt == '.') {
+      PUT(*fmt++);
+      while (isdigit(*fmt)) {
+        PUT(*fmt++);
+      }
+    }
+    while (*fmt == 'h' || *fmt == 'l' || *fmt == 'L' || *fmt == 'q' ||
+           *fmt == 'j' || *fmt == 'z' || *fmt == 't') {
+      ++fmt; /* skip length modifier */
+    }
+    c = *fmt++;
+    if (c == 'd' || c == 'i' || c == 'o' || c == 'u' ||
+        c == 'x' || c == 'X') {
+      PUT('l');
+      kind = INTEGER_FORMAT;
+    } else if (c == 'e' || c == 'E' || c == 'f' || c == 'F' ||
+               c == 'g' || c == 'G' || c == 'a' || c == 'A') {
+      kind = FLOAT_FORMAT;
+    } else {
+      return 0;
+    }
+    PUT(c);
+  }
+#undef PUT
+  buf[n] = '\0';
+  return kind;
+}
+
+typedef struct _array_t array_t;
+struct _array_t {
+  emitter_t* emitter;
+  const void* data;
+  long dims[Y_DIMSIZE];
+  int type; /* Yorick type identifier */
+  int kind; /* kind of format for numerical values */
+  yaml_sequence_style_t inner; /* style of the innermost sequences */
+  yaml_sequence_style_t outer; /* style of the other sequences */
+  char format[64];
+  char buffer[128];
+};
+
+/* Check the type of the array and choose once for all the format of its
+   elements.  FORMAT may be NULL to use the default for the type. */
+static void
+setup_array(array_t* arr, const char* format)
+{
+  if (arr->type > Y_STRING) {
+    y_error("expecting an array of numbers or of strings");
+  }
+  if (format != NULL && format[0] != '\0') {
+    if (arr->type == Y_STRING || arr->type == Y_COMPLEX) {
+      y_error("a format is only for integer or real values");
+    }
+    arr->kind = parse_format(format, arr->format, sizeof(arr->format));
+    if (arr->kind == 0) {
+      y_error("invalid format for a numerical value");
+    }
+  } else if (arr->type <= Y_LONG) {
+    arr->kind = INTEGER_FORMAT;
+    strcpy(arr->format, "%ld");
+  } else if (arr->type <= Y_DOUBLE) {
+    /* Enough digits for the values to be read back exactly. */
+    arr->kind = FLOAT_FORMAT;
+    strcpy(arr->format, (arr->type == Y_FLOAT ? "%.9g" : "%.17g"));
+  } else {
+    arr->kind = 0;
+  }
+}
+
+/* Yield the number of elements of the array. */
+static long
+array_length(const array_t* arr)
+{
+  long i, n = 1;
+  for (i = 1; i <= arr->dims[0]; ++i) {
+    n *= arr->dims[i];
+  }
+  return n;
+}
+
+/* Choose the style of the sequences.  STYLE < 0 is for the default. */
+static void
+setup_styles(array_t* arr, int style)
+{
+  if (style >= 0) {
+    arr->inner = style;
+    arr->outer = style;
+  } else {
+    arr->outer = YAML_ANY_SEQUENCE_STYLE;
+    if (arr->type != Y_STRING && arr->dims[0] >= 1 &&
+        arr->dims[1] > FLOW_MIN_LENGTH) {
+      arr->inner = YAML_FLOW_SEQUENCE_STYLE;
+    } else {
+      arr->inner = YAML_ANY_SEQUENCE_STYLE;
+    }
+  }
+}
+
+static void
+emit_string(emitter_t* emitter, const char* str)
+{
+  yaml_event_t event;
+  if (! ycore_scalar_event_initialize(
+          &event, NULL, NULL, (const yaml_char_t*)(str != NULL ? str : ""),
+          (size_t)-1, TRUE, TRUE, YAML_ANY_SCALAR_STYLE)) {
+    y_error("failed to initialize SCALAR event");
+  }
+  emit_event(emitter, &event);
+}
+
+/* Emit the element at index I of the array. */
+static void
+emit_array_element(array_t* arr, long i)
+{
+  yaml_event_t event;
+  const char* str;
+  double dval;
+  int length;
+
+  if (arr->type == Y_STRING) {
+    str = ((char* const*)arr->data)[i];
+    if (str == NULL) {
+      str = "";
+    }
+    length = -1; /* compute the length later */
+  } else {
+    if (arr->type == Y_COMPLEX) {
+      const double* z = ((const double*)arr->data) + 2*i;
+      length = sprintf(arr->buffer, "%.17g %s %.17gim", z[0],
+                       (z[1] >= 0 ? "+" : "-"), fabs(z[1]));
+    } else {
+      switch (arr->type) {
+      case Y_CHAR:   dval = ((const unsigned char*)arr->data)[i]; break;
+      case Y_SHORT:  dval = ((const short*)arr->data)[i];         break;
+      case Y_INT:    dval = ((const int*)arr->data)[i];           break;
+      case Y_FLOAT:  dval = ((const float*)arr->data)[i];         break;
+      case Y_DOUBLE: dval = ((const double*)arr->data)[i];        break;
+      default:       dval = 0.0;
+      }
+      if (arr->kind == INTEGER_FORMAT) {
+        long ival = (arr->type == Y_LONG ? ((const long*)arr->data)[i] :
+                     (long)dval);
+        length = snprintf(arr->buffer, sizeof(arr->buffer),
+                          arr->format, ival);
+      } else {
+        if (arr->type == Y_LONG) {
+          dval = (double)((const long*)arr->data)[i];
+        }
+        length = snprintf(arr->buffer, sizeof(arr->buffer),
+                          arr->format, dval);
+      }
+      if (length < 0 || (size_t)length >= sizeof(arr->buffer)) {
+        y_error("formatted value too long");
+      }
+    }
+    str = arr->buffer;
+  }
+  if (! ycore_scalar_event_initialize(
+          &event, NULL, NULL, (const yaml_char_t*)str,
+          (length < 0 ? (size_t)-1 : (size_t)length),
+          TRUE, TRUE, YAML_ANY_SCALAR_STYLE)) {
+    y_error("failed to initialize SCALAR event");
+  }
+  emit_event(arr->emitter, &event);
+}
+
+/* Emit the sub-array of rank R starting at OFFSET as nested sequences, the
+   first dimension being the innermost one. */
+static void
+emit_subarray(array_t* arr, int r, long offset, long stride)
+{
+  yaml_event_t event;
+  long i, n = arr->dims[r];
+  yaml_sequence_style_t style;
+
+  style = (r == 1 ? arr->inner : arr->outer);
+  if (! yaml_sequence_start_event_initialize(&event, NULL, NULL, TRUE,
+                                             style)) {
+    y_error("failed to initialize SEQUENCE-START event");
+  }
+  emit_event(arr->emitter, &event);
+  if (r == 1) {
+    for (i = 0; i < n; ++i) {
+      emit_array_element(arr, offset + i);
+    }
+  } else {
+    stride /= n;
+    for (i = 0; i < n; ++i) {
+      emit_subarray(arr, r - 1, offset + i*stride, stride);
+    }
+  }
+  if (! yaml_sequence_end_event_initialize(&event)) {
+    y_error("failed to initialize SEQUENCE-END event");
+  }
+  emit_event(arr->emitter, &event);
+}
+
+void
+Y_yaml_emit_array(int argc)
+{
+  array_t arr;
+  emitter_t* dst = NULL;
+  const char* format = NULL;
+  long ntot;
+  int iarg, rank, pos = 0, style = -1;
+
+  if (! initialized) {
+    initialize();
+  }
+  memset(&arr, 0, sizeof(arr));
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (pos == 0) {
+        dst = yget_obj(iarg, &emitter_type);
+      } else if (pos == 1) {
+        arr.data = ygeta_any(iarg, &ntot, arr.dims, &arr.type);
+      } else {
+        y_error("too many arguments");
+      }
+      ++pos;
+    } else {
+      /* Keyword argument. */
+      if (index == style_index) {
+        style = ygets_i(--iarg);
+      } else if (index == format_index) {
+        format = ygets_q(--iarg);
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+  if (pos != 2) {
+    y_error("expecting exactly two arguments");
+  }
+  arr.emitter = dst;
+  setup_array(&arr, format);
+  setup_styles(&arr, style);
+  rank = arr.dims[0];
+  if (rank == 0) {
+    emit_array_element(&arr, 0);
+  } else {
+    emit_subarray(&arr, rank, 0, ntot);
+  }
+  ypush_nil();
+}
+
+/* A list of columns is a simple container to pass any number of columns to
+   yaml_emit_table from interpreted code. */
+static void    free_columns(void* ptr);
+static void   print_columns(void* ptr);
+static void    eval_columns(void* ptr, int argc);
+
+static y_userobj_t columns_type = {
+  /* type_name:  */   "yaml_columns",
+  /* on_free:    */    free_columns,
+  /* on_print:   */   print_columns,
+  /* on_eval:    */    eval_columns,
+  /* on_extract: */ (void (*)(void*, char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _columns_t columns_t;
+struct _columns_t {
+  long number; /* number of columns */
+  void* column[1]; /* actually NUMBER handles (NULL if unset) */
+};
+
+static void free_columns(void* ptr)
+{
+  columns_t* obj = (columns_t*)ptr;
+  long j;
+  for (j = 0; j < obj->number; ++j) {
+    if (obj->column[j] != NULL) {
+      ydrop_use(obj->column[j]);
+    }
+  }
+}
+
+static void print_columns(void* ptr)
+{
+  columns_t* obj = (columns_t*)ptr;
+  char buffer[64];
+  sprintf(buffer, "list of %ld YAML column(s)", obj->number);
+  y_print(buffer, 1);
+}
+
+/* Calling OBJ(J, COL) stores column COL in the J-th slot of OBJ. */
+static void eval_columns(void* ptr, int argc)
+{
+  columns_t* obj = (columns_t*)ptr;
+  long j;
+  if (argc != 2) {
+    y_error("expecting exactly two arguments");
+  }
+  j = ygets_l(1);
+  if (j < 1 || j > obj->number) {
+    y_error("out of range column index");
+  }
+  if (obj->column[j - 1] != NULL) {
+    ydrop_use(obj->column[j - 1]);
+    obj->column[j - 1] = NULL;
+  }
+  obj->column[j - 1] = yget_use(0);
+  ypush_nil();
+}
+
+void
+Y_yaml_columns(int argc)
+{
+  columns_t* obj;
+  long number;
+
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  number = ygets_l(0);
+  if (number < 0) {
+    y_error("invalid number of columns");
+  }
+  obj = (columns_t*)ypush_obj(&columns_type, sizeof(columns_t) +
+                              (number > 1 ? number - 1 : 0)*sizeof(void*));
+  obj->number = number;
+}
+
+void
+Y_yaml_emit_table(int argc)
+{
+  yaml_event_t event;
+  array_t* cols;
+  emitter_t* dst = NULL;
+  columns_t* list = NULL;
+  char** names = NULL;
+  char** formats = NULL;
+  long dims[2];
+  long i, j, ncols, nrows = -1, nformats = 0, nnames = 0;
+  int iarg, pos, first = -1, style = -1, columns = FALSE;
+
+  if (! initialized) {
+    initialize();
+  }
+
+  /* First pass to parse keywords and arguments but the columns. */
+  pos = 0;
+  ncols = 0;
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      /* Positional argument. */
+      if (pos == 0) {
+        dst = yget_obj(iarg, &emitter_type);
+      } else if (pos == 1) {
+        names = ygeta_q(iarg, &nnames, NULL);
+      } else {
+        if (pos == 2) {
+          first = iarg;
+        }
+        if (pos == 2 && yarg_typeid(iarg) == Y_OPAQUE &&
+            yget_obj(iarg, NULL) == columns_type.type_name) {
+          list = (columns_t*)yget_obj(iarg, &columns_type);
+        } else if (list != NULL) {
+          y_error("too many arguments");
+        }
+        ++ncols;
+      }
+      ++pos;
+    } else {
+      /* Keyword argument. */
+      --iarg;
+      if (index == columns_index) {
+        columns = yarg_true(iarg);
+      } else if (index == style_index) {
+        style = ygets_i(iarg);
+      } else if (index == format_index) {
+        if (! yarg_nil(iarg)) {
+          formats = ygeta_q(iarg, &nformats, NULL);
+        }
+      } else {
+        y_error("unknown keyword");
+      }
+    }
+  }
+  if (pos < 2) {
+    y_error("expecting at least an emitter and a list of names");
+  }
+  if (list != NULL) {
+    ncols = list->number;
+  }
+  if (nnames != ncols) {
+    y_error("there must be as many names as columns");
+  }
+  if (nformats > 1 && nformats != ncols) {
+    y_error("there must be as many formats as columns");
+  }
+
+  /* Push the table of column descriptors on top of the stack so that it is
+     automatically freed.  If columns are provided by a list, they are pushed
+     on top of the stack in order. */
+  dims[0] = 1;
+  dims[1] = (ncols > 0 ? ncols*sizeof(array_t) : 1);
+  cols = (array_t*)ypush_c(dims);
+  memset(cols, 0, ncols*sizeof(array_t));
+  if (list != NULL) {
+    for (j = 0; j < ncols; ++j) {
+      if (list->column[j] == NULL) {
+        y_error("unset column in list");
+      }
+      ykeep_use(list->column[j]);
+    }
+    iarg = ncols - 1;
+  } else {
+    iarg = first + 1;
+  }
+  for (j = 0; j < ncols; ++j, --iarg) {
+    array_t* col = &cols[j];
+    long rank;
+    if (list == NULL) {
+      while (yarg_key(iarg) >= 0) {
+        iarg -= 2; /* skip keywords */
+      }
+    }
+    col->data = ygeta_any(iarg, NULL, col->dims, &col->type);
+    col->emitter = dst;
+    setup_array(col, (nformats == 0 ? NULL :
+                      formats[nformats > 1 ? j : 0]));
+    rank = col->dims[0];
+    if (rank < 1) {
+      y_error("columns must have at least one dimension");
+    }
+    if (nrows < 0) {
+      nrows = col->dims[rank];
+    } else if (col->dims[rank] != nrows) {
+      y_error("all columns must have the same last dimension");
+    }
+    if (! columns) {
+      /* Only keep the dimensions of a cell. */
+      col->dims[0] = rank - 1;
+    }
+    setup_styles(col, -1);
+  }
+  if (columns) {
+    /* Emit the table as a mapping of sequences. */
+    if (! yaml_mapping_start_event_initialize(
+            &event, NULL, NULL, TRUE,
+            (style >= 0 ? style : YAML_ANY_MAPPING_STYLE))) {
+      y_error("failed to initialize MAPPING-START event");
+    }
+    emit_event(dst, &event);
+    for (j = 0; j < ncols; ++j) {
+      array_t* col = &cols[j];
+      emit_string(dst, names[j]);
+      emit_subarray(col, col->dims[0], 0, array_length(col));
+    }
+    if (! yaml_mapping_end_event_initialize(&event)) {
+      y_error("failed to initialize MAPPING-END event");
+    }
+    emit_event(dst, &event);
+  } else {
+    /* Emit the table as a sequence of mappings. */
+    if (! yaml_sequence_start_event_initialize(&event, NULL, NULL, TRUE,
+                                               YAML_ANY_SEQUENCE_STYLE)) {
+      y_error("failed to initialize SEQUENCE-START event");
+    }
+    emit_event(dst, &event);
+    for (i = 0; i < nrows; ++i) {
+      if (! yaml_mapping_start_event_initialize(
+              &event, NULL, NULL, TRUE,
+              (style >= 0 ? style : YAML_ANY_MAPPING_STYLE))) {
+        y_error("failed to initialize MAPPING-START event");
+      }
+      emit_event(dst, &event);
+      for (j = 0; j < ncols; ++j) {
+        array_t* col = &cols[j];
+        long size = array_length(col);
+        emit_string(dst, names[j]);
+        if (col->dims[0] == 0) {
+          emit_array_element(col, i);
+        } else {
+          emit_subarray(col, col->dims[0], i*size, size);
+        }
+      }
+      if (! yaml_mapping_end_event_initialize(&event)) {
+        y_error("failed to initialize MAPPING-END event");
+      }
+      emit_event(dst, &event);
+    }
+    if (! yaml_sequence_end_event_initialize(&event)) {
+      y_error("failed to initialize SEQUENCE-END event");
+    }
+    emit_event(dst, &event);
+  }
+  ypush_nil();
+}
+
+/* Yield the names of the members of an array of structures.  The Yorick
+   API has no function for that, the structure definition is examined
+   directly. */
+void
+Y__yaml_struct_members(int argc)
+{
+  Operand op;
+  StructDef* base;
+  char** names;
+  long i, n, dims[2];
+
+  if (argc != 1 || yarg_typeid(0) != Y_STRUCT) {
+    y_error("expecting an array of structures");
+  }
+  sp->ops->FormOperand(sp, &op);
+  base = op.type.base;
+  n = base->table.nItems;
+  if (n < 1) {
+    y_error("structure has no members");
+  }
+  dims[0] = 1;
+  dims[1] = n;
+  names = ypush_q(dims);
+  for (i = 0; i < n; ++i) {
+    names[i] = p_strcpy(base->table.names[i]);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* FINGERPRINTS */
+
+static void    free_hasher(void* ptr);
+static void   print_hasher(void* ptr);
+
+static y_userobj_t hasher_type = {
+  /* type_name:  */   "yaml_hasher",
+  /* on_free:    */    free_hasher,
+  /* on_print:   */   print_hasher,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+static void free_hasher(void* ptr)
+{
+  ycore_hasher_destroy((ycore_hasher_t*)ptr);
+}
+
+static void print_hasher(void* ptr)
+{
+  y_print("YAML hasher", 1);
+}
+
+void
+Y__yaml_hash(int argc)
+{
+  const char* canonical = NULL;
+  parser_t* src = NULL;
+  ycore_hasher_t* h;
+  yaml_event_t event;
+  yaml_event_type_t type;
+  const char* errmsg;
+  int iarg, isrc = -1;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      if (isrc >= 0) {
+        y_error("too many arguments");
+      }
+      isrc = iarg;
+    } else if (index == canonical_index) {
+      canonical = ygets_q(--iarg);
+    } else {
+      y_error("unknown keyword");
+    }
+  }
+  if (isrc < 0) {
+    y_error("expecting one argument");
+  }
+
+  if (yarg_string(isrc) == 1) {
+    /* Open the file. */
+    src = open_parser(ygets_q(isrc));
+    ++isrc;
+  } else if (yarg_typeid(isrc) == Y_OPAQUE &&
+             yget_obj(isrc, NULL) == emitter_type.type_name) {
+    /* Digest of what has been emitted by a hashing emitter. */
+    emitter_t* obj = (emitter_t*)yget_obj(isrc, &emitter_type);
+    if (obj->hasher == NULL) {
+      y_error("not a hashing emitter");
+    }
+    if (! obj->hasher->done) {
+      y_error("end of stream not yet emitted");
+    }
+    push_digest(obj->hasher->digest);
+    return;
+  } else {
+    src = (parser_t*)yget_obj(isrc, &parser_type);
+  }
+  if (src->parsing == YCORE_ANY) {
+    src->parsing = YCORE_PARSE;
+  } else if (src->parsing != YCORE_PARSE) {
+    y_error("not an event-based parser");
+  }
+
+  h = (ycore_hasher_t*)ypush_obj(&hasher_type, sizeof(ycore_hasher_t));
+  ycore_hasher_init(h);
+  if (canonical != NULL && canonical[0] != '\0') {
+    h->output = fopen(canonical, "w");
+    if (h->output == NULL) {
+      y_error("failed to open file for writing");
+    }
+    h->open = TRUE;
+  }
+  do {
+    if (! parse_event(src, &event) &&
+        ! yaml_stream_end_event_initialize(&event)) {
+      y_error("failed to initialize STREAM-END event");
+    }
+    type = event.type;
+    errmsg = ycore_hasher_feed(h, &event);
+    yaml_event_delete(&event);
+    if (errmsg != NULL) {
+      y_error(errmsg);
+    }
+  } while (type != YAML_STREAM_END_EVENT);
+  push_digest(h->digest);
+}
+
+/*---------------------------------------------------------------------------*/
+/* NATIVE DOCUMENTS */
+
+static void    free_document(void* ptr);
+static void   print_document(void* ptr);
+
+static y_userobj_t document_type = {
+  /* type_name:  */   "yaml_document",
+  /* on_free:    */    free_document,
+  /* on_print:   */   print_document,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+/* A document object is a document of the core. */
+typedef ycore_document_t document_t;
+
+static void free_document(void* ptr)
+{
+  ycore_document_destroy((document_t*)ptr);
+}
+
+static void print_document(void* ptr)
+{
+  document_t* obj = (document_t*)ptr;
+  if (obj->init) {
+    y_print("YAML document", 1);
+  } else {
+    y_print("uninitialized YAML document", 1);
+  }
+}
+
+/* Load the next document from file FILENAME or from PARSER (only one of
+   them is non-NULL).  Pushes a document object on top of the stack, possibly
+   after a temporary parser object.  If there are no more documents, it is
+   an error if REQUIRED is true, NULL is returned otherwise. */
+static document_t*
+load_document(const char* filename, parser_t* parser, int required)
+{
+  const char* errmsg;
+  document_t* doc;
+
+  if (filename != NULL) {
+    parser = open_parser(filename);
+  }
+  if (parser->parsing != YCORE_ANY && parser->parsing != YCORE_LOAD) {
+    y_error("not a document-based parser");
+  }
+  doc = (document_t*)ypush_obj(&document_type, sizeof(document_t));
+  errmsg = ycore_load_document(parser, doc);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+  if (doc->nnodes == 0) {
+    if (! required) {
+      return NULL;
+    }
+    y_error("no document");
+  }
+  return doc;
+}
+
+/* Get the filename or the parser of argument IARG to load a document. */
+static void
+get_document_source(int iarg, const char** filename, parser_t** parser)
+{
+  if (yarg_string(iarg) == 1) {
+    *filename = ygets_q(iarg);
+    *parser = NULL;
+  } else {
+    *filename = NULL;
+    *parser = (parser_t*)yget_obj(iarg, &parser_type);
+  }
+}
+
+/* Compute the digests of all the nodes of a document. */
+static void
+hash_document(ycore_hasher_t* h, document_t* doc)
+{
+  const char* errmsg = ycore_hash_document(h, doc);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+}
+
+static int
+same_digest(const document_t* a, int ia, const document_t* b, int ib)
+{
+  const uint64_t* da = a->digest + 2*(ia - 1);
+  const uint64_t* db = b->digest + 2*(ib - 1);
+  return (da[0] == db[0] && da[1] == db[1]);
+}
+
+/* Append a compact flow form of a node to the scratch buffer of hasher H.
+   Non-plain scalars are quoted if QUOTE is true. */
+static int
+buf_put_node(ycore_hasher_t* h, document_t* doc, int id, int quote, int depth)
+{
+  yaml_node_t* node = yaml_document_get_node(&doc->document, id);
+  long i, n;
+
+  if (depth > 256) {
+    return ycore_buf_puts(h, "...");
+  }
+  switch (node->type) {
+  case YAML_SCALAR_NODE:
+    if (quote && node->data.scalar.style != YAML_PLAIN_SCALAR_STYLE) {
+      return ycore_buf_put_quoted(h, (const char*)node->data.scalar.value,
+                                  node->data.scalar.length);
+    }
+    return ycore_buf_put(h, node->data.scalar.value, node->data.scalar.length);
+  case YAML_SEQUENCE_NODE:
+    n = node->data.sequence.items.top - node->data.sequence.items.start;
+    if (! ycore_buf_puts(h, "[")) {
+      return FALSE;
+    }
+    for (i = 0; i < n; ++i) {
+      if ((i > 0 && ! ycore_buf_puts(h, ", ")) ||
+          ! buf_put_node(h, doc, node->data.sequence.items.start[i],
+                         TRUE, depth + 1)) {
+        return FALSE;
+      }
+    }
+    return ycore_buf_puts(h, "]");
+  case YAML_MAPPING_NODE:
+    n = node->data.mapping.pairs.top - node->data.mapping.pairs.start;
+    if (! ycore_buf_puts(h, "{")) {
+      return FALSE;
+    }
+    for (i = 0; i < n; ++i) {
+      yaml_node_pair_t* pair = &node->data.mapping.pairs.start[i];
+      if ((i > 0 && ! ycore_buf_puts(h, ", ")) ||
+          ! buf_put_node(h, doc, pair->key, TRUE, depth + 1) ||
+          ! ycore_buf_puts(h, ": ") ||
+          ! buf_put_node(h, doc, pair->value, TRUE, depth + 1)) {
+        return FALSE;
+      }
+    }
+    return ycore_buf_puts(h, "}");
+  default:
+    return TRUE;
+  }
+}
+
+/* Append a path component for a mapping key to the scratch buffer of hasher
+   H: ".key" for a simple word, ["key"] otherwise. */
+static int
+buf_put_key(ycore_hasher_t* h, const yaml_char_t* key, size_t len)
+{
+  int simple = (len > 0);
+  size_t i;
+  for (i = 0; simple && i < len; ++i) {
+    int c = key[i];
+    simple = (c < 0x80 && (isalnum(c) || c == '_' || c == '-'));
+  }
+  if (simple) {
+    return (ycore_buf_puts(h, ".") && ycore_buf_put(h, key, len));
+  }
+  return (ycore_buf_puts(h, "[") &&
+          ycore_buf_put_quoted(h, (const char*)key, len) &&
+          ycore_buf_puts(h, "]"));
+}
+
+/* Append a path component for a sequence index to the scratch buffer of
+   hasher H. */
+static int
+buf_put_index(ycore_hasher_t* h, long index)
+{
+  char buf[32];
+  sprintf(buf, "[%ld]", index);
+  return ycore_buf_puts(h, buf);
+}
+
+/*---------------------------------------------------------------------------*/
+/* STRUCTURAL DIFF */
+
+/* Sequences longer than this (after removing their common head and tail)
+   are aligned by index even though LCS alignment is requested. */
+#define LCS_MAX_CELLS (1L << 22)
+
+static void    free_diff(void* ptr);
+static void   print_diff(void* ptr);
+
+static y_userobj_t diff_type = {
+  /* type_name:  */   "yaml_diff",
+  /* on_free:    */    free_diff,
+  /* on_print:   */   print_diff,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _hkey_t hkey_t;
+struct _hkey_t {
+  uint64_t h[2]; /* hash value of the text and tag of a scalar key and 0,
+                    or digest of a collection key */
+  int scalar; /* key is a scalar? */
+  int node; /* key node */
+  long index; /* index of the pair, -1 - index once matched */
+};
+
+typedef struct _diff_t diff_t;
+struct _diff_t {
+  ycore_hasher_t scratch; /* scratch buffer for hashing and for texts */
+  document_t* a; /* old document */
+  document_t* b; /* new document */
+  char* path; /* path of the current node */
+  size_t pathlen, pathsize;
+  char** change; /* path, kind, old and new values of each change */
+  size_t count, size; /* number of strings used and allocated */
+  hkey_t* key; /* stack of keys for aligning mappings */
+  size_t nkeys, maxkeys;
+  long* match; /* stack of matches for aligning sequences */
+  size_t nmatches, maxmatches;
+  int lcs; /* align sequences by LCS? */
+};
+
+static void free_diff(void* ptr)
+{
+  diff_t* d = (diff_t*)ptr;
+  size_t i;
+  ycore_hasher_destroy(&d->scratch);
+  free(d->path);
+  for (i = 0; i < d->count; ++i) {
+    if (d->change[i] != NULL) {
+      p_free(d->change[i]);
+    }
+  }
+  free(d->change);
+  free(d->key);
+  free(d->match);
+}
+
+static void print_diff(void* ptr)
+{
+  y_print("YAML diff", 1);
+}
+
+/* Append a component to the path, returns the previous length of the
+   path. */
+static size_t
+push_path(diff_t* d, document_t* doc, int key, long index)
+{
+  size_t len = d->pathlen;
+  ycore_hasher_t* h = &d->scratch;
+  h->length = 0;
+  if (key > 0) {
+    yaml_node_t* node = yaml_document_get_node(&doc->document, key);
+    if (node->type == YAML_SCALAR_NODE) {
+      if (! buf_put_key(h, node->data.scalar.value,
+                        node->data.scalar.length)) {
+        y_error("insufficient memory");
+      }
+    } else if (! ycore_buf_puts(h, "[") ||
+               ! buf_put_node(h, doc, key, TRUE, 0) ||
+               ! ycore_buf_puts(h, "]")) {
+      y_error("insufficient memory");
+    }
+  } else if (! buf_put_index(h, index)) {
+    y_error("insufficient memory");
+  }
+  grow_array((void**)&d->path, &d->pathsize, len + h->length + 1, 1);
+  memcpy(d->path + len, h->buffer, h->length);
+  d->pathlen = len + h->length;
+  d->path[d->pathlen] = '\0';
+  return len;
+}
+
+static void
+pop_path(diff_t* d, size_t len)
+{
+  d->pathlen = len;
+  d->path[len] = '\0';
+}
+
+static char*
+node_string(diff_t* d, document_t* doc, int id)
+{
+  ycore_hasher_t* h = &d->scratch;
+  if (id <= 0) {
+    return p_strcpy("");
+  }
+  h->length = 0;
+  if (! buf_put_node(h, doc, id, FALSE, 0) || ! ycore_buf_put(h, "", 1)) {
+    y_error("insufficient memory");
+  }
+  return p_strcpy(h->buffer);
+}
+
+/* Record a change, IA or IB is zero if there is no old or new node. */
+static void
+add_change(diff_t* d, const char* kind, int ia, int ib)
+{
+  grow_array((void**)&d->change, &d->size, d->count + 4, sizeof(char*));
+  d->change[d->count] = p_strcpy(d->pathlen > 0 ? d->path : ".");
+  d->change[d->count + 1] = p_strcpy(kind);
+  d->change[d->count + 2] = NULL;
+  d->change[d->count + 3] = NULL;
+  d->count += 4;
+  d->change[d->count - 2] = node_string(d, d->a, ia);
+  d->change[d->count - 1] = node_string(d, d->b, ib);
+}
+
+static void diff_nodes(diff_t* d, int ia, int ib, int depth);
+
+/* Set the identity of key node ID of document DOC.  Scalar keys are
+   identified by their text and tag, other keys by their digest. */
+static void
+set_key(hkey_t* k, document_t* doc, int id)
+{
+  yaml_node_t* node = yaml_document_get_node(&doc->document, id);
+  k->node = id;
+  k->scalar = (node->type == YAML_SCALAR_NODE);
+  if (k->scalar) {
+    const char* tag = (const char*)node->tag;
+    k->h[0] = ycore_hash_mix(ycore_key_hash(node), (tag == NULL ? 0 :
+                             ycore_hash_bytes(YCORE_HASH_SEED, tag,
+                                              strlen(tag))));
+    k->h[1] = 0;
+  } else {
+    memcpy(k->h, doc->digest + 2*(id - 1), 2*sizeof(uint64_t));
+  }
+}
+
+static int
+compare_keys(const void* a, const void* b)
+{
+  const hkey_t* ka = (const hkey_t*)a;
+  const hkey_t* kb = (const hkey_t*)b;
+  if (ka->scalar != kb->scalar) {
+    return (ka->scalar ? -1 : 1);
+  }
+  return ycore_compare_digests(ka->h, kb->h);
+}
+
+/* Check whether key KA of the old document is the same as key KB of the
+   new one (which have the same identity). */
+static int
+same_key(diff_t* d, const hkey_t* ka, const hkey_t* kb)
+{
+  yaml_node_t* na;
+  yaml_node_t* nb;
+  if (! ka->scalar) {
+    return TRUE;
+  }
+  na = yaml_document_get_node(&d->a->document, ka->node);
+  nb = yaml_document_get_node(&d->b->document, kb->node);
+  return (ycore_same_key(na, nb) && same_string(na->tag, nb->tag));
+}
+
+static int
+compare_key_indices(const void* a, const void* b)
+{
+  long i = ((const hkey_t*)a)->index;
+  long j = ((const hkey_t*)b)->index;
+  if (i < 0) i = -1 - i;
+  if (j < 0) j = -1 - j;
+  return (i < j ? -1 : (i > j ? 1 : 0));
+}
+
+static void
+diff_mappings(diff_t* d, yaml_node_t* na, yaml_node_t* nb, int depth)
+{
+  yaml_node_pair_t* pa = na->data.mapping.pairs.start;
+  yaml_node_pair_t* pb = nb->data.mapping.pairs.start;
+  long i, n = na->data.mapping.pairs.top - pa;
+  long m = nb->data.mapping.pairs.top - pb;
+  size_t base = d->nkeys, len;
+
+  /* Sort the keys of B by identity for fast look-up. */
+  grow_array((void**)&d->key, &d->maxkeys, base + m, sizeof(hkey_t));
+  for (i = 0; i < m; ++i) {
+    hkey_t* k = &d->key[base + i];
+    set_key(k, d->b, pb[i].key);
+    k->index = i;
+  }
+  d->nkeys = base + m;
+  qsort(d->key + base, m, sizeof(hkey_t), compare_keys);
+
+  for (i = 0; i < n; ++i) {
+    hkey_t ka;
+    long lo = 0, hi = m, j = -1;
+    set_key(&ka, d->a, pa[i].key);
+    while (lo < hi) {
+      long mid = (lo + hi)/2;
+      if (compare_keys(&d->key[base + mid], &ka) < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    for (; lo < m && compare_keys(&d->key[base + lo], &ka) == 0; ++lo) {
+      if (d->key[base + lo].index >= 0 &&
+          same_key(d, &ka, &d->key[base + lo])) {
+        j = d->key[base + lo].index;
+        d->key[base + lo].index = -1 - j;
+        break;
+      }
+    }
+    len = push_path(d, d->a, pa[i].key, 0);
+    if (j < 0) {
+      add_change(d, "removed", pa[i].value, 0);
+    } else {
+      diff_nodes(d, pa[i].value, pb[j].value, depth);
+    }
+    pop_path(d, len);
+  }
+
+  /* Report the new keys in their order. */
+  qsort(d->key + base, m, sizeof(hkey_t), compare_key_indices);
+  for (i = 0; i < m; ++i) {
+    if (d->key[base + i].index >= 0) {
+      len = push_path(d, d->b, pb[i].key, 0);
+      add_change(d, "added", 0, pb[i].value);
+      pop_path(d, len);
+    }
+  }
+  d->nkeys = base;
+}
+
+/* Compare the items of sequences in ranges [I0,I1) and [J0,J1) by index. */
+static void
+diff_items(diff_t* d, yaml_node_item_t* a, long i0, long i1,
+           yaml_node_item_t* b, long j0, long j1, int depth)
+{
+  long k, len;
+  for (k = 0; i0 + k < i1 || j0 + k < j1; ++k) {
+    if (i0 + k < i1) {
+      len = push_path(d, NULL, 0, i0 + k);
+      if (j0 + k < j1) {
+        diff_nodes(d, a[i0 + k], b[j0 + k], depth);
+      } else {
+        add_change(d, "removed", a[i0 + k], 0);
+      }
+    } else {
+      len = push_path(d, NULL, 0, j0 + k);
+      add_change(d, "added", 0, b[j0 + k]);
+    }
+    pop_path(d, len);
+  }
+}
+
+/* Find a longest common subsequence of items in ranges [I0,I1) and [J0,J1)
+   and push the matched pairs of indices.  Returns false if the ranges are
+   too long. */
+static int
+lcs_items(diff_t* d, yaml_node_item_t* a, long i0, long i1,
+          yaml_node_item_t* b, long j0, long j1)
+{
+  long n = i1 - i0, m = j1 - j0, i, j, k;
+  unsigned int* t;
+  size_t base = d->nmatches;
+
+  if (n*m > LCS_MAX_CELLS) {
+    return FALSE;
+  }
+  /* T(i,j) is the length of the LCS of the tails from I0+I and J0+J. */
+  t = (unsigned int*)malloc((n + 1)*(m + 1)*sizeof(unsigned int));
+  if (t == NULL) {
+    return FALSE;
+  }
+#define T(i,j) t[(i)*(m + 1) + (j)]
+  for (i = n; i >= 0; --i) {
+    for (j = m; j >= 0; --j) {
+      if (i == n || j == m) {
+        T(i,j) = 0;
+      } else if (same_digest(d->a, a[i0 + i], d->b, b[j0 + j])) {
+        T(i,j) = T(i+1,j+1) + 1;
+      } else {
+        T(i,j) = (T(i+1,j) >= T(i,j+1) ? T(i+1,j) : T(i,j+1));
+      }
+    }
+  }
+  k = T(0,0);
+  if (base + 2*k > d->maxmatches) {
+    long* match = NULL;
+    size_t size = d->maxmatches;
+    if (size < 16) {
+      size = 16;
+    }
+    while (size < base + 2*k) {
+      size *= 2;
+    }
+    match = (long*)realloc(d->match, size*sizeof(long));
+    if (match == NULL) {
+      free(t);
+      return FALSE;
+    }
+    d->match = match;
+    d->maxmatches = size;
+  }
+  i = 0;
+  j = 0;
+  while (i < n && j < m) {
+    if (same_digest(d->a, a[i0 + i], d->b, b[j0 + j])) {
+      d->match[d->nmatches++] = i0 + i;
+      d->match[d->nmatches++] = j0 + j;
+      ++i;
+      ++j;
+    } else if (T(i+1,j) >= T(i,j+1)) {
+      ++i;
+    } else {
+      ++j;
+    }
+  }
+#undef T
+  free(t);
+  return TRUE;
+}
+
+static void
+diff_sequences(diff_t* d, yaml_node_t* na, yaml_node_t* nb, int depth)
+{
+  yaml_node_item_t* a = na->data.sequence.items.start;
+  yaml_node_item_t* b = nb->data.sequence.items.start;
+  long n = na->data.sequence.items.top - a;
+  long m = nb->data.sequence.items.top - b;
+  long i0 = 0, j0 = 0, i1 = n, j1 = m, k;
+  size_t base, end;
+
+  if (! d->lcs) {
+    diff_items(d, a, 0, n, b, 0, m, depth);
+    return;
+  }
+
+  /* Skip common head and tail. */
+  while (i0 < i1 && j0 < j1 && same_digest(d->a, a[i0], d->b, b[j0])) {
+    ++i0;
+    ++j0;
+  }
+  while (i0 < i1 && j0 < j1 &&
+         same_digest(d->a, a[i1 - 1], d->b, b[j1 - 1])) {
+    --i1;
+    --j1;
+  }
+  base = d->nmatches;
+  if (! lcs_items(d, a, i0, i1, b, j0, j1)) {
+    diff_items(d, a, i0, i1, b, j0, j1, depth);
+    return;
+  }
+  end = d->nmatches;
+
+  /* Compare unmatched items in-between matched ones by index. */
+  for (k = base; k < end; k += 2) {
+    long mi = d->match[k], mj = d->match[k + 1];
+    diff_items(d, a, i0, mi, b, j0, mj, depth);
+    i0 = mi + 1;
+    j0 = mj + 1;
+  }
+  diff_items(d, a, i0, i1, b, j0, j1, depth);
+  d->nmatches = base;
+}
+
+static int
+same_tag(const yaml_node_t* a, const yaml_node_t* b)
+{
+  return same_string(a->tag, b->tag);
+}
+
+/* Compare node IA of the old document with node IB of the new one.  As the
+   digests of recursive structures do not account for their cycles, the
+   depth is limited. */
+static void
+diff_nodes(diff_t* d, int ia, int ib, int depth)
+{
+  yaml_node_t* na = yaml_document_get_node(&d->a->document, ia);
+  yaml_node_t* nb = yaml_document_get_node(&d->b->document, ib);
+
+  if (same_digest(d->a, ia, d->b, ib)) {
+    return;
+  }
+  if (depth > YCORE_MAX_DEPTH) {
+    y_error("too many levels of nesting (recursive structure?)");
+  }
+  if (na->type == YAML_MAPPING_NODE && nb->type == YAML_MAPPING_NODE &&
+      same_tag(na, nb)) {
+    diff_mappings(d, na, nb, depth + 1);
+  } else if (na->type == YAML_SEQUENCE_NODE &&
+             nb->type == YAML_SEQUENCE_NODE && same_tag(na, nb)) {
+    diff_sequences(d, na, nb, depth + 1);
+  } else {
+    add_change(d, "changed", ia, ib);
+  }
+}
+
+void
+Y_yaml_diff(int argc)
+{
+  const char* filename[2];
+  parser_t* parser[2];
+  diff_t* d;
+  int iarg, pos = 0, lcs = FALSE, apos[2];
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      if (pos >= 2) {
+        y_error("expecting two arguments");
+      }
+      apos[pos++] = iarg;
+    } else if (index == lcs_index) {
+      lcs = yarg_true(--iarg);
+    } else {
+      y_error("unknown keyword");
+    }
+  }
+  if (pos != 2) {
+    y_error("expecting two arguments");
+  }
+  get_document_source(apos[0], &filename[0], &parser[0]);
+  get_document_source(apos[1], &filename[1], &parser[1]);
+
+  d = (diff_t*)ypush_obj(&diff_type, sizeof(diff_t));
+  d->lcs = lcs;
+  d->a = load_document(filename[0], parser[0], TRUE);
+  d->b = load_document(filename[1], parser[1], TRUE);
+  hash_document(&d->scratch, d->a);
+  hash_document(&d->scratch, d->b);
+  diff_nodes(d, 1, 1, 0);
+
+  if (d->count > 0) {
+    long dims[3];
+    ystring_t* out;
+    size_t i;
+    dims[0] = 2;
+    dims[1] = 4;
+    dims[2] = d->count/4;
+    out = ypush_q(dims);
+    for (i = 0; i < d->count; ++i) {
+      out[i] = d->change[i];
+      d->change[i] = NULL;
+    }
+  } else {
+    ypush_nil();
+  }
+}
+
+static yaml_node_t*
+get_node(document_t* doc, int id)
+{
+  return yaml_document_get_node(&doc->document, id);
+}
+
+/* Get the policy for duplicate keys from argument IARG. */
+static int
+get_dupkeys(int iarg)
+{
+  const char* str;
+  if (yarg_nil(iarg)) {
+    return YCORE_DUPKEYS_NONE;
+  }
+  str = ygets_q(iarg);
+  if (str != NULL) {
+    if (strcmp(str, "error") == 0) return YCORE_DUPKEYS_ERROR;
+    if (strcmp(str, "first") == 0) return YCORE_DUPKEYS_FIRST;
+    if (strcmp(str, "last") == 0) return YCORE_DUPKEYS_LAST;
+    if (strcmp(str, "collect") == 0) return YCORE_DUPKEYS_COLLECT;
+  }
+  y_error("DUPKEYS must be \"error\", \"first\", \"last\" or \"collect\"");
+  return -1;
+}
+
+/* Apply POLICY to the duplicate scalar keys of the mappings of document
+   DOC (see ycore_check_duplicates). */
+static void
+check_duplicates(document_t* doc, int policy)
+{
+  const char* errmsg = ycore_check_duplicates(doc, policy);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+}
+
+/* Yield the pairs of a mapping node with the merge keys ("<<") resolved
+   (see ycore_mapping_pairs). */
+static yaml_node_pair_t*
+mapping_pairs(document_t* doc, int id, long* count)
+{
+  yaml_node_pair_t* pairs;
+  const char* errmsg = ycore_mapping_pairs(doc, id, &pairs, count);
+  if (errmsg != NULL) {
+    y_error(errmsg);
+  }
+  return pairs;
+}
+
+/* Emit the events of a node of a document. */
+static void
+emit_node(emitter_t* dst, document_t* doc, int id, int depth)
+{
+  yaml_node_t* node = yaml_document_get_node(&doc->document, id);
+  yaml_event_t event;
+  const yaml_char_t* tag;
+  int implicit, status;
+  long i, n;
+
+  if (depth > YCORE_MAX_DEPTH) {
+    y_error("too many levels of nesting (recursive structure?)");
+  }
+  switch (node->type) {
+  case YAML_SCALAR_NODE:
+    tag = node->tag;
+    implicit = (tag == NULL ||
+                strcmp((const char*)tag, YAML_DEFAULT_SCALAR_TAG) == 0);
+    status = ycore_scalar_event_initialize(&event, NULL,
+                                           (implicit ? NULL : node->tag),
+                                           node->data.scalar.value,
+                                           node->data.scalar.length,
+                                           implicit, implicit,
+                                           node->data.scalar.style);
+    if (! status) {
+      y_error("failed to initialize SCALAR event");
+    }
+    emit_event(dst, &event);
+    break;
+  case YAML_SEQUENCE_NODE:
+    tag = node->tag;
+    implicit = (tag == NULL ||
+                strcmp((const char*)tag, YAML_DEFAULT_SEQUENCE_TAG) == 0);
+    status = yaml_sequence_start_event_initialize(&event, NULL,
+                                                  (implicit ? NULL : tag),
+                                                  implicit,
+                                                  node->data.sequence.style);
+    if (! status) {
+      y_error("failed to initialize SEQUENCE-START event");
+    }
+    emit_event(dst, &event);
+    n = node->data.sequence.items.top - node->data.sequence.items.start;
+    for (i = 0; i < n; ++i) {
+      /* The node may have moved. */
+      node = yaml_document_get_node(&doc->document, id);
+      emit_node(dst, doc, node->data.sequence.items.start[i], depth + 1);
+    }
+    if (! yaml_sequence_end_event_initialize(&event)) {
+      y_error("failed to initialize SEQUENCE-END event");
+    }
+    emit_event(dst, &event);
+    break;
+  case YAML_MAPPING_NODE:
+    tag = node->tag;
+    implicit = (tag == NULL ||
+                strcmp((const char*)tag, YAML_DEFAULT_MAPPING_TAG) == 0);
+    status = yaml_mapping_start_event_initialize(&event, NULL,
+                                                 (implicit ? NULL : tag),
+                                                 implicit,
+                                                 node->data.mapping.style);
+    if (! status) {
+      y_error("failed to initialize MAPPING-START event");
+    }
+    emit_event(dst, &event);
+    n = node->data.mapping.pairs.top - node->data.mapping.pairs.start;
+    for (i = 0; i < n; ++i) {
+      yaml_node_pair_t pair;
+      node = yaml_document_get_node(&doc->document, id);
+      pair = node->data.mapping.pairs.start[i];
+      emit_node(dst, doc, pair.key, depth + 1);
+      emit_node(dst, doc, pair.value, depth + 1);
+    }
+    if (! yaml_mapping_end_event_initialize(&event)) {
+      y_error("failed to initialize MAPPING-END event");
+    }
+    emit_event(dst, &event);
+    break;
+  default:
+    y_error("unexpected node type");
+  }
+}
+
+/* Emit a document (without the surrounding STREAM events). */
+static void
+emit_document(emitter_t* dst, document_t* doc)
+{
+  yaml_event_t event;
+  if (! yaml_document_start_event_initialize(&event, NULL, NULL, NULL, 1)) {
+    y_error("failed to initialize DOCUMENT-START event");
+  }
+  emit_event(dst, &event);
+  emit_node(dst, doc, doc->root, 0);
+  if (! yaml_document_end_event_initialize(&event, 1)) {
+    y_error("failed to initialize DOCUMENT-END event");
+  }
+  emit_event(dst, &event);
+}
+
+/* Get the node given by the optional second argument (the root node by
+   default) of the document given by the first argument. */
+static yaml_node_t*
+get_node_arg(int argc, document_t** docptr)
+{
+  document_t* doc;
+  yaml_node_t* node;
+  long id;
+  if (argc < 1 || argc > 2) {
+    y_error("expecting one or two arguments");
+  }
+  doc = (document_t*)yget_obj(argc - 1, &document_type);
+  id = (argc < 2 || yarg_nil(argc - 2) ? doc->root : ygets_l(argc - 2));
+  node = (id >= 1 && id <= doc->nnodes ?
+          yaml_document_get_node(&doc->document, (int)id) : NULL);
+  if (node == NULL) {
+    y_error("invalid node identifier");
+  }
+  if (docptr != NULL) {
+    *docptr = doc;
+  }
+  return node;
+}
+
+void
+Y__yaml_node_kind(int argc)
+{
+  ypush_int(get_node_arg(argc, NULL)->type);
+}
+
+void
+Y__yaml_node(int argc)
+{
+  document_t* doc;
+  yaml_node_t* node = get_node_arg(argc, &doc);
+  long i, n, dims[2];
+  int scalars = TRUE;
+
+  if (node->type == YAML_SCALAR_NODE) {
+    ypush_q(NULL)[0] = scalar_string(node->data.scalar.value,
+                                     node->data.scalar.length,
+                                     node->data.scalar.style);
+  } else if (node->type == YAML_SEQUENCE_NODE) {
+    yaml_node_item_t* item = node->data.sequence.items.start;
+    n = node->data.sequence.items.top - item;
+    if (n < 1) {
+      ypush_nil();
+      return;
+    }
+    for (i = 0; scalars && i < n; ++i) {
+      scalars = (yaml_document_get_node(&doc->document, item[i])->type ==
+                 YAML_SCALAR_NODE);
+    }
+    dims[0] = 1;
+    dims[1] = n;
+    if (scalars) {
+      ystring_t* out = ypush_q(dims);
+      for (i = 0; i < n; ++i) {
+        yaml_node_t* elem = yaml_document_get_node(&doc->document, item[i]);
+        out[i] = scalar_string(elem->data.scalar.value,
+                               elem->data.scalar.length,
+                               elem->data.scalar.style);
+      }
+    } else {
+      long* out = ypush_l(dims);
+      for (i = 0; i < n; ++i) {
+        out[i] = item[i];
+      }
+    }
+  } else {
+    yaml_node_pair_t* pair = mapping_pairs(doc, (int)(node -
+                                           doc->document.nodes.start) + 1,
+                                           &n);
+    if (n < 1) {
+      ypush_nil();
+      return;
+    }
+    dims[0] = 1;
+    dims[1] = n;
+    {
+      long* out = ypush_l(dims);
+      for (i = 0; i < n; ++i) {
+        out[i] = pair[i].value;
+      }
+    }
+  }
+}
+
+void
+Y__yaml_node_keys(int argc)
+{
+  document_t* doc;
+  yaml_node_t* node = get_node_arg(argc, &doc);
+  yaml_node_pair_t* pair;
+  ystring_t* out;
+  long i, n, dims[2];
+
+  if (node->type != YAML_MAPPING_NODE) {
+    y_error("not a mapping node");
+  }
+  pair = mapping_pairs(doc, (int)(node - doc->document.nodes.start) + 1,
+                       &n);
+  for (i = 0; i < n; ++i) {
+    if (yaml_document_get_node(&doc->document, pair[i].key)->type !=
+        YAML_SCALAR_NODE) {
+      y_error("non-scalar mapping key");
+    }
+  }
+  if (n < 1) {
+    ypush_nil();
+    return;
+  }
+  dims[0] = 1;
+  dims[1] = n;
+  out = ypush_q(dims);
+  for (i = 0; i < n; ++i) {
+    yaml_node_t* key = yaml_document_get_node(&doc->document, pair[i].key);
+    out[i] = scalar_string(key->data.scalar.value, key->data.scalar.length,
+                           key->data.scalar.style);
+  }
+}
+
+static void build_document(document_t* doc);
+
+void
+Y__yaml_load(int argc)
+{
+  const char* filename;
+  parser_t* parser;
+  document_t* doc;
+  long ref = -1;
+  int iarg, src = -1, out = -1, mapping = FALSE;
+  int dupkeys = YCORE_DUPKEYS_NONE;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      if (src < 0) {
+        src = iarg;
+      } else if (out < 0) {
+        out = iarg;
+      } else {
+        y_error("expecting one or two arguments");
+      }
+    } else if (index == dupkeys_index) {
+      dupkeys = get_dupkeys(--iarg);
+    } else if (index == mapping_index) {
+      mapping = yarg_true(--iarg);
+    } else {
+      y_error("unknown keyword");
+    }
+  }
+  if (src < 0 || (out >= 0) != mapping) {
+    y_error(mapping ? "expecting a source and an output variable" :
+            "expecting exactly one argument");
+  }
+  if (mapping) {
+    ref = yget_ref(out);
+    if (ref < 0) {
+      y_error("expecting a simple variable reference for the value");
+    }
+  }
+  get_document_source(src, &filename, &parser);
+  doc = load_document(filename, parser, FALSE);
+  if (doc == NULL) {
+    if (mapping) {
+      ypush_int(FALSE);
+    } else {
+      ypush_nil();
+    }
+    return;
+  }
+  check_duplicates(doc, dupkeys);
+  if (mapping) {
+    if (get_node(doc, doc->root)->type == YAML_SCALAR_NODE) {
+      y_error("unexpected event: doc should be composed of mapping or "
+              "sequence only");
+    }
+    build_document(doc);
+    yput_global(ref, 0);
+    ypush_int(TRUE);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* ORDERED MAPPINGS */
+
+/*
+ * A mapping object stores its entries in insertion order in compact arrays
+ * and indexes them with an open-addressing hash table (linear probing) so
+ * that the look-up of a key takes constant time whatever the number of
+ * entries.  The values are references to Yorick objects.  With MAP a
+ * mapping:
+ *
+ *   MAP(KEY)       yields the value of KEY (nil if there is no such key);
+ *   MAP(I)         yields the value of the I-th entry;
+ *   MAP()          yields the keys in order;
+ *   MAP, KEY, VAL; sets (or adds) the value of KEY;
+ *   MAP.KEY        yields the value of KEY (nil if there is no such key).
+ */
+
+static void    free_mapping(void* ptr);
+static void   print_mapping(void* ptr);
+static void    eval_mapping(void* ptr, int argc);
+static void extract_mapping(void* ptr, char* name);
+
+static y_userobj_t mapping_type = {
+  /* type_name:  */   "yaml_mapping",
+  /* on_free:    */    free_mapping,
+  /* on_print:   */   print_mapping,
+  /* on_eval:    */    eval_mapping,
+  /* on_extract: */ extract_mapping,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _mapping_t mapping_t;
+struct _mapping_t {
+  char** keys; /* keys in insertion order */
+  size_t* lens; /* lengths of the keys */
+  uint64_t* hashes; /* hash values of the keys */
+  void** values; /* references to the values (NULL for nil) */
+  size_t count; /* number of entries */
+  size_t size; /* number of allocated entries */
+  size_t* table; /* hash table (entry index + 1, 0 for an empty slot) */
+  size_t mask; /* number of slots in the hash table minus one */
+};
+
+static void free_mapping(void* ptr)
+{
+  mapping_t* obj = (mapping_t*)ptr;
+  size_t i;
+  for (i = 0; i < obj->count; ++i) {
+    free(obj->keys[i]);
+    if (obj->values[i] != NULL) {
+      ydrop_use(obj->values[i]);
+    }
+  }
+  free(obj->keys);
+  free(obj->lens);
+  free(obj->hashes);
+  free(obj->values);
+  free(obj->table);
+}
+
+static void print_mapping(void* ptr)
+{
+  mapping_t* obj = (mapping_t*)ptr;
+  char buf[64];
+  sprintf(buf, "YAML mapping with %lu entr%s", (unsigned long)obj->count,
+          (obj->count == 1 ? "y" : "ies"));
+  y_print(buf, 1);
+}
+
+/* Find the index of key KEY of LEN bytes and hash value HASH in mapping
+   OBJ, -1 if not found.  *SLOT is set with the slot of the key or the
+   empty slot where to insert it. */
+static long
+find_mapping_key(const mapping_t* obj, const char* key, size_t len,
+                 uint64_t hash, size_t* slot)
+{
+  size_t i;
+  if (obj->table == NULL) {
+    return -1;
+  }
+  for (i = hash & obj->mask; obj->table[i] != 0; i = (i + 1) & obj->mask) {
+    size_t j = obj->table[i] - 1;
+    if (obj->hashes[j] == hash && obj->lens[j] == len &&
+        memcmp(obj->keys[j], key, len) == 0) {
+      *slot = i;
+      return j;
+    }
+  }
+  *slot = i;
+  return -1;
+}
+
+/* Rebuild the hash table of mapping OBJ with at least twice as many slots
+   as entries. */
+static void
+rehash_mapping(mapping_t* obj, size_t n)
+{
+  size_t i, mask = 15;
+  size_t* table;
+  while (mask + 1 < 2*n) {
+    mask = 2*mask + 1;
+  }
+  table = (size_t*)calloc(mask + 1, sizeof(size_t));
+  if (table == NULL) {
+    y_error("insufficient memory");
+  }
+  for (i = 0; i < obj->count; ++i) {
+    size_t k = obj->hashes[i] & mask;
+    while (table[k] != 0) {
+      k = (k + 1) & mask;
+    }
+    table[k] = i + 1;
+  }
+  free(obj->table);
+  obj->table = table;
+  obj->mask = mask;
+}
+
+/* Make room for SIZE entries in mapping OBJ.  Returns false on error. */
+static int
+grow_mapping(mapping_t* obj, size_t size)
+{
+  void* ptr;
+  if (size <= obj->size) {
+    return TRUE;
+  }
+#define GROW(memb, type)                                        \
+  ptr = realloc(obj->memb, size*sizeof(type));                  \
+  if (ptr == NULL) {                                            \
+    return FALSE;                                               \
+  }                                                             \
+  obj->memb = (type*)ptr
+  GROW(keys, char*);
+  GROW(lens, size_t);
+  GROW(hashes, uint64_t);
+  GROW(values, void*);
+#undef GROW
+  obj->size = size;
+  return TRUE;
+}
+
+/* Set the value of key KEY of LEN bytes in mapping OBJ to VALUE (a
+   reference which is stolen by the mapping, NULL for nil). */
+static void
+set_mapping(mapping_t* obj, const char* key, size_t len, void* value)
+{
+  uint64_t hash = ycore_hash_bytes(YCORE_HASH_SEED, key, len);
+  size_t slot, n = obj->count;
+  long j = find_mapping_key(obj, key, len, hash, &slot);
+  char* copy;
+  if (j >= 0) {
+    /* Replace the value, the entry keeps its position. */
+    if (obj->values[j] != NULL) {
+      ydrop_use(obj->values[j]);
+    }
+    obj->values[j] = value;
+    return;
+  }
+  if (n + 1 > obj->size) {
+    size_t size = (obj->size < 8 ? 8 : 2*obj->size);
+    if (! grow_mapping(obj, size)) {
+      if (value != NULL) {
+        ydrop_use(value);
+      }
+      y_error("insufficient memory");
+    }
+  }
+  copy = (char*)malloc(len + 1);
+  if (copy == NULL) {
+    if (value != NULL) {
+      ydrop_use(value);
+    }
+    y_error("insufficient memory");
+  }
+  memcpy(copy, key, len);
+  copy[len] = '\0';
+  obj->keys[n] = copy;
+  obj->lens[n] = len;
+  obj->hashes[n] = hash;
+  obj->values[n] = value;
+  obj->count = n + 1;
+  if (obj->table == NULL || 2*obj->count > obj->mask + 1) {
+    rehash_mapping(obj, obj->count);
+  } else {
+    obj->table[slot] = obj->count;
+  }
+}
+
+/* Push the value of key KEY in mapping OBJ, nil if there is no such key. */
+static void
+push_mapping_value(const mapping_t* obj, const char* key)
+{
+  size_t len = strlen(key), slot;
+  long j = find_mapping_key(obj, key, len,
+                            ycore_hash_bytes(YCORE_HASH_SEED, key, len),
+                            &slot);
+  if (j < 0 || obj->values[j] == NULL) {
+    ypush_nil();
+  } else {
+    ykeep_use(obj->values[j]);
+  }
+}
+
+static void eval_mapping(void* ptr, int argc)
+{
+  mapping_t* obj = (mapping_t*)ptr;
+  if (argc == 1) {
+    if (yarg_nil(0)) {
+      /* Yield the keys in order. */
+      long dims[2];
+      ystring_t* out;
+      size_t i;
+      if (obj->count < 1) {
+        ypush_nil();
+        return;
+      }
+      dims[0] = 1;
+      dims[1] = obj->count;
+      out = ypush_q(dims);
+      for (i = 0; i < obj->count; ++i) {
+        out[i] = new_string(obj->keys[i], obj->lens[i]);
+      }
+    } else if (yarg_string(0) == 1) {
+      const char* key = ygets_q(0);
+      push_mapping_value(obj, (key != NULL ? key : ""));
+    } else if (yarg_number(0) == 1 && yarg_rank(0) == 0) {
+      long i = ygets_l(0);
+      if (i < 1 || i > obj->count) {
+        y_error("out of range entry index");
+      }
+      if (obj->values[i - 1] == NULL) {
+        ypush_nil();
+      } else {
+        ykeep_use(obj->values[i - 1]);
+      }
+    } else {
+      y_error("expecting a key or an entry index");
+    }
+  } else if (argc == 2) {
+    const char* key = ygets_q(1);
+    void* value = (yarg_nil(0) ? NULL : yget_use(0));
+    if (key == NULL) {
+      key = "";
+    }
+    set_mapping(obj, key, strlen(key), value);
+    ypush_nil();
+  } else {
+    y_error("expecting one or two arguments");
+  }
+}
+
+static void extract_mapping(void* ptr, char* name)
+{
+  push_mapping_value((mapping_t*)ptr, name);
+}
+
+void
+Y_yaml_mapping(int argc)
+{
+  mapping_t* obj;
+  int iarg;
+  if (argc == 1 && yarg_nil(0)) {
+    argc = 0;
+  }
+  if (argc%2 != 0) {
+    y_error("expecting pairs of keys and values");
+  }
+  obj = (mapping_t*)ypush_obj(&mapping_type, sizeof(mapping_t));
+  if (argc > 0) {
+    if (! grow_mapping(obj, argc/2)) {
+      y_error("insufficient memory");
+    }
+    rehash_mapping(obj, argc/2);
+  }
+  for (iarg = argc; iarg > 0; iarg -= 2) {
+    /* The arguments are shifted by one because of the result. */
+    const char* key = ygets_q(iarg);
+    void* value = (yarg_nil(iarg - 1) ? NULL : yget_use(iarg - 1));
+    if (key == NULL) {
+      key = "";
+    }
+    set_mapping(obj, key, strlen(key), value);
+  }
+}
+
+/*
+ * In mapping mode, yaml_load and yaml_merge build the Yorick value of a
+ * document in C: a scalar is a string, a sequence of scalars is an array
+ * of strings (nil if empty), any other sequence is an ordered mapping with
+ * keys "1", "2", etc. (so that VAL(I) yields its I-th item as for an
+ * object) and a mapping is an ordered mapping.  The values of the nodes
+ * are memorized so that the aliases of a node share its value.
+ */
+
+static void    free_build(void* ptr);
+static void   print_build(void* ptr);
+
+static y_userobj_t build_type = {
+  /* type_name:  */   "yaml_build",
+  /* on_free:    */    free_build,
+  /* on_print:   */   print_build,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _build_t build_t;
+struct _build_t {
+  void** value; /* references to the values of the nodes (NULL if none) */
+  long count; /* number of nodes */
+};
+
+static void free_build(void* ptr)
+{
+  build_t* obj = (build_t*)ptr;
+  long i;
+  if (obj->value != NULL) {
+    for (i = 0; i < obj->count; ++i) {
+      if (obj->value[i] != NULL) {
+        ydrop_use(obj->value[i]);
+      }
+    }
+    free(obj->value);
+  }
+}
+
+static void print_build(void* ptr)
+{
+  y_print("YAML build", 1);
+}
+
+/* Pop the top of the stack and yield a reference to it (NULL for nil). */
+static void*
+pop_use(void)
+{
+  void* value = (yarg_nil(0) ? NULL : yget_use(0));
+  yarg_drop(1);
+  return value;
+}
+
+/* Push the value of node ID of document DOC. */
+static void
+push_node_value(build_t* b, document_t* doc, int id, int depth)
+{
+  yaml_node_t* node = get_node(doc, id);
+  yaml_node_t* elem;
+  mapping_t* obj;
+  long i, n, dims[2];
+  int scalars = TRUE;
+  char key[32];
+
+  if (b->value[id - 1] != NULL) {
+    ykeep_use(b->value[id - 1]);
+    return;
+  }
+  if (depth > YCORE_MAX_DEPTH) {
+    y_error("too many levels of nesting (recursive structure?)");
+  }
+  if (node->type == YAML_SCALAR_NODE) {
+    ypush_q(NULL)[0] = scalar_string(node->data.scalar.value,
+                                     node->data.scalar.length,
+                                     node->data.scalar.style);
+  } else if (node->type == YAML_SEQUENCE_NODE) {
+    yaml_node_item_t* item = node->data.sequence.items.start;
+    n = node->data.sequence.items.top - item;
+    if (n < 1) {
+      ypush_nil();
+      return;
+    }
+    for (i = 0; scalars && i < n; ++i) {
+      scalars = (get_node(doc, item[i])->type == YAML_SCALAR_NODE);
+    }
+    if (scalars) {
+      ystring_t* out;
+      dims[0] = 1;
+      dims[1] = n;
+      out = ypush_q(dims);
+      for (i = 0; i < n; ++i) {
+        elem = get_node(doc, item[i]);
+        out[i] = scalar_string(elem->data.scalar.value,
+                               elem->data.scalar.length,
+                               elem->data.scalar.style);
+      }
+    } else {
+      obj = (mapping_t*)ypush_obj(&mapping_type, sizeof(mapping_t));
+      if (! grow_mapping(obj, n)) {
+        y_error("insufficient memory");
+      }
+      rehash_mapping(obj, n);
+      for (i = 0; i < n; ++i) {
+        push_node_value(b, doc, item[i], depth + 1);
+        set_mapping(obj, key, sprintf(key, "%ld", i + 1), pop_use());
+      }
+    }
+  } else {
+    yaml_node_pair_t* pair = mapping_pairs(doc, id, &n);
+    obj = (mapping_t*)ypush_obj(&mapping_type, sizeof(mapping_t));
+    if (n > 0) {
+      if (! grow_mapping(obj, n)) {
+        y_error("insufficient memory");
+      }
+      rehash_mapping(obj, n);
+    }
+    for (i = 0; i < n; ++i) {
+      elem = get_node(doc, pair[i].key);
+      if (elem->type != YAML_SCALAR_NODE) {
+        y_error("non-scalar mapping key");
+      }
+      check_scalar(elem->data.scalar.value, elem->data.scalar.length,
+                   elem->data.scalar.style);
+      push_node_value(b, doc, pair[i].value, depth + 1);
+      set_mapping(obj, (const char*)elem->data.scalar.value,
+                  elem->data.scalar.length, pop_use());
+    }
+  }
+  b->value[id - 1] = yget_use(0);
+}
+
+/* Replace document DOC, on top of the stack, by its value in mapping
+   mode. */
+static void
+build_document(document_t* doc)
+{
+  build_t* b = (build_t*)ypush_obj(&build_type, sizeof(build_t));
+  b->value = (void**)calloc(doc->nnodes, sizeof(void*));
+  if (b->value == NULL) {
+    y_error("insufficient memory");
+  }
+  b->count = doc->nnodes;
+  push_node_value(b, doc, doc->root, 0);
+  yarg_swap(0, 2);
+  yarg_drop(2);
+}
+
+/*---------------------------------------------------------------------------*/
+/* MERGING OF LAYERS */
+
+static void    free_merge(void* ptr);
+static void   print_merge(void* ptr);
+
+static y_userobj_t merge_type = {
+  /* type_name:  */   "yaml_merge",
+  /* on_free:    */    free_merge,
+  /* on_print:   */   print_merge,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _merge_t merge_t;
+struct _merge_t {
+  int* table; /* stack of hash tables of keys */
+  size_t ntable, maxtable;
+  int* copied; /* identifiers in the result of the copied nodes of a layer */
+  size_t maxcopied;
+  int* refs; /* number of references to the nodes of the result */
+  size_t maxrefs;
+  int deep; /* merge mappings recursively? */
+  int append; /* append items of sequences? */
+  int delete; /* a null value deletes the key? */
+};
+
+static void free_merge(void* ptr)
+{
+  merge_t* m = (merge_t*)ptr;
+  free(m->table);
+  free(m->copied);
+  free(m->refs);
+}
+
+static void print_merge(void* ptr)
+{
+  y_print("YAML merge", 1);
+}
+
+/* Copy a node of layer SRC into the result DST, returns its identifier in
+   DST.  The merge keys of the mappings are resolved.  A node of SRC is
+   copied once: its aliases share the copy, which is only memorized once
+   complete so that recursive structures still hit the nesting limit. */
+static int
+copy_node(merge_t* m, document_t* dst, document_t* src, int id, int depth)
+{
+  yaml_node_t* node = get_node(src, id);
+  yaml_node_pair_t* pairs;
+  long i, n;
+  int res, key, val;
+
+  if (m->copied[id - 1] != 0) {
+    res = m->copied[id - 1];
+    ++m->refs[res - 1];
+    return res;
+  }
+  if (depth > YCORE_MAX_DEPTH) {
+    y_error("too many levels of nesting (recursive structure?)");
+  }
+  switch (node->type) {
+  case YAML_SCALAR_NODE:
+    res = ycore_document_add_scalar(&dst->document, node->tag,
+                                    node->data.scalar.value,
+                                    node->data.scalar.length,
+                                    node->data.scalar.style);
+    break;
+  case YAML_SEQUENCE_NODE:
+    res = yaml_document_add_sequence(&dst->document, node->tag,
+                                     node->data.sequence.style);
+    n = node->data.sequence.items.top - node->data.sequence.items.start;
+    for (i = 0; res != 0 && i < n; ++i) {
+      val = copy_node(m, dst, src,
+                      get_node(src, id)->data.sequence.items.start[i],
+                      depth + 1);
+      if (! yaml_document_append_sequence_item(&dst->document, res, val)) {
+        res = 0;
+      }
+    }
+    break;
+  case YAML_MAPPING_NODE:
+    res = yaml_document_add_mapping(&dst->document, node->tag,
+                                    node->data.mapping.style);
+    pairs = mapping_pairs(src, id, &n);
+    for (i = 0; res != 0 && i < n; ++i) {
+      key = copy_node(m, dst, src, pairs[i].key, depth + 1);
+      val = copy_node(m, dst, src, pairs[i].value, depth + 1);
+      if (! yaml_document_append_mapping_pair(&dst->document, res,
+                                              key, val)) {
+        res = 0;
+      }
+    }
+    break;
+  default:
+    res = 0;
+  }
+  if (res == 0) {
+    y_error("failed to copy node");
+  }
+  dst->nnodes = dst->document.nodes.top - dst->document.nodes.start;
+  grow_array((void**)&m->refs, &m->maxrefs, dst->nnodes, sizeof(int));
+  m->refs[res - 1] = 1;
+  m->copied[id - 1] = res;
+  return res;
+}
+
+/* Yield a node of the result R which can be modified in place of
+   collection ID: ID itself if it is referenced once, a shallow copy
+   otherwise.  The counts of references may be overestimated (replaced
+   nodes are not released), which only costs extra copies. */
+static int
+own_node(merge_t* m, document_t* r, int id)
+{
+  yaml_node_t* node = get_node(r, id);
+  long i, n;
+  int res, item, ok = TRUE;
+
+  if (m->refs[id - 1] <= 1) {
+    return id;
+  }
+  if (node->type == YAML_MAPPING_NODE) {
+    res = yaml_document_add_mapping(&r->document, node->tag,
+                                    node->data.mapping.style);
+    node = get_node(r, id);
+    n = node->data.mapping.pairs.top - node->data.mapping.pairs.start;
+    for (i = 0; ok && res != 0 && i < n; ++i) {
+      yaml_node_pair_t pair = get_node(r, id)->data.mapping.pairs.start[i];
+      ok = yaml_document_append_mapping_pair(&r->document, res,
+                                             pair.key, pair.value);
+      ++m->refs[pair.key - 1];
+      ++m->refs[pair.value - 1];
+    }
+  } else {
+    res = yaml_document_add_sequence(&r->document, node->tag,
+                                     node->data.sequence.style);
+    node = get_node(r, id);
+    n = node->data.sequence.items.top - node->data.sequence.items.start;
+    for (i = 0; ok && res != 0 && i < n; ++i) {
+      item = get_node(r, id)->data.sequence.items.start[i];
+      ok = yaml_document_append_sequence_item(&r->document, res, item);
+      ++m->refs[item - 1];
+    }
+  }
+  if (res == 0 || ! ok) {
+    y_error("insufficient memory");
+  }
+  r->nnodes = r->document.nodes.top - r->document.nodes.start;
+  grow_array((void**)&m->refs, &m->maxrefs, r->nnodes, sizeof(int));
+  m->refs[res - 1] = 1;
+  --m->refs[id - 1];
+  return res;
+}
+
+static int
+is_null_node(const yaml_node_t* node)
+{
+  const yaml_char_t* tag;
+  char buf[128];
+  return (node->type == YAML_SCALAR_NODE &&
+          ycore_resolve_node(node, buf, sizeof(buf), &tag) ==
+          YCORE_HASH_NULL);
+}
+
+/* Find scalar key KEY in the hash table at BASE of size MASK + 1 for the
+   pairs of node ID of document R.  Returns the slot of the key (where the
+   pair index plus one is stored, 0 if not found). */
+static size_t
+find_key(merge_t* m, size_t base, size_t mask, document_t* r, int id,
+         const yaml_node_t* key)
+{
+  size_t h = ycore_key_hash(key) & mask;
+  int k;
+  while ((k = m->table[base + h]) != 0) {
+    yaml_node_pair_t* pair = &get_node(r, id)->data.mapping.pairs.start[k - 1];
+    if (ycore_same_key(get_node(r, pair->key), key)) {
+      break;
+    }
+    h = (h + 1) & mask;
+  }
+  return base + h;
+}
+
+static int merge_nodes(merge_t* m, document_t* r, int rid,
+                       document_t* l, int lid, int depth);
+
+/* Merge mapping LID of layer L, with its merge keys resolved, into mapping
+   RID of the result R. */
+static void
+merge_mappings(merge_t* m, document_t* r, int rid, document_t* l, int lid,
+               int depth)
+{
+  yaml_node_t* rn = get_node(r, rid);
+  yaml_node_pair_t* pairs;
+  yaml_node_pair_t* lpairs;
+  long n = rn->data.mapping.pairs.top - rn->data.mapping.pairs.start;
+  long nl, i, j;
+  size_t base = m->ntable, mask, slot;
+  int deleted = FALSE;
+
+  lpairs = mapping_pairs(l, lid, &nl);
+  for (mask = 15; mask + 1 < 2*(size_t)(n + nl); mask = 2*mask + 1)
+    ;
+  grow_array((void**)&m->table, &m->maxtable, base + mask + 1, sizeof(int));
+  memset(m->table + base, 0, (mask + 1)*sizeof(int));
+  m->ntable = base + mask + 1;
+  for (i = 0; i < n; ++i) {
+    yaml_node_t* key = get_node(r, rn->data.mapping.pairs.start[i].key);
+    if (key->type == YAML_SCALAR_NODE) {
+      /* Last occurrence of a duplicate key wins. */
+      m->table[find_key(m, base, mask, r, rid, key)] = i + 1;
+    }
+  }
+
+  for (j = 0; j < nl; ++j) {
+    yaml_node_pair_t lpair = lpairs[j];
+    yaml_node_t* lkey = get_node(l, lpair.key);
+    int k = 0, val;
+    slot = 0;
+    if (lkey->type == YAML_SCALAR_NODE) {
+      slot = find_key(m, base, mask, r, rid, lkey);
+      k = m->table[slot];
+      if (k != 0 &&
+          get_node(r, rid)->data.mapping.pairs.start[k - 1].value == 0) {
+        k = 0; /* deleted pair */
+      }
+    }
+    if (m->delete && is_null_node(get_node(l, lpair.value))) {
+      if (k != 0) {
+        get_node(r, rid)->data.mapping.pairs.start[k - 1].value = 0;
+        deleted = TRUE;
+      }
+      continue;
+    }
+    if (k != 0) {
+      val = merge_nodes(m, r,
+                        get_node(r, rid)->data.mapping.pairs.start[k - 1].value,
+                        l, lpair.value, depth + 1);
+      get_node(r, rid)->data.mapping.pairs.start[k - 1].value = val;
+    } else {
+      int key = copy_node(m, r, l, lpair.key, depth + 1);
+      val = copy_node(m, r, l, lpair.value, depth + 1);
+      if (! yaml_document_append_mapping_pair(&r->document, rid, key, val)) {
+        y_error("insufficient memory");
+      }
+      if (slot != 0) {
+        rn = get_node(r, rid);
+        m->table[slot] = (rn->data.mapping.pairs.top -
+                          rn->data.mapping.pairs.start);
+      }
+    }
+  }
+
+  if (deleted) {
+    /* Remove deleted pairs. */
+    rn = get_node(r, rid);
+    pairs = rn->data.mapping.pairs.start;
+    n = rn->data.mapping.pairs.top - pairs;
+    for (i = j = 0; i < n; ++i) {
+      if (pairs[i].value != 0) {
+        pairs[j++] = pairs[i];
+      }
+    }
+    rn->data.mapping.pairs.top = pairs + j;
+  }
+  m->ntable = base;
+}
+
+/* Merge node LID of layer L into node RID of the result R, returns the
+   identifier of the merged node in R. */
+static int
+merge_nodes(merge_t* m, document_t* r, int rid, document_t* l, int lid,
+            int depth)
+{
+  yaml_node_type_t rtype = get_node(r, rid)->type;
+  yaml_node_type_t ltype = get_node(l, lid)->type;
+  if (depth > YCORE_MAX_DEPTH) {
+    y_error("too many levels of nesting (recursive structure?)");
+  }
+  if (m->deep && rtype == YAML_MAPPING_NODE && ltype == YAML_MAPPING_NODE) {
+    rid = own_node(m, r, rid);
+    merge_mappings(m, r, rid, l, lid, depth);
+    return rid;
+  }
+  if (m->append && rtype == YAML_SEQUENCE_NODE &&
+      ltype == YAML_SEQUENCE_NODE) {
+    long i, n = (get_node(l, lid)->data.sequence.items.top -
+                 get_node(l, lid)->data.sequence.items.start);
+    rid = own_node(m, r, rid);
+    for (i = 0; i < n; ++i) {
+      int item = copy_node(m, r, l,
+                           get_node(l, lid)->data.sequence.items.start[i],
+                           depth + 1);
+      if (! yaml_document_append_sequence_item(&r->document, rid, item)) {
+        y_error("insufficient memory");
+      }
+    }
+    return rid;
+  }
+  return copy_node(m, r, l, lid, depth);
+}
+
+void
+Y__yaml_merge(int argc)
+{
+  emitter_t* dst = NULL;
+  ystring_t* files = NULL;
+  merge_t* m;
+  document_t* r;
+  document_t* l;
+  long i, nfiles = 0;
+  int iarg, pos = 0, deep = TRUE, append = FALSE, delete = TRUE;
+  int mapping = FALSE, dupkeys = YCORE_DUPKEYS_NONE;
+
+  if (! initialized) {
+    initialize();
+  }
+  for (iarg = argc - 1; iarg >= 0; --iarg) {
+    long index = yarg_key(iarg);
+    if (index < 0) {
+      if (pos++ > 0) {
+        y_error("too many arguments");
+      }
+      files = ygeta_q(iarg, &nfiles, NULL);
+    } else if (index == deep_index) {
+      deep = yarg_true(--iarg);
+    } else if (index == append_index) {
+      append = yarg_true(--iarg);
+    } else if (index == delete_index) {
+      delete = yarg_true(--iarg);
+    } else if (index == mapping_index) {
+      mapping = yarg_true(--iarg);
+    } else if (index == dupkeys_index) {
+      dupkeys = get_dupkeys(--iarg);
+    } else if (index == emit_index) {
+      --iarg;
+      if (! yarg_nil(iarg)) {
+        dst = (emitter_t*)yget_obj(iarg, &emitter_type);
+      }
+    } else {
+      y_error("unknown keyword");
+    }
+  }
+  if (nfiles < 1) {
+    y_error("expecting at least one file");
+  }
+
+  m = (merge_t*)ypush_obj(&merge_type, sizeof(merge_t));
+  m->deep = deep;
+  m->append = append;
+  m->delete = delete;
+  r = (document_t*)ypush_obj(&document_type, sizeof(document_t));
+  if (! yaml_document_initialize(&r->document, NULL, NULL, NULL, 1, 1)) {
+    y_error("failed to initialize document");
+  }
+  r->init = TRUE;
+  for (i = 0; i < nfiles; ++i) {
+    if (files[i] == NULL) {
+      y_error("invalid file name");
+    }
+    l = load_document(files[i], NULL, TRUE);
+    check_duplicates(l, dupkeys);
+    grow_array((void**)&m->copied, &m->maxcopied, l->nnodes, sizeof(int));
+    memset(m->copied, 0, l->nnodes*sizeof(int));
+    if (i == 0) {
+      r->root = copy_node(m, r, l, l->root, 0);
+    } else {
+      r->root = merge_nodes(m, r, r->root, l, l->root, 0);
+    }
+    yarg_drop(2); /* drop layer document and its parser */
+  }
+  if (dst != NULL) {
+    emit_document(dst, r);
+    ypush_nil();
+  } else if (mapping) {
+    build_document(r);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* FLATTENED DOCUMENTS */
+
+/*
+ * yaml_flatten streams the events of a document and yields every leaf (a
+ * scalar or an empty collection) as a path, a kind and a value.  Aliases
+ * are expanded by replicating the leaves of the anchored node under the
+ * path of the alias.  yaml_unflatten does the converse.
+ */
+
+static void    free_flatten(void* ptr);
+static void   print_flatten(void* ptr);
+
+static y_userobj_t flatten_type = {
+  /* type_name:  */   "yaml_flatten",
+  /* on_free:    */    free_flatten,
+  /* on_print:   */   print_flatten,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _flevel_t flevel_t;
+struct _flevel_t {
+  int type; /* YAML_SEQUENCE_NODE or YAML_MAPPING_NODE */
+  int key; /* next node is a mapping key? */
+  long index; /* index of next item in a sequence */
+  size_t pathlen; /* length of the path of the collection */
+  long first; /* index of the first leaf of the collection */
+  char* anchor; /* anchor of the collection or NULL */
+};
+
+typedef struct _fanchor_t fanchor_t;
+struct _fanchor_t {
+  char* name; /* name of the anchor */
+  long first, last; /* range of leaves of the anchored node */
+  size_t pathlen; /* length of the path of the anchored node */
+};
+
+typedef struct _flatten_t flatten_t;
+struct _flatten_t {
+  ycore_hasher_t scratch; /* scratch buffer for path components */
+  char* path; /* path of the current node */
+  size_t pathlen, pathsize;
+  flevel_t* level; /* stack of collections */
+  size_t depth, maxdepth;
+  fanchor_t* anchor; /* anchored nodes */
+  size_t nanchors, maxanchors;
+  char* paths; /* paths of the leaves (null terminated) */
+  size_t pathsused, pathsmax;
+  char* texts; /* texts of the leaves (null terminated) */
+  size_t textsused, textsmax;
+  size_t* pathoff; /* offset of the path of each leaf */
+  size_t* textoff; /* offset of the text of each leaf */
+  int* kind; /* kind of each leaf */
+  size_t nleaves, maxleaves;
+};
+
+static void free_flatten(void* ptr)
+{
+  flatten_t* f = (flatten_t*)ptr;
+  size_t i;
+  ycore_hasher_destroy(&f->scratch);
+  free(f->path);
+  for (i = 0; i < f->depth; ++i) {
+    free(f->level[i].anchor);
+  }
+  free(f->level);
+  for (i = 0; i < f->nanchors; ++i) {
+    free(f->anchor[i].name);
+  }
+  free(f->anchor);
+  free(f->paths);
+  free(f->texts);
+  free(f->pathoff);
+  free(f->textoff);
+  free(f->kind);
+}
+
+static void print_flatten(void* ptr)
+{
+  y_print("YAML flattener", 1);
+}
+
+/* Append the contents of the scratch buffer to the current path. */
+static void
+flatten_push_path(flatten_t* f)
+{
+  ycore_hasher_t* h = &f->scratch;
+  grow_array((void**)&f->path, &f->pathsize, f->pathlen + h->length + 1, 1);
+  memcpy(f->path + f->pathlen, h->buffer, h->length);
+  f->pathlen += h->length;
+  f->path[f->pathlen] = '\0';
+}
+
+/* Append N bytes to an array of characters and a final null. */
+static size_t
+append_text(char** ptr, size_t* used, size_t* size, const void* text,
+            size_t n)
+{
+  size_t off = *used;
+  grow_array((void**)ptr, size, off + n + 1, 1);
+  if (n > 0) {
+    memcpy(*ptr + off, text, n);
+  }
+  (*ptr)[off + n] = '\0';
+  *used = off + n + 1;
+  return off;
+}
+
+/* Add a leaf with the current path.  The numerical values are converted
+   from the texts after the structural pass (see convert_leaves). */
+static void
+add_leaf(flatten_t* f, int kind, const char* text, size_t len)
+{
+  size_t n = f->nleaves + 1, size;
+  size = f->maxleaves;
+  grow_array((void**)&f->pathoff, &size, n, sizeof(size_t));
+  size = f->maxleaves;
+  grow_array((void**)&f->textoff, &size, n, sizeof(size_t));
+  size = f->maxleaves;
+  grow_array((void**)&f->kind, &size, n, sizeof(int));
+  f->maxleaves = size;
+  f->pathoff[f->nleaves] = append_text(&f->paths, &f->pathsused,
+                                       &f->pathsmax, f->path, f->pathlen);
+  f->textoff[f->nleaves] = append_text(&f->texts, &f->textsused,
+                                       &f->textsmax, text, len);
+  f->kind[f->nleaves] = kind;
+  f->nleaves = n;
+}
+
+static void
+add_flatten_anchor(flatten_t* f, const char* name, long first,
+                   size_t pathlen)
+{
+  fanchor_t* a;
+  grow_array((void**)&f->anchor, &f->maxanchors, f->nanchors + 1,
+             sizeof(fanchor_t));
+  a = &f->anchor[f->nanchors];
+  a->name = ycore_copy_string((const yaml_char_t*)name);
+  if (a->name == NULL) {
+    y_error("insufficient memory");
+  }
+  a->first = first;
+  a->last = f->nleaves;
+  a->pathlen = pathlen;
+  ++f->nanchors;
+}
+
+/* Called before a node which is not a mapping key. */
+static void
+begin_node(flatten_t* f)
+{
+  if (f->depth > 0 && f->level[f->depth - 1].type == YAML_SEQUENCE_NODE) {
+    flevel_t* lev = &f->level[f->depth - 1];
+    f->scratch.length = 0;
+    if (! buf_put_index(&f->scratch, lev->index++)) {
+      y_error("insufficient memory");
+    }
+    flatten_push_path(f);
+  }
+}
+
+/* Called after a node which is not a mapping key. */
+static void
+end_node(flatten_t* f)
+{
+  if (f->depth > 0) {
+    flevel_t* lev = &f->level[f->depth - 1];
+    f->pathlen = lev->pathlen;
+    f->path[f->pathlen] = '\0';
+    lev->key = TRUE;
+  }
+}
+
+/* Conversion pass of yaml_flatten. */
+typedef struct _convert_t convert_t;
+struct _convert_t {
+  const flatten_t* f;
+  double* value;
+};
+
+static void
+convert_leaves(void* data, size_t start, size_t stop)
+{
+  const convert_t* c = (const convert_t*)data;
+  const flatten_t* f = c->f;
+  size_t i;
+  for (i = start; i < stop; ++i) {
+    c->value[i] = ycore_leaf_number(f->kind[i], f->texts + f->textoff[i]);
+  }
+}
+
+static int
+leaf_kind(int kind)
+{
+  switch (kind) {
+  case YCORE_HASH_NULL:  return YCORE_NULL_VALUE;
+  case YCORE_HASH_BOOL:  return YCORE_BOOL_VALUE;
+  case YCORE_HASH_INT:   return YCORE_INT_VALUE;
+  case YCORE_HASH_FLOAT: return YCORE_FLOAT_VALUE;
+  default:         return YCORE_STRING_VALUE;
+  }
+}
+
+/* Process an event of the document, returns true when the document is
+   complete. */
+static int
+flatten_event(flatten_t* f, const yaml_event_t* ev)
+{
+  flevel_t* lev = (f->depth > 0 ? &f->level[f->depth - 1] : NULL);
+  long i, first;
+  size_t k;
+  int kind;
+
+  if (lev != NULL && lev->type == YAML_MAPPING_NODE && lev->key &&
+      ev->type != YAML_MAPPING_END_EVENT) {
+    /* Mapping key. */
+    if (ev->type != YAML_SCALAR_EVENT) {
+      y_error("only scalar mapping keys are supported");
+    }
+    f->scratch.length = 0;
+    if (! buf_put_key(&f->scratch, ev->data.scalar.value,
+                      ev->data.scalar.length)) {
+      y_error("insufficient memory");
+    }
+    flatten_push_path(f);
+    lev->key = FALSE;
+    return FALSE;
+  }
+  switch (ev->type) {
+  case YAML_STREAM_START_EVENT:
+  case YAML_DOCUMENT_START_EVENT:
+    return FALSE;
+  case YAML_DOCUMENT_END_EVENT:
+  case YAML_STREAM_END_EVENT:
+    return TRUE;
+  case YAML_SCALAR_EVENT:
+    check_scalar(ev->data.scalar.value, ev->data.scalar.length,
+                 ev->data.scalar.style);
+    begin_node(f);
+    /* Only resolve the type here (numbers have the same maximum length as
+       with the buffers of the other callers), numbers are converted
+       later. */
+    kind = ycore_resolve_scalar(ev->data.scalar.tag, ev->data.scalar.value,
+                                ev->data.scalar.length, ev->data.scalar.style,
+                                NULL, 128);
+    first = f->nleaves;
+    add_leaf(f, leaf_kind(kind), (const char*)ev->data.scalar.value,
+             ev->data.scalar.length);
+    if (ev->data.scalar.anchor != NULL) {
+      add_flatten_anchor(f, (const char*)ev->data.scalar.anchor, first,
+                         f->pathlen);
+    }
+    end_node(f);
+    return FALSE;
+  case YAML_ALIAS_EVENT:
+    begin_node(f);
+    for (k = f->nanchors; k > 0; --k) {
+      if (strcmp(f->anchor[k - 1].name,
+                 (const char*)ev->data.alias.anchor) == 0) {
+        break;
+      }
+    }
+    if (k == 0) {
+      y_error("undefined alias");
+    }
+    {
+      fanchor_t a = f->anchor[k - 1];
+      size_t len = f->pathlen;
+      for (i = a.first; i < a.last; ++i) {
+        /* Path of the replicated leaf is the path of the alias followed by
+           the path of the leaf relative to the anchored node. */
+        const char* suffix = f->paths + f->pathoff[i] + a.pathlen;
+        f->scratch.length = 0;
+        if (! ycore_buf_puts(&f->scratch, suffix)) {
+          y_error("insufficient memory");
+        }
+        flatten_push_path(f);
+        f->scratch.length = 0;
+        if (! ycore_buf_puts(&f->scratch, f->texts + f->textoff[i])) {
+          y_error("insufficient memory");
+        }
+        add_leaf(f, f->kind[i], f->scratch.buffer, f->scratch.length);
+        f->pathlen = len;
+        f->path[len] = '\0';
+      }
+    }
+    end_node(f);
+    return FALSE;
+  case YAML_SEQUENCE_START_EVENT:
+  case YAML_MAPPING_START_EVENT:
+    begin_node(f);
+    grow_array((void**)&f->level, &f->maxdepth, f->depth + 1,
+               sizeof(flevel_t));
+    lev = &f->level[f->depth++];
+    lev->type = (ev->type == YAML_SEQUENCE_START_EVENT ?
+                 YAML_SEQUENCE_NODE : YAML_MAPPING_NODE);
+    lev->key = TRUE;
+    lev->index = 0;
+    lev->pathlen = f->pathlen;
+    lev->first = f->nleaves;
+    lev->anchor = NULL;
+    {
+      const yaml_char_t* anchor = (ev->type == YAML_SEQUENCE_START_EVENT ?
+                                   ev->data.sequence_start.anchor :
+                                   ev->data.mapping_start.anchor);
+      if (anchor != NULL &&
+          (lev->anchor = ycore_copy_string(anchor)) == NULL) {
+        y_error("insufficient memory");
+      }
+    }
+    return FALSE;
+  case YAML_SEQUENCE_END_EVENT:
+  case YAML_MAPPING_END_EVENT:
+    if (lev == NULL) {
+      y_error("unbalanced events");
+    }
+    if (lev->first == (long)f->nleaves) {
+      if (lev->type == YAML_SEQUENCE_NODE) {
+        add_leaf(f, YCORE_EMPTY_SEQUENCE, "[]", 2);
+      } else {
+        add_leaf(f, YCORE_EMPTY_MAPPING, "{}", 2);
+      }
+    }
+    if (lev->anchor != NULL) {
+      add_flatten_anchor(f, lev->anchor, lev->first, lev->pathlen);
+      free(lev->anchor);
+      lev->anchor = NULL;
+    }
+    --f->depth;
+    end_node(f);
+    return FALSE;
+  default:
+    y_error("unexpected event");
+    return TRUE;
+  }
+}
+
+/* Store the top of the stack in the global variable of index REF (if any)
+   and drop it. */
+static void
+store_output(long ref)
+{
+  if (ref >= 0) {
+    yput_global(ref, 0);
+  }
+  yarg_drop(1);
+}
+
+void
+Y_yaml_flatten(int argc)
+{
+  const char* filename;
+  parser_t* parser;
+  flatten_t* f;
+  yaml_event_t event;
+  long ref[3], dims[2];
+  size_t i;
+  int j, done;
+
+  if (! initialized) {
+    initialize();
+  }
+  if (argc < 1 || argc > 4) {
+    y_error("expecting between one and four arguments");
+  }
+  for (j = 0; j < 3; ++j) {
+    ref[j] = -1;
+    if (argc >= j + 2) {
+      ref[j] = yget_ref(argc - 2 - j);
+      if (ref[j] < 0 && ! yarg_nil(argc - 2 - j)) {
+        y_error("expecting a simple variable reference for an output");
+      }
+    }
+  }
+  get_document_source(argc - 1, &filename, &parser);
+  if (filename != NULL) {
+    parser = open_parser(filename);
+  }
+  if (parser->parsing == YCORE_ANY) {
+    parser->parsing = YCORE_PARSE;
+  } else if (parser->parsing != YCORE_PARSE) {
+    y_error("not an event-based parser");
+  }
+
+  f = (flatten_t*)ypush_obj(&flatten_type, sizeof(flatten_t));
+  do {
+    if (! parse_event(parser, &event) &&
+        ! yaml_stream_end_event_initialize(&event)) {
+      y_error("failed to initialize STREAM-END event");
+    }
+    /* Copy the event in a local object so that it is deleted even if
+       flatten_event() throws an error. */
+    {
+      event_t* tmp = push_event();
+      tmp->event = event;
+      tmp->init = TRUE;
+      done = flatten_event(f, &tmp->event);
+      yarg_drop(1);
+    }
+  } while (! done);
+
+  dims[0] = 1;
+  dims[1] = f->nleaves;
+  if (ref[0] >= 0) {
+    long* kind = (f->nleaves > 0 ? ypush_l(dims) : NULL);
+    if (kind == NULL) {
+      ypush_nil();
+    }
+    for (i = 0; i < f->nleaves; ++i) {
+      kind[i] = f->kind[i];
+    }
+    store_output(ref[0]);
+  }
+  if (ref[1] >= 0) {
+    /* Conversion pass: the numbers are converted in parallel straight
+       into the output array.  This is the only parallel pass, the native
+       loader builds strings with the Yorick allocator which is not
+       thread-safe. */
+    convert_t c;
+    c.f = f;
+    c.value = (f->nleaves > 0 ? ypush_d(dims) : NULL);
+    if (c.value == NULL) {
+      ypush_nil();
+    }
+    ycore_parallel_for(f->nleaves, convert_leaves, &c);
+    store_output(ref[1]);
+  }
+  if (ref[2] >= 0) {
+    ystring_t* text = (f->nleaves > 0 ? ypush_q(dims) : NULL);
+    if (text == NULL) {
+      ypush_nil();
+    }
+    for (i = 0; i < f->nleaves; ++i) {
+      /* Texts are stored in order and null-terminated. */
+      size_t end = (i + 1 < f->nleaves ? f->textoff[i + 1] : f->textsused);
+      text[i] = new_string(f->texts + f->textoff[i],
+                           end - f->textoff[i] - 1);
+    }
+    store_output(ref[2]);
+  }
+  if (f->nleaves > 0) {
+    ystring_t* path = ypush_q(dims);
+    for (i = 0; i < f->nleaves; ++i) {
+      const char* str = f->paths + f->pathoff[i];
+      path[i] = p_strcpy(str[0] != '\0' ? str : ".");
+    }
+  } else {
+    ypush_nil();
+  }
+}
+
+static void    free_unflatten(void* ptr);
+static void   print_unflatten(void* ptr);
+
+static y_userobj_t unflatten_type = {
+  /* type_name:  */   "yaml_unflatten",
+  /* on_free:    */    free_unflatten,
+  /* on_print:   */   print_unflatten,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _uentry_t uentry_t;
+struct _uentry_t {
+  int parent; /* parent mapping */
+  int key; /* key node */
+  int child; /* value node */
+};
+
+typedef struct _unflatten_t unflatten_t;
+struct _unflatten_t {
+  ycore_hasher_t scratch; /* scratch buffer for decoded keys */
+  ycore_hasher_t key; /* key leading to the current node */
+  uentry_t* table; /* hash table of (mapping, key) -> value */
+  size_t mask, used;
+};
+
+static void free_unflatten(void* ptr)
+{
+  unflatten_t* u = (unflatten_t*)ptr;
+  ycore_hasher_destroy(&u->scratch);
+  ycore_hasher_destroy(&u->key);
+  free(u->table);
+}
+
+static void print_unflatten(void* ptr)
+{
+  y_print("YAML unflattener", 1);
+}
+
+static size_t
+entry_hash(int parent, const char* key, size_t len)
+{
+  return (size_t)ycore_hash_bytes(ycore_hash_mix(YCORE_HASH_SEED, parent),
+                                  key, len);
+}
+
+/* Find the slot of (PARENT, KEY) in the hash table. */
+static size_t
+find_entry(unflatten_t* u, document_t* r, int parent, const char* key,
+           size_t len)
+{
+  size_t h = entry_hash(parent, key, len) & u->mask;
+  uentry_t* e;
+  while ((e = &u->table[h])->parent != 0) {
+    if (e->parent == parent) {
+      yaml_node_t* k = get_node(r, e->key);
+      if (k->data.scalar.length == len &&
+          memcmp(k->data.scalar.value, key, len) == 0) {
+        break;
+      }
+    }
+    h = (h + 1) & u->mask;
+  }
+  return h;
+}
+
+static void
+grow_table(unflatten_t* u, document_t* r)
+{
+  uentry_t* old = u->table;
+  size_t i, n = (old == NULL ? 0 : u->mask + 1);
+  size_t size = (n < 64 ? 64 : 2*n);
+  u->table = (uentry_t*)calloc(size, sizeof(uentry_t));
+  if (u->table == NULL) {
+    u->table = old;
+    y_error("insufficient memory");
+  }
+  u->mask = size - 1;
+  for (i = 0; i < n; ++i) {
+    if (old[i].parent != 0) {
+      yaml_node_t* k = get_node(r, old[i].key);
+      size_t h = find_entry(u, r, old[i].parent,
+                            (const char*)k->data.scalar.value,
+                            k->data.scalar.length);
+      u->table[h] = old[i];
+    }
+  }
+  free(old);
+}
+
+/* Decode a string quoted by QUOTE (as written by ycore_buf_put_quoted) into
+   the scratch buffer of H.  P is just after the opening quote, the address
+   after the closing quote is returned. */
+static const char*
+decode_quoted(ycore_hasher_t* h, const char* p, int quote)
+{
+  h->length = 0;
+  while (*p != quote) {
+    char c = *p++;
+    if (c == '\0') {
+      y_error("unterminated quoted string");
+    }
+    if (c == '\\') {
+      c = *p++;
+      if (c == 'n') {
+        c = '\n';
+      } else if (c == 't') {
+        c = '\t';
+      } else if (c == 'x' && isxdigit((unsigned char)p[0]) &&
+                 isxdigit((unsigned char)p[1])) {
+        char hex[3];
+        hex[0] = p[0];
+        hex[1] = p[1];
+        hex[2] = '\0';
+        c = (char)strtol(hex, NULL, 16);
+        p += 2;
+      } else if (c != '"' && c != '\'' && c != '\\') {
+        y_error("bad escape sequence in quoted string");
+      }
+    }
+    if (! ycore_buf_put(h, &c, 1)) {
+      y_error("insufficient memory");
+    }
+  }
+  return p + 1;
+}
+
+/* Parse the next component of PATH at *POS.  Returns 0 at the end of the
+   path, YAML_MAPPING_NODE for a key (decoded in the scratch buffer) or
+   YAML_SEQUENCE_NODE for an index. */
+static int
+next_component(unflatten_t* u, const char* path, size_t* pos, long* index)
+{
+  const char* p = path + *pos;
+  ycore_hasher_t* h = &u->scratch;
+  h->length = 0;
+  if (*p == '\0') {
+    return 0;
+  }
+  if (*p == '.') {
+    size_t n = 0;
+    ++p;
+    while (p[n] != '\0' && p[n] != '.' && p[n] != '[') {
+      ++n;
+    }
+    if (n == 0) {
+      if (p[0] == '\0' && *pos == 0) {
+        *pos += 1; /* path of the root node */
+        return 0;
+      }
+      y_error("invalid path (empty key)");
+    }
+    if (! ycore_buf_put(h, p, n)) {
+      y_error("insufficient memory");
+    }
+    *pos = (p + n) - path;
+    return YAML_MAPPING_NODE;
+  }
+  if (p[0] == '[' && p[1] == '"') {
+    p = decode_quoted(h, p + 2, '"');
+    if (*p != ']') {
+      y_error("invalid path (missing bracket)");
+    }
+    *pos = (p + 1) - path;
+    return YAML_MAPPING_NODE;
+  }
+  if (p[0] == '[') {
+    char* end;
+    *index = strtol(p + 1, &end, 10);
+    if (end == p + 1 || *end != ']' || *index < 0) {
+      y_error("invalid path (bad index)");
+    }
+    *pos = (end + 1) - path;
+    return YAML_SEQUENCE_NODE;
+  }
+  y_error("invalid path");
+  return 0;
+}
+
+/* Add a new node to R: a collection of type TYPE or, if TYPE is 0, the
+   leaf of kind KIND and text TEXT. */
+static int
+new_node(document_t* r, int type, int kind, const char* text)
+{
+  char buf[128];
+  int id;
+  if (type == 0) {
+    if (kind == YCORE_EMPTY_SEQUENCE) {
+      type = YAML_SEQUENCE_NODE;
+    } else if (kind == YCORE_EMPTY_MAPPING) {
+      type = YAML_MAPPING_NODE;
+    }
+  }
+  if (type == YAML_SEQUENCE_NODE) {
+    id = yaml_document_add_sequence(&r->document, NULL,
+                                    YAML_ANY_SEQUENCE_STYLE);
+  } else if (type == YAML_MAPPING_NODE) {
+    id = yaml_document_add_mapping(&r->document, NULL,
+                                   YAML_ANY_MAPPING_STYLE);
+  } else {
+    yaml_scalar_style_t style = YAML_PLAIN_SCALAR_STYLE;
+    size_t len = strlen(text);
+    if (kind == YCORE_NULL_VALUE && len == 0) {
+      text = "null";
+      len = 4;
+    } else if (kind == YCORE_STRING_VALUE &&
+               ycore_resolve_scalar(NULL, (const yaml_char_t*)text, len,
+                                    YAML_PLAIN_SCALAR_STYLE, buf,
+                                    sizeof(buf)) != YCORE_HASH_STRING) {
+      /* Quote strings which would be taken for something else. */
+      style = YAML_DOUBLE_QUOTED_SCALAR_STYLE;
+    }
+    id = ycore_document_add_scalar(&r->document, NULL,
+                                   (yaml_char_t*)text, len, style);
+  }
+  if (id == 0) {
+    y_error("insufficient memory");
+  }
+  r->nnodes = r->document.nodes.top - r->document.nodes.start;
+  return id;
+}
+
+/* Add a null item to fill a gap in a sequence.  Such items have no
+   specific style so that they can be told apart from explicit nulls. */
+static int
+new_gap(document_t* r)
+{
+  int id = yaml_document_add_scalar(&r->document, NULL,
+                                    (yaml_char_t*)"null", 4,
+                                    YAML_ANY_SCALAR_STYLE);
+  if (id == 0) {
+    y_error("insufficient memory");
+  }
+  r->nnodes = r->document.nodes.top - r->document.nodes.start;
+  return id;
+}
+
+/* Insert the leaf of path PATH in document R. */
+static void
+insert_leaf(unflatten_t* u, document_t* r, const char* path, int kind,
+            const char* text)
+{
+  yaml_node_t* node;
+  size_t pos = 0, slot = 0;
+  long index = 0, n;
+  int type, cur, parent = 0, ptype = 0, gap = FALSE, k;
+
+  /* CUR is the current node (0 if not yet created), PARENT is its parent
+     and PTYPE the type of the component leading to it (SLOT is the entry
+     in the hash table for a mapping, INDEX the position in a sequence). */
+  cur = r->root;
+  while (TRUE) {
+    type = next_component(u, path, &pos, &index);
+    if (cur != 0 && ! gap) {
+      node = get_node(r, cur);
+      if (type == 0) {
+        y_error("duplicate path");
+      }
+      if (node->type != type) {
+        y_error("inconsistent paths");
+      }
+    } else {
+      cur = new_node(r, type, kind, text);
+      if (parent == 0) {
+        r->root = cur;
+      } else if (ptype == YAML_SEQUENCE_NODE) {
+        node = get_node(r, parent);
+        n = node->data.sequence.items.top - node->data.sequence.items.start;
+        if (index < n) {
+          /* Replace a gap. */
+          node->data.sequence.items.start[index] = cur;
+        } else if (! yaml_document_append_sequence_item(&r->document,
+                                                        parent, cur)) {
+          y_error("insufficient memory");
+        }
+      } else {
+        k = ycore_document_add_scalar(&r->document, NULL,
+                                      (yaml_char_t*)u->key.buffer,
+                                      u->key.length, YAML_ANY_SCALAR_STYLE);
+        if (k == 0 || ! yaml_document_append_mapping_pair(&r->document,
+                                                          parent, k, cur)) {
+          y_error("insufficient memory");
+        }
+        r->nnodes = r->document.nodes.top - r->document.nodes.start;
+        u->table[slot].parent = parent;
+        u->table[slot].key = k;
+        u->table[slot].child = cur;
+        ++u->used;
+      }
+      if (type == 0) {
+        return;
+      }
+    }
+
+    /* Move to the child given by the current component. */
+    parent = cur;
+    ptype = type;
+    gap = FALSE;
+    if (type == YAML_MAPPING_NODE) {
+      u->key.length = 0;
+      if (! ycore_buf_put(&u->key, u->scratch.buffer, u->scratch.length)) {
+        y_error("insufficient memory");
+      }
+      if (u->table == NULL || 2*(u->used + 1) > u->mask + 1) {
+        grow_table(u, r);
+      }
+      slot = find_entry(u, r, parent, u->key.buffer, u->key.length);
+      cur = u->table[slot].child;
+    } else {
+      node = get_node(r, parent);
+      n = node->data.sequence.items.top - node->data.sequence.items.start;
+      while (n < index) {
+        /* Fill the gap with nulls. */
+        k = new_gap(r);
+        if (! yaml_document_append_sequence_item(&r->document, parent, k)) {
+          y_error("insufficient memory");
+        }
+        ++n;
+      }
+      node = get_node(r, parent);
+      cur = (index < n ? node->data.sequence.items.start[index] : 0);
+      if (cur != 0) {
+        node = get_node(r, cur);
+        gap = (node->type == YAML_SCALAR_NODE &&
+               node->data.scalar.style == YAML_ANY_SCALAR_STYLE);
+      }
+    }
+  }
+}
+
+/* Format the numerical value VALUE of kind KIND in BUF. */
+static const char*
+format_leaf(char* buf, int kind, double value)
+{
+  switch (kind) {
+  case YCORE_NULL_VALUE:
+    return "null";
+  case YCORE_BOOL_VALUE:
+    return (value != 0 ? "true" : "false");
+  case YCORE_INT_VALUE:
+    sprintf(buf, "%.0f", value);
+    return buf;
+  case YCORE_FLOAT_VALUE:
+    if (isnan(value)) {
+      return ".nan";
+    } else if (isinf(value)) {
+      return (value < 0 ? "-.inf" : ".inf");
+    }
+    sprintf(buf, "%.17g", value);
+    if (strpbrk(buf, ".e") == NULL) {
+      strcat(buf, ".0");
+    }
+    return buf;
+  case YCORE_EMPTY_SEQUENCE:
+    return "[]";
+  case YCORE_EMPTY_MAPPING:
+    return "{}";
+  default:
+    y_error("string leaves require textual values");
+    return NULL;
+  }
+}
+
+void
+Y_yaml_unflatten(int argc)
+{
+  emitter_t* dst;
+  unflatten_t* u;
+  document_t* r;
+  ystring_t* path;
+  ystring_t* text = NULL;
+  long* kind;
+  double* value = NULL;
+  long i, n, ntot, dims[Y_DIMSIZE];
+  char buf[64];
+
+  if (! initialized) {
+    initialize();
+  }
+  if (argc != 4) {
+    y_error("expecting exactly four arguments");
+  }
+  dst = (emitter_t*)yget_obj(argc - 1, &emitter_type);
+  path = ygeta_q(argc - 2, &ntot, dims);
+  kind = ygeta_l(argc - 3, &n, NULL);
+  if (n != ntot) {
+    y_error("arrays of paths and kinds must have the same number of elements");
+  }
+  if (yarg_string(argc - 4)) {
+    text = ygeta_q(argc - 4, &n, NULL);
+  } else {
+    value = ygeta_d(argc - 4, &n, NULL);
+  }
+  if (n != ntot) {
+    y_error("arrays of paths and values must have the same number of elements");
+  }
+  for (i = 0; i < ntot; ++i) {
+    if (kind[i] < YCORE_NULL_VALUE || kind[i] > YCORE_EMPTY_MAPPING) {
+      y_error("invalid leaf kind");
+    }
+  }
+
+  u = (unflatten_t*)ypush_obj(&unflatten_type, sizeof(unflatten_t));
+  r = (document_t*)ypush_obj(&document_type, sizeof(document_t));
+  if (! yaml_document_initialize(&r->document, NULL, NULL, NULL, 1, 1)) {
+    y_error("failed to initialize document");
+  }
+  r->init = TRUE;
+  for (i = 0; i < ntot; ++i) {
+    const char* str;
+    if (path[i] == NULL) {
+      y_error("invalid path");
+    }
+    if (text != NULL) {
+      str = (text[i] != NULL ? text[i] : "");
+    } else {
+      str = format_leaf(buf, (int)kind[i], value[i]);
+    }
+    insert_leaf(u, r, path[i], (int)kind[i], str);
+  }
+  if (r->root == 0) {
+    y_error("no leaves");
+  }
+  emit_document(dst, r);
+  ypush_nil();
+}
+
+/*---------------------------------------------------------------------------*/
+/* QUERIES */
+
+/*
+ * A query is compiled into a list of steps and evaluated on the stream of
+ * events by a small automaton: the state of a node is the set of the
+ * numbers of steps matched by the path leading to the node, the state of a
+ * child is derived from the state of its parent and from the key or index
+ * of the child.  A node whose state includes the last step is a result and
+ * its events are captured in flow form.  Subtrees where no step can match
+ * are skipped.  As filters depend on the contents of a node, such a node is
+ * recorded on a tape of events which is replayed once the filters have been
+ * evaluated.  Memory is thus proportional to the results and to the largest
+ * filtered node, not to the input.
+ */
+
+#define QUERY_KEY    1 /* a given mapping key */
+#define QUERY_INDEX  2 /* a given sequence index */
+#define QUERY_ANY    3 /* any child */
+
+#define QUERY_EXISTS 0 /* filter operators */
+#define QUERY_EQ     1
+#define QUERY_NE     2
+#define QUERY_LT     3
+#define QUERY_LE     4
+#define QUERY_GT     5
+#define QUERY_GE     6
+
+typedef struct _qstep_t qstep_t;
+struct _qstep_t {
+  int type; /* QUERY_KEY, QUERY_INDEX or QUERY_ANY */
+  int recursive; /* match at any depth? */
+  char* key; /* key for QUERY_KEY */
+  size_t len; /* length of key */
+  long index; /* index for QUERY_INDEX */
+  int filter; /* step has a filter? */
+  qstep_t* path; /* relative path of the filter */
+  int npath; /* number of components in the relative path */
+  int op; /* operator of the filter */
+  int lit; /* type of literal (YCORE_HASH_FLOAT, YCORE_HASH_STRING,
+              YCORE_HASH_BOOL or YCORE_HASH_NULL) */
+  double number; /* numerical literal */
+  char* text; /* textual literal */
+  size_t textlen; /* length of textual literal */
+};
+
+static void    free_query(void* ptr);
+static void   print_query(void* ptr);
+
+static y_userobj_t query_type = {
+  /* type_name:  */   "yaml_query",
+  /* on_free:    */    free_query,
+  /* on_print:   */   print_query,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _query_t query_t;
+struct _query_t {
+  char* expr; /* query expression */
+  qstep_t* step; /* compiled steps */
+  int nsteps; /* number of steps */
+  size_t maxsteps; /* number of allocated steps */
+  ycore_hasher_t scratch; /* scratch buffer for parsing */
+};
+
+static void
+free_steps(qstep_t* step, int n)
+{
+  int i;
+  for (i = 0; i < n; ++i) {
+    free(step[i].key);
+    free(step[i].text);
+    if (step[i].path != NULL) {
+      free_steps(step[i].path, step[i].npath);
+    }
+  }
+  free(step);
+}
+
+static void free_query(void* ptr)
+{
+  query_t* q = (query_t*)ptr;
+  free(q->expr);
+  free_steps(q->step, q->nsteps);
+  ycore_hasher_destroy(&q->scratch);
+}
+
+static void print_query(void* ptr)
+{
+  query_t* q = (query_t*)ptr;
+  y_print("YAML query: ", 0);
+  y_print(q->expr, 1);
+}
+
+static int
+is_word_char(int c)
+{
+  return (c < 0x80 && (isalnum(c) || c == '_' || c == '-'));
+}
+
+/* Add a new step to an array of steps. */
+static qstep_t*
+new_step(qstep_t** step, int* n, size_t* size)
+{
+  qstep_t* s;
+  grow_array((void**)step, size, *n + 1, sizeof(qstep_t));
+  s = &(*step)[(*n)++];
+  memset(s, 0, sizeof(qstep_t));
+  return s;
+}
+
+/* Set the key of a step from the scratch buffer. */
+static void
+set_step_key(qstep_t* s, ycore_hasher_t* h)
+{
+  s->type = QUERY_KEY;
+  s->key = ycore_buf_copy(h, 0);
+  if (s->key == NULL) {
+    y_error("insufficient memory");
+  }
+  s->len = h->length;
+}
+
+/* Parse a name (or a '*' if ANY is true) at P into step S, returns the
+   address after the name. */
+static const char*
+parse_name(ycore_hasher_t* h, const char* p, qstep_t* s, int any)
+{
+  size_t n = 0;
+  if (any && *p == '*') {
+    s->type = QUERY_ANY;
+    return p + 1;
+  }
+  while (is_word_char((unsigned char)p[n])) {
+    ++n;
+  }
+  if (n == 0) {
+    y_error("invalid query (expecting a key)");
+  }
+  h->length = 0;
+  if (! ycore_buf_put(h, p, n)) {
+    y_error("insufficient memory");
+  }
+  set_step_key(s, h);
+  return p + n;
+}
+
+/* Parse a bracketed selector (P is just after the opening bracket), returns
+   the address after the closing bracket. */
+static const char*
+parse_bracket(ycore_hasher_t* h, const char* p, qstep_t* s, int any)
+{
+  char* end;
+  if (*p == '"' || *p == '\'') {
+    p = decode_quoted(h, p + 1, *p);
+    set_step_key(s, h);
+  } else if (any && *p == '*') {
+    s->type = QUERY_ANY;
+    ++p;
+  } else {
+    s->type = QUERY_INDEX;
+    s->index = strtol(p, &end, 10);
+    if (end == p || s->index < 0) {
+      y_error("invalid query (bad index)");
+    }
+    p = end;
+  }
+  if (*p != ']') {
+    y_error("invalid query (missing bracket)");
+  }
+  return p + 1;
+}
+
+static const char*
+skip_spaces(const char* p)
+{
+  while (*p == ' ' || *p == '\t') {
+    ++p;
+  }
+  return p;
+}
+
+/* Parse the filter of step S (P is just after "[?"), returns the address
+   after the closing bracket. */
+static const char*
+parse_filter(ycore_hasher_t* h, const char* p, qstep_t* s)
+{
+  size_t size = 0;
+  char* end;
+  s->type = QUERY_ANY;
+  s->filter = TRUE;
+  p = skip_spaces(p);
+  if (*p == '@') {
+    ++p;
+  } else if (is_word_char((unsigned char)*p)) {
+    p = parse_name(h, p, new_step(&s->path, &s->npath, &size), FALSE);
+  }
+  while (*p == '.' || *p == '[') {
+    qstep_t* c = new_step(&s->path, &s->npath, &size);
+    if (*p == '.') {
+      p = parse_name(h, p + 1, c, FALSE);
+    } else {
+      p = parse_bracket(h, p + 1, c, FALSE);
+    }
+  }
+  p = skip_spaces(p);
+  if (p[0] == '=' && p[1] == '=') {
+    s->op = QUERY_EQ;
+  } else if (p[0] == '!' && p[1] == '=') {
+    s->op = QUERY_NE;
+  } else if (p[0] == '<' && p[1] == '=') {
+    s->op = QUERY_LE;
+  } else if (p[0] == '>' && p[1] == '=') {
+    s->op = QUERY_GE;
+  } else if (p[0] == '<') {
+    s->op = QUERY_LT;
+  } else if (p[0] == '>') {
+    s->op = QUERY_GT;
+  } else {
+    s->op = QUERY_EXISTS;
+  }
+  if (s->op != QUERY_EXISTS) {
+    p = skip_spaces(p + (s->op == QUERY_LT || s->op == QUERY_GT ? 1 : 2));
+    if (*p == '"' || *p == '\'') {
+      p = decode_quoted(h, p + 1, *p);
+      s->lit = YCORE_HASH_STRING;
+    } else if (strncmp(p, "true", 4) == 0 || strncmp(p, "false", 5) == 0) {
+      h->length = 0;
+      ycore_buf_puts(h, (*p == 't' ? "true" : "false"));
+      p += (*p == 't' ? 4 : 5);
+      s->lit = YCORE_HASH_BOOL;
+    } else if (strncmp(p, "null", 4) == 0) {
+      h->length = 0;
+      p += 4;
+      s->lit = YCORE_HASH_NULL;
+    } else {
+      s->number = strtod(p, &end);
+      if (end == p) {
+        y_error("invalid query (bad literal in filter)");
+      }
+      p = end;
+      s->lit = YCORE_HASH_FLOAT;
+    }
+    if (s->lit != YCORE_HASH_FLOAT) {
+      s->text = ycore_buf_copy(h, 0);
+      if (s->text == NULL) {
+        y_error("insufficient memory");
+      }
+      s->textlen = h->length;
+    }
+  } else if (s->npath == 0) {
+    y_error("invalid query (empty filter)");
+  }
+  p = skip_spaces(p);
+  if (*p != ']') {
+    y_error("invalid query (missing bracket after filter)");
+  }
+  return p + 1;
+}
+
+/* Compile expression EXPR into query Q. */
+static void
+compile_query(query_t* q, const char* expr)
+{
+  const char* p = expr;
+  const char* begin;
+  q->expr = ycore_copy_string((const yaml_char_t*)expr);
+  if (q->expr == NULL) {
+    y_error("insufficient memory");
+  }
+  if (*p == '$') {
+    ++p;
+  }
+  begin = p;
+  while (*p != '\0') {
+    qstep_t* s = new_step(&q->step, &q->nsteps, &q->maxsteps);
+    if (p[0] == '.' && p[1] == '.') {
+      s->recursive = TRUE;
+      p += 2;
+      if (*p != '[') {
+        p = parse_name(&q->scratch, p, s, TRUE);
+        continue;
+      }
+    } else if (*p == '.') {
+      p = parse_name(&q->scratch, p + 1, s, TRUE);
+      continue;
+    } else if (p == begin && is_word_char((unsigned char)*p)) {
+      /* Leading key without a dot. */
+      p = parse_name(&q->scratch, p, s, TRUE);
+      continue;
+    }
+    if (p[0] == '[' && p[1] == '?') {
+      p = parse_filter(&q->scratch, p + 2, s);
+    } else if (*p == '[') {
+      p = parse_bracket(&q->scratch, p + 1, s, TRUE);
+    } else {
+      y_error("invalid query (unexpected character)");
+    }
+  }
+}
+
+/* Get the query given by argument IARG (a compiled query or an expression
+   which is compiled and pushed on top of the stack). */
+static query_t*
+get_query(int iarg)
+{
+  query_t* q;
+  if (yarg_string(iarg) == 1) {
+    const char* expr = ygets_q(iarg);
+    q = (query_t*)ypush_obj(&query_type, sizeof(query_t));
+    compile_query(q, (expr != NULL ? expr : ""));
+    return q;
+  }
+  return (query_t*)yget_obj(iarg, &query_type);
+}
+
+void
+Y_yaml_query(int argc)
+{
+  if (argc != 1) {
+    y_error("expecting exactly one argument");
+  }
+  if (yarg_string(argc - 1) != 1) {
+    y_error("expecting a query expression");
+  }
+  get_query(argc - 1);
+}
+
+static void    free_select(void* ptr);
+static void   print_select(void* ptr);
+
+static y_userobj_t select_type = {
+  /* type_name:  */   "yaml_select",
+  /* on_free:    */    free_select,
+  /* on_print:   */   print_select,
+  /* on_eval:    */ (void (*)(void*,int))0,
+  /* on_extract: */ (void (*)(void*,char*))0,
+  /* uo_ops:     */ (void *)0
+};
+
+typedef struct _qlevel_t qlevel_t;
+struct _qlevel_t {
+  int type; /* YAML_SEQUENCE_NODE or YAML_MAPPING_NODE */
+  int key; /* next node is a mapping key? */
+  long index; /* number of items or pairs so far */
+  size_t pathlen; /* length of the path of the parent */
+  size_t state; /* offset of the states of the node */
+  size_t nstates; /* number of states of the node */
+};
+
+typedef struct _qcapture_t qcapture_t;
+struct _qcapture_t {
+  ycore_hasher_t text; /* flow form of the node */
+  size_t level; /* level of the node */
+  size_t slot; /* index of the result */
+};
+
+typedef struct _qtape_t qtape_t;
+struct _qtape_t {
+  ycore_tape_t tape; /* recorded events */
+  int recording; /* still recording? */
+  char* key; /* key of the recorded node */
+  size_t keylen; /* length of key */
+};
+
+typedef struct _select_t select_t;
+struct _select_t {
+  query_t* query; /* compiled query */
+  ycore_hasher_t key; /* current mapping key */
+  ycore_hasher_t scratch; /* scratch buffer for path components */
+  char* path; /* path of the current node */
+  size_t pathlen, pathsize;
+  qlevel_t* level; /* stack of collections */
+  size_t depth, maxdepth;
+  int* state; /* stack of states */
+  size_t nstates, maxstates;
+  qcapture_t* capture; /* stack of captured nodes */
+  size_t ncaptures, maxcaptures;
+  qtape_t* tape; /* stack of tapes */
+  size_t ntapes, maxtapes;
+  char* decision; /* results of the filters for a replayed node */
+  long skip; /* nesting level in a skipped subtree */
+  long doc; /* index of current document */
+  char* paths; /* paths of the results */
+  size_t pathsused, pathsmax;
+  char* texts; /* flow forms of the results */
+  size_t textsused, textsmax;
+  size_t* pathoff; /* offsets of the paths of the results */
+  size_t* textoff; /* offsets of the texts of the results */
+  long* docs; /* documents of the results */
+  size_t nresults, maxresults;
+};
+
+static void
+free_tape(qtape_t* t)
+{
+  ycore_tape_clear(&t->tape);
+  free(t->key);
+  t->key = NULL;
+}
+
+static void free_select(void* ptr)
+{
+  select_t* s = (select_t*)ptr;
+  size_t i;
+  ycore_hasher_destroy(&s->key);
+  ycore_hasher_destroy(&s->scratch);
+  free(s->path);
+  free(s->level);
+  free(s->state);
+  for (i = 0; i < s->maxcaptures; ++i) {
+    ycore_hasher_destroy(&s->capture[i].text);
+  }
+  free(s->capture);
+  for (i = 0; i < s->maxtapes; ++i) {
+    free_tape(&s->tape[i]);
+    ycore_tape_destroy(&s->tape[i].tape);
+  }
+  free(s->tape);
+  free(s->decision);
+  free(s->paths);
+  free(s->texts);
+  free(s->pathoff);
+  free(s->textoff);
+  free(s->docs);
+}
+
+static void print_select(void* ptr)
+{
+  y_print("YAML query evaluator", 1);
+}
+
+/* Grow an array of structures whose new elements must be zero. */
+static void
+grow_zeroed(void** ptr, size_t* size, size_t n, size_t elsize)
+{
+  size_t old = *size;
+  grow_array(ptr, size, n, elsize);
+  if (*size > old) {
+    memset((char*)*ptr + old*elsize, 0, (*size - old)*elsize);
+  }
+}
+
+/* Add state K to the states of the node being entered (which start at
+   FIRST). */
+static void
+add_state(select_t* s, size_t first, int k)
+{
+  size_t i;
+  for (i = first; i < s->nstates; ++i) {
+    if (s->state[i] == k) {
+      return;
+    }
+  }
+  grow_array((void**)&s->state, &s->maxstates, s->nstates + 1, sizeof(int));
+  s->state[s->nstates++] = k;
+}
+
+/* Append a string to all active captures. */
+static void
+capture_puts(select_t* s, const char* str, size_t len)
+{
+  size_t i;
+  for (i = 0; i < s->ncaptures; ++i) {
+    if (! ycore_buf_put(&s->capture[i].text, str, len)) {
+      y_error("insufficient memory");
+    }
+  }
+}
+
+/* Append a scalar to all active captures.  Non-plain scalars are quoted
+   unless ROOT is true and the capture is the innermost one (the scalar is
+   the captured node). */
+static void
+capture_scalar(select_t* s, const yaml_event_t* ev, int root)
+{
+  size_t i, n = s->ncaptures;
+  const char* val = (const char*)ev->data.scalar.value;
+  size_t len = ev->data.scalar.length;
+  for (i = 0; i < n; ++i) {
+    ycore_hasher_t* h = &s->capture[i].text;
+    int ok;
+    if ((root && i == n - 1) ||
+        ev->data.scalar.style == YAML_PLAIN_SCALAR_STYLE) {
+      ok = ycore_buf_put(h, val, len);
+    } else {
+      ok = ycore_buf_put_quoted(h, val, len);
+    }
+    if (! ok) {
+      y_error("insufficient memory");
+    }
+  }
+}
+
+/* Start capturing the node at the current level, the slot of the result is
+   reserved so that results are in document order. */
+static void
+start_capture(select_t* s)
+{
+  size_t n = s->nresults + 1, size;
+  qcapture_t* c;
+  size = s->maxresults;
+  grow_array((void**)&s->pathoff, &size, n, sizeof(size_t));
+  size = s->maxresults;
+  grow_array((void**)&s->textoff, &size, n, sizeof(size_t));
+  size = s->maxresults;
+  grow_array((void**)&s->docs, &size, n, sizeof(long));
+  s->maxresults = size;
+  s->pathoff[s->nresults] = append_text(&s->paths, &s->pathsused,
+                                        &s->pathsmax, s->path, s->pathlen);
+  s->textoff[s->nresults] = 0;
+  s->docs[s->nresults] = s->doc;
+  grow_zeroed((void**)&s->capture, &s->maxcaptures, s->ncaptures + 1,
+              sizeof(qcapture_t));
+  c = &s->capture[s->ncaptures++];
+  c->text.length = 0;
+  c->level = s->depth;
+  c->slot = s->nresults++;
+}
+
+/* Finish the capture of the node at level DEPTH (if any). */
+static void
+finish_capture(select_t* s, size_t depth)
+{
+  qcapture_t* c;
+  if (s->ncaptures > 0 && (c = &s->capture[s->ncaptures - 1])->level == depth) {
+    s->textoff[c->slot] = append_text(&s->texts, &s->textsused,
+                                      &s->textsmax, c->text.buffer,
+                                      c->text.length);
+    --s->ncaptures;
+  }
+}
+
+/* Find the node at relative path PATH in the N recorded events EV starting
+   at P.  Returns the index of the node or -1. */
+static long
+find_recorded(const yaml_event_t* ev, long n, long p, const qstep_t* path,
+              int npath)
+{
+  int i;
+  long j;
+  for (i = 0; i < npath && p >= 0; ++i) {
+    const qstep_t* c = &path[i];
+    if (ev[p].type == YAML_MAPPING_START_EVENT && c->type == QUERY_KEY) {
+      ++p;
+      while (p >= 0 && p < n && ev[p].type != YAML_MAPPING_END_EVENT) {
+        int found = (ev[p].type == YAML_SCALAR_EVENT &&
+                     ev[p].data.scalar.length == c->len &&
+                     memcmp(ev[p].data.scalar.value, c->key, c->len) == 0);
+        p = ycore_tape_skip(ev, n, p);
+        if (found) {
+          break;
+        }
+        p = ycore_tape_skip(ev, n, p);
+      }
+      if (p >= n || ev[p].type == YAML_MAPPING_END_EVENT) {
+        p = -1;
+      }
+    } else if (ev[p].type == YAML_SEQUENCE_START_EVENT &&
+               c->type == QUERY_INDEX) {
+      ++p;
+      for (j = 0; j < c->index && p < n &&
+             ev[p].type != YAML_SEQUENCE_END_EVENT; ++j) {
+        p = ycore_tape_skip(ev, n, p);
+      }
+      if (p >= n || ev[p].type == YAML_SEQUENCE_END_EVENT) {
+        p = -1;
+      }
+    } else {
+      p = -1;
+    }
+  }
+  return p;
+}
+
+/* Evaluate the filter of step S on the node recorded in the N events EV. */
+static int
+eval_filter(const qstep_t* s, const yaml_event_t* ev, long n)
+{
+  char buf[128];
+  long p = find_recorded(ev, n, 0, s->path, s->npath);
+  const yaml_event_t* e;
+  int kind, cmp;
+  if (p < 0) {
+    return FALSE;
+  }
+  if (s->op == QUERY_EXISTS) {
+    return TRUE;
+  }
+  e = &ev[p];
+  if (e->type != YAML_SCALAR_EVENT) {
+    return (s->op == QUERY_NE);
+  }
+  if (s->lit == YCORE_HASH_STRING) {
+    size_t len = e->data.scalar.length;
+    cmp = memcmp(e->data.scalar.value, s->text,
+                 (len < s->textlen ? len : s->textlen));
+    if (cmp == 0) {
+      cmp = (len < s->textlen ? -1 : (len > s->textlen ? 1 : 0));
+    }
+  } else {
+    kind = ycore_resolve_scalar(e->data.scalar.tag, e->data.scalar.value,
+                                e->data.scalar.length, e->data.scalar.style,
+                                buf, sizeof(buf));
+    if (s->lit == YCORE_HASH_FLOAT) {
+      double x;
+      if (kind != YCORE_HASH_INT && kind != YCORE_HASH_FLOAT) {
+        return (s->op == QUERY_NE);
+      }
+      x = ycore_leaf_number((kind == YCORE_HASH_INT ? YCORE_INT_VALUE :
+                             YCORE_FLOAT_VALUE), buf);
+      if (x != x) {
+        return (s->op == QUERY_NE);
+      }
+      cmp = (x < s->number ? -1 : (x > s->number ? 1 : 0));
+    } else {
+      if (kind != s->lit) {
+        return (s->op == QUERY_NE);
       }
+      if (s->op != QUERY_EQ && s->op != QUERY_NE) {
+        return FALSE;
+      }
+      cmp = (s->lit == YCORE_HASH_NULL ? 0 : strcmp(buf, s->text));
     }
   }
-
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
-    obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
+  switch (s->op) {
+  case QUERY_EQ: return (cmp == 0);
+  case QUERY_NE: return (cmp != 0);
+  case QUERY_LT: return (cmp < 0);
+  case QUERY_LE: return (cmp <= 0);
+  case QUERY_GT: return (cmp > 0);
+  case QUERY_GE: return (cmp >= 0);
+  default:       return FALSE;
   }
-  if (! yaml_alias_event_initialize(&obj->event, anchor)) {
-    y_error("failed to initialize ALIAS event");
+}
+
+static int
+select_child(const qstep_t* step, const qlevel_t* parent,
+             const ycore_hasher_t* key)
+{
+  switch (step->type) {
+  case QUERY_KEY:
+    return (parent->type == YAML_MAPPING_NODE && key->length == step->len &&
+            memcmp(key->buffer, step->key, step->len) == 0);
+  case QUERY_INDEX:
+    return (parent->type == YAML_SEQUENCE_NODE &&
+            parent->index == step->index);
+  default:
+    return TRUE;
   }
-  obj->init = TRUE;
 }
 
-void
-Y_yaml_scalar_event(int argc)
+static void
+select_push_path(select_t* s)
 {
-  char buffer[64];
-  event_t* obj = NULL;
-  yaml_char_t* anchor = NULL;
-  yaml_char_t* tag = NULL;
-  yaml_char_t* value = NULL;
-  int plain_implicit = TRUE;
-  int quoted_implicit = TRUE;
-  yaml_scalar_style_t style = YAML_ANY_SCALAR_STYLE;
-  int iarg, drop = 0, number, length = 0;
+  ycore_hasher_t* h = &s->scratch;
+  grow_array((void**)&s->path, &s->pathsize, s->pathlen + h->length + 1, 1);
+  memcpy(s->path + s->pathlen, h->buffer, h->length);
+  s->pathlen += h->length;
+  s->path[s->pathlen] = '\0';
+}
 
-  if (! initialized) {
-    initialize();
+static void
+start_recording(select_t* s)
+{
+  qtape_t* t;
+  grow_zeroed((void**)&s->tape, &s->maxtapes, s->ntapes + 1, sizeof(qtape_t));
+  t = &s->tape[s->ntapes++];
+  t->recording = TRUE;
+  t->key = ycore_buf_copy(&s->key, 0);
+  t->keylen = s->key.length;
+  if (t->key == NULL) {
+    y_error("insufficient memory");
   }
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    long index = yarg_key(iarg);
-    if (index < 0) {
-      /* Positional argument. */
-      if (obj == NULL) {
-        obj = get_event(iarg, NIL_OK|FRESH);
-        drop = iarg;
-      } else {
-        y_error("too many arguments");
+}
+
+static void select_event(select_t* s, const yaml_event_t* ev);
+
+/* Enter a node (not a mapping key).  DECISION gives the results of the
+   filters for a replayed node, it is NULL otherwise. */
+static void
+enter_node(select_t* s, const yaml_event_t* ev, const char* decision)
+{
+  const query_t* q = s->query;
+  qlevel_t* parent = (s->depth > 0 ? &s->level[s->depth - 1] : NULL);
+  qlevel_t* lev;
+  size_t i, n, first = s->nstates, pathlen = s->pathlen;
+  int k, collection, match;
+
+  collection = (ev->type == YAML_SEQUENCE_START_EVENT ||
+                ev->type == YAML_MAPPING_START_EVENT);
+  if (parent == NULL) {
+    add_state(s, first, 0);
+  } else {
+    for (i = parent->state; i < parent->state + parent->nstates; ++i) {
+      const qstep_t* step;
+      k = s->state[i];
+      if (k >= q->nsteps) {
+        continue;
       }
-    } else {
-      /* Keyword argument. */
-      if (index == anchor_index) {
-        anchor = (yaml_char_t*)ygets_q(--iarg);
-      } else if (index == tag_index) {
-        tag = (yaml_char_t*)ygets_q(--iarg);
-      } else if (index == value_index) {
-        --iarg;
-        number = yarg_number(iarg);
-        if (number == 1) {
-          /* Integer. */
-          long val = ygets_l(iarg);
-          sprintf(buffer, "%ld", val);
-          value = (yaml_char_t*)buffer;
-        } else if (number == 2) {
-          /* Floating-point. */
-          double val = ygets_d(iarg);
-          sprintf(buffer, "%g", val);
-          value = (yaml_char_t*)buffer;
-        } else if (number == 3) {
-          /* Complex. */
-          double* arr = ygeta_z(iarg, NULL, NULL);
-          sprintf(buffer, "%g %s %gim", arr[0], (arr[1] >= 0 ? "+" : "-"),
-                  fabs(arr[1]));
-          value = (yaml_char_t*)buffer;
-        } else if (yarg_string(iarg)) {
-          value = (yaml_char_t*)ygets_q(iarg);
+      step = &q->step[k];
+      if (select_child(step, parent, &s->key)) {
+        if (! step->filter) {
+          add_state(s, first, k + 1);
+        } else if (decision != NULL) {
+          if (decision[k]) {
+            add_state(s, first, k + 1);
+          }
+        } else if (! collection) {
+          if (eval_filter(step, ev, 1)) {
+            add_state(s, first, k + 1);
+          }
         } else {
-          y_error("value must be a string or a numerical scalar");
+          s->nstates = first;
+          start_recording(s);
+          select_event(s, ev);
+          return;
         }
-      } else if (index == plain_implicit_index) {
-        plain_implicit = yarg_true(--iarg);
-      } else if (index == quoted_implicit_index) {
-        quoted_implicit = yarg_true(--iarg);
-      } else if (index == style_index) {
-        style = ygets_i(--iarg);
-      } else {
-        y_error("unknown keyword");
+      }
+      if (step->recursive) {
+        add_state(s, first, k);
       }
     }
   }
-  if (value == NULL || value[0] == '\0') {
-    length = 0;
-  } else {
-    size_t len = strlen((const char*)value);
-    length = (int)len;
-    if (length != len) {
-      y_error("integer overflow");
+  n = s->nstates - first;
+  match = FALSE;
+  for (i = first; i < s->nstates; ++i) {
+    if (s->state[i] == q->nsteps) {
+      match = TRUE;
     }
   }
 
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
-    obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
+  /* Update the parent, the path and the captures. */
+  if (parent != NULL) {
+    if (n > 0) {
+      s->scratch.length = 0;
+      if (parent->type == YAML_SEQUENCE_NODE) {
+        if (! buf_put_index(&s->scratch, parent->index)) {
+          y_error("insufficient memory");
+        }
+      } else if (! buf_put_key(&s->scratch, (yaml_char_t*)s->key.buffer,
+                               s->key.length)) {
+        y_error("insufficient memory");
+      }
+      select_push_path(s);
+    }
+    if (s->ncaptures > 0) {
+      if (parent->type == YAML_MAPPING_NODE) {
+        capture_puts(s, ": ", 2);
+      } else if (parent->index > 0) {
+        capture_puts(s, ", ", 2);
+      }
+    }
+    ++parent->index;
+    parent->key = TRUE;
   }
-  if (! yaml_scalar_event_initialize(&obj->event, anchor, tag, value, length,
-                                     plain_implicit, quoted_implicit, style)) {
-    y_error("failed to initialize SCALAR event");
+  if (match) {
+    start_capture(s);
   }
-  obj->init = TRUE;
-}
-
-void
-Y_yaml_sequence_start_event(int argc)
-{
-  event_t* obj = NULL;
-  yaml_char_t* anchor = NULL;
-  yaml_char_t* tag = NULL;
-  int implicit = TRUE;
-  yaml_sequence_style_t style = YAML_ANY_SEQUENCE_STYLE;
-  int iarg, drop = 0;
 
-  if (! initialized) {
-    initialize();
-  }
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    long index = yarg_key(iarg);
-    if (index < 0) {
-      /* Positional argument. */
-      if (obj == NULL) {
-        obj = get_event(iarg, NIL_OK|FRESH);
-        drop = iarg;
-      } else {
-        y_error("too many arguments");
-      }
+  if (collection) {
+    if (n == 0 && s->ncaptures == 0) {
+      s->skip = 1;
     } else {
-      /* Keyword argument. */
-      if (index == anchor_index) {
-        anchor = (yaml_char_t*)ygets_q(--iarg);
-      } else if (index == tag_index) {
-        tag = (yaml_char_t*)ygets_q(--iarg);
-      } else if (index == style_index) {
-        style = ygets_i(--iarg);
-      } else if (index == implicit_index) {
-        implicit = yarg_true(--iarg);
-      } else {
-        y_error("unknown keyword");
+      grow_array((void**)&s->level, &s->maxdepth, s->depth + 1,
+                 sizeof(qlevel_t));
+      lev = &s->level[s->depth++];
+      lev->type = (ev->type == YAML_SEQUENCE_START_EVENT ?
+                   YAML_SEQUENCE_NODE : YAML_MAPPING_NODE);
+      lev->key = TRUE;
+      lev->index = 0;
+      lev->pathlen = pathlen;
+      lev->state = first;
+      lev->nstates = n;
+      if (s->ncaptures > 0) {
+        capture_puts(s, (lev->type == YAML_SEQUENCE_NODE ? "[" : "{"), 1);
       }
+      return;
     }
+  } else if (ev->type == YAML_SCALAR_EVENT) {
+    capture_scalar(s, ev, match);
+  } else if (s->ncaptures > 0) {
+    const char* anchor = (const char*)ev->data.alias.anchor;
+    capture_puts(s, "*", 1);
+    capture_puts(s, anchor, strlen(anchor));
   }
+  finish_capture(s, s->depth);
+  s->nstates = first;
+  s->pathlen = pathlen;
+  if (s->path != NULL) {
+    s->path[pathlen] = '\0';
+  }
+}
 
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
-    obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
+static void
+leave_node(select_t* s)
+{
+  qlevel_t* lev;
+  if (s->depth < 1) {
+    y_error("unbalanced events");
   }
-  if (! yaml_sequence_start_event_initialize(&obj->event, anchor, tag,
-                                             implicit, style)) {
-    y_error("failed to initialize SEQUENCE-START event");
+  lev = &s->level[--s->depth];
+  if (s->ncaptures > 0) {
+    capture_puts(s, (lev->type == YAML_SEQUENCE_NODE ? "]" : "}"), 1);
+  }
+  finish_capture(s, s->depth);
+  s->nstates = lev->state;
+  s->pathlen = lev->pathlen;
+  if (s->path != NULL) {
+    s->path[s->pathlen] = '\0';
   }
-  obj->init = TRUE;
 }
 
-void
-Y_yaml_sequence_end_event(int argc)
+/* Replay the tape on top of the stack. */
+static void
+replay_tape(select_t* s)
 {
-  event_t* obj;
+  const query_t* q = s->query;
+  size_t t = s->ntapes - 1, i;
+  int k;
 
-  if (argc != 1) {
-    y_error("expecting exactly one argument");
+  /* The decisions are only used when entering the node, before any nested
+     tape is replayed, so a single buffer is needed. */
+  s->tape[t].recording = FALSE;
+  for (k = 0; k < q->nsteps; ++k) {
+    s->decision[k] = (q->step[k].filter &&
+                      eval_filter(&q->step[k], s->tape[t].tape.event,
+                                  s->tape[t].tape.count));
   }
-  obj = get_event(0, NIL_OK|FRESH);
-  if (! yaml_sequence_end_event_initialize(&obj->event)) {
-    y_error("failed to initialize SEQUENCE-END event");
+  s->key.length = 0;
+  if (! ycore_buf_put(&s->key, s->tape[t].key, s->tape[t].keylen)) {
+    y_error("insufficient memory");
   }
-  obj->init = TRUE;
+  enter_node(s, &s->tape[t].tape.event[0], s->decision);
+  for (i = 1; i < s->tape[t].tape.count; ++i) {
+    select_event(s, &s->tape[t].tape.event[i]);
+  }
+  free_tape(&s->tape[t]);
+  --s->ntapes;
 }
 
-void
-Y_yaml_mapping_start_event(int argc)
+/* Process an event of the stream. */
+static void
+select_event(select_t* s, const yaml_event_t* ev)
 {
-  event_t* obj = NULL;
-  yaml_char_t* anchor = NULL;
-  yaml_char_t* tag = NULL;
-  int implicit = TRUE;
-  yaml_mapping_style_t style = YAML_ANY_MAPPING_STYLE;
-  int iarg, drop = 0;
+  qlevel_t* lev;
+  yaml_event_type_t type = ev->type;
+  int start = (type == YAML_SEQUENCE_START_EVENT ||
+               type == YAML_MAPPING_START_EVENT);
+  int end = (type == YAML_SEQUENCE_END_EVENT ||
+             type == YAML_MAPPING_END_EVENT);
 
-  if (! initialized) {
-    initialize();
+  if (s->ntapes > 0 && s->tape[s->ntapes - 1].recording) {
+    qtape_t* t = &s->tape[s->ntapes - 1];
+    const char* errmsg = ycore_tape_record(&t->tape, ev);
+    if (errmsg != NULL) {
+      y_error(errmsg);
+    }
+    if (t->tape.depth == 0) {
+      replay_tape(s);
+    }
+    return;
   }
-  for (iarg = argc - 1; iarg >= 0; --iarg) {
-    long index = yarg_key(iarg);
-    if (index < 0) {
-      /* Positional argument. */
-      if (obj == NULL) {
-        obj = get_event(iarg, NIL_OK|FRESH);
-        drop = iarg;
-      } else {
-        y_error("too many arguments");
-      }
-    } else {
-      /* Keyword argument. */
-      if (index == anchor_index) {
-        anchor = (yaml_char_t*)ygets_q(--iarg);
-      } else if (index == tag_index) {
-        tag = (yaml_char_t*)ygets_q(--iarg);
-      } else if (index == style_index) {
-        style = ygets_i(--iarg);
-      } else if (index == implicit_index) {
-        implicit = yarg_true(--iarg);
-      } else {
-        y_error("unknown keyword");
+  if (s->skip > 0) {
+    s->skip += (start ? 1 : (end ? -1 : 0));
+    return;
+  }
+  lev = (s->depth > 0 ? &s->level[s->depth - 1] : NULL);
+  if (lev != NULL && lev->type == YAML_MAPPING_NODE && lev->key &&
+      type != YAML_MAPPING_END_EVENT) {
+    /* Mapping key. */
+    if (type != YAML_SCALAR_EVENT) {
+      y_error("only scalar mapping keys are supported");
+    }
+    s->key.length = 0;
+    if (! ycore_buf_put(&s->key, ev->data.scalar.value,
+                        ev->data.scalar.length)) {
+      y_error("insufficient memory");
+    }
+    if (s->ncaptures > 0) {
+      if (lev->index > 0) {
+        capture_puts(s, ", ", 2);
       }
+      capture_scalar(s, ev, FALSE);
     }
+    lev->key = FALSE;
+    return;
   }
-
-  /* Manage to push/let the result on top of the stack. */
-  if (obj == NULL) {
-    obj = push_event();
-  } else if (drop > 0) {
-    yarg_drop(drop);
+  switch (type) {
+  case YAML_DOCUMENT_START_EVENT:
+    ++s->doc;
+    break;
+  case YAML_SCALAR_EVENT:
+  case YAML_ALIAS_EVENT:
+  case YAML_SEQUENCE_START_EVENT:
+  case YAML_MAPPING_START_EVENT:
+    enter_node(s, ev, NULL);
+    break;
+  case YAML_SEQUENCE_END_EVENT:
+  case YAML_MAPPING_END_EVENT:
+    leave_node(s);
+    break;
+  default:
+    break;
   }
-  if (! yaml_mapping_start_event_initialize(&obj->event, anchor, tag,
-                                             implicit, style)) {
-    y_error("failed to initialize MAPPING-START event");
+}
+
+/* Evaluate the query on all the documents read by a parser. */
+static void
+select_parser(select_t* s, parser_t* parser)
+{
+  yaml_event_t event;
+  int done;
+  if (parser->parsing == YCORE_ANY) {
+    parser->parsing = YCORE_PARSE;
+  } else if (parser->parsing != YCORE_PARSE) {
+    y_error("not an event-based parser");
   }
-  obj->init = TRUE;
+  do {
+    if (! parse_event(parser, &event) &&
+        ! yaml_stream_end_event_initialize(&event)) {
+      y_error("failed to initialize STREAM-END event");
+    }
+    /* Keep the event in an object so that it is deleted in case of
+       errors. */
+    {
+      event_t* tmp = push_event();
+      tmp->event = event;
+      tmp->init = TRUE;
+      done = (event.type == YAML_STREAM_END_EVENT);
+      select_event(s, &tmp->event);
+      yarg_drop(1);
+    }
+  } while (! done);
 }
 
 void
-Y_yaml_mapping_end_event(int argc)
+Y_yaml_select(int argc)
 {
-  event_t* obj;
+  query_t* q;
+  select_t* s;
+  ystring_t* files = NULL;
+  parser_t* parser = NULL;
+  long ref[2], i, nfiles = 0, dims[2];
+  int j;
 
-  if (argc != 1) {
-    y_error("expecting exactly one argument");
+  if (! initialized) {
+    initialize();
   }
-  obj = get_event(0, NIL_OK|FRESH);
-  if (! yaml_mapping_end_event_initialize(&obj->event)) {
-    y_error("failed to initialize MAPPING-END event");
+  if (argc < 2 || argc > 4) {
+    y_error("expecting between two and four arguments");
+  }
+  for (j = 0; j < 2; ++j) {
+    ref[j] = -1;
+    if (argc >= j + 3) {
+      ref[j] = yget_ref(argc - 3 - j);
+      if (ref[j] < 0 && ! yarg_nil(argc - 3 - j)) {
+        y_error("expecting a simple variable reference for an output");
+      }
+    }
+  }
+  if (yarg_string(argc - 2)) {
+    files = ygeta_q(argc - 2, &nfiles, NULL);
+  } else {
+    parser = (parser_t*)yget_obj(argc - 2, &parser_type);
+  }
+  q = get_query(argc - 1);
+  s = (select_t*)ypush_obj(&select_type, sizeof(select_t));
+  s->query = q;
+  s->decision = (char*)malloc(q->nsteps + 1);
+  if (s->decision == NULL) {
+    y_error("insufficient memory");
+  }
+  if (parser != NULL) {
+    select_parser(s, parser);
+  }
+  for (i = 0; i < nfiles; ++i) {
+    if (files[i] == NULL) {
+      y_error("invalid file name");
+    }
+    parser = open_parser(files[i]);
+    select_parser(s, parser);
+    yarg_drop(1);
+  }
+
+  dims[0] = 1;
+  dims[1] = s->nresults;
+  if (ref[0] >= 0) {
+    if (s->nresults > 0) {
+      ystring_t* path = ypush_q(dims);
+      for (i = 0; i < s->nresults; ++i) {
+        const char* str = s->paths + s->pathoff[i];
+        path[i] = p_strcpy(str[0] != '\0' ? str : ".");
+      }
+    } else {
+      ypush_nil();
+    }
+    store_output(ref[0]);
+  }
+  if (ref[1] >= 0) {
+    if (s->nresults > 0) {
+      long* doc = ypush_l(dims);
+      for (i = 0; i < s->nresults; ++i) {
+        doc[i] = s->docs[i];
+      }
+    } else {
+      ypush_nil();
+    }
+    store_output(ref[1]);
+  }
+  if (s->nresults > 0) {
+    ystring_t* text = ypush_q(dims);
+    for (i = 0; i < s->nresults; ++i) {
+      text[i] = p_strcpy(s->texts + s->textoff[i]);
+    }
+  } else {
+    ypush_nil();
   }
-  obj->init = TRUE;
 }
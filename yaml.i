@@ -95,7 +95,7 @@ func event_print_type(event)
 
 
 
-func yaml_load(filename)
+func yaml_load(filename, mapping=, dupkeys=)
 /* DOCUMENT doc = yaml_load(filename)
    load the first document of a YAML file
    FILENAME can either be a YAML filename or a YAML parser object.
@@ -103,87 +103,71 @@ func yaml_load(filename)
        DOC is a htab if the document begin with a MAPPING
        DOC is an array if the document is an sequence of string
        DOC is an object if the document is a sequence
-   SEE ALSO:  yaml_load_all,yaml_open
+   If keyword MAPPING is true, the value is built in C with ordered
+   mappings (see yaml_mapping) which keep the keys in the order of the
+   document: the mappings and the sequences which are not only made of
+   scalars are ordered mappings (the keys of a sequence are "1", "2",
+   etc.) and the aliases of a node share its value.
+   Keyword DUPKEYS sets the policy for duplicate keys in a mapping (which
+   YAML forbids): "error" to raise an error, "first" or "last" for the
+   first or the last value to win (the key keeps its first position), or
+   "collect" to replace the value by a sequence of all the values.  The
+   keys are checked with a hash table, so the cost is linear.  By default,
+   the keys are not checked and the last value wins.
+   The document is loaded by the native loader which resolves aliases and
+   merge keys ("<<: *defaults"): the keys of the merged mappings are
+   inherited unless they are explicitly given.
+   SEE ALSO:  yaml_load_all,yaml_open,yaml_mapping
  */
 {
-  true = 1n;
-  false = 0n;
-
-  if(typeof(filename) == "yaml_parser"){
-    eq_nocopy,parser, filename;
-  }else if (is_string(filename)){
-    parser = yaml_open(filename, "r");
-  }
-  
-  event = yaml_parse(parser);
-  if (event.type != YAML_STREAM_START_EVENT) {
-      error, "yaml file should begin with a stream start event"
-  } 
-  
-  event = yaml_parse(parser);
-  if (event.type != YAML_DOCUMENT_START_EVENT) {
-      error, "yaml document should begin with a document start event"
-  }
-
-  
-  while(  (type = (event = yaml_parse(parser)).type)!= YAML_DOCUMENT_END_EVENT){
-    if (type == YAML_SEQUENCE_START_EVENT) {
-      doc= yaml_build_sequence(parser);
-    } else if (type == YAML_MAPPING_START_EVENT) {
-      doc = yaml_build_mapping(parser);
-    } else  {
-      error, "unexpected event: doc should be composed of mapping or sequence only"; 
+  if (mapping) {
+    if (! _yaml_load(filename, doc, dupkeys=dupkeys, mapping=1)) {
+      error, "no document in yaml stream";
     }
+    return doc;
   }
-  
-  return doc;
-  
+  doc = _yaml_load(filename, dupkeys=dupkeys);
+  if (is_void(doc)) {
+    error, "no document in yaml stream";
+  }
+  return _yaml_load_build(doc);
 }
 
 
-func yaml_load_all(filename)
+func yaml_load_all(filename, mapping=, dupkeys=)
 /* DOCUMENT doc = yaml_load_all(filename)
-   load the first document of a YAML file
+   load all the documents of a YAML file
    FILENAME can either be a YAML filename or a YAML parser object.
    DOC is an object containing all the documents
-   SEE ALSO:  yaml_load_all,yaml_open
+   Keywords MAPPING and DUPKEYS are as for yaml_load.
+   SEE ALSO:  yaml_load,yaml_open
  */
 {
-  true = 1n;
-  false = 0n;
-
-  if(typeof(filename) == "yaml_parser"){
-    eq_nocopy,parser, filename;
-  }else if (is_string(filename)){
+  if (is_string(filename)) {
     parser = yaml_open(filename, "r");
+  } else {
+    eq_nocopy, parser, filename;
   }
-  
-  event = yaml_parse(parser);
-  if (event.type != YAML_STREAM_START_EVENT) {
-    error, "yaml file should begin with a stream start event";
-  } 
-  
-  doc =  save();
+  doc = save();
   idx = 0;
-  while(  (type = (event = yaml_parse(parser)).type)!= YAML_STREAM_END_EVENT){
-    
-    if (event.type != YAML_DOCUMENT_START_EVENT) {
-      error, "yaml document should begin with a document start event";
-    }
-    
-    while(  (type = (event = yaml_parse(parser)).type)!= YAML_DOCUMENT_END_EVENT){
-      if (type == YAML_SEQUENCE_START_EVENT) {
-        save,doc,swrite(format="doc%ld",++idx), yaml_build_sequence(parser);
-      } else if (type == YAML_MAPPING_START_EVENT) {
-        save,doc,swrite(format="doc%ld",++idx), yaml_build_mapping(parser);
-      } else  {
-        error, "unexpected event: doc should be composed of mapping or sequence only"; 
-      }
+  if (mapping) {
+    while (_yaml_load(parser, tmp, dupkeys=dupkeys, mapping=1)) {
+      save, doc, swrite(format="doc%ld", ++idx), tmp;
     }
+    return doc;
+  }
+  while (! is_void((tmp = _yaml_load(parser, dupkeys=dupkeys)))) {
+    save, doc, swrite(format="doc%ld", ++idx), _yaml_load_build(tmp);
   }
-  
   return doc;
-  
+}
+
+func _yaml_load_build(doc)
+{
+  if (_yaml_node_kind(doc) == YAML_SCALAR_NODE) {
+    error, "unexpected event: doc should be composed of mapping or sequence only";
+  }
+  return _yaml_build(doc);
 }
 
 
@@ -220,45 +204,490 @@ func yaml_build_mapping(parser){
   return htab;
 }
                 
-func yaml_build_sequence(parser){
-  true = 1n;
-  false = 0n;
-  scalar_only=true;
-  while(1) {
+func yaml_build_sequence(parser)
+/* DOCUMENT tab = yaml_build_sequence(parser);
+
+     Builds the sequence whose SEQUENCE-START event has just been delivered
+     by yaml_parse.  A sequence of scalars yields an array of strings (nil
+     if empty), any other sequence an object.  The events of the sequence
+     are first measured (see _yaml_sequence) so that the result is
+     allocated at its final size.  A sequence too long to be measured is
+     built as its events are parsed.
+
+   SEE ALSO: yaml_parse, yaml_build_mapping.
+ */
+{
+  tab = _yaml_sequence(parser);
+  if (! is_integer(tab)) {
+    return tab;
+  }
+  n = tab;
+  tab = save();
+  scalars = 1n;
+  for (i = 1; n < 0 || i <= n; ++i) {
     event = yaml_parse(parser);
     type = event.type;
-    
-    if (type == YAML_SEQUENCE_END_EVENT){
-      break;
-    }else if (type == YAML_SCALAR_EVENT) {
-      value  =  event.value;
+    if (type == YAML_SCALAR_EVENT) {
+      value = event.value;
     } else if (type == YAML_SEQUENCE_START_EVENT) {
       value = yaml_build_sequence(parser);
-      scalar_only=false;
+      scalars = 0n;
     } else if (type == YAML_MAPPING_START_EVENT) {
       value = yaml_build_mapping(parser);
-      scalar_only=false;
-    }else{
+      scalars = 0n;
+    } else if (n < 0 && type == YAML_SEQUENCE_END_EVENT) {
+      break;
+    } else {
       error, "Waiting for a sequence value";
     }
-    list  = _cat(list,value);
+    save, tab, swrite(format="%ld", i), value;
   }
-  ll = _len(list);
-  if(scalar_only){
-    tab = array(string,ll);
-    for (i=0;i<ll;i++){
-      tab(ll-i) =_nxt(list); 
+  if (n < 0) {
+    /* Not measured: the items are now known. */
+    n = tab(*);
+    if (scalars && n > 0) {
+      val = array(string, n);
+      for (i = 1; i <= n; ++i) {
+        val(i) = tab(i);
+      }
+      return val;
+    }
+    return tab;
+  }
+  if (yaml_parse(parser).type != YAML_SEQUENCE_END_EVENT) {
+    error, "Waiting for a sequence end";
+  }
+  return tab;
+}
+
+extern _yaml_sequence;
+/* DOCUMENT val = _yaml_sequence(parser);
+
+     Private function for yaml_build_sequence.  The sequence whose
+     SEQUENCE-START event has just been delivered by PARSER is measured in
+     a first pass over the events which are buffered in the parser (see
+     yaml_peek).  If the items are all scalars, they are consumed with the
+     SEQUENCE-END event and returned as an array of strings (nil if there
+     are none); otherwise nothing is consumed and the number of items is
+     returned, -1 if the sequence is too long to be measured with a bounded
+     lookahead.  The nested sequences are measured by the same pass.
+
+   SEE ALSO: yaml_build_sequence.
+ */
+
+func yaml_save(dest, doc, dedup=, atomic=)
+/* DOCUMENT yaml_save, dest, doc, dedup=, atomic=;
+
+     Saves DOC as a YAML document.  DEST is either a filename or a YAML
+     emitter object; if it is a filename, the file is created (or truncated)
+     and a complete stream with a single document is written.  DOC may be
+     nil (saved as "null"), an array of numbers or of strings (see
+     yaml_emit_array), an ordered mapping (see yaml_mapping), a hash table
+     (see h_new) or an object (see save), possibly nested.  The keys of an
+     ordered mapping are saved in order, those of a hash table are
+     sorted.  The members of an object (or the entries of an ordered
+     mapping) are saved as a sequence if they are anonymous or named "1",
+     "2", etc. in order (as built by yaml_load), as a mapping otherwise.
+
+     If keyword DEDUP is true, repeated identical collections are saved only
+     once: their first occurrence is given an anchor and the others are
+     replaced by aliases to this anchor.  This makes the output smaller when
+     DOC contains large identical substructures and preserves the sharing
+     when the file is loaded again.  DEDUP is only applicable when DEST is a
+     filename, otherwise it is the DEDUP option of the emitter which applies
+     (see yaml_open).
+
+     Keyword ATOMIC may be set to 1 or 2 to replace file DEST atomically
+     (see yaml_open and yaml_commit).
+
+   SEE ALSO: yaml_load, yaml_open, yaml_emit.
+ */
+{
+  if (is_string(dest)) {
+    emitter = yaml_open(dest, "w", dedup=dedup, atomic=atomic);
+    yaml_emit, emitter, yaml_stream_start_event();
+    yaml_save, emitter, doc;
+    yaml_emit, emitter, yaml_stream_end_event();
+    yaml_close, emitter;
+  } else if (typeof(dest) == "yaml_emitter") {
+    yaml_emit, dest, yaml_document_start_event();
+    _yaml_save_value, dest, doc;
+    yaml_emit, dest, yaml_document_end_event();
+  } else {
+    error, "expecting a filename or a YAML emitter";
+  }
+}
+
+func _yaml_save_value(emitter, val)
+/* DOCUMENT _yaml_save_value, emitter, val;
+
+     Emits the events for value VAL with YAML emitter.
+
+   SEE ALSO: yaml_save.
+ */
+{
+  if (is_void(val)) {
+    yaml_emit, emitter, yaml_scalar_event(value="null");
+  } else if (is_array(val) && (is_numerical(val) || is_string(val))) {
+    yaml_emit_array, emitter, val;
+  } else if (typeof(val) == "yaml_mapping") {
+    keys = val();
+    n = numberof(keys);
+    if (n > 0 && allof(keys == swrite(format="%d", indgen(n)))) {
+      yaml_emit, emitter, yaml_sequence_start_event();
+      for (i = 1; i <= n; ++i) {
+        _yaml_save_value, emitter, val(i);
+      }
+      yaml_emit, emitter, yaml_sequence_end_event();
+      return;
+    }
+    yaml_emit, emitter, yaml_mapping_start_event();
+    for (i = 1; i <= n; ++i) {
+      yaml_emit, emitter, yaml_scalar_event(value=keys(i));
+      _yaml_save_value, emitter, val(i);
     }
-  }else{
+    yaml_emit, emitter, yaml_mapping_end_event();
+  } else if (is_func(is_hash) && is_hash(val)) {
+    keys = h_keys(val);
+    yaml_emit, emitter, yaml_mapping_start_event();
+    if (! is_void(keys)) {
+      keys = keys(sort(keys));
+      n = numberof(keys);
+      for (i = 1; i <= n; ++i) {
+        yaml_emit, emitter, yaml_scalar_event(value=keys(i));
+        _yaml_save_value, emitter, h_get(val, keys(i));
+      }
+    }
+    yaml_emit, emitter, yaml_mapping_end_event();
+  } else if (is_obj(val)) {
+    n = val(*);
+    keys = (n > 0 ? val(*,) : []);
+    if (n == 0 || allof(! keys) ||
+        allof(keys == swrite(format="%d", indgen(n)))) {
+      yaml_emit, emitter, yaml_sequence_start_event();
+      for (i = 1; i <= n; ++i) {
+        _yaml_save_value, emitter, val(i);
+      }
+      yaml_emit, emitter, yaml_sequence_end_event();
+    } else {
+      yaml_emit, emitter, yaml_mapping_start_event();
+      for (i = 1; i <= n; ++i) {
+        yaml_emit, emitter, yaml_scalar_event(value=keys(i));
+        _yaml_save_value, emitter, val(i);
+      }
+      yaml_emit, emitter, yaml_mapping_end_event();
+    }
+  } else {
+    error, "unsupported data type";
+  }
+}
+
+func yaml_hash(src, canonical=)
+/* DOCUMENT str = yaml_hash(src, canonical=);
+
+     Yields the fingerprint of the YAML contents of SRC as a string of 32
+     hexadecimal digits (a 128-bit hash).  SRC is a YAML filename, a YAML
+     parser object (the remaining events are consumed) or any value
+     supported by yaml_save.  The fingerprint is computed on the fly from
+     the events, without building the tree, and is designed so that
+     semantically equal contents have the same fingerprint: the keys of
+     mappings are sorted, the plain scalars are resolved according to the
+     YAML core schema (null, boolean, integer, floating-point or string) and
+     normalized (e.g., "~" and "null", "0x1F" and "31", "2.50" and "2.5" are
+     the same), the styles and the anchors are ignored and the aliases stand
+     for the node they refer to.
+
+     If keyword CANONICAL is a filename, the canonical form of the documents
+     (in flow style with sorted keys) is written into this file.
+
+   SEE ALSO: yaml_save, yaml_open.
+ */
+{
+  if ((is_string(src) && is_scalar(src)) || typeof(src) == "yaml_parser") {
+    return _yaml_hash(src, canonical=canonical);
+  }
+  emitter = yaml_open(canonical, "w", hash=1);
+  yaml_emit, emitter, yaml_stream_start_event();
+  yaml_save, emitter, src;
+  yaml_emit, emitter, yaml_stream_end_event();
+  return _yaml_hash(emitter);
+}
+
+extern _yaml_hash;
+/* DOCUMENT str = _yaml_hash(filename, canonical=);
+         or str = _yaml_hash(parser, canonical=);
+         or str = _yaml_hash(emitter);
+
+     Private function to compute the fingerprint of a YAML stream read from a
+     file or a parser, or emitted by a hashing emitter.
+
+   SEE ALSO: yaml_hash.
+ */
+
+extern yaml_diff;
+/* DOCUMENT chg = yaml_diff(a, b, lcs=);
+
+     Compares the first documents of YAML files A and B (or the next
+     documents of YAML parser objects A and B) and yields the list of
+     changes to go from A to B.  The documents are parsed in C and compared
+     by node digests (see yaml_hash) so that only the subtrees which differ
+     are visited.  The keys of mappings are matched by their text and tag
+     (by their digests for keys which are collections), the items of
+     sequences by their index or, if keyword LCS is true, by a
+     longest common subsequence (very long sequences are still aligned by
+     index).
+
+     The result is nil if the documents have the same contents, otherwise a
+     4-by-N array of strings: CHG(1,) are the paths of the changed nodes,
+     CHG(2,) the kinds of the changes ("changed", "added" or "removed"),
+     CHG(3,) the old values and CHG(4,) the new values (empty for an added
+     or removed node).  Paths are like ".optics.lens[0]" with 0-based
+     indices for sequences and keys which are not simple words written as
+     ["some key"]; the path of the root node is ".".  Collections are given
+     in flow style.
+
+   SEE ALSO: yaml_hash, yaml_open.
+ */
+
+extern yaml_flatten;
+/* DOCUMENT paths = yaml_flatten(src, kinds, values, texts);
+
+     Flattens the first document of YAML file SRC (or the next document of
+     YAML parser SRC) into a table of leaves.  The events are streamed in C
+     while maintaining a path stack, no tree is built.  The leaves are the
+     scalars and the empty collections of the document, they are returned
+     in document order.  The result is an array of strings with the paths of
+     the leaves (same syntax as in yaml_diff: ".optics.lens[0]" with 0-based
+     indices for sequences, keys which are not simple words written as
+     ["some key"] and "." for the root node).
+
+     Optional outputs KINDS, VALUES and TEXTS are set with the kinds of the
+     leaves (YAML_NULL_VALUE, YAML_BOOL_VALUE, YAML_INT_VALUE,
+     YAML_FLOAT_VALUE, YAML_STRING_VALUE, YAML_EMPTY_SEQUENCE or
+     YAML_EMPTY_MAPPING), their numerical values (0 or 1 for booleans, 0 for
+     non-numerical leaves) and their textual values ("[]" and "{}" for empty
+     collections).  Scalars are typed according to the YAML core schema.
+     The numerical values are converted after the structural pass, in
+     parallel on large documents (see yaml_threads).
+
+     Aliases are expanded: the leaves of the anchored node are repeated
+     under the path of the alias.  Only scalar mapping keys are supported,
+     merge keys ("<<") are kept as ordinary keys.
+
+   SEE ALSO: yaml_unflatten, yaml_diff.
+ */
+
+extern yaml_unflatten;
+/* DOCUMENT yaml_unflatten, emitter, paths, kinds, values;
+
+     Emits a document built from a table of leaves as returned by
+     yaml_flatten.  PATHS, KINDS and VALUES are arrays with the same number
+     of elements.  VALUES may be the textual values of the leaves or their
+     numerical values (which are then formatted according to KINDS, this is
+     not possible for strings).  Strings which would be taken for another
+     type are quoted.  Missing items of sequences are set to null.  It is an
+     error if a path is repeated or if paths are inconsistent (e.g., a node
+     indexed both as a mapping and a sequence).
+
+     The caller is responsible for emitting the STREAM-START and STREAM-END
+     events around the document.
+
+   SEE ALSO: yaml_flatten, yaml_open.
+ */
+
+extern yaml_threads;
+/* DOCUMENT n = yaml_threads();
+         or yaml_threads, n;
+
+     Queries or sets the number of threads used by the conversion of the
+     numerical values by yaml_flatten, the only parallel operation of the
+     plugin: the loaders (yaml_load, yaml_merge, etc.) yield strings which
+     can only be created by Yorick in the main thread.  The worker threads
+     form a pool which is created when first needed.  N = 0 (the initial setting) means as
+     many threads as CPUs available to the process, given its CPU affinity
+     and its cgroup CPU quota if any; N = 1 disables parallelism.  The
+     number of threads in effect is returned.
+
+   SEE ALSO: yaml_flatten.
+ */
+
+extern yaml_query;
+extern yaml_select;
+/* DOCUMENT q = yaml_query(expr);
+         or res = yaml_select(q, src, paths, docs);
+
+     yaml_query compiles the query expression EXPR.  yaml_select evaluates
+     query Q (a compiled query or an expression) on all the documents of
+     SRC which is a YAML parser object or a name (or an array of names) of
+     YAML files.  A compiled query may be reused for any number of sources.
+
+     The query is evaluated in C on the stream of events, only the matching
+     nodes are materialized.  The result is nil if there are no matches,
+     otherwise an array of strings with the matching nodes in document
+     order: scalars are given as is, collections in flow form.  Optional
+     outputs PATHS and DOCS are set with the paths of the matching nodes
+     (same syntax as in yaml_diff) and the 1-based indices of their
+     documents (counted over all the sources).
+
+     A query is a list of steps optionally preceded by "$" (the root node):
+
+       .key or ["key"]   the value of a given key of a mapping;
+       [i]               the item of 0-based index I of a sequence;
+       .* or [*]         any item or value of a collection;
+       ..key, ..*, etc.  same as above but at any depth;
+       [?cond]           any item or value satisfying the condition.
+
+     The first key may be given without a leading dot.  A condition is a
+     relative path (like "gain", "sub.gain" or "@" for the node itself)
+     optionally followed by a comparison (==, !=, <, <=, > or >=) with a
+     literal which is a number, a quoted string, true, false or null.
+     Without comparison, the condition is that the relative path exists.
+     For example:
+
+       yaml_select, "runs[*].detectors[?gain > 2].id", "log.yaml";
+
+     Numbers are compared to the integer and floating-point scalars,
+     strings to the textual value of the scalars.  Aliases are not
+     expanded and mapping keys must be scalars.
+
+   SEE ALSO: yaml_flatten, yaml_open.
+ */
+
+func yaml_merge(files, .., deep=, append=, delete=, emit=, mapping=,
+                dupkeys=)
+/* DOCUMENT doc = yaml_merge(file1, file2, ...);
+         or yaml_merge, file1, file2, ..., emit=emitter;
+
+     Merges the first documents of YAML files FILE1, FILE2, etc. (which may
+     also be given as an array of names) considered as successive layers
+     (e.g., defaults, site and run-specific configurations).  All the layers
+     are merged in C into a single native tree, the contents of a layer
+     having precedence over the contents of the previous ones.  The rules
+     are set by keywords:
+
+     - deep: If true (the default), mappings are merged recursively: keys
+           of a layer which exist in the merged tree have their value merged,
+           the other ones are added.  Otherwise, a mapping replaces the
+           previous one.
+
+     - append: If true, the items of a sequence are appended to those of
+           the sequence in the merged tree.  By default, a sequence replaces
+           the previous one.
+
+     - delete: If true (the default), a key with a null value (like "~",
+           "null" or an empty value) in a layer deletes this key from the
+           merged tree.
+
+     Any other kind of node replaces the previous one.  The merge keys
+     ("<<") of a layer are resolved before merging it.  The aliases of a
+     layer share a single copy of their node until a later layer changes
+     one of them.  If keyword EMIT is
+     an emitter object (see yaml_open), the merged document is emitted (as
+     yaml_save does) and nothing is returned.  Otherwise the merged document
+     is returned as yaml_load would do.  Keywords MAPPING and DUPKEYS are as
+     for yaml_load, the duplicate keys are resolved in each layer before
+     merging.
+
+   SEE ALSO: yaml_load, yaml_save, yaml_open.
+ */
+{
+  while (more_args()) {
+    grow, files, next_arg();
+  }
+  doc = _yaml_merge(files, deep=deep, append=append, delete=delete,
+                    emit=emit, mapping=mapping, dupkeys=dupkeys);
+  if (! is_void(emit) || mapping) {
+    return doc;
+  }
+  return _yaml_build(doc);
+}
+
+func _yaml_build(doc, id)
+/* DOCUMENT val = _yaml_build(doc);
+         or val = _yaml_build(doc, id);
+
+     Converts the node ID (the root node by default) of the native YAML
+     document DOC into a Yorick value of the same kind as yaml_load: a
+     scalar is a string, a sequence of scalars is an array of strings, any
+     other sequence is an object and a mapping is a hash table.
+
+   SEE ALSO: yaml_load, yaml_merge.
+ */
+{
+  kind = _yaml_node_kind(doc, id);
+  val = _yaml_node(doc, id);
+  if (kind == YAML_SCALAR_NODE || is_void(val) || is_string(val)) {
+    return val;
+  }
+  n = numberof(val);
+  if (kind == YAML_SEQUENCE_NODE) {
+    /* The number of items is known from the document tree. */
+    keys = swrite(format="%ld", indgen(n));
     tab = save();
-    for (i=0;i<ll;i++){
-      save,tab,swrite(format="%ld",ll-i),_nxt(list); 
+    for (i = 1; i <= n; ++i) {
+      save, tab, keys(i), _yaml_build(doc, val(i));
     }
+    return tab;
   }
-  return tab;
+  keys = _yaml_node_keys(doc, id);
+  htab = h_new();
+  for (i = 1; i <= n; ++i) {
+    h_set, htab, keys(i), _yaml_build(doc, val(i));
+  }
+  return htab;
 }
 
-                              
+extern yaml_mapping;
+/* DOCUMENT map = yaml_mapping();
+         or map = yaml_mapping(key1, val1, key2, val2, ...);
+
+     Creates an ordered mapping, optionally initialized with pairs of keys
+     and values.  An ordered mapping keeps its entries in insertion order
+     and finds the value of a key in constant time whatever the number of
+     entries (with a hash table).  It is what yaml_load yields for YAML
+     mappings with keyword MAPPING set.  With MAP an ordered mapping:
+
+       map(key)         yields the value of KEY (nil if there is no such key);
+       map.key          is the same for keys which are valid symbol names;
+       map(i)           yields the value of the I-th entry;
+       map()            yields the keys in order (nil if MAP is empty);
+       map, key, val;   sets the value of KEY (a new key is appended, an
+                        existing key keeps its position).
+
+   SEE ALSO: yaml_load, yaml_save.
+ */
+
+extern _yaml_load;
+extern _yaml_merge;
+extern _yaml_node_kind;
+extern _yaml_node;
+extern _yaml_node_keys;
+/* DOCUMENT doc = _yaml_load(filename, dupkeys=);
+         or doc = _yaml_load(parser, dupkeys=);
+         or bool = _yaml_load(src, val, dupkeys=, mapping=1);
+         or doc = _yaml_merge(files, deep=, append=, delete=, emit=,
+                              mapping=, dupkeys=);
+         or kind = _yaml_node_kind(doc, id);
+         or val = _yaml_node(doc, id);
+         or keys = _yaml_node_keys(doc, id);
+
+     Private functions for native YAML documents.  _yaml_load loads the
+     next document of a file or of a parser (nil if there are no more
+     documents), _yaml_merge merges the layers and yields a native document
+     (unless EMIT is set).  With keyword MAPPING set, the value of the
+     document is built in C as explained for yaml_load: _yaml_merge yields
+     it and _yaml_load stores it in variable VAL and yields whether there
+     was a document.
+     _yaml_node_kind yields the type of the node ID of DOC
+     (YAML_SCALAR_NODE, YAML_SEQUENCE_NODE or YAML_MAPPING_NODE),
+     _yaml_node yields the value of a scalar, the values of a sequence of
+     scalars or the identifiers of the items of a sequence or of the values
+     of a mapping and _yaml_node_keys yields the keys of a mapping.  For a
+     mapping, the merge keys ("<<") are resolved.  If ID is omitted, the
+     root node is assumed.
+
+   SEE ALSO: yaml_merge.
+ */
 
 /*extern yaml_event;*/
 
@@ -266,15 +695,132 @@ extern yaml_debug;
 extern yaml_open;
 /* DOCUMENT parser = yaml_open(filename);
          or parser = yaml_open(filename, "r");
-         or emitter = yaml_open(filename, "w");
-         or emitter = yaml_open(filename, "a");
+         or parser = yaml_open(filename, "r", follow=1, timeout=);
+         or parser = yaml_open(filename, "r", checkpoint=);
+         or parser = yaml_open(fd, "r", bufsize=);
+         or emitter = yaml_open(filename, "w", dedup=);
+         or emitter = yaml_open(filename, "a", dedup=);
+         or emitter = yaml_open(filename, "w", hash=1);
+         or emitter = yaml_open(filename, "w", bufsize=, sync=);
+         or emitter = yaml_open(filename, "w", atomic=);
+         or emitter = yaml_open(fd, "w");
 
       This function opens file FILENAME for reading or writing.  If the mode
       is "w", the file is opened for writing, the file is is truncated to zero
       length or created.  It the mode is "a", the file is opened for appending
       (writing at end of file), the file is created if it does not exist.
 
-   SEE ALSO: yaml_parse, yaml_emit.
+      Keyword DEDUP may be set true to create an emitter which replaces
+      repeated subtrees by aliases.  A digest of every subtree is computed
+      as its events are emitted and a collection identical to a previous
+      one is replaced by an alias to an anchor ("id001", "id002", etc.,
+      skipping the anchors of the document) given to its first occurrence.
+      The events of each document are kept by the emitter until the
+      DOCUMENT-END event is emitted, but the repetitions are dropped as soon
+      as they are complete.  Subtrees with anchors or aliases of their own
+      are left unchanged.
+
+      Keyword HASH may be set true to create a hashing emitter which computes
+      the fingerprint of the emitted events instead of writing YAML (see
+      yaml_hash).  For a hashing emitter, FILENAME is the name of the file to
+      write the canonical form of the documents, it may be nil or empty to
+      not write anything.  Keywords BUFSIZE and SYNC do not apply to
+      hashing emitters.
+
+      Keyword FOLLOW may be set true to create a parser which follows a
+      growing file (like "tail -f"), for instance a log to which documents
+      are appended.  Such a parser only delivers complete documents, that
+      is the documents followed by a line starting with "---" or terminated
+      by a line starting with "...", and waits for the file to grow when
+      there are no more complete documents (on Linux, inotify is used to be
+      notified of the changes, otherwise the file is polled).  Keyword
+      TIMEOUT is the maximum number of seconds to wait (for ever by
+      default), after which yaml_parse yields nil.  A parser in follow mode
+      never yields a STREAM-END event and can only be used for event-based
+      parsing.  Keywords FOLLOW and TIMEOUT are only for parsers.
+
+      For reading, the first argument may also be an integer file
+      descriptor (e.g. a pipe from a decompressor or a socket) which is not
+      closed when the parser is destroyed.  The input is read by blocks of
+      BUFSIZE bytes (1 MiB by default, no more than the size of a regular
+      file).  For regular files, the system is advised that the file will
+      be read sequentially.
+
+      Keyword CHECKPOINT may be set true to enable checkpoints for a parser
+      (see yaml_checkpoint) or set with a checkpoint to create a parser which
+      resumes parsing at this checkpoint (checkpoints are then enabled).
+      This keyword is only for parsers.
+
+      For writing, FILENAME may be nil or empty to write to the standard
+      output or an integer file descriptor which is not closed by the
+      emitter.  The output is buffered in aligned blocks of 1 MiB, up to
+      BUFSIZE bytes (4 MiB by default), which are written by a single system
+      call when they are full, at the end of the stream and when the emitter
+      is closed (see yaml_close) or destroyed.  Keyword SYNC specifies
+      whether the written data are committed to the storage device with
+      fdatasync: "never" (the default), after every "document" or when the
+      emitter is closed ("close").  Keywords SYNC, DEDUP, HASH and ATOMIC
+      are only for emitters.
+
+      Keyword ATOMIC may be set to 1 to write file FILENAME atomically: the
+      output goes to a temporary file in the same directory which, when the
+      emitter is closed or destroyed after the STREAM-END event, is
+      synchronized and renamed as FILENAME.  If the stream is incomplete
+      (e.g. after an error), the temporary file is removed and FILENAME is
+      left unchanged.  Thus a crash never leaves a truncated file.  With
+      ATOMIC=2, the synchronization is deferred: closed files are queued and
+      committed together by yaml_commit (or when 1024 files are queued,
+      when a file written with ATOMIC=1 is closed and when Yorick exits),
+      which is much faster when many small files are written in a loop.
+
+   SEE ALSO: yaml_parse, yaml_emit, yaml_save, yaml_hash, yaml_checkpoint,
+             yaml_close, yaml_commit.
+ */
+
+extern yaml_close;
+/* DOCUMENT yaml_close, emitter;
+
+     Writes the pending output of EMITTER, commits it to the storage device
+     if the emitter was created with SYNC set to "document" or "close" (see
+     yaml_open) and closes its file.  Contrarily to destroying the emitter,
+     an error is raised if the output cannot be written.  Nothing more can
+     be emitted after closing.  In atomic mode, the target file is replaced
+     (or queued for yaml_commit) if the stream is complete; otherwise, the
+     output is discarded and an error is raised.
+
+   SEE ALSO: yaml_open, yaml_emit, yaml_commit.
+ */
+
+extern yaml_commit;
+/* DOCUMENT yaml_commit;
+
+     Commits the files written by emitters created with ATOMIC=2 (see
+     yaml_open) and closed since the last commit: the data of all these
+     files are synchronized, then each file replaces its target and each
+     directory is synchronized once.  Call this function after writing a
+     batch of files, the targets are not replaced before.
+
+   SEE ALSO: yaml_open, yaml_close.
+ */
+
+extern yaml_checkpoint;
+/* DOCUMENT cp = yaml_checkpoint(parser);
+
+     Yields the checkpoint at the end of the last document read by PARSER
+     (or at the beginning of the input if no documents have been read).
+     The checkpoints must have been enabled when the parser was created by
+     yaml_open with keyword CHECKPOINT.  The result is an array of 5 integers:
+     the byte offset, the character index, the line and the column (both
+     0-based as in the marks of the events) of the end of the document, and
+     the number of documents read so far.  A checkpoint can be saved and
+     given to yaml_open to resume parsing at this position, for instance to
+     restart an interrupted job:
+
+       parser = yaml_open(filename, "r", checkpoint=cp);
+
+     Only UTF-8 input is supported.
+
+   SEE ALSO: yaml_open, yaml_parse, yaml_load.
  */
 
 extern yaml_parse;
@@ -285,19 +831,163 @@ extern yaml_parse;
      value is an instance of YAML event.  Second argument may be an existing
      YAML event instance which is reused (and returned).
 
-   SEE ALSO: yaml_open.
+     For a parser in follow mode (see yaml_open), nil is returned if no new
+     complete documents are available before the timeout.
+
+   SEE ALSO: yaml_open, yaml_peek.
+ */
+
+extern yaml_peek;
+/* DOCUMENT event = yaml_peek(parser);
+         or event = yaml_peek(parser, k);
+
+     This function yields a copy of the K-th next YAML event (K = 1 by
+     default) of a parser without consuming it: the same events will be
+     delivered, in order, by the subsequent calls to yaml_parse.  Events are
+     parsed only once and are buffered in the parser until delivered, so
+     looking ahead (e.g., to check whether a sequence only contains scalars)
+     does not re-parse anything.
+
+     Events beyond the end of the stream have type YAML_NO_EVENT.  For a
+     parser in follow mode (see yaml_open), nil is returned if the K-th next
+     event is not available before the timeout.
+
+   SEE ALSO: yaml_parse.
  */
 
 extern yaml_emit;
 /* DOCUMENT yaml_emit, emitter, event, ...;
+         or yaml_emit, emitter, event, ..., keep=1;
 
      Emits event(s) with YAML emitter.  There may be any events in the
      argument list.  The contents of emitted events is destroyed (these events
-     becomes uninitialized).
+     becomes uninitialized) unless keyword KEEP is true.  With KEEP=1, a copy
+     of each event is emitted and the events are left unchanged so that they
+     can be emitted again (e.g., document separators or fixed headers) without
+     rebuilding them.
 
    SEE ALSO: yaml_open.
  */
 
+extern yaml_emit_events;
+/* DOCUMENT yaml_emit_events, emitter, types, values, styles,
+                              tags=, anchors=;
+
+     Emits a whole sequence of events with YAML emitter in a single call.
+     TYPES is an array of event types (YAML_STREAM_START_EVENT,
+     YAML_SCALAR_EVENT, etc.) and the other arguments are optional arrays
+     with the same number of elements.  This is much faster than building
+     and emitting the events one by one.
+
+     VALUES gives the values of the SCALAR events (as strings or as
+     integers or reals which are formatted with "%ld", "%.9g" for floats or
+     "%.17g" for doubles, as yaml_emit_array does by default) and the
+     names of the anchors of the ALIAS events, it is ignored for the other
+     events.  STYLES gives the styles of the SCALAR, SEQUENCE-START and
+     MAPPING-START events (the emitter chooses by default).  Keywords TAGS
+     and ANCHORS give the tags and the anchors of the node events, empty
+     strings are for none.  Nodes with a tag are not implicit, the other
+     events take the same defaults as their constructors (e.g.
+     yaml_scalar_event).
+
+     All the events are checked before any of them is emitted: their
+     types, values and styles, and that they are correctly nested given the
+     events already emitted (e.g., a MAPPING-END event must close a mapping
+     with as many keys as values).
+
+   SEE ALSO: yaml_emit, yaml_emit_array, yaml_scalar_event.
+ */
+
+extern yaml_emit_array;
+/* DOCUMENT yaml_emit_array, emitter, arr, style=, format=;
+
+     Emits the contents of array ARR with YAML emitter as a sequence of
+     scalars.  This is equivalent to, but much faster than, emitting a
+     SEQUENCE-START event, a SCALAR event for each element of ARR and a
+     SEQUENCE-END event.  ARR may be an array of integers, reals, complexes or
+     strings.  Multi-dimensional arrays are emitted as nested sequences, the
+     first dimension of ARR being the innermost one.  A scalar ARR is emitted
+     as a single SCALAR event.
+
+     Keyword STYLE may be used to specify the style of the sequence(s).  By
+     default, the innermost sequences of a numerical array with more than 8
+     elements along its first dimension are emitted in flow style and the
+     style of the other sequences is left to the emitter.
+
+     Keyword FORMAT may be used to specify the format for the elements of an
+     integer or real array.  It must have exactly one conversion for an
+     integer (like "%d" or "%x") or a real (like "%g" or "%.3f") value; the
+     elements of ARR are converted as needed.  The default format is "%ld"
+     for integers, "%.9g" for floats and "%.17g" for doubles (so that the
+     values are read back exactly).
+
+   SEE ALSO: yaml_emit, yaml_sequence_start_event.
+ */
+
+extern yaml_emit_table;
+extern yaml_columns;
+/* DOCUMENT yaml_emit_table, emitter, names, col1, col2, ..., colN;
+         or yaml_emit_table, emitter, names, list;
+         or list = yaml_columns(n);
+
+     Emits a table with YAML emitter.  NAMES is an array of N strings with the
+     names of the columns and COL1, COL2, ..., COLN are the N columns of the
+     table.  The columns are arrays of numbers or of strings which must have
+     the same last dimension, the number of rows of the table.  The leading
+     dimensions of a column, if any, are those of its cells.
+
+     By default, the table is emitted as a sequence of mappings (one mapping
+     per row).  If keyword COLUMNS is true, the table is emitted as a mapping
+     of sequences (one sequence per column).  Keyword STYLE may be used to
+     specify the style of the mapping(s).  Keyword FORMAT may be used to
+     specify the format of the numerical values: it is either a single
+     format for all the columns or an array of N formats (with empty strings
+     for the default format of a column).  See yaml_emit_array for the rules
+     about the formats.
+
+     The columns may also be provided by a list created by yaml_columns(N),
+     the J-th column of the list being set by calling LIST as a subroutine:
+
+         list, j, colj;
+
+     This is useful when the number of columns is not known in advance.
+
+   SEE ALSO: yaml_emit_struct, yaml_emit_array.
+ */
+
+func yaml_emit_struct(emitter, arr, columns=, format=, style=)
+/* DOCUMENT yaml_emit_struct, emitter, arr, columns=, format=, style=;
+
+     Emits the array of structures ARR with YAML emitter.  The structure
+     definition is examined once and each member of the structure yields a
+     column of a table emitted by yaml_emit_table (which see for the meaning
+     of the keywords).  By default, ARR is emitted as a sequence of mappings,
+     one per element.  The members must be numbers or strings (possibly
+     arrays).
+
+   SEE ALSO: yaml_emit_table.
+ */
+{
+  names = _yaml_struct_members(arr);
+  n = numberof(names);
+  arr = arr(*);
+  list = yaml_columns(n);
+  for (i = 1; i <= n; ++i) {
+    list, i, get_member(arr, names(i));
+  }
+  yaml_emit_table, emitter, names, list, columns=columns, format=format,
+    style=style;
+}
+
+extern _yaml_struct_members;
+/* DOCUMENT names = _yaml_struct_members(arr);
+
+     Yields the names of the members of the array of structures ARR, in the
+     order of the structure definition.
+
+   SEE ALSO: yaml_emit_struct.
+ */
+
 extern yaml_stream_start_event;
 extern yaml_stream_end_event;
 /* DOCUMENT event = yaml_stream_start_event([event,] encoding=);
@@ -569,6 +1259,21 @@ local YAML_NO_NODE, YAML_SCALAR_NODE, YAML_SEQUENCE_NODE, YAML_MAPPING_NODE;
    SEE ALSO:
 */
 
+local YAML_NULL_VALUE, YAML_BOOL_VALUE, YAML_INT_VALUE, YAML_FLOAT_VALUE;
+local YAML_STRING_VALUE, YAML_EMPTY_SEQUENCE, YAML_EMPTY_MAPPING;
+/* DOCUMENT Kinds of leaves for yaml_flatten and yaml_unflatten.
+
+     YAML_NULL_VALUE:     A null scalar.
+     YAML_BOOL_VALUE:     A boolean scalar.
+     YAML_INT_VALUE:      An integer scalar.
+     YAML_FLOAT_VALUE:    A floating-point scalar.
+     YAML_STRING_VALUE:   Any other scalar.
+     YAML_EMPTY_SEQUENCE: An empty sequence.
+     YAML_EMPTY_MAPPING:  An empty mapping.
+
+   SEE ALSO: yaml_flatten.
+*/
+
 local YAML_PARSE_STREAM_START_STATE, YAML_PARSE_IMPLICIT_DOCUMENT_START_STATE, YAML_PARSE_DOCUMENT_START_STATE, YAML_PARSE_DOCUMENT_CONTENT_STATE, YAML_PARSE_DOCUMENT_END_STATE, YAML_PARSE_BLOCK_NODE_STATE, YAML_PARSE_BLOCK_NODE_OR_INDENTLESS_SEQUENCE_STATE, YAML_PARSE_FLOW_NODE_STATE, YAML_PARSE_BLOCK_SEQUENCE_FIRST_ENTRY_STATE, YAML_PARSE_BLOCK_SEQUENCE_ENTRY_STATE, YAML_PARSE_INDENTLESS_SEQUENCE_ENTRY_STATE, YAML_PARSE_BLOCK_MAPPING_FIRST_KEY_STATE, YAML_PARSE_BLOCK_MAPPING_KEY_STATE, YAML_PARSE_BLOCK_MAPPING_VALUE_STATE, YAML_PARSE_FLOW_SEQUENCE_FIRST_ENTRY_STATE, YAML_PARSE_FLOW_SEQUENCE_ENTRY_STATE, YAML_PARSE_FLOW_SEQUENCE_ENTRY_MAPPING_KEY_STATE, YAML_PARSE_FLOW_SEQUENCE_ENTRY_MAPPING_VALUE_STATE, YAML_PARSE_FLOW_SEQUENCE_ENTRY_MAPPING_END_STATE, YAML_PARSE_FLOW_MAPPING_FIRST_KEY_STATE, YAML_PARSE_FLOW_MAPPING_KEY_STATE, YAML_PARSE_FLOW_MAPPING_VALUE_STATE, YAML_PARSE_FLOW_MAPPING_EMPTY_VALUE_STATE, YAML_PARSE_END_STATE;
 /* DOCUMENT YAML parser states.
 
@@ -0,0 +1,3270 @@
+/*
+ * yaml_core.c --
+ *
+ * Reentrant core of the YAML plugin which does not depend on Yorick.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2018: Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * See LICENSE.md for details.
+ *
+ */
+
+#if defined(__linux__) && ! defined(_GNU_SOURCE)
+#  define _GNU_SOURCE /* for sync_file_range and CPU_COUNT */
+#endif
+#ifndef _FILE_OFFSET_BITS
+#  define _FILE_OFFSET_BITS 64 /* for files larger than 2 GiB */
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#  include <sys/inotify.h>
+#endif
+
+#include "yaml_core.h"
+
+#define FALSE 0
+#define TRUE  1
+
+/*---------------------------------------------------------------------------*/
+/* MEMORY */
+
+int
+ycore_grow_array(void** ptr, size_t* size, size_t n, size_t elsize)
+{
+  if (n > *size) {
+    size_t newsize = (*size < 16 ? 16 : *size);
+    void* newptr;
+    while (newsize < n) {
+      newsize *= 2;
+    }
+    newptr = realloc(*ptr, newsize*elsize);
+    if (newptr == NULL) {
+      return FALSE;
+    }
+    *ptr = newptr;
+    *size = newsize;
+  }
+  return TRUE;
+}
+
+/*---------------------------------------------------------------------------*/
+/* PARALLEL LOOPS */
+
+/*
+ * A parallel loop splits a range of indices in contiguous chunks which are
+ * processed by a process-wide pool of worker threads shared by all the
+ * bulk operations of the plugin.  The loop body must not call the Yorick
+ * API (in particular y_error) as it may not run in the main thread.
+ *
+ * The pool is created when first needed.  Each thread (the calling thread
+ * and the workers) has a deque of chunks: a thread takes the chunks at the
+ * bottom of its own deque, and steals chunks at the top of the others when
+ * its deque is empty.  The number of threads is set by
+ * ycore_set_parallel_threads(), by default it is the number of CPUs
+ * available to the process (given its CPU affinity and its cgroup CPU
+ * quota, if any).
+ *
+ * The pool runs one job at a time: the thread which runs a job holds the
+ * BUSY lock of the pool.  A loop started while the pool is busy (by
+ * another thread or in the body of a loop) runs in its calling thread, so
+ * loops can be nested or started by several threads at the same time.
+ */
+
+/* Minimum number of iterations per chunk, below this, loops run in the
+   calling thread. */
+#define PARALLEL_GRAIN 16384
+
+/* Number of chunks per thread (more than one for load balancing). */
+#define PARALLEL_CHUNKS 4
+
+typedef struct _chunk_t chunk_t;
+struct _chunk_t {
+  ycore_parallel_body_t* body;
+  void* data;
+  size_t start, stop;
+};
+
+typedef struct _deque_t deque_t;
+struct _deque_t {
+  pthread_mutex_t lock;
+  chunk_t* chunk;
+  size_t top, bottom; /* chunks in [top,bottom) */
+  size_t size;
+};
+
+typedef struct _pool_t pool_t;
+struct _pool_t {
+  pthread_mutex_t lock;
+  pthread_cond_t work; /* signaled when chunks are available */
+  pthread_cond_t done; /* signaled when all chunks have been processed */
+  pthread_t* thread; /* worker threads */
+  deque_t* deque; /* deques of the calling thread (0) and of the workers */
+  int nthreads; /* number of threads (including the calling thread) */
+  int nworkers; /* number of started workers */
+  int quit; /* workers must exit? */
+  long job; /* index of the last job */
+  size_t pending; /* number of chunks not yet processed */
+  pthread_mutex_t busy; /* held by the thread running a job */
+  int setting; /* number of threads, 0 for automatic */
+};
+
+static pool_t pool = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+  PTHREAD_COND_INITIALIZER, NULL, NULL, 0, 0, 0, 0, 0,
+  PTHREAD_MUTEX_INITIALIZER, 0
+};
+
+/* Take a chunk from the bottom of deque SELF, or steal one from the top of
+   another deque.  Returns false if there are no chunks left. */
+static int
+take_chunk(int self, chunk_t* c)
+{
+  int i, n = pool.nworkers + 1;
+  for (i = 0; i < n; ++i) {
+    deque_t* d = &pool.deque[(self + i) % n];
+    int found = FALSE;
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom) {
+      *c = (i == 0 ? d->chunk[--d->bottom] : d->chunk[d->top++]);
+      found = TRUE;
+    }
+    pthread_mutex_unlock(&d->lock);
+    if (found) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/* Process chunks until there are none left. */
+static void
+run_chunks(int self)
+{
+  chunk_t c;
+  while (take_chunk(self, &c)) {
+    c.body(c.data, c.start, c.stop);
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.pending == 0) {
+      pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+  }
+}
+
+static void*
+run_worker(void* arg)
+{
+  int self = (int)(intptr_t)arg;
+  long job;
+  pthread_mutex_lock(&pool.lock);
+  job = pool.job;
+  while (! pool.quit) {
+    if (pool.job == job) {
+      pthread_cond_wait(&pool.work, &pool.lock);
+      continue;
+    }
+    job = pool.job;
+    pthread_mutex_unlock(&pool.lock);
+    run_chunks(self);
+    pthread_mutex_lock(&pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+/* Stop the workers and free the pool resources. */
+static void
+stop_pool(void)
+{
+  int i;
+  pthread_mutex_lock(&pool.lock);
+  pool.quit = TRUE;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+  for (i = 0; i < pool.nworkers; ++i) {
+    pthread_join(pool.thread[i], NULL);
+  }
+  if (pool.deque != NULL) {
+    for (i = 0; i < pool.nthreads; ++i) {
+      pthread_mutex_destroy(&pool.deque[i].lock);
+      free(pool.deque[i].chunk);
+    }
+  }
+  free(pool.deque);
+  free(pool.thread);
+  pool.deque = NULL;
+  pool.thread = NULL;
+  pool.nthreads = 0;
+  pool.nworkers = 0;
+  pool.quit = FALSE;
+}
+
+/* Start a pool of NTHREADS threads (including the calling thread).  The
+   pool may have less workers than requested if some cannot be started.
+   Returns false on failure. */
+static int
+start_pool(int nthreads)
+{
+  int i;
+  pool.thread = (pthread_t*)malloc((nthreads - 1)*sizeof(pthread_t));
+  pool.deque = (deque_t*)calloc(nthreads, sizeof(deque_t));
+  if (pool.thread == NULL || pool.deque == NULL) {
+    free(pool.thread);
+    free(pool.deque);
+    pool.thread = NULL;
+    pool.deque = NULL;
+    return FALSE;
+  }
+  pool.nthreads = nthreads;
+  for (i = 0; i < nthreads; ++i) {
+    pthread_mutex_init(&pool.deque[i].lock, NULL);
+  }
+  pthread_mutex_lock(&pool.lock);
+  while (pool.nworkers < nthreads - 1 &&
+         pthread_create(&pool.thread[pool.nworkers], NULL, run_worker,
+                        (void*)(intptr_t)(pool.nworkers + 1)) == 0) {
+    ++pool.nworkers;
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return TRUE;
+}
+
+const char* ycore_cgroup_root = "";
+
+/* Open file NAME (an absolute path) of the cgroup description for
+   reading. */
+static FILE*
+open_cgroup_file(const char* name)
+{
+  char path[4096];
+  if (strlen(ycore_cgroup_root) + strlen(name) >= sizeof(path)) {
+    return NULL;
+  }
+  sprintf(path, "%s%s", ycore_cgroup_root, name);
+  return fopen(path, "r");
+}
+
+/* Read a line of at most SIZE - 1 bytes of file PATH into BUF.  Returns
+   false on failure. */
+static int
+read_first_line(const char* path, char* buf, size_t size)
+{
+  FILE* file = fopen(path, "r");
+  int ok = (file != NULL && fgets(buf, size, file) != NULL);
+  if (file != NULL) {
+    fclose(file);
+  }
+  return ok;
+}
+
+/* Check whether the comma-separated list of controllers LIST has NAME. */
+static int
+has_controller(const char* list, const char* name)
+{
+  size_t len = strlen(name);
+  while (list != NULL) {
+    if (strncmp(list, name, len) == 0 &&
+        (list[len] == ',' || list[len] == '\0' || list[len] == '\n')) {
+      return TRUE;
+    }
+    list = strchr(list, ',');
+    if (list != NULL) {
+      ++list;
+    }
+  }
+  return FALSE;
+}
+
+/* Get the path of the cgroup of the process in the cgroup v2 hierarchy or,
+   if V1 is true, in the cgroup v1 hierarchy of the "cpu" controller (from
+   /proc/self/cgroup whose lines are "ID:CONTROLLERS:PATH").  Returns false
+   if not found. */
+static int
+cgroup_path(int v1, char* path, size_t size)
+{
+  char line[4096];
+  int found = FALSE;
+  FILE* file = open_cgroup_file("/proc/self/cgroup");
+  if (file == NULL) {
+    return FALSE;
+  }
+  while (! found && fgets(line, sizeof(line), file) != NULL) {
+    char* list = strchr(line, ':');
+    char* str = (list == NULL ? NULL : strchr(++list, ':'));
+    size_t len;
+    if (str == NULL) {
+      continue;
+    }
+    *str++ = '\0';
+    if (v1 ? ! has_controller(list, "cpu") :
+        (strcmp(line, "0:") != 0 || list[0] != '\0')) {
+      continue;
+    }
+    len = strcspn(str, "\n");
+    if (str[0] == '/' && len < size) {
+      memcpy(path, str, len);
+      path[len] = '\0';
+      found = TRUE;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/* Find where the cgroup hierarchy (v2, or v1 with the "cpu" controller) is
+   mounted (from /proc/self/mountinfo whose lines are "ID PARENT DEV ROOT
+   MOUNT OPTIONS... - TYPE SOURCE SUPER-OPTIONS").  ROOT is the path in the
+   hierarchy of the mounted directory.  Returns false if not found. */
+static int
+cgroup_mount(int v1, char* mount, char* root, size_t size)
+{
+  char line[4096], type[32], opts[1024], fmt[64];
+  int found = FALSE;
+  FILE* file = open_cgroup_file("/proc/self/mountinfo");
+  if (file == NULL || size < 2) {
+    if (file != NULL) {
+      fclose(file);
+    }
+    return FALSE;
+  }
+  sprintf(fmt, "%%*s %%*s %%*s %%%lus %%%lus",
+          (unsigned long)size - 1, (unsigned long)size - 1);
+  while (! found && fgets(line, sizeof(line), file) != NULL) {
+    const char* sep = strstr(line, " - ");
+    if (sep == NULL ||
+        sscanf(sep + 3, "%31s %*s %1023s", type, opts) != 2 ||
+        strcmp(type, (v1 ? "cgroup" : "cgroup2")) != 0 ||
+        (v1 && ! has_controller(opts, "cpu"))) {
+      continue;
+    }
+    found = (sscanf(line, fmt, root, mount) == 2);
+  }
+  fclose(file);
+  return found;
+}
+
+/* Yield the number of CPUs allowed by the quota of the cgroup directory
+   DIR, -1 if there is no quota. */
+static double
+cgroup_quota(int v1, const char* dir)
+{
+  char path[4232], buf[128]; /* DIR has less than 4200 bytes */
+  double quota = -1, period = -1;
+  if (! v1) {
+    /* cgroup v2: "max PERIOD" or "QUOTA PERIOD" */
+    sprintf(path, "%s/cpu.max", dir);
+    if (! read_first_line(path, buf, sizeof(buf)) ||
+        sscanf(buf, "%lf %lf", &quota, &period) != 2) {
+      return -1;
+    }
+  } else {
+    /* cgroup v1: a quota of -1 means no limit */
+    sprintf(path, "%s/cpu.cfs_quota_us", dir);
+    if (read_first_line(path, buf, sizeof(buf))) {
+      quota = strtod(buf, NULL);
+      sprintf(path, "%s/cpu.cfs_period_us", dir);
+      if (read_first_line(path, buf, sizeof(buf))) {
+        period = strtod(buf, NULL);
+      }
+    }
+  }
+  return (quota > 0 && period > 0 ? quota/period : -1);
+}
+
+/* The cgroup of the process is resolved in its hierarchy (it is not
+   necessarily the root of the mounted hierarchy, e.g. for systemd slices or
+   batch jobs without a cgroup namespace) and the most restrictive quota of
+   the cgroup and of its ancestors applies. */
+int
+ycore_cgroup_cpus(void)
+{
+  char path[2048], mount[2048], root[2048], dir[4200];
+  double cpus = -1;
+  int v1;
+  for (v1 = 0; v1 <= 1 && cpus < 0; ++v1) {
+    const char* rel = "";
+    size_t len, base;
+    if (! cgroup_mount(v1, mount, root, sizeof(root))) {
+      continue;
+    }
+    if (cgroup_path(v1, path, sizeof(path))) {
+      /* Path relative to the mounted directory. */
+      len = strlen(root);
+      if (strcmp(root, "/") == 0) {
+        rel = path;
+      } else if (strncmp(path, root, len) == 0 &&
+                 (path[len] == '/' || path[len] == '\0')) {
+        rel = path + len;
+      }
+    }
+    base = strlen(ycore_cgroup_root) + strlen(mount);
+    if (base + strlen(rel) >= sizeof(dir)) {
+      continue;
+    }
+    strcpy(dir, ycore_cgroup_root);
+    strcat(dir, mount);
+    strcat(dir, rel);
+    len = strlen(dir);
+    while (len > base && dir[len - 1] == '/') {
+      dir[--len] = '\0';
+    }
+    while (TRUE) {
+      double q = cgroup_quota(v1, dir);
+      if (q > 0 && (cpus < 0 || q < cpus)) {
+        cpus = q;
+      }
+      /* Move to the parent directory. */
+      while (len > base && dir[len - 1] != '/') {
+        --len;
+      }
+      if (len <= base) {
+        break;
+      }
+      dir[--len] = '\0';
+    }
+  }
+  return (cpus > 0 ? (int)ceil(cpus) : 0);
+}
+
+/* Yield the number of CPUs available to the process. */
+static int
+available_cpus(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  int quota;
+#if defined(__linux__) && defined(CPU_COUNT)
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+    n = CPU_COUNT(&set);
+  }
+#endif
+  quota = ycore_cgroup_cpus();
+  if (quota > 0 && quota < n) {
+    n = quota;
+  }
+  if (n < 1) {
+    return 1;
+  }
+  return (n > YCORE_MAXIMUM_THREADS ? YCORE_MAXIMUM_THREADS : (int)n);
+}
+
+int
+ycore_parallel_threads(void)
+{
+  int n;
+  pthread_mutex_lock(&pool.lock);
+  n = pool.setting;
+  pthread_mutex_unlock(&pool.lock);
+  return (n > 0 ? n : available_cpus());
+}
+
+void
+ycore_set_parallel_threads(int n)
+{
+  /* Wait for the running job (if any).  The pool is restarted with its
+     new size when needed. */
+  pthread_mutex_lock(&pool.busy);
+  if (n != pool.setting) {
+    stop_pool();
+    pthread_mutex_lock(&pool.lock);
+    pool.setting = n;
+    pthread_mutex_unlock(&pool.lock);
+  }
+  pthread_mutex_unlock(&pool.busy);
+}
+
+/* Run a parallel loop with the pool (the caller holds the BUSY lock).
+   Returns false if the loop has not been run. */
+static int
+run_job(size_t n, ycore_parallel_body_t* body, void* data)
+{
+  size_t i, nchunks = n/PARALLEL_GRAIN;
+  int nthreads;
+
+  if (pool.nthreads == 0) {
+    nthreads = ycore_parallel_threads();
+    if (nthreads <= 1 || ! start_pool(nthreads)) {
+      return FALSE;
+    }
+  }
+  nthreads = pool.nworkers + 1;
+  if (nchunks > (size_t)nthreads*PARALLEL_CHUNKS) {
+    nchunks = (size_t)nthreads*PARALLEL_CHUNKS;
+  }
+  if (nchunks <= 1 || nthreads <= 1) {
+    return FALSE;
+  }
+
+  /* Make room in the deques.  Workers may still be looking for chunks of
+     the previous job, so the deques are only modified with their lock. */
+  for (i = 0; i < (size_t)nthreads; ++i) {
+    deque_t* d = &pool.deque[i];
+    size_t size = (nchunks + nthreads - 1)/nthreads;
+    int ok = TRUE;
+    pthread_mutex_lock(&d->lock);
+    if (d->size < size) {
+      chunk_t* chunk = (chunk_t*)realloc(d->chunk, size*sizeof(chunk_t));
+      if (chunk == NULL) {
+        ok = FALSE;
+      } else {
+        d->chunk = chunk;
+        d->size = size;
+      }
+    }
+    d->top = 0; /* the deque is empty after the previous job */
+    d->bottom = 0;
+    pthread_mutex_unlock(&d->lock);
+    if (! ok) {
+      return FALSE;
+    }
+  }
+
+  /* Distribute the chunks in the deques (the count of pending chunks must
+     be set before as workers may start with them). */
+  pthread_mutex_lock(&pool.lock);
+  pool.pending = nchunks;
+  pthread_mutex_unlock(&pool.lock);
+  for (i = 0; i < nchunks; ++i) {
+    deque_t* d = &pool.deque[i % nthreads];
+    chunk_t* c;
+    pthread_mutex_lock(&d->lock);
+    c = &d->chunk[d->bottom++];
+    c->body = body;
+    c->data = data;
+    c->start = (n/nchunks)*i;
+    c->stop = (i == nchunks - 1 ? n : (n/nchunks)*(i + 1));
+    pthread_mutex_unlock(&d->lock);
+  }
+
+  /* Start the job, take part in it and wait for completion. */
+  pthread_mutex_lock(&pool.lock);
+  ++pool.job;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+  run_chunks(0);
+  pthread_mutex_lock(&pool.lock);
+  while (pool.pending > 0) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return TRUE;
+}
+
+void
+ycore_parallel_for(size_t n, ycore_parallel_body_t* body, void* data)
+{
+  int done = FALSE;
+  if (n/PARALLEL_GRAIN > 1 && pthread_mutex_trylock(&pool.busy) == 0) {
+    done = run_job(n, body, data);
+    pthread_mutex_unlock(&pool.busy);
+  }
+  if (! done && n > 0) {
+    /* Short loop, busy pool or no workers: run in the calling thread. */
+    body(data, 0, n);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* SCALARS */
+
+static int
+match_null(const char* s)
+{
+  return (s[0] == '\0' || strcmp(s, "~") == 0 || strcmp(s, "null") == 0 ||
+          strcmp(s, "Null") == 0 || strcmp(s, "NULL") == 0);
+}
+
+/* Returns 1 for true, 0 for false and -1 otherwise. */
+static int
+match_bool(const char* s)
+{
+  if (strcmp(s, "true") == 0 || strcmp(s, "True") == 0 ||
+      strcmp(s, "TRUE") == 0) {
+    return 1;
+  }
+  if (strcmp(s, "false") == 0 || strcmp(s, "False") == 0 ||
+      strcmp(s, "FALSE") == 0) {
+    return 0;
+  }
+  return -1;
+}
+
+/* Check whether S is an integer of the core schema and write its canonical
+   form in BUF (of size SIZE) unless BUF is NULL. */
+static int
+match_int(const char* s, char* buf, size_t size)
+{
+  const char* p;
+  size_t n;
+  if (s[0] == '0' && (s[1] == 'o' || s[1] == 'x')) {
+    int base = (s[1] == 'o' ? 8 : 16);
+    unsigned long long val;
+    char* end;
+    for (p = s + 2; *p != '\0'; ++p) {
+      if (base == 8 ? (*p < '0' || *p > '7') : ! isxdigit((unsigned char)*p)) {
+        return FALSE;
+      }
+    }
+    if (p == s + 2) {
+      return FALSE;
+    }
+    errno = 0;
+    val = strtoull(s + 2, &end, base);
+    if (errno == 0) {
+      if (buf != NULL) {
+        sprintf(buf, "%llu", val);
+      }
+    } else {
+      /* Too large, keep the text in lower case. */
+      if (strlen(s) + 1 > size) {
+        return FALSE;
+      }
+      if (buf == NULL) {
+        return TRUE;
+      }
+      for (n = 0; s[n] != '\0'; ++n) {
+        buf[n] = tolower((unsigned char)s[n]);
+      }
+      buf[n] = '\0';
+    }
+    return TRUE;
+  }
+  p = s;
+  if (*p == '-' || *p == '+') {
+    ++p;
+  }
+  if (*p == '\0') {
+    return FALSE;
+  }
+  for (n = 0; p[n] != '\0'; ++n) {
+    if (p[n] < '0' || p[n] > '9') {
+      return FALSE;
+    }
+  }
+  /* Strip leading zeros (no limit on the number of digits). */
+  while (p[0] == '0' && p[1] != '\0') {
+    ++p;
+  }
+  n = strlen(p);
+  if (n + 2 > size) {
+    return FALSE;
+  }
+  if (buf == NULL) {
+    return TRUE;
+  }
+  if (s[0] == '-' && p[0] != '0') {
+    buf[0] = '-';
+    strcpy(buf + 1, p);
+  } else {
+    strcpy(buf, p);
+  }
+  return TRUE;
+}
+
+/* Check whether S is a floating-point value of the core schema and write its
+   canonical form in BUF (of size SIZE >= 32) unless BUF is NULL. */
+static int
+match_float(const char* s, char* buf, size_t size)
+{
+  const char* p = s;
+  int neg = FALSE, ndigits = 0;
+  double val;
+  if (*p == '-' || *p == '+') {
+    neg = (*p == '-');
+    ++p;
+  }
+  if (strcmp(p, ".inf") == 0 || strcmp(p, ".Inf") == 0 ||
+      strcmp(p, ".INF") == 0) {
+    if (buf != NULL) {
+      strcpy(buf, (neg ? "-.inf" : ".inf"));
+    }
+    return TRUE;
+  }
+  if (strcmp(s, ".nan") == 0 || strcmp(s, ".NaN") == 0 ||
+      strcmp(s, ".NAN") == 0) {
+    if (buf != NULL) {
+      strcpy(buf, ".nan");
+    }
+    return TRUE;
+  }
+  while (*p >= '0' && *p <= '9') {
+    ++p;
+    ++ndigits;
+  }
+  if (*p == '.') {
+    ++p;
+    while (*p >= '0' && *p <= '9') {
+      ++p;
+      ++ndigits;
+    }
+  }
+  if (ndigits == 0) {
+    return FALSE;
+  }
+  if (*p == 'e' || *p == 'E') {
+    ++p;
+    if (*p == '-' || *p == '+') {
+      ++p;
+    }
+    if (*p < '0' || *p > '9') {
+      return FALSE;
+    }
+    while (*p >= '0' && *p <= '9') {
+      ++p;
+    }
+  }
+  if (*p != '\0' || size < 32) {
+    return FALSE;
+  }
+  if (buf == NULL) {
+    return TRUE;
+  }
+  val = strtod(s, NULL);
+  if (isinf(val)) {
+    strcpy(buf, (val < 0 ? "-.inf" : ".inf"));
+  } else {
+    sprintf(buf, "%.17g", val);
+    if (strpbrk(buf, ".e") == NULL) {
+      strcat(buf, ".0");
+    }
+  }
+  return TRUE;
+}
+
+/* Resolve the type of a scalar according to the YAML core schema.  For
+   all types but strings and tagged values, the canonical form of the value
+   is written in BUF unless BUF is NULL (the type is then resolved without
+   converting the value, SIZE still limits the length of numbers). */
+int
+ycore_resolve_scalar(const yaml_char_t* tag_, const yaml_char_t* val_,
+                     size_t len, yaml_scalar_style_t style, char* buf,
+                     size_t size)
+{
+  const char* tag = (const char*)tag_;
+  const char* val = (const char*)val_;
+  const char* type = NULL;
+  int b;
+
+  if (tag != NULL) {
+    if (strcmp(tag, "!") == 0) {
+      return YCORE_HASH_STRING;
+    }
+    if (strncmp(tag, YCORE_TAG_PREFIX, strlen(YCORE_TAG_PREFIX)) != 0) {
+      return YCORE_HASH_TAGGED;
+    }
+    type = tag + strlen(YCORE_TAG_PREFIX);
+    if (strcmp(type, "str") == 0) {
+      return YCORE_HASH_STRING;
+    }
+  } else if (style != YAML_PLAIN_SCALAR_STYLE &&
+             style != YAML_ANY_SCALAR_STYLE) {
+    return YCORE_HASH_STRING;
+  }
+  if (strlen(val) != len) {
+    /* Embedded null. */
+    return (type == NULL ? YCORE_HASH_STRING : YCORE_HASH_TAGGED);
+  }
+  if ((type == NULL || strcmp(type, "null") == 0) && match_null(val)) {
+    if (buf != NULL) {
+      strcpy(buf, "null");
+    }
+    return YCORE_HASH_NULL;
+  }
+  if ((type == NULL || strcmp(type, "bool") == 0) &&
+      (b = match_bool(val)) >= 0) {
+    if (buf != NULL) {
+      strcpy(buf, (b ? "true" : "false"));
+    }
+    return YCORE_HASH_BOOL;
+  }
+  if ((type == NULL || strcmp(type, "int") == 0) &&
+      match_int(val, buf, size)) {
+    return YCORE_HASH_INT;
+  }
+  if ((type == NULL || strcmp(type, "float") == 0) &&
+      match_float(val, buf, size)) {
+    return YCORE_HASH_FLOAT;
+  }
+  return (type == NULL ? YCORE_HASH_STRING : YCORE_HASH_TAGGED);
+}
+
+/* Convert the text S of a leaf of kind KIND (as resolved by
+   ycore_resolve_scalar for the flattened leaves) to a number. */
+double
+ycore_leaf_number(int kind, const char* s)
+{
+  const char* p = s;
+  switch (kind) {
+  case YCORE_BOOL_VALUE:
+    return (s[0] == 't' || s[0] == 'T' ? 1.0 : 0.0);
+  case YCORE_INT_VALUE:
+    if (s[0] == '0' && (s[1] == 'o' || s[1] == 'x')) {
+      int base = (s[1] == 'o' ? 8 : 16);
+      double val = 0.0;
+      for (p = s + 2; *p != '\0'; ++p) {
+        int c = *p;
+        val = base*val + (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+      }
+      return val;
+    }
+    return strtod(s, NULL) + 0.0; /* no negative zero */
+  case YCORE_FLOAT_VALUE:
+    if (*p == '-' || *p == '+') {
+      ++p;
+    }
+    if (p[0] == '.' && (p[1] == 'i' || p[1] == 'I')) {
+      return (s[0] == '-' ? -HUGE_VAL : HUGE_VAL);
+    }
+    if (p[0] == '.' && (p[1] == 'n' || p[1] == 'N')) {
+      return NAN;
+    }
+    return strtod(s, NULL);
+  default:
+    return 0.0;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* CANONICAL HASHING */
+
+/*
+ * A hasher consumes a stream of events and computes a 128-bit fingerprint
+ * of its contents in the manner of a Merkle tree: the digest of a scalar
+ * depends on its resolved type and on its canonical value, the digest of a
+ * sequence depends on the digests of its items (in order) and the digest of
+ * a mapping depends on the digests of its key-value pairs sorted by key
+ * digests.  Styles, anchors and the order of keys are thus irrelevant and
+ * aliases stand for the nodes they refer to.  Only the digests of the items
+ * of the collections being built are stored, not the whole tree.  If an
+ * output file is given, the canonical form of each document (in flow style
+ * with keys sorted in lexicographic order) is written to it.
+ *
+ * The hash function is MurmurHash3 (x64, 128-bit version) by Austin
+ * Appleby which is in the public domain.
+ */
+
+struct _ycore_hframe_t {
+  int kind; /* kind of collection */
+  char* anchor; /* anchor of the collection or NULL */
+  char* tag; /* non-core tag of the collection or NULL */
+  ycore_hnode_t* item; /* items of the collection */
+  size_t count; /* number of items */
+  size_t size; /* number of allocated items */
+};
+
+struct _ycore_hanchor_t {
+  char* name;
+  ycore_hnode_t node;
+};
+
+static uint64_t
+rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t
+fmix64(uint64_t k)
+{
+  k ^= k >> 33;
+  k *= UINT64_C(0xff51afd7ed558ccd);
+  k ^= k >> 33;
+  k *= UINT64_C(0xc4ceb9fe1a85ec53);
+  k ^= k >> 33;
+  return k;
+}
+
+static uint64_t
+get_u64(const unsigned char* p)
+{
+  return (((uint64_t)p[0])       | ((uint64_t)p[1] <<  8) |
+          ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+          ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+          ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56));
+}
+
+uint64_t
+ycore_hash_bytes(uint64_t h, const void* ptr, size_t len)
+{
+  const unsigned char* buf = (const unsigned char*)ptr;
+  size_t i;
+  for (i = 0; i < len; ++i) {
+    h = (h ^ buf[i])*UINT64_C(0x100000001b3); /* FNV-1a */
+  }
+  return h;
+}
+
+uint64_t
+ycore_hash_mix(uint64_t h, uint64_t x)
+{
+  h = ((h << 5) | (h >> 59)) ^ x;
+  return h*UINT64_C(0x9e3779b97f4a7c15);
+}
+
+void
+ycore_murmur3_128(const void* key, size_t len, uint64_t out[2])
+{
+  const uint64_t c1 = UINT64_C(0x87c37b91114253d5);
+  const uint64_t c2 = UINT64_C(0x4cf5ad432745937f);
+  const unsigned char* data = (const unsigned char*)key;
+  const unsigned char* tail;
+  size_t i, nblocks = len/16;
+  uint64_t h1 = 0, h2 = 0, k1, k2;
+
+  for (i = 0; i < nblocks; ++i) {
+    k1 = get_u64(data + 16*i);
+    k2 = get_u64(data + 16*i + 8);
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+  }
+  tail = data + 16*nblocks;
+  k1 = 0;
+  k2 = 0;
+  switch (len & 15) {
+  case 15: k2 ^= ((uint64_t)tail[14]) << 48;
+    /* fall through */
+  case 14: k2 ^= ((uint64_t)tail[13]) << 40;
+    /* fall through */
+  case 13: k2 ^= ((uint64_t)tail[12]) << 32;
+    /* fall through */
+  case 12: k2 ^= ((uint64_t)tail[11]) << 24;
+    /* fall through */
+  case 11: k2 ^= ((uint64_t)tail[10]) << 16;
+    /* fall through */
+  case 10: k2 ^= ((uint64_t)tail[ 9]) << 8;
+    /* fall through */
+  case  9: k2 ^= ((uint64_t)tail[ 8]);
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    /* fall through */
+  case  8: k1 ^= ((uint64_t)tail[ 7]) << 56;
+    /* fall through */
+  case  7: k1 ^= ((uint64_t)tail[ 6]) << 48;
+    /* fall through */
+  case  6: k1 ^= ((uint64_t)tail[ 5]) << 40;
+    /* fall through */
+  case  5: k1 ^= ((uint64_t)tail[ 4]) << 32;
+    /* fall through */
+  case  4: k1 ^= ((uint64_t)tail[ 3]) << 24;
+    /* fall through */
+  case  3: k1 ^= ((uint64_t)tail[ 2]) << 16;
+    /* fall through */
+  case  2: k1 ^= ((uint64_t)tail[ 1]) << 8;
+    /* fall through */
+  case  1: k1 ^= ((uint64_t)tail[ 0]);
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+  h1 ^= (uint64_t)len;
+  h2 ^= (uint64_t)len;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+  out[0] = h1;
+  out[1] = h2;
+}
+
+void
+ycore_hasher_init(ycore_hasher_t* h)
+{
+  memset(h, 0, sizeof(ycore_hasher_t));
+}
+
+static void
+free_frame_items(ycore_hframe_t* f)
+{
+  while (f->count > 0) {
+    free(f->item[--f->count].text);
+  }
+  free(f->anchor);
+  free(f->tag);
+  f->anchor = NULL;
+  f->tag = NULL;
+}
+
+static void
+free_anchors(ycore_hasher_t* h)
+{
+  while (h->nanchors > 0) {
+    ycore_hanchor_t* a = &h->anchor[--h->nanchors];
+    free(a->name);
+    free(a->node.text);
+  }
+}
+
+void
+ycore_hasher_destroy(ycore_hasher_t* h)
+{
+  size_t i;
+  for (i = 0; i < h->nframes; ++i) {
+    if (i < h->depth) {
+      free_frame_items(&h->frame[i]);
+    }
+    free(h->frame[i].item);
+  }
+  free(h->frame);
+  free_anchors(h);
+  free(h->anchor);
+  free(h->buffer);
+  if (h->output != NULL && h->open) {
+    fclose(h->output);
+  }
+  memset(h, 0, sizeof(ycore_hasher_t));
+}
+
+/* Append N bytes to the scratch buffer.  Returns false on error. */
+int
+ycore_buf_put(ycore_hasher_t* h, const void* ptr, size_t n)
+{
+  if (h->length + n + 1 > h->size) {
+    size_t size = (h->size < 256 ? 256 : h->size);
+    char* buffer;
+    while (size < h->length + n + 1) {
+      size *= 2;
+    }
+    buffer = (char*)realloc(h->buffer, size);
+    if (buffer == NULL) {
+      return FALSE;
+    }
+    h->buffer = buffer;
+    h->size = size;
+  }
+  memcpy(h->buffer + h->length, ptr, n);
+  h->length += n;
+  return TRUE;
+}
+
+int
+ycore_buf_puts(ycore_hasher_t* h, const char* str)
+{
+  return ycore_buf_put(h, str, strlen(str));
+}
+
+int
+ycore_buf_put_digest(ycore_hasher_t* h, const uint64_t d[2])
+{
+  unsigned char b[16];
+  int i;
+  for (i = 0; i < 8; ++i) {
+    b[i]     = (unsigned char)(d[0] >> (8*i));
+    b[i + 8] = (unsigned char)(d[1] >> (8*i));
+  }
+  return ycore_buf_put(h, b, 16);
+}
+
+/* Append a double-quoted string to the scratch buffer. */
+int
+ycore_buf_put_quoted(ycore_hasher_t* h, const char* str, size_t len)
+{
+  size_t i;
+  if (! ycore_buf_put(h, "\"", 1)) {
+    return FALSE;
+  }
+  for (i = 0; i < len; ++i) {
+    unsigned char c = str[i];
+    char esc[8];
+    if (c == '"' || c == '\\') {
+      esc[0] = '\\';
+      esc[1] = c;
+      esc[2] = '\0';
+    } else if (c == '\n') {
+      strcpy(esc, "\\n");
+    } else if (c == '\t') {
+      strcpy(esc, "\\t");
+    } else if (c < 0x20 || c == 0x7f) {
+      sprintf(esc, "\\x%02x", c);
+    } else {
+      esc[0] = c;
+      esc[1] = '\0';
+    }
+    if (! ycore_buf_puts(h, esc)) {
+      return FALSE;
+    }
+  }
+  return ycore_buf_put(h, "\"", 1);
+}
+
+/* Yield a copy of the contents of the scratch buffer from OFFSET. */
+char*
+ycore_buf_copy(ycore_hasher_t* h, size_t offset)
+{
+  size_t len = h->length - offset;
+  char* str = (char*)malloc(len + 1);
+  if (str != NULL) {
+    memcpy(str, h->buffer + offset, len);
+    str[len] = '\0';
+  }
+  return str;
+}
+
+char*
+ycore_copy_string(const yaml_char_t* str)
+{
+  char* dup;
+  if (str == NULL) {
+    return NULL;
+  }
+  dup = (char*)malloc(strlen((const char*)str) + 1);
+  if (dup != NULL) {
+    strcpy(dup, (const char*)str);
+  }
+  return dup;
+}
+
+int
+ycore_compare_digests(const uint64_t a[2], const uint64_t b[2])
+{
+  if (a[0] != b[0]) {
+    return (a[0] < b[0] ? -1 : 1);
+  }
+  if (a[1] != b[1]) {
+    return (a[1] < b[1] ? -1 : 1);
+  }
+  return 0;
+}
+
+/* Compare key-value pairs by key digests. */
+int
+ycore_compare_pair_digests(const void* a, const void* b)
+{
+  return ycore_compare_digests(((const ycore_hnode_t*)a)->h,
+                               ((const ycore_hnode_t*)b)->h);
+}
+
+/* Compare key-value pairs by canonical key forms. */
+static int
+compare_pair_texts(const void* a, const void* b)
+{
+  return strcmp(((const ycore_hnode_t*)a)->text,
+                ((const ycore_hnode_t*)b)->text);
+}
+
+/* Compute the digest of a scalar node and, if needed, its canonical form.
+   TEXT is the canonical value of the scalar (quoted if QUOTE is true). */
+const char*
+ycore_make_node(ycore_hasher_t* h, ycore_hnode_t* node, int kind,
+                const char* tag, const char* text, size_t len, int quote)
+{
+  node->text = NULL;
+  h->length = 0;
+  if (! ycore_buf_put(h, &kind, 1) ||
+      (tag != NULL && ! ycore_buf_put(h, tag, strlen(tag) + 1)) ||
+      ! ycore_buf_put(h, text, len)) {
+    return "insufficient memory";
+  }
+  ycore_murmur3_128(h->buffer, h->length, node->h);
+  if (h->output != NULL) {
+    h->length = 0;
+    if ((tag != NULL && (! ycore_buf_puts(h, "!<") ||
+                         ! ycore_buf_puts(h, tag) ||
+                         ! ycore_buf_puts(h, "> "))) ||
+        ! (quote ? ycore_buf_put_quoted(h, text, len) :
+           ycore_buf_put(h, text, len)) ||
+        (node->text = ycore_buf_copy(h, 0)) == NULL) {
+      return "insufficient memory";
+    }
+  }
+  return NULL;
+}
+
+/* Add a node to the collection being built (which takes the responsibility
+   of the canonical form of the node). */
+static const char*
+add_node(ycore_hasher_t* h, ycore_hnode_t* node)
+{
+  ycore_hframe_t* f;
+  if (h->depth < 1) {
+    free(node->text);
+    return "unexpected node event";
+  }
+  f = &h->frame[h->depth - 1];
+  if (f->count >= f->size) {
+    size_t size = (f->size < 8 ? 8 : 2*f->size);
+    ycore_hnode_t* item = (ycore_hnode_t*)realloc(
+        f->item, size*sizeof(ycore_hnode_t));
+    if (item == NULL) {
+      free(node->text);
+      return "insufficient memory";
+    }
+    f->item = item;
+    f->size = size;
+  }
+  f->item[f->count++] = *node;
+  return NULL;
+}
+
+static const char*
+add_anchor(ycore_hasher_t* h, const char* name, const ycore_hnode_t* node)
+{
+  ycore_hanchor_t* a;
+  if (h->nanchors >= h->maxanchors) {
+    size_t size = (h->maxanchors < 8 ? 8 : 2*h->maxanchors);
+    a = (ycore_hanchor_t*)realloc(h->anchor, size*sizeof(ycore_hanchor_t));
+    if (a == NULL) {
+      return "insufficient memory";
+    }
+    h->anchor = a;
+    h->maxanchors = size;
+  }
+  a = &h->anchor[h->nanchors];
+  a->name = ycore_copy_string((const yaml_char_t*)name);
+  a->node = *node;
+  a->node.text = NULL;
+  if (a->name == NULL ||
+      (node->text != NULL &&
+       (a->node.text = ycore_copy_string(
+           (const yaml_char_t*)node->text)) == NULL)) {
+    free(a->name);
+    return "insufficient memory";
+  }
+  ++h->nanchors;
+  return NULL;
+}
+
+static const char*
+push_frame(ycore_hasher_t* h, int kind, const yaml_char_t* anchor,
+           const yaml_char_t* tag)
+{
+  ycore_hframe_t* f;
+  if (h->depth >= h->nframes) {
+    size_t n = (h->nframes < 8 ? 8 : 2*h->nframes);
+    f = (ycore_hframe_t*)realloc(h->frame, n*sizeof(ycore_hframe_t));
+    if (f == NULL) {
+      return "insufficient memory";
+    }
+    memset(f + h->nframes, 0, (n - h->nframes)*sizeof(ycore_hframe_t));
+    h->frame = f;
+    h->nframes = n;
+  }
+  f = &h->frame[h->depth++];
+  f->kind = kind;
+  f->count = 0;
+  f->anchor = ycore_copy_string(anchor);
+  f->tag = NULL;
+  if (tag != NULL && strncmp((const char*)tag, YCORE_TAG_PREFIX,
+                             strlen(YCORE_TAG_PREFIX)) != 0) {
+    f->tag = ycore_copy_string(tag);
+  }
+  if ((anchor != NULL && f->anchor == NULL) ||
+      (tag != NULL && f->tag == NULL &&
+       strncmp((const char*)tag, YCORE_TAG_PREFIX,
+               strlen(YCORE_TAG_PREFIX)) != 0)) {
+    return "insufficient memory";
+  }
+  return NULL;
+}
+
+/* Complete the collection being built and store its digest and canonical
+   form in NODE. */
+static const char*
+pop_frame(ycore_hasher_t* h, int kind, ycore_hnode_t* node)
+{
+  ycore_hframe_t* f;
+  size_t i;
+  const char* errmsg = NULL;
+
+  node->text = NULL;
+  if (h->depth < 1 || h->frame[h->depth - 1].kind != kind) {
+    return "unbalanced events";
+  }
+  f = &h->frame[h->depth - 1];
+  if (kind == YCORE_HASH_MAPPING) {
+    if ((f->count & 1) != 0) {
+      errmsg = "missing value in mapping";
+      goto done;
+    }
+    qsort(f->item, f->count/2, 2*sizeof(ycore_hnode_t),
+          ycore_compare_pair_digests);
+  }
+  h->length = 0;
+  if (! ycore_buf_put(h, &kind, 1) ||
+      (f->tag != NULL && ! ycore_buf_put(h, f->tag, strlen(f->tag) + 1))) {
+    errmsg = "insufficient memory";
+    goto done;
+  }
+  for (i = 0; i < f->count; ++i) {
+    if (! ycore_buf_put_digest(h, f->item[i].h)) {
+      errmsg = "insufficient memory";
+      goto done;
+    }
+  }
+  ycore_murmur3_128(h->buffer, h->length, node->h);
+  if (h->output != NULL &&
+      (kind == YCORE_HASH_SEQUENCE || kind == YCORE_HASH_MAPPING)) {
+    int ok;
+    if (kind == YCORE_HASH_MAPPING) {
+      qsort(f->item, f->count/2, 2*sizeof(ycore_hnode_t), compare_pair_texts);
+    }
+    h->length = 0;
+    ok = (f->tag == NULL || (ycore_buf_puts(h, "!<") &&
+                             ycore_buf_puts(h, f->tag) &&
+                             ycore_buf_puts(h, "> ")));
+    ok = ok && ycore_buf_puts(h, (kind == YCORE_HASH_MAPPING ? "{" : "["));
+    for (i = 0; ok && i < f->count; ++i) {
+      ok = ((i == 0 ||
+             ycore_buf_puts(h, (kind == YCORE_HASH_MAPPING && (i & 1) != 0 ?
+                                ": " : ", "))) &&
+            ycore_buf_puts(h, f->item[i].text));
+    }
+    ok = ok && ycore_buf_puts(h, (kind == YCORE_HASH_MAPPING ? "}" : "]"));
+    if (! ok || (node->text = ycore_buf_copy(h, 0)) == NULL) {
+      errmsg = "insufficient memory";
+      goto done;
+    }
+  } else if (h->output != NULL && kind == YCORE_HASH_DOCUMENT) {
+    if (fputs("--- ", h->output) < 0 ||
+        (f->count > 0 && fputs(f->item[0].text, h->output) < 0) ||
+        fputs("\n", h->output) < 0) {
+      errmsg = "failed to write canonical form";
+      goto done;
+    }
+  }
+  if (f->anchor != NULL) {
+    errmsg = add_anchor(h, f->anchor, node);
+  }
+ done:
+  free_frame_items(f);
+  --h->depth;
+  if (errmsg != NULL) {
+    free(node->text);
+    node->text = NULL;
+  }
+  return errmsg;
+}
+
+/* Feed an event to the hasher (the event is left unchanged).  Returns NULL
+   on success or an error message. */
+const char*
+ycore_hasher_feed(ycore_hasher_t* h, const yaml_event_t* ev)
+{
+  const char* errmsg;
+  ycore_hnode_t node;
+  char buf[128];
+  size_t i;
+  int kind;
+
+  if (h->done) {
+    return "end of stream already reached";
+  }
+  switch (ev->type) {
+  case YAML_STREAM_START_EVENT:
+    if (h->depth != 0) {
+      return "unexpected STREAM-START event";
+    }
+    return push_frame(h, YCORE_HASH_STREAM, NULL, NULL);
+  case YAML_STREAM_END_EVENT:
+    errmsg = pop_frame(h, YCORE_HASH_STREAM, &node);
+    if (errmsg == NULL) {
+      h->digest[0] = node.h[0];
+      h->digest[1] = node.h[1];
+      h->done = TRUE;
+      if (h->output != NULL && fflush(h->output) != 0) {
+        errmsg = "failed to write canonical form";
+      }
+    }
+    return errmsg;
+  case YAML_DOCUMENT_START_EVENT:
+    if (h->depth != 1) {
+      return "unexpected DOCUMENT-START event";
+    }
+    return push_frame(h, YCORE_HASH_DOCUMENT, NULL, NULL);
+  case YAML_DOCUMENT_END_EVENT:
+    errmsg = pop_frame(h, YCORE_HASH_DOCUMENT, &node);
+    free_anchors(h);
+    return (errmsg != NULL ? errmsg : add_node(h, &node));
+  case YAML_SEQUENCE_START_EVENT:
+    return push_frame(h, YCORE_HASH_SEQUENCE, ev->data.sequence_start.anchor,
+                      ev->data.sequence_start.tag);
+  case YAML_MAPPING_START_EVENT:
+    return push_frame(h, YCORE_HASH_MAPPING, ev->data.mapping_start.anchor,
+                      ev->data.mapping_start.tag);
+  case YAML_SEQUENCE_END_EVENT:
+    errmsg = pop_frame(h, YCORE_HASH_SEQUENCE, &node);
+    return (errmsg != NULL ? errmsg : add_node(h, &node));
+  case YAML_MAPPING_END_EVENT:
+    errmsg = pop_frame(h, YCORE_HASH_MAPPING, &node);
+    return (errmsg != NULL ? errmsg : add_node(h, &node));
+  case YAML_SCALAR_EVENT:
+    kind = ycore_resolve_scalar(ev->data.scalar.tag, ev->data.scalar.value,
+                                ev->data.scalar.length, ev->data.scalar.style,
+                                buf, sizeof(buf));
+    if (kind == YCORE_HASH_STRING || kind == YCORE_HASH_TAGGED) {
+      errmsg = ycore_make_node(h, &node, kind,
+                               (kind == YCORE_HASH_TAGGED ?
+                                (const char*)ev->data.scalar.tag : NULL),
+                         (const char*)ev->data.scalar.value,
+                         ev->data.scalar.length, TRUE);
+    } else {
+      errmsg = ycore_make_node(h, &node, kind, NULL, buf, strlen(buf), FALSE);
+    }
+    if (errmsg == NULL && ev->data.scalar.anchor != NULL) {
+      errmsg = add_anchor(h, (const char*)ev->data.scalar.anchor, &node);
+    }
+    if (errmsg != NULL) {
+      free(node.text);
+      return errmsg;
+    }
+    return add_node(h, &node);
+  case YAML_ALIAS_EVENT:
+    for (i = h->nanchors; i > 0; --i) {
+      if (strcmp(h->anchor[i - 1].name,
+                 (const char*)ev->data.alias.anchor) == 0) {
+        node = h->anchor[i - 1].node;
+        if (node.text != NULL &&
+            (node.text = ycore_copy_string(
+                (const yaml_char_t*)node.text)) == NULL) {
+          return "insufficient memory";
+        }
+        return add_node(h, &node);
+      }
+    }
+    return "undefined alias";
+  default:
+    return "unexpected event";
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* OUTPUT */
+
+/*
+ * An output writes to a file descriptor through a number of large aligned
+ * blocks: libyaml hands its small internal buffer to ycore_output_write which
+ * appends it to the blocks.  All the blocks are written by a single call
+ * to writev() when they are full, at the end of the stream and when the
+ * output is closed.  Depending on the synchronization policy, the data
+ * are also committed to the storage device after every document or when
+ * the output is closed.
+ */
+
+#define OUTPUT_BLOCK_SIZE (1L << 20)
+#define DEFAULT_OUTPUT_SIZE (4L << 20)
+#define OUTPUT_ALIGNMENT 4096
+
+int
+ycore_flush_output(ycore_output_t* out)
+{
+  struct iovec iov[YCORE_MAXIMUM_OUTPUT_BLOCKS];
+  size_t i, n, len;
+  if (out->wlen == 0) {
+    return TRUE;
+  }
+  if (out->fd < 0) {
+    return FALSE;
+  }
+  if (out->fd == STDOUT_FILENO) {
+    fflush(stdout);
+  }
+  len = out->wlen;
+  for (n = 0; len > 0; ++n) {
+    iov[n].iov_base = out->blocks[n];
+    iov[n].iov_len = (len < out->bsize ? len : out->bsize);
+    len -= iov[n].iov_len;
+  }
+  i = 0;
+  while (i < n) {
+    ssize_t nw = writev(out->fd, iov + i, n - i);
+    if (nw < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return FALSE;
+    }
+    while (i < n && (size_t)nw >= iov[i].iov_len) {
+      nw -= iov[i].iov_len;
+      ++i;
+    }
+    if (nw > 0) {
+      iov[i].iov_base = (char*)iov[i].iov_base + nw;
+      iov[i].iov_len -= nw;
+    }
+  }
+  out->wlen = 0;
+  return TRUE;
+}
+
+int
+ycore_sync_output(ycore_output_t* out)
+{
+  if (! ycore_flush_output(out)) {
+    return FALSE;
+  }
+  if (out->fd >= 0 && fdatasync(out->fd) != 0 &&
+      errno != EINVAL && errno != EROFS) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+int
+ycore_output_write(void* data, unsigned char* buffer, size_t size)
+{
+  ycore_output_t* out = (ycore_output_t*)data;
+  while (size > 0) {
+    size_t j = out->wlen/out->bsize;
+    size_t k = out->wlen%out->bsize;
+    size_t n = out->bsize - k;
+    if (j >= out->nblocks) {
+      if (! ycore_flush_output(out)) {
+        return 0;
+      }
+      continue;
+    }
+    if (out->blocks[j] == NULL) {
+      void* block;
+      if (posix_memalign(&block, OUTPUT_ALIGNMENT, out->bsize) != 0) {
+        return 0;
+      }
+      out->blocks[j] = (unsigned char*)block;
+    }
+    if (n > size) {
+      n = size;
+    }
+    memcpy(out->blocks[j] + k, buffer, n);
+    out->wlen += n;
+    buffer += n;
+    size -= n;
+  }
+  return 1;
+}
+
+const char*
+ycore_output_init(ycore_output_t* out, int fd, int closefd, long bufsize,
+                  int sync)
+{
+  out->fd = fd;
+  out->closefd = closefd;
+  out->sync = sync;
+  if (bufsize <= 0) {
+    bufsize = DEFAULT_OUTPUT_SIZE;
+  }
+  if (bufsize < OUTPUT_BLOCK_SIZE) {
+    /* A single block, rounded up to the alignment. */
+    out->bsize = (bufsize + OUTPUT_ALIGNMENT - 1) & ~(OUTPUT_ALIGNMENT - 1L);
+    out->nblocks = 1;
+  } else {
+    out->bsize = OUTPUT_BLOCK_SIZE;
+    out->nblocks = (bufsize + OUTPUT_BLOCK_SIZE - 1)/OUTPUT_BLOCK_SIZE;
+    if (out->nblocks > YCORE_MAXIMUM_OUTPUT_BLOCKS) {
+      out->nblocks = YCORE_MAXIMUM_OUTPUT_BLOCKS;
+    }
+  }
+  out->blocks = (unsigned char**)calloc(out->nblocks, sizeof(unsigned char*));
+  if (out->blocks == NULL) {
+    return "insufficient memory";
+  }
+  return NULL;
+}
+
+void
+ycore_free_output(ycore_output_t* out)
+{
+  size_t i;
+  (void)ycore_close_output(out);
+  if (out->blocks != NULL) {
+    for (i = 0; i < out->nblocks; ++i) {
+      free(out->blocks[i]);
+    }
+    free(out->blocks);
+    out->blocks = NULL;
+  }
+  free(out->path);
+  free(out->temp);
+  out->path = NULL;
+  out->temp = NULL;
+}
+
+/*
+ * In atomic mode, the output is written to a temporary file in the same
+ * directory as the target file.  When the emitter is closed after a
+ * complete stream, the temporary file is committed: it is synchronized,
+ * renamed over the target and the directory is synchronized.  If the
+ * stream is incomplete (e.g. after an error), the temporary file is
+ * removed and the target is left unchanged.  Thus a crash never leaves a
+ * truncated file behind.
+ *
+ * In batched atomic mode, the writeback of a closed temporary file is only
+ * started and the file is queued.  All the queued files are committed
+ * together by yaml_commit() (also when there are too many of them, before
+ * a file which is not batched and at exit): their writebacks proceed in
+ * parallel and each directory is synchronized once so that writing many
+ * small files in a loop is not dominated by the latency of the
+ * synchronizations.
+ */
+
+#define MAXIMUM_PENDING 1024
+
+typedef struct _pending_t pending_t;
+struct _pending_t {
+  char* path; /* name of the target file */
+  char* temp; /* name of the temporary file */
+  size_t dirlen; /* length of the directory part of the names */
+  int failed; /* commit has failed? */
+};
+
+static pending_t* pending = NULL; /* queued temporary files */
+static size_t npending = 0, pending_size = 0;
+static int pending_atexit = FALSE; /* commit_at_exit() registered? */
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Length of the directory part of PATH (0 for the current directory). */
+static size_t
+dirname_length(const char* path)
+{
+  const char* slash = strrchr(path, '/');
+  return (slash == NULL ? 0 : (slash == path ? 1 : slash - path));
+}
+
+/* Synchronize the directory whose name is the first LEN bytes of PATH.
+   Returns false on error. */
+static int
+sync_directory(const char* path, size_t len)
+{
+  char* dir;
+  int fd, status;
+  if (len == 0) {
+    path = ".";
+    len = 1;
+  }
+  dir = (char*)malloc(len + 1);
+  if (dir == NULL) {
+    return FALSE;
+  }
+  memcpy(dir, path, len);
+  dir[len] = '\0';
+  fd = open(dir, O_RDONLY);
+  free(dir);
+  if (fd < 0) {
+    return FALSE;
+  }
+  status = (fsync(fd) == 0 || errno == EINVAL);
+  close(fd);
+  return status;
+}
+
+const char*
+ycore_open_atomic(ycore_output_t* out, const char* filename, int atomic)
+{
+  struct stat st;
+  size_t len = strlen(filename);
+  mode_t mask;
+  int fd;
+  out->path = (char*)malloc(len + 1);
+  out->temp = (char*)malloc(len + 8);
+  if (out->path == NULL || out->temp == NULL) {
+    return "insufficient memory";
+  }
+  memcpy(out->path, filename, len + 1);
+  memcpy(out->temp, filename, len);
+  memcpy(out->temp + len, ".XXXXXX", 8);
+  fd = mkstemp(out->temp);
+  if (fd < 0) {
+    free(out->temp);
+    out->temp = NULL;
+    return "failed to create temporary file";
+  }
+  out->fd = fd;
+  out->closefd = TRUE;
+  out->atomic = atomic;
+  /* Give the file the permissions of the target, or the default ones. */
+  if (stat(filename, &st) == 0) {
+    (void)fchmod(fd, st.st_mode & 07777);
+  } else {
+    mask = umask(0);
+    umask(mask);
+    (void)fchmod(fd, 0666 & ~mask);
+  }
+  return NULL;
+}
+
+/* Commit all queued temporary files, the caller owns the lock of the
+   queue.  Returns NULL on success, an error message otherwise. */
+static const char*
+commit_queued(void)
+{
+  const char* errmsg = NULL;
+  size_t i, j;
+
+  /* Wait for the data of all files to be on the storage device, then
+     replace the targets. */
+  for (i = 0; i < npending; ++i) {
+    pending_t* e = &pending[i];
+    int fd = open(e->temp, O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+      errmsg = "failed to synchronize temporary file";
+      unlink(e->temp);
+      e->failed = TRUE;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  for (i = 0; i < npending; ++i) {
+    pending_t* e = &pending[i];
+    if (! e->failed && rename(e->temp, e->path) != 0) {
+      errmsg = "failed to rename temporary file";
+      unlink(e->temp);
+      e->failed = TRUE;
+    }
+  }
+
+  /* Synchronize each directory once. */
+  for (i = 0; i < npending; ++i) {
+    pending_t* e = &pending[i];
+    if (e->failed) {
+      continue;
+    }
+    for (j = 0; j < i; ++j) {
+      if (! pending[j].failed && pending[j].dirlen == e->dirlen &&
+          strncmp(pending[j].path, e->path, e->dirlen) == 0) {
+        break;
+      }
+    }
+    if (j == i && ! sync_directory(e->path, e->dirlen)) {
+      errmsg = "failed to synchronize directory";
+    }
+  }
+  for (i = 0; i < npending; ++i) {
+    free(pending[i].path);
+    free(pending[i].temp);
+  }
+  npending = 0;
+  return errmsg;
+}
+
+const char*
+ycore_commit_pending(void)
+{
+  const char* errmsg;
+  pthread_mutex_lock(&pending_lock);
+  errmsg = commit_queued();
+  pthread_mutex_unlock(&pending_lock);
+  return errmsg;
+}
+
+/* Commit the files still queued when the process exits, so that they are
+   not left as temporary files. */
+static void
+commit_at_exit(void)
+{
+  (void)ycore_commit_pending();
+}
+
+/* Commit the temporary file of output OUT whose file descriptor is FD.
+   The output loses the ownership of the names of the files.  Returns NULL
+   on success, an error message otherwise. */
+static const char*
+commit_atomic(ycore_output_t* out, int fd)
+{
+  const char* errmsg = NULL;
+  pending_t* e;
+  if (out->atomic == YCORE_ATOMIC_BATCH) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    (void)sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+  } else if (fsync(fd) != 0) {
+    close(fd);
+    unlink(out->temp);
+    return "failed to synchronize temporary file";
+  }
+  if (close(fd) != 0) {
+    unlink(out->temp);
+    return "failed to write output";
+  }
+  if (out->atomic == YCORE_ATOMIC_BATCH) {
+    pthread_mutex_lock(&pending_lock);
+    if (! pending_atexit) {
+      pending_atexit = (atexit(commit_at_exit) == 0);
+    }
+    if (npending >= pending_size) {
+      size_t size = (pending_size < 16 ? 16 : 2*pending_size);
+      pending_t* tmp = (pending_t*)realloc(pending, size*sizeof(pending_t));
+      if (tmp == NULL) {
+        pthread_mutex_unlock(&pending_lock);
+        unlink(out->temp);
+        return "insufficient memory";
+      }
+      pending = tmp;
+      pending_size = size;
+    }
+    e = &pending[npending++];
+    e->path = out->path;
+    e->temp = out->temp;
+    e->dirlen = dirname_length(out->path);
+    e->failed = FALSE;
+    out->path = NULL;
+    out->temp = NULL;
+    if (npending >= MAXIMUM_PENDING) {
+      errmsg = commit_queued();
+    }
+    pthread_mutex_unlock(&pending_lock);
+    return errmsg;
+  }
+  /* The files queued before are committed first, so that the targets are
+     replaced in the order of their closing. */
+  errmsg = ycore_commit_pending();
+  if (rename(out->temp, out->path) != 0) {
+    unlink(out->temp);
+    return "failed to rename temporary file";
+  }
+  if (! sync_directory(out->path, dirname_length(out->path))) {
+    return "failed to synchronize directory";
+  }
+  return errmsg;
+}
+
+const char*
+ycore_close_output(ycore_output_t* out)
+{
+  const char* errmsg = NULL;
+  int fd = out->fd;
+  if (fd < 0) {
+    return NULL;
+  }
+  if (out->atomic && ! out->ended) {
+    errmsg = "incomplete YAML stream, output discarded";
+  } else if (! (out->sync != YCORE_SYNC_NEVER && ! out->atomic ?
+                ycore_sync_output(out) : ycore_flush_output(out))) {
+    errmsg = "failed to write output";
+  }
+  out->fd = -1;
+  if (out->atomic) {
+    if (errmsg != NULL) {
+      close(fd);
+      unlink(out->temp);
+      return errmsg;
+    }
+    return commit_atomic(out, fd);
+  }
+  if (out->closefd && close(fd) != 0) {
+    errmsg = "failed to write output";
+  }
+  return errmsg;
+}
+
+/*---------------------------------------------------------------------------*/
+/* EVENTS */
+
+size_t ycore_max_libyaml_length = INT_MAX;
+
+int
+ycore_scalar_event_initialize(yaml_event_t* event, const yaml_char_t* anchor,
+                              const yaml_char_t* tag, const yaml_char_t* value,
+                              size_t length, int plain_implicit,
+                              int quoted_implicit, yaml_scalar_style_t style)
+{
+  yaml_char_t* anchor_copy = NULL;
+  yaml_char_t* tag_copy = NULL;
+  yaml_char_t* value_copy = NULL;
+
+  if (length == (size_t)-1) {
+    length = strlen((const char*)value);
+  }
+  if (length <= ycore_max_libyaml_length) {
+    return yaml_scalar_event_initialize(event, anchor, tag, value,
+                                        (int)length, plain_implicit,
+                                        quoted_implicit, style);
+  }
+
+  /* Build the event as libyaml does (the strings are released by
+     yaml_event_delete() with free()). */
+  if ((anchor != NULL &&
+       (anchor_copy = (yaml_char_t*)strdup((const char*)anchor)) == NULL) ||
+      (tag != NULL &&
+       (tag_copy = (yaml_char_t*)strdup((const char*)tag)) == NULL) ||
+      (value_copy = (yaml_char_t*)malloc(length + 1)) == NULL) {
+    free(anchor_copy);
+    free(tag_copy);
+    return 0;
+  }
+  memcpy(value_copy, value, length);
+  value_copy[length] = '\0';
+  memset(event, 0, sizeof(yaml_event_t));
+  event->type = YAML_SCALAR_EVENT;
+  event->data.scalar.anchor = anchor_copy;
+  event->data.scalar.tag = tag_copy;
+  event->data.scalar.value = value_copy;
+  event->data.scalar.length = length;
+  event->data.scalar.plain_implicit = plain_implicit;
+  event->data.scalar.quoted_implicit = quoted_implicit;
+  event->data.scalar.style = style;
+  return 1;
+}
+
+int
+ycore_copy_event(yaml_event_t* dst, const yaml_event_t* src)
+{
+  switch (src->type) {
+  case YAML_STREAM_START_EVENT:
+    return yaml_stream_start_event_initialize(
+        dst, src->data.stream_start.encoding);
+  case YAML_STREAM_END_EVENT:
+    return yaml_stream_end_event_initialize(dst);
+  case YAML_DOCUMENT_START_EVENT:
+    return yaml_document_start_event_initialize(
+        dst, src->data.document_start.version_directive,
+        src->data.document_start.tag_directives.start,
+        src->data.document_start.tag_directives.end,
+        src->data.document_start.implicit);
+  case YAML_DOCUMENT_END_EVENT:
+    return yaml_document_end_event_initialize(
+        dst, src->data.document_end.implicit);
+  case YAML_ALIAS_EVENT:
+    return yaml_alias_event_initialize(dst, src->data.alias.anchor);
+  case YAML_SCALAR_EVENT:
+    return ycore_scalar_event_initialize(
+        dst, src->data.scalar.anchor, src->data.scalar.tag,
+        src->data.scalar.value, src->data.scalar.length,
+        src->data.scalar.plain_implicit, src->data.scalar.quoted_implicit,
+        src->data.scalar.style);
+  case YAML_SEQUENCE_START_EVENT:
+    return yaml_sequence_start_event_initialize(
+        dst, src->data.sequence_start.anchor, src->data.sequence_start.tag,
+        src->data.sequence_start.implicit, src->data.sequence_start.style);
+  case YAML_SEQUENCE_END_EVENT:
+    return yaml_sequence_end_event_initialize(dst);
+  case YAML_MAPPING_START_EVENT:
+    return yaml_mapping_start_event_initialize(
+        dst, src->data.mapping_start.anchor, src->data.mapping_start.tag,
+        src->data.mapping_start.implicit, src->data.mapping_start.style);
+  case YAML_MAPPING_END_EVENT:
+    return yaml_mapping_end_event_initialize(dst);
+  default:
+    return FALSE;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* READER */
+
+void
+ycore_reader_init(ycore_reader_t* r)
+{
+  memset(r, 0, sizeof(ycore_reader_t));
+  r->parsing = YCORE_ANY;
+  r->fd = -1;
+  r->watch = -1;
+}
+
+void
+ycore_reader_destroy(ycore_reader_t* r)
+{
+  if (r->init) {
+    r->init = FALSE;
+    yaml_parser_delete(&r->parser);
+  }
+  if (r->fd >= 0 && r->closefd) {
+    close(r->fd);
+  }
+  r->fd = -1;
+  free(r->rbuf);
+  r->rbuf = NULL;
+  if (r->watch >= 0) {
+    close(r->watch);
+  }
+  r->watch = -1;
+  free(r->history);
+  r->history = NULL;
+  while (r->nahead > 0) {
+    yaml_event_delete(&r->ahead[r->head].event);
+    r->head = (r->head + 1) & (r->maxahead - 1);
+    --r->nahead;
+  }
+  free(r->ahead);
+  r->ahead = NULL;
+}
+
+/*
+ * Readers read their input from a file descriptor (opened by us or given
+ * by the caller, e.g. a pipe from a decompressor or a socket) with a large
+ * buffer: libyaml only asks for small chunks, the buffer reduces the number
+ * of system calls.  For regular files, the kernel is advised that the file
+ * is read sequentially and the buffer is not larger than the file.
+ */
+
+#define DEFAULT_BUFFER_SIZE (1L << 20)
+#define MINIMUM_BUFFER_SIZE 4096L
+
+static int track_input(ycore_reader_t* r, const unsigned char* buf,
+                       size_t n);
+
+static int
+input_read(void* data, unsigned char* buffer, size_t size,
+           size_t* size_read)
+{
+  ycore_reader_t* r = (ycore_reader_t*)data;
+  size_t n;
+  if (r->rpos >= r->rlen) {
+    ssize_t nr;
+    do {
+      nr = read(r->fd, r->rbuf, r->rsize);
+    } while (nr < 0 && errno == EINTR);
+    if (nr < 0) {
+      return 0;
+    }
+    r->rpos = 0;
+    r->rlen = nr;
+  }
+  n = r->rlen - r->rpos;
+  if (n > size) {
+    n = size;
+  }
+  memcpy(buffer, r->rbuf + r->rpos, n);
+  r->rpos += n;
+  if (! track_input(r, buffer, n)) {
+    return 0;
+  }
+  *size_read = n;
+  return 1;
+}
+
+const char*
+ycore_reader_set_input(ycore_reader_t* r, int fd, int closefd,
+                       int64_t offset, long bufsize)
+{
+  struct stat st;
+  r->fd = fd;
+  r->closefd = closefd;
+  if (bufsize <= 0) {
+    bufsize = DEFAULT_BUFFER_SIZE;
+  }
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if (bufsize > st.st_size - offset + 1) {
+      bufsize = st.st_size - offset + 1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    (void)posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  if (bufsize < MINIMUM_BUFFER_SIZE) {
+    bufsize = MINIMUM_BUFFER_SIZE;
+  }
+  if (offset > 0 && (offset != (off_t)offset ||
+                     lseek(fd, (off_t)offset, SEEK_SET) != offset)) {
+    return "failed to seek input position";
+  }
+  r->rbuf = (unsigned char*)malloc(bufsize);
+  if (r->rbuf == NULL) {
+    return "insufficient memory";
+  }
+  r->rsize = bufsize;
+  return NULL;
+}
+
+/* Set the marks of a new libyaml parser to the current position of a
+   tracking reader. */
+static void
+init_marks(ycore_reader_t* r, long line, long column)
+{
+  r->parser.mark.index = r->nchars;
+  r->parser.mark.line = line;
+  r->parser.mark.column = column;
+}
+
+const char*
+ycore_reader_start(ycore_reader_t* r)
+{
+  if (! yaml_parser_initialize(&r->parser)) {
+    return "failed to initialize parser";
+  }
+  r->init = TRUE;
+  yaml_parser_set_input(&r->parser, input_read, r);
+  if (r->track) {
+    init_marks(r, r->cpline, r->cpcolumn);
+  }
+  return NULL;
+}
+
+const char*
+ycore_reader_open(ycore_reader_t* r, const char* filename)
+{
+  const char* errmsg;
+  int fd;
+  if (filename == NULL) {
+    return "invalid file name";
+  }
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return "failed to open file for reading";
+  }
+  errmsg = ycore_reader_set_input(r, fd, TRUE, 0, 0);
+  if (errmsg == NULL) {
+    errmsg = ycore_reader_start(r);
+  }
+  return errmsg;
+}
+
+/*
+ * A checkpoint is the position after a DOCUMENT-END event: byte offset,
+ * character index, line, column and number of documents.  A new reader can
+ * resume at a checkpoint.  The marks of libyaml count characters (not
+ * bytes), so the input read by a tracking reader is kept in a history
+ * buffer from which byte offsets are computed.  The history starts at an
+ * anchor whose byte offset and character index are known and which moves
+ * forward after each conversion.  As the marks of the parser are not far
+ * behind what has been read, the history is trimmed when it becomes large.
+ * Only UTF-8 input is supported.
+ */
+
+#define HISTORY_SIZE (1L << 20)
+
+#define IS_UTF8_CONTINUATION(c) (((c) & 0xC0) == 0x80)
+
+/* Move the anchor of the history forward by N bytes (N must be at a
+   character boundary). */
+static void
+drop_history(ycore_reader_t* r, size_t n)
+{
+  const unsigned char* h = (const unsigned char*)r->history;
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    if (! IS_UTF8_CONTINUATION(h[i])) {
+      ++r->hchar;
+    }
+  }
+  memmove(r->history, r->history + n, r->hlen - n);
+  r->hlen -= n;
+  r->hbyte += n;
+}
+
+/* Keep track of N bytes of input read by the parser.  Returns false on
+   failure. */
+static int
+track_input(ycore_reader_t* r, const unsigned char* buf, size_t n)
+{
+  size_t i;
+  if (! r->track || n == 0) {
+    return TRUE;
+  }
+  if (r->hbyte == 0 && r->hlen == 0 && r->hchar == 0 && n >= 3 &&
+      buf[0] == 0xEF && buf[1] == 0xBB && buf[2] == 0xBF) {
+    /* The BOM is not counted by libyaml. */
+    r->hchar = -1;
+    r->nchars = -1;
+  }
+  for (i = 0; i < n; ++i) {
+    if (! IS_UTF8_CONTINUATION(buf[i])) {
+      ++r->nchars;
+    }
+  }
+  if (r->hlen + n > HISTORY_SIZE) {
+    size_t k = r->hlen/2;
+    while (k < r->hlen &&
+           IS_UTF8_CONTINUATION(((unsigned char*)r->history)[k])) {
+      ++k;
+    }
+    drop_history(r, k);
+  }
+  if (! ycore_grow_array((void**)&r->history, &r->hsize, r->hlen + n, 1)) {
+    r->error = "insufficient memory";
+    return FALSE;
+  }
+  memcpy(r->history + r->hlen, buf, n);
+  r->hlen += n;
+  return TRUE;
+}
+
+/* Convert a character index of the input into a byte offset stored in
+   *BYTE.  Returns false on failure. */
+static int
+byte_offset(ycore_reader_t* r, long index, int64_t* byte)
+{
+  const unsigned char* h = (const unsigned char*)r->history;
+  size_t i = 0;
+  long c = r->hchar;
+  if (index < c) {
+    r->error = "checkpoint is no longer available";
+    return FALSE;
+  }
+  while (c < index) {
+    if (i >= r->hlen) {
+      r->error = "checkpoint is not yet available";
+      return FALSE;
+    }
+    ++i;
+    while (i < r->hlen && IS_UTF8_CONTINUATION(h[i])) {
+      ++i;
+    }
+    ++c;
+  }
+  drop_history(r, i);
+  *byte = r->hbyte;
+  return TRUE;
+}
+
+/* Store in *BYTE the byte offset of the end of a document, -1 if
+   checkpoints are not enabled.  This must be done as soon as the document
+   end has been parsed, while its position is in the history.  Returns
+   false on failure. */
+static int
+checkpoint_offset(ycore_reader_t* r, const yaml_mark_t* mark,
+                  int64_t* byte)
+{
+  *byte = -1;
+  if (! r->track) {
+    return TRUE;
+  }
+  if (r->parser.encoding != YAML_UTF8_ENCODING) {
+    r->error = "checkpoints are only supported for UTF-8 input";
+    return FALSE;
+  }
+  return byte_offset(r, mark->index, byte);
+}
+
+/* Record the checkpoint at the end of a document whose byte offset is
+   BYTE (see checkpoint_offset). */
+static void
+set_checkpoint(ycore_reader_t* r, const yaml_mark_t* mark, int64_t byte)
+{
+  ++r->ndocs;
+  if (r->track) {
+    r->cpbyte = byte;
+    r->cpchar = mark->index;
+    r->cpline = mark->line;
+    r->cpcolumn = mark->column;
+    r->cpdoc = r->ndocs;
+  }
+}
+
+const char*
+ycore_reader_resume(ycore_reader_t* r, const int64_t cp[5])
+{
+  int i;
+  r->track = TRUE;
+  if (cp == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < 5; ++i) {
+    if (cp[i] < 0 || (i > 0 && cp[i] > LONG_MAX)) {
+      return "invalid checkpoint";
+    }
+  }
+  r->hbyte = r->cpbyte = cp[0];
+  r->hchar = r->cpchar = r->nchars = (long)cp[1];
+  r->cpline = (long)cp[2];
+  r->cpcolumn = (long)cp[3];
+  r->ndocs = r->cpdoc = (long)cp[4];
+  return NULL;
+}
+
+/*
+ * In follow mode, the reader reads a file which is being appended (like
+ * "tail -f").  Only complete documents are given to libyaml: the input of
+ * the parser ends at the last document marker, that is at the beginning of
+ * the last line starting with "---" or after the last line starting with
+ * "...".  When the parser reaches the end of its input, it is re-created to
+ * resume at this offset once the file has grown (its marks are set to
+ * count from the beginning of the file).  Intermediate STREAM-START and
+ * STREAM-END events are not delivered.
+ */
+
+static int
+follow_read(void* data, unsigned char* buffer, size_t size,
+            size_t* size_read)
+{
+  ycore_reader_t* r = (ycore_reader_t*)data;
+  ssize_t n = r->end - r->pos;
+  if (n > (ssize_t)size) {
+    n = size;
+  }
+  if (n > 0) {
+    n = pread(r->fd, buffer, n, r->pos);
+    if (n < 0 || ! track_input(r, buffer, n)) {
+      return 0;
+    }
+    r->pos += n;
+  }
+  *size_read = n;
+  return 1;
+}
+
+static int
+is_marker(const char* head, const char* marker)
+{
+  return (head[0] == marker[0] && head[1] == marker[1] &&
+          head[2] == marker[2] && (head[3] == ' ' || head[3] == '\t' ||
+                                   head[3] == '\r' || head[3] == '\n'));
+}
+
+/* Scan the lines appended to the file for document markers and update the
+   end of complete documents.  Returns false on failure. */
+static int
+follow_scan(ycore_reader_t* r)
+{
+  char buf[16384], head[4];
+  int64_t off = r->scanned, start = off;
+  long line = r->scannedline;
+  ssize_t i, n;
+  int col = 0;
+  struct stat st;
+
+  if (fstat(r->fd, &st) != 0) {
+    r->error = "failed to get file size";
+    return FALSE;
+  }
+  if (st.st_size < r->scanned) {
+    r->error = "followed file has been truncated";
+    return FALSE;
+  }
+  while ((n = pread(r->fd, buf, sizeof(buf), off)) > 0) {
+    for (i = 0; i < n; ++i) {
+      char c = buf[i];
+      if (col < 4) {
+        head[col] = c;
+      }
+      if (++col == 4 && is_marker(head, "---") && start > r->limit) {
+        r->limit = start;
+        r->limitline = line;
+      }
+      if (c == '\n') {
+        ++line;
+        if (col >= 4 && is_marker(head, "...")) {
+          r->limit = off + i + 1;
+          r->limitline = line;
+        }
+        col = 0;
+        start = off + i + 1;
+        r->scanned = start;
+        r->scannedline = line;
+      }
+    }
+    off += n;
+  }
+  if (n < 0) {
+    r->error = "failed to read followed file";
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static double
+elapsed_time(const struct timespec* t0)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - t0->tv_sec) + 1E-9*(t.tv_nsec - t0->tv_nsec);
+}
+
+/* Wait at most SECS seconds (for ever if negative) for the file to be
+   modified.  Modifications are notified by inotify on Linux, otherwise the
+   file is polled. */
+static void
+follow_wait(ycore_reader_t* r, double secs)
+{
+  int ms = (secs < 0 ? 100 : (secs > 0.1 ? 100 : (int)(1E3*secs + 0.5)));
+  if (r->watch >= 0) {
+    struct pollfd fds;
+    fds.fd = r->watch;
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (secs < 0) {
+      ms = -1;
+    } else {
+      ms = (int)(1E3*secs + 0.5);
+    }
+    if (poll(&fds, 1, ms) > 0) {
+      char buf[4096];
+      while (read(r->watch, buf, sizeof(buf)) > 0) {
+        ; /* drain pending notifications */
+      }
+    }
+  } else if (ms > 0) {
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000L*ms;
+    nanosleep(&ts, NULL);
+  }
+}
+
+void
+ycore_reader_follow(ycore_reader_t* r, const char* filename, double timeout)
+{
+  /* Tracking is needed to set the marks when the parser is re-created.
+     Only event-based parsing is possible in follow mode. */
+  r->parsing = YCORE_PARSE;
+  r->follow = TRUE;
+  r->timeout = timeout;
+  r->track = TRUE;
+  r->pos = r->end = r->limit = r->scanned = r->cpbyte;
+  r->endline = r->limitline = r->scannedline = r->cpline;
+#ifdef __linux__
+  r->watch = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+  if (r->watch >= 0 &&
+      inotify_add_watch(r->watch, filename, IN_MODIFY|IN_CLOSE_WRITE) < 0) {
+    close(r->watch);
+    r->watch = -1;
+  }
+#endif
+}
+
+/* (Re)create the libyaml parser of a reader in follow mode to read the
+   complete documents available from its current position.  Returns false
+   on failure. */
+static int
+follow_restart(ycore_reader_t* r)
+{
+  if (r->init) {
+    r->init = FALSE;
+    yaml_parser_delete(&r->parser);
+  }
+  if (! yaml_parser_initialize(&r->parser)) {
+    r->error = "failed to initialize parser";
+    return FALSE;
+  }
+  r->init = TRUE;
+  yaml_parser_set_input(&r->parser, follow_read, r);
+  init_marks(r, r->endline, (r->end == r->cpbyte ? r->cpcolumn : 0));
+  r->end = r->limit;
+  r->endline = r->limitline;
+  return TRUE;
+}
+
+/* Parse the next event of reader R.  Errors of the input handlers are
+   reported as parser errors unless they have set a more precise error. */
+static int
+parse_next(ycore_reader_t* r, yaml_event_t* event)
+{
+  r->error = NULL;
+  if (! yaml_parser_parse(&r->parser, event)) {
+    if (r->error == NULL) {
+      r->error = "parser error";
+    }
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Get the next event from reader R, not considering the lookahead, with
+   the same returned value as ycore_reader_next(). */
+static int
+read_event(ycore_reader_t* r, yaml_event_t* event, int64_t* byte)
+{
+  struct timespec t0;
+  double remain;
+  int waiting = FALSE;
+
+  if (! r->follow) {
+    if (! parse_next(r, event)) {
+      return -1;
+    }
+    if (event->type == YAML_DOCUMENT_END_EVENT &&
+        ! checkpoint_offset(r, &event->end_mark, byte)) {
+      yaml_event_delete(event);
+      return -1;
+    }
+    return 1;
+  }
+  while (TRUE) {
+    if (r->init && ! r->parser.stream_end_produced) {
+      if (! parse_next(r, event)) {
+        return -1;
+      }
+      if (event->type == YAML_STREAM_START_EVENT && ! r->started) {
+        r->started = TRUE;
+        return 1;
+      }
+      if (event->type != YAML_STREAM_START_EVENT &&
+          event->type != YAML_STREAM_END_EVENT) {
+        if (event->type == YAML_DOCUMENT_END_EVENT &&
+            ! checkpoint_offset(r, &event->end_mark, byte)) {
+          yaml_event_delete(event);
+          return -1;
+        }
+        return 1;
+      }
+      yaml_event_delete(event);
+      continue;
+    }
+    if (! follow_scan(r)) {
+      return -1;
+    }
+    if (r->limit > r->end) {
+      if (! follow_restart(r)) {
+        return -1;
+      }
+      continue;
+    }
+    if (! waiting) {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      waiting = TRUE;
+    }
+    remain = (r->timeout < 0 ? -1 : r->timeout - elapsed_time(&t0));
+    if (r->timeout >= 0 && remain <= 0) {
+      return 0;
+    }
+    follow_wait(r, remain);
+  }
+}
+
+int
+ycore_reader_next(ycore_reader_t* r, yaml_event_t* event)
+{
+  int64_t byte = -1;
+  r->items = -1;
+  if (r->nahead > 0) {
+    ycore_ahead_t* a = &r->ahead[r->head];
+    *event = a->event;
+    byte = a->byte;
+    r->items = a->items;
+    r->scalars = a->scalars;
+    r->head = (r->head + 1) & (r->maxahead - 1);
+    --r->nahead;
+  } else {
+    int status = read_event(r, event, &byte);
+    if (status <= 0) {
+      r->seqstart = FALSE;
+      return status;
+    }
+  }
+  r->seqstart = (event->type == YAML_SEQUENCE_START_EVENT);
+  if (event->type == YAML_DOCUMENT_END_EVENT) {
+    set_checkpoint(r, &event->end_mark, byte);
+  }
+  return 1;
+}
+
+/* The events are parsed once and buffered in a ring buffer until
+   delivered. */
+int
+ycore_reader_peek(ycore_reader_t* r, size_t k, ycore_ahead_t** ptr)
+{
+  while (r->nahead < k) {
+    ycore_ahead_t* a;
+    int status;
+    if (r->nahead >= r->maxahead) {
+      /* Grow the ring buffer, unwrapping its contents. */
+      size_t i, size = (r->maxahead < 8 ? 8 : 2*r->maxahead);
+      ycore_ahead_t* ahead = (ycore_ahead_t*)malloc(
+          size*sizeof(ycore_ahead_t));
+      if (ahead == NULL) {
+        r->error = "insufficient memory";
+        return -1;
+      }
+      for (i = 0; i < r->nahead; ++i) {
+        ahead[i] = r->ahead[(r->head + i) & (r->maxahead - 1)];
+      }
+      free(r->ahead);
+      r->ahead = ahead;
+      r->head = 0;
+      r->maxahead = size;
+    }
+    a = &r->ahead[(r->head + r->nahead) & (r->maxahead - 1)];
+    a->byte = -1;
+    a->items = -1;
+    a->scalars = FALSE;
+    status = read_event(r, &a->event, &a->byte);
+    if (status <= 0) {
+      return status;
+    }
+    ++r->nahead;
+  }
+  *ptr = &r->ahead[(r->head + k - 1) & (r->maxahead - 1)];
+  return 1;
+}
+
+/* Open collection while measuring a sequence. */
+typedef struct _measure_t measure_t;
+struct _measure_t {
+  size_t k; /* position of the START event (0 for the outer sequence) */
+  long items; /* number of items so far */
+  int scalars; /* all items so far are scalars? */
+  int sequence; /* a sequence (not a mapping)? */
+};
+
+size_t ycore_max_measured_events = 65536;
+
+/* The nested sequences are measured by the same single pass, so that
+   building a whole tree of sequences after this first pass only costs one
+   more pass over the buffered events.  A sequence too long to be measured
+   is left unmeasured (but its nested sequences which end before the limit
+   are measured), so that the lookahead stays bounded. */
+int
+ycore_reader_measure(ycore_reader_t* r)
+{
+  measure_t* stack;
+  measure_t* top;
+  ycore_ahead_t* a;
+  size_t k, depth = 0, size = 16;
+  int status;
+
+  if (! r->seqstart) {
+    r->error = "last delivered event is not a SEQUENCE-START";
+    return -1;
+  }
+  if (r->items >= 0) {
+    return 1;
+  }
+  stack = (measure_t*)malloc(size*sizeof(measure_t));
+  if (stack == NULL) {
+    r->error = "insufficient memory";
+    return -1;
+  }
+  top = stack;
+  top->k = 0;
+  top->items = 0;
+  top->scalars = TRUE;
+  top->sequence = TRUE;
+  for (k = 1; ; ++k) {
+    yaml_event_type_t type;
+    if (k > ycore_max_measured_events) {
+      free(stack);
+      return 1;
+    }
+    status = ycore_reader_peek(r, k, &a);
+    if (status <= 0) {
+      break;
+    }
+    type = a->event.type;
+    if (type == YAML_SCALAR_EVENT) {
+      ++top->items;
+    } else if (type == YAML_ALIAS_EVENT) {
+      ++top->items;
+      top->scalars = FALSE;
+    } else if (type == YAML_SEQUENCE_START_EVENT ||
+               type == YAML_MAPPING_START_EVENT) {
+      ++top->items;
+      top->scalars = FALSE;
+      if (++depth >= size) {
+        measure_t* tmp = (measure_t*)realloc(stack,
+                                             2*size*sizeof(measure_t));
+        if (tmp == NULL) {
+          free(stack);
+          r->error = "insufficient memory";
+          return -1;
+        }
+        stack = tmp;
+        size *= 2;
+      }
+      top = &stack[depth];
+      top->k = k;
+      top->items = 0;
+      top->scalars = TRUE;
+      top->sequence = (type == YAML_SEQUENCE_START_EVENT);
+    } else if (type == YAML_SEQUENCE_END_EVENT ||
+               type == YAML_MAPPING_END_EVENT) {
+      if (depth == 0) {
+        r->items = top->items;
+        r->scalars = top->scalars;
+        free(stack);
+        return 1;
+      }
+      if (top->sequence) {
+        a = &r->ahead[(r->head + top->k - 1) & (r->maxahead - 1)];
+        a->items = top->items;
+        a->scalars = top->scalars;
+      }
+      top = &stack[--depth];
+    } else {
+      free(stack);
+      r->error = "unexpected event in sequence";
+      return -1;
+    }
+  }
+  free(stack);
+  return status;
+}
+
+/*---------------------------------------------------------------------------*/
+/* DOCUMENTS */
+
+void
+ycore_document_destroy(ycore_document_t* doc)
+{
+  if (doc->init) {
+    doc->init = FALSE;
+    yaml_document_delete(&doc->document);
+  }
+  free(doc->digest);
+  doc->digest = NULL;
+  free(doc->state);
+  doc->state = NULL;
+  if (doc->merged != NULL) {
+    int i;
+    for (i = 0; i < doc->nnodes; ++i) {
+      free(doc->merged[i]);
+    }
+    free(doc->merged);
+    doc->merged = NULL;
+  }
+  free(doc->nmerged);
+  doc->nmerged = NULL;
+}
+
+const char*
+ycore_load_document(ycore_reader_t* r, ycore_document_t* doc)
+{
+  int64_t byte;
+  if (r->parsing == YCORE_ANY) {
+    r->parsing = YCORE_LOAD;
+  } else if (r->parsing != YCORE_LOAD) {
+    return "not a document-based parser";
+  }
+  r->error = NULL;
+  if (! yaml_parser_load(&r->parser, &doc->document)) {
+    return (r->error != NULL ? r->error : "parser error");
+  }
+  doc->init = TRUE;
+  if (yaml_document_get_root_node(&doc->document) == NULL) {
+    return NULL;
+  }
+  if (! checkpoint_offset(r, &doc->document.end_mark, &byte)) {
+    return r->error;
+  }
+  set_checkpoint(r, &doc->document.end_mark, byte);
+  doc->nnodes = doc->document.nodes.top - doc->document.nodes.start;
+  doc->root = 1;
+  return NULL;
+}
+
+int
+ycore_document_add_scalar(yaml_document_t* document, const yaml_char_t* tag,
+                          const yaml_char_t* value, size_t length,
+                          yaml_scalar_style_t style)
+{
+  yaml_node_t* node;
+  yaml_char_t* copy;
+  int id;
+  if (length <= ycore_max_libyaml_length) {
+    return yaml_document_add_scalar(document, tag, value, (int)length, style);
+  }
+  copy = (yaml_char_t*)malloc(length + 1);
+  if (copy == NULL) {
+    return 0;
+  }
+  id = yaml_document_add_scalar(document, tag, (const yaml_char_t*)"", 0,
+                                style);
+  if (id == 0) {
+    free(copy);
+    return 0;
+  }
+  memcpy(copy, value, length);
+  copy[length] = '\0';
+  node = yaml_document_get_node(document, id);
+  free(node->data.scalar.value);
+  node->data.scalar.value = copy;
+  node->data.scalar.length = length;
+  return id;
+}
+
+static yaml_node_t*
+get_node(ycore_document_t* doc, int id)
+{
+  return yaml_document_get_node(&doc->document, id);
+}
+
+const char*
+ycore_node_tag(const yaml_node_t* node)
+{
+  const char* tag = (const char*)node->tag;
+  if (tag == NULL ||
+      strncmp(tag, YCORE_TAG_PREFIX, strlen(YCORE_TAG_PREFIX)) == 0) {
+    return NULL;
+  }
+  return tag;
+}
+
+int
+ycore_resolve_node(const yaml_node_t* node, char* buf, size_t size,
+                   const yaml_char_t** tag)
+{
+  *tag = node->tag;
+  if (*tag != NULL &&
+      strcmp((const char*)*tag, YAML_DEFAULT_SCALAR_TAG) == 0 &&
+      node->data.scalar.style == YAML_PLAIN_SCALAR_STYLE) {
+    *tag = NULL;
+  }
+  return ycore_resolve_scalar(*tag, node->data.scalar.value,
+                              node->data.scalar.length,
+                              node->data.scalar.style, buf, size);
+}
+
+/* Compute the digest of a node of a document.  The scratch buffer of
+   hasher H is used. */
+static const char*
+node_digest(ycore_hasher_t* h, ycore_document_t* doc, int id)
+{
+  yaml_node_t* node = get_node(doc, id);
+  uint64_t* dig = doc->digest + 2*(id - 1);
+  const char* errmsg = NULL;
+  const char* tag = ycore_node_tag(node);
+  char kind;
+  long i, n;
+
+  if (doc->state[id - 1] != 0) {
+    /* Already computed or recursive structure (the digest is then zero). */
+    return NULL;
+  }
+  doc->state[id - 1] = 1;
+  if (node->type == YAML_SCALAR_NODE) {
+    const yaml_char_t* stag;
+    ycore_hnode_t tmp;
+    char buf[128];
+    int k = ycore_resolve_node(node, buf, sizeof(buf), &stag);
+    if (k == YCORE_HASH_STRING || k == YCORE_HASH_TAGGED) {
+      errmsg = ycore_make_node(h, &tmp, k,
+                               (k == YCORE_HASH_TAGGED ?
+                                (const char*)stag : NULL),
+                               (const char*)node->data.scalar.value,
+                               node->data.scalar.length, TRUE);
+    } else {
+      errmsg = ycore_make_node(h, &tmp, k, NULL, buf, strlen(buf), FALSE);
+    }
+    if (errmsg != NULL) {
+      return errmsg;
+    }
+    dig[0] = tmp.h[0];
+    dig[1] = tmp.h[1];
+  } else if (node->type == YAML_SEQUENCE_NODE) {
+    yaml_node_item_t* item = node->data.sequence.items.start;
+    n = node->data.sequence.items.top - item;
+    for (i = 0; i < n; ++i) {
+      if ((errmsg = node_digest(h, doc, item[i])) != NULL) {
+        return errmsg;
+      }
+    }
+    kind = YCORE_HASH_SEQUENCE;
+    h->length = 0;
+    if (! ycore_buf_put(h, &kind, 1) ||
+        (tag != NULL && ! ycore_buf_put(h, tag, strlen(tag) + 1))) {
+      return "insufficient memory";
+    }
+    for (i = 0; i < n; ++i) {
+      if (! ycore_buf_put_digest(h, doc->digest + 2*(item[i] - 1))) {
+        return "insufficient memory";
+      }
+    }
+    ycore_murmur3_128(h->buffer, h->length, dig);
+  } else if (node->type == YAML_MAPPING_NODE) {
+    yaml_node_pair_t* pair = node->data.mapping.pairs.start;
+    ycore_hnode_t* tmp;
+    n = node->data.mapping.pairs.top - pair;
+    for (i = 0; i < n; ++i) {
+      if ((errmsg = node_digest(h, doc, pair[i].key)) != NULL ||
+          (errmsg = node_digest(h, doc, pair[i].value)) != NULL) {
+        return errmsg;
+      }
+    }
+    tmp = (ycore_hnode_t*)malloc(2*n*sizeof(ycore_hnode_t) + 1);
+    if (tmp == NULL) {
+      return "insufficient memory";
+    }
+    for (i = 0; i < n; ++i) {
+      memcpy(tmp[2*i].h, doc->digest + 2*(pair[i].key - 1),
+             2*sizeof(uint64_t));
+      memcpy(tmp[2*i + 1].h, doc->digest + 2*(pair[i].value - 1),
+             2*sizeof(uint64_t));
+    }
+    qsort(tmp, n, 2*sizeof(ycore_hnode_t), ycore_compare_pair_digests);
+    kind = YCORE_HASH_MAPPING;
+    h->length = 0;
+    if (! ycore_buf_put(h, &kind, 1) ||
+        (tag != NULL && ! ycore_buf_put(h, tag, strlen(tag) + 1))) {
+      errmsg = "insufficient memory";
+    }
+    for (i = 0; errmsg == NULL && i < 2*n; ++i) {
+      if (! ycore_buf_put_digest(h, tmp[i].h)) {
+        errmsg = "insufficient memory";
+      }
+    }
+    free(tmp);
+    if (errmsg != NULL) {
+      return errmsg;
+    }
+    ycore_murmur3_128(h->buffer, h->length, dig);
+  }
+  doc->state[id - 1] = 2;
+  return NULL;
+}
+
+const char*
+ycore_hash_document(ycore_hasher_t* h, ycore_document_t* doc)
+{
+  const char* errmsg;
+  int id;
+  if (doc->digest == NULL) {
+    doc->digest = (uint64_t*)calloc(2*doc->nnodes + 1, sizeof(uint64_t));
+    doc->state = (unsigned char*)calloc(doc->nnodes + 1, 1);
+    if (doc->digest == NULL || doc->state == NULL) {
+      return "insufficient memory";
+    }
+    for (id = 1; id <= doc->nnodes; ++id) {
+      if ((errmsg = node_digest(h, doc, id)) != NULL) {
+        return errmsg;
+      }
+    }
+  }
+  return NULL;
+}
+
+size_t
+ycore_key_hash(const yaml_node_t* key)
+{
+  return (size_t)ycore_hash_bytes(YCORE_HASH_SEED, key->data.scalar.value,
+                                  key->data.scalar.length);
+}
+
+int
+ycore_same_key(const yaml_node_t* a, const yaml_node_t* b)
+{
+  return (a->data.scalar.length == b->data.scalar.length &&
+          memcmp(a->data.scalar.value, b->data.scalar.value,
+                 a->data.scalar.length) == 0);
+}
+
+int
+ycore_is_merge_key(const yaml_node_t* node)
+{
+  const char* tag = (const char*)node->tag;
+  return (node->type == YAML_SCALAR_NODE &&
+          node->data.scalar.style == YAML_PLAIN_SCALAR_STYLE &&
+          node->data.scalar.length == 2 &&
+          memcmp(node->data.scalar.value, "<<", 2) == 0 &&
+          (tag == NULL || strcmp(tag, YAML_DEFAULT_SCALAR_TAG) == 0 ||
+           strcmp(tag, YCORE_TAG_PREFIX "merge") == 0));
+}
+
+/* The pairs of each mapping are compacted in place, with a hash table of
+   the keys so that the cost is linear in the size of the mappings.  With
+   YCORE_DUPKEYS_COLLECT, the value of a repeated key is replaced by a new
+   sequence of all its values.  Merge keys are left for
+   ycore_mapping_pairs(). */
+const char*
+ycore_check_duplicates(ycore_document_t* doc, int policy)
+{
+  const char* errmsg = NULL;
+  int id, nnodes = doc->nnodes;
+  int* set = NULL; /* hash table: index + 1 of kept pair */
+  int* coll = NULL; /* sequence collecting the values of a kept pair */
+  size_t size = 0;
+
+  if (policy == YCORE_DUPKEYS_NONE) {
+    return NULL;
+  }
+  for (id = 1; errmsg == NULL && id <= nnodes; ++id) {
+    yaml_node_t* node = get_node(doc, id);
+    yaml_node_pair_t* pairs;
+    long j, n, nres;
+    size_t mask;
+    if (node->type != YAML_MAPPING_NODE) {
+      continue;
+    }
+    pairs = node->data.mapping.pairs.start;
+    n = node->data.mapping.pairs.top - pairs;
+    if (n < 2) {
+      continue;
+    }
+    for (mask = 15; mask + 1 < 2*(size_t)n; mask = 2*mask + 1)
+      ;
+    if (mask + 1 > size) {
+      free(set);
+      free(coll);
+      size = mask + 1;
+      set = (int*)malloc(size*sizeof(int));
+      coll = (int*)malloc(size*sizeof(int));
+      if (set == NULL || coll == NULL) {
+        errmsg = "insufficient memory";
+        break;
+      }
+    }
+    memset(set, 0, (mask + 1)*sizeof(int));
+    nres = 0;
+    for (j = 0; errmsg == NULL && j < n; ++j) {
+      yaml_node_t* key = get_node(doc, pairs[j].key);
+      if (key->type == YAML_SCALAR_NODE && ! ycore_is_merge_key(key)) {
+        size_t h = ycore_key_hash(key) & mask;
+        int e;
+        while ((e = set[h]) != 0 &&
+               ! ycore_same_key(get_node(doc, pairs[e - 1].key), key)) {
+          h = (h + 1) & mask;
+        }
+        if (e != 0) {
+          /* Duplicate key. */
+          if (policy == YCORE_DUPKEYS_ERROR) {
+            sprintf(doc->errmsg,
+                    "duplicate mapping key \"%.80s\" at line %lu",
+                    (const char*)key->data.scalar.value,
+                    (unsigned long)key->start_mark.line + 1);
+            errmsg = doc->errmsg;
+          } else if (policy == YCORE_DUPKEYS_LAST) {
+            pairs[e - 1].value = pairs[j].value;
+          } else if (policy == YCORE_DUPKEYS_COLLECT) {
+            if (coll[e - 1] == 0) {
+              int seq = yaml_document_add_sequence(&doc->document, NULL,
+                                                   YAML_ANY_SEQUENCE_STYLE);
+              if (seq == 0 ||
+                  ! yaml_document_append_sequence_item(
+                      &doc->document, seq, pairs[e - 1].value)) {
+                errmsg = "insufficient memory";
+                break;
+              }
+              coll[e - 1] = seq;
+              pairs[e - 1].value = seq;
+            }
+            if (! yaml_document_append_sequence_item(
+                    &doc->document, coll[e - 1], pairs[j].value)) {
+              errmsg = "insufficient memory";
+            }
+          }
+          continue;
+        }
+        set[h] = nres + 1;
+      }
+      coll[nres] = 0;
+      pairs[nres++] = pairs[j];
+    }
+    if (errmsg == NULL) {
+      /* Adding nodes may have moved the nodes of the document. */
+      get_node(doc, id)->data.mapping.pairs.top = pairs + nres;
+    }
+  }
+  free(set);
+  free(coll);
+  doc->nnodes = doc->document.nodes.top - doc->document.nodes.start;
+  return errmsg;
+}
+
+/* Resolve the merge keys ("<<") of mapping node ID: the keys of the merged
+   mappings are inherited (their value nodes are shared, not copied) unless
+   they are explicitly given or inherited from a previous merged mapping.
+   The resolved pairs are memorized. */
+static const char*
+mapping_pairs(ycore_document_t* doc, int id, yaml_node_pair_t** pairsptr,
+              long* count, int depth)
+{
+  const char* errmsg;
+  yaml_node_t* node = get_node(doc, id);
+  yaml_node_pair_t* pairs = node->data.mapping.pairs.start;
+  yaml_node_pair_t* res;
+  long i, j, k, n = node->data.mapping.pairs.top - pairs, nres, max;
+  int* set;
+  size_t mask;
+  int merge = FALSE;
+
+  if (doc->merged != NULL && doc->merged[id - 1] != NULL) {
+    *pairsptr = doc->merged[id - 1];
+    *count = doc->nmerged[id - 1];
+    return NULL;
+  }
+  for (i = 0; i < n && ! merge; ++i) {
+    merge = ycore_is_merge_key(get_node(doc, pairs[i].key));
+  }
+  if (! merge) {
+    *pairsptr = pairs;
+    *count = n;
+    return NULL;
+  }
+  if (depth > YCORE_MAX_DEPTH) {
+    return "too many levels of merging (recursive structure?)";
+  }
+  if (doc->merged == NULL) {
+    doc->merged = (yaml_node_pair_t**)calloc(doc->nnodes,
+                                             sizeof(yaml_node_pair_t*));
+    doc->nmerged = (long*)calloc(doc->nnodes, sizeof(long));
+    if (doc->merged == NULL || doc->nmerged == NULL) {
+      return "insufficient memory";
+    }
+  }
+
+  /* Resolve the merged mappings first and count the pairs. */
+  max = n;
+  for (i = 0; i < n; ++i) {
+    yaml_node_t* val;
+    if (! ycore_is_merge_key(get_node(doc, pairs[i].key))) {
+      continue;
+    }
+    val = get_node(doc, pairs[i].value);
+    if (val->type == YAML_MAPPING_NODE) {
+      errmsg = mapping_pairs(doc, pairs[i].value, &res, &k, depth + 1);
+      if (errmsg != NULL) {
+        return errmsg;
+      }
+      max += k;
+    } else if (val->type == YAML_SEQUENCE_NODE) {
+      for (j = 0; j < val->data.sequence.items.top -
+             val->data.sequence.items.start; ++j) {
+        int item = val->data.sequence.items.start[j];
+        if (get_node(doc, item)->type != YAML_MAPPING_NODE) {
+          return "merge key must refer to mappings";
+        }
+        errmsg = mapping_pairs(doc, item, &res, &k, depth + 1);
+        if (errmsg != NULL) {
+          return errmsg;
+        }
+        max += k;
+      }
+    } else {
+      return "merge key must refer to mappings";
+    }
+  }
+
+  /* Collect explicit keys, then inherited ones which are not yet defined.
+     A hash table of the scalar keys makes this linear.  The merged
+     mappings have been resolved above, so the nested calls below only
+     fetch memorized pairs and cannot fail. */
+  for (mask = 15; mask + 1 < 2*(size_t)max; mask = 2*mask + 1)
+    ;
+  res = (yaml_node_pair_t*)malloc(max*sizeof(yaml_node_pair_t) + 1);
+  set = (int*)calloc(mask + 1, sizeof(int));
+  if (res == NULL || set == NULL) {
+    free(res);
+    free(set);
+    return "insufficient memory";
+  }
+  nres = 0;
+  for (k = -1; k < n; ++k) {
+    /* K = -1 is for the explicit keys, then the merged mappings. */
+    yaml_node_pair_t* src;
+    long l, nsrc, m = 1;
+    yaml_node_t* val = NULL;
+    if (k >= 0) {
+      if (! ycore_is_merge_key(get_node(doc, pairs[k].key))) {
+        continue;
+      }
+      val = get_node(doc, pairs[k].value);
+      if (val->type == YAML_SEQUENCE_NODE) {
+        m = val->data.sequence.items.top - val->data.sequence.items.start;
+      }
+    }
+    for (l = 0; l < m; ++l) {
+      if (k < 0) {
+        src = pairs;
+        nsrc = n;
+      } else {
+        mapping_pairs(doc, (val->type == YAML_SEQUENCE_NODE ?
+                            val->data.sequence.items.start[l] :
+                            pairs[k].value), &src, &nsrc, depth + 1);
+      }
+      for (j = 0; j < nsrc; ++j) {
+        yaml_node_t* key = get_node(doc, src[j].key);
+        if (k < 0 && ycore_is_merge_key(key)) {
+          continue;
+        }
+        if (key->type == YAML_SCALAR_NODE) {
+          size_t h = ycore_key_hash(key) & mask;
+          int found = FALSE, e;
+          while ((e = set[h]) != 0) {
+            if (ycore_same_key(get_node(doc, res[e - 1].key), key)) {
+              found = TRUE;
+              break;
+            }
+            h = (h + 1) & mask;
+          }
+          if (found) {
+            if (k < 0) {
+              res[e - 1] = src[j]; /* last explicit occurrence wins */
+            }
+            continue;
+          }
+          set[h] = nres + 1;
+        }
+        res[nres++] = src[j];
+      }
+    }
+  }
+  free(set);
+  doc->merged[id - 1] = res;
+  doc->nmerged[id - 1] = nres;
+  *pairsptr = res;
+  *count = nres;
+  return NULL;
+}
+
+const char*
+ycore_mapping_pairs(ycore_document_t* doc, int id, yaml_node_pair_t** pairs,
+                    long* count)
+{
+  return mapping_pairs(doc, id, pairs, count, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+/* TAPES */
+
+const char*
+ycore_tape_record(ycore_tape_t* t, const yaml_event_t* ev)
+{
+  if (! ycore_grow_array((void**)&t->event, &t->size, t->count + 1,
+                   sizeof(yaml_event_t))) {
+    return "insufficient memory";
+  }
+  if (! ycore_copy_event(&t->event[t->count], ev)) {
+    return "failed to copy event";
+  }
+  ++t->count;
+  switch (ev->type) {
+  case YAML_SEQUENCE_START_EVENT:
+  case YAML_MAPPING_START_EVENT:
+    ++t->depth;
+    break;
+  case YAML_SEQUENCE_END_EVENT:
+  case YAML_MAPPING_END_EVENT:
+    --t->depth;
+    break;
+  default:
+    break;
+  }
+  return NULL;
+}
+
+void
+ycore_tape_clear(ycore_tape_t* t)
+{
+  while (t->count > 0) {
+    yaml_event_delete(&t->event[--t->count]);
+  }
+  t->depth = 0;
+}
+
+void
+ycore_tape_destroy(ycore_tape_t* t)
+{
+  ycore_tape_clear(t);
+  free(t->event);
+  t->event = NULL;
+  t->size = 0;
+}
+
+long
+ycore_tape_skip(const yaml_event_t* ev, long n, long p)
+{
+  long depth = 0;
+  do {
+    switch (ev[p].type) {
+    case YAML_SEQUENCE_START_EVENT:
+    case YAML_MAPPING_START_EVENT:
+      ++depth;
+      break;
+    case YAML_SEQUENCE_END_EVENT:
+    case YAML_MAPPING_END_EVENT:
+      --depth;
+      break;
+    default:
+      break;
+    }
+    ++p;
+  } while (depth > 0 && p < n);
+  return p;
+}
+
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,504 @@
+/*
+ * yaml_core.h --
+ *
+ * Definitions for the reentrant core of the YAML plugin.  The core does
+ * not depend on Yorick: its functions report errors by their returned
+ * value (false or an error message), never call y_error and only use the
+ * state given by their arguments, so they can be used by worker threads.
+ * The only process-wide resources are the pool of threads of the parallel
+ * loops and the queue of files of the batched atomic outputs.  All the
+ * public symbols are prefixed by "ycore_" (or "YCORE_" for macros) to not
+ * clash with other plugins or libraries loaded by Yorick.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2018: Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * See LICENSE.md for details.
+ *
+ */
+
+#ifndef YAML_CORE_H_
+#define YAML_CORE_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <yaml.h>
+
+/*---------------------------------------------------------------------------*/
+/* MEMORY */
+
+/* Grow the array *PTR of *SIZE elements of size ELSIZE so that it has room
+   for at least N elements.  Returns false on failure (the array is left
+   unchanged). */
+extern int ycore_grow_array(void** ptr, size_t* size, size_t n,
+                            size_t elsize);
+
+/*---------------------------------------------------------------------------*/
+/* PARALLEL LOOPS */
+
+typedef void ycore_parallel_body_t(void* data, size_t start, size_t stop);
+
+/* Maximum number of threads (including the calling thread). */
+#define YCORE_MAXIMUM_THREADS 256
+
+/* Call BODY(DATA, START, STOP) for contiguous chunks of [0,N) in parallel
+   and wait for completion.  The pool runs one loop at a time: if it cannot
+   be started or if it is busy (with a loop of another thread or because
+   this loop is nested in the body of another one), the loop runs in the
+   calling thread. */
+extern void ycore_parallel_for(size_t n, ycore_parallel_body_t* body,
+                               void* data);
+
+/* Yield the number of CPUs allowed by the cgroup CPU quota of the process
+   (rounded up), 0 if there is no quota. */
+extern int ycore_cgroup_cpus(void);
+
+/* Directory prepended to the paths of the files which describe the cgroups
+   of the process ("" for the real ones).  Only the tests change it, to read
+   a fixture tree. */
+extern const char* ycore_cgroup_root;
+
+/* Yield the number of threads of parallel loops. */
+extern int ycore_parallel_threads(void);
+
+/* Set the number of threads of parallel loops, 0 for the number of CPUs
+   available to the process.  This waits for the running loop, if any, so
+   it must not be called by the body of a loop. */
+extern void ycore_set_parallel_threads(int n);
+
+/*---------------------------------------------------------------------------*/
+/* SCALARS */
+
+/* Kinds of leaves for yaml_flatten and yaml_unflatten (YAML_NULL_VALUE,
+   etc. in Yorick). */
+typedef enum {
+  YCORE_NULL_VALUE = 0,
+  YCORE_BOOL_VALUE,
+  YCORE_INT_VALUE,
+  YCORE_FLOAT_VALUE,
+  YCORE_STRING_VALUE,
+  YCORE_EMPTY_SEQUENCE,
+  YCORE_EMPTY_MAPPING
+} ycore_leaf_kind_t;
+
+/* Resolved types of scalars and kinds of nodes (first byte of the hashed
+   data). */
+#define YCORE_HASH_NULL      'n'
+#define YCORE_HASH_BOOL      'b'
+#define YCORE_HASH_INT       'i'
+#define YCORE_HASH_FLOAT     'f'
+#define YCORE_HASH_STRING    's'
+#define YCORE_HASH_TAGGED    't'
+#define YCORE_HASH_SEQUENCE  'S'
+#define YCORE_HASH_MAPPING   'M'
+#define YCORE_HASH_DOCUMENT  'D'
+#define YCORE_HASH_STREAM    'Y'
+
+#define YCORE_TAG_PREFIX "tag:yaml.org,2002:"
+
+/* Resolve the type (YCORE_HASH_NULL, YCORE_HASH_BOOL, ...,
+   YCORE_HASH_TAGGED) of a scalar of LEN bytes according to the YAML core
+   schema.  For all types but strings and tagged values, the canonical form
+   of the value is written in BUF of SIZE bytes unless BUF is NULL. */
+extern int ycore_resolve_scalar(const yaml_char_t* tag, const yaml_char_t* val,
+                                size_t len, yaml_scalar_style_t style,
+                                char* buf, size_t size);
+
+/* Convert the text of a leaf of kind YCORE_BOOL_VALUE, YCORE_INT_VALUE or
+   YCORE_FLOAT_VALUE to a number (0 for other kinds). */
+extern double ycore_leaf_number(int kind, const char* s);
+
+/*---------------------------------------------------------------------------*/
+/* CANONICAL HASHING */
+
+typedef struct _ycore_hnode_t ycore_hnode_t;
+struct _ycore_hnode_t {
+  uint64_t h[2]; /* digest of the node */
+  char* text; /* canonical form of the node or NULL */
+};
+
+typedef struct _ycore_hframe_t ycore_hframe_t;
+typedef struct _ycore_hanchor_t ycore_hanchor_t;
+
+typedef struct _ycore_hasher_t ycore_hasher_t;
+struct _ycore_hasher_t {
+  ycore_hframe_t* frame; /* stack of collections being built */
+  size_t depth; /* number of collections being built */
+  size_t nframes; /* number of allocated frames */
+  ycore_hanchor_t* anchor; /* anchors of the current document */
+  size_t nanchors; /* number of anchors */
+  size_t maxanchors; /* number of allocated anchors */
+  char* buffer; /* scratch buffer */
+  size_t length; /* number of bytes used in the buffer */
+  size_t size; /* size of the buffer */
+  FILE* output; /* output file for the canonical form or NULL */
+  int open; /* output file has to be closed */
+  int done; /* the end of the stream has been reached? */
+  uint64_t digest[2]; /* digest of the stream */
+};
+
+/* MurmurHash3 (x64, 128-bit version) of LEN bytes at KEY. */
+extern void ycore_murmur3_128(const void* key, size_t len, uint64_t out[2]);
+
+/* Hash values for hash tables: ycore_hash_bytes continues hash value H
+   (YCORE_HASH_SEED to start) with LEN bytes at PTR (FNV-1a) and
+   ycore_hash_mix mixes value X into hash value H. */
+#define YCORE_HASH_SEED UINT64_C(0xcbf29ce484222325)
+extern uint64_t ycore_hash_bytes(uint64_t h, const void* ptr, size_t len);
+extern uint64_t ycore_hash_mix(uint64_t h, uint64_t x);
+
+/* Initialize a hasher, free its resources (and close its output file if
+   it owns it), and feed it with an event.  The digest of the stream is
+   available when DONE is set.  ycore_hasher_feed returns NULL on success,
+   an error message otherwise. */
+extern void ycore_hasher_init(ycore_hasher_t* h);
+extern void ycore_hasher_destroy(ycore_hasher_t* h);
+extern const char* ycore_hasher_feed(ycore_hasher_t* h,
+                                     const yaml_event_t* ev);
+
+/* Compute the digest of a scalar node and, if the hasher has an output,
+   its canonical form.  Returns NULL on success, an error message
+   otherwise. */
+extern const char* ycore_make_node(ycore_hasher_t* h, ycore_hnode_t* node,
+                                   int kind, const char* tag,
+                                   const char* text, size_t len, int quote);
+
+/* Compare digests, and nodes by their digests (for qsort). */
+extern int ycore_compare_digests(const uint64_t a[2], const uint64_t b[2]);
+extern int ycore_compare_pair_digests(const void* a, const void* b);
+
+/* Append bytes to the scratch buffer of a hasher: N bytes, a string, a
+   digest in hexadecimal or a double-quoted string of LEN bytes.  Returns
+   false on failure. */
+extern int ycore_buf_put(ycore_hasher_t* h, const void* ptr, size_t n);
+extern int ycore_buf_puts(ycore_hasher_t* h, const char* str);
+extern int ycore_buf_put_digest(ycore_hasher_t* h, const uint64_t d[2]);
+extern int ycore_buf_put_quoted(ycore_hasher_t* h, const char* str,
+                                size_t len);
+
+/* Yield a null-terminated copy of the scratch buffer of a hasher from
+   OFFSET, and a copy of a string.  Return NULL on failure. */
+extern char* ycore_buf_copy(ycore_hasher_t* h, size_t offset);
+extern char* ycore_copy_string(const yaml_char_t* str);
+
+/*---------------------------------------------------------------------------*/
+/* OUTPUT */
+
+#define YCORE_MAXIMUM_OUTPUT_BLOCKS 64
+
+/* Synchronization policies. */
+#define YCORE_SYNC_NEVER    0
+#define YCORE_SYNC_DOCUMENT 1
+#define YCORE_SYNC_CLOSE    2
+
+/* Atomic modes. */
+#define YCORE_ATOMIC_NOW   1
+#define YCORE_ATOMIC_BATCH 2
+
+typedef struct _ycore_output_t ycore_output_t;
+struct _ycore_output_t {
+  int fd; /* output file descriptor, -1 if none */
+  int closefd; /* close the file descriptor when done? */
+  int sync; /* synchronization policy */
+  unsigned char** blocks; /* output blocks (allocated when needed) */
+  size_t nblocks; /* number of output blocks */
+  size_t bsize; /* size of an output block */
+  size_t wlen; /* number of buffered output bytes */
+  int atomic; /* atomic mode */
+  int ended; /* the stream is complete? */
+  char* path; /* name of the target file in atomic mode */
+  char* temp; /* name of the temporary file in atomic mode */
+};
+
+/* Set output OUT (initially zero-filled, except the file descriptor which
+   may have been set by ycore_open_atomic) to write to file descriptor FD with
+   BUFSIZE bytes of buffers (a default size if less or equal zero).
+   Returns NULL on success, an error message otherwise. */
+extern const char* ycore_output_init(ycore_output_t* out, int fd, int closefd,
+                                     long bufsize, int sync);
+
+/* Output handler for libyaml, DATA is the output. */
+extern int ycore_output_write(void* data, unsigned char* buffer, size_t size);
+
+/* Write all buffered bytes and, for ycore_sync_output, commit them to the
+   storage device.  Return false on error.  Descriptors which cannot be
+   synchronized (pipes, terminals, etc.) are not considered as an error. */
+extern int ycore_flush_output(ycore_output_t* out);
+extern int ycore_sync_output(ycore_output_t* out);
+
+/* Create the temporary file of output OUT for writing FILENAME atomically
+   (ATOMIC is YCORE_ATOMIC_NOW or YCORE_ATOMIC_BATCH).  Returns NULL on
+   success, an error message otherwise. */
+extern const char* ycore_open_atomic(ycore_output_t* out, const char* filename,
+                                     int atomic);
+
+/* Write the pending output of OUT, synchronize it if requested and close
+   its file descriptor.  In atomic mode, the temporary file is committed if
+   the stream is complete and removed otherwise (in batch mode, it is
+   queued for ycore_commit_pending, otherwise the queued files are
+   committed first).  The queued files are also committed at exit.
+   Returns NULL on success, an error message otherwise. */
+extern const char* ycore_close_output(ycore_output_t* out);
+
+/* Close output OUT ignoring errors and free its resources. */
+extern void ycore_free_output(ycore_output_t* out);
+
+/* Commit all the queued temporary files of batched atomic outputs.
+   Returns NULL on success, an error message otherwise. */
+extern const char* ycore_commit_pending(void);
+
+/*---------------------------------------------------------------------------*/
+/* EVENTS */
+
+/* Largest length of the scalars built by libyaml (INT_MAX), longer ones
+   are built by the core.  Only the tests lower it, to exercise the latter
+   without gigabytes of memory. */
+extern size_t ycore_max_libyaml_length;
+
+/* Initialize a SCALAR event.  Contrarily to yaml_scalar_event_initialize()
+   whose LENGTH argument is an int, values longer than INT_MAX bytes are
+   supported (they are not checked for UTF-8 validity).  LENGTH may be
+   (size_t)-1 to use the length of the null-terminated VALUE.  Returns true
+   on success, false on failure. */
+extern int ycore_scalar_event_initialize(yaml_event_t* event,
+                                         const yaml_char_t* anchor,
+                                         const yaml_char_t* tag,
+                                         const yaml_char_t* value,
+                                         size_t length, int plain_implicit,
+                                         int quoted_implicit,
+                                         yaml_scalar_style_t style);
+
+/* Make a deep copy of an event.  Returns true on success, false on
+   failure. */
+extern int ycore_copy_event(yaml_event_t* dst, const yaml_event_t* src);
+
+/*---------------------------------------------------------------------------*/
+/* READER */
+
+/* An application must not alternate the calls of yaml_parser_scan() with
+ * the calls of yaml_parser_parse() or yaml_parser_load(). Doing this will
+ * break the parser.
+ */
+typedef enum {
+  YCORE_ANY,   /* parser type not yet decided */
+  YCORE_SCAN,  /* only calls yaml_parser_scan() are allowed */
+  YCORE_PARSE, /* only calls yaml_parser_parse() are allowed */
+  YCORE_LOAD   /* only calls yaml_parser_load() are allowed */
+} ycore_parsing_t;
+
+/* A buffered event of the lookahead.  For a SEQUENCE-START event, ITEMS
+   is the number of items of the sequence (-1 if not yet measured) and
+   SCALARS is whether all these items are scalars. */
+typedef struct _ycore_ahead_t ycore_ahead_t;
+struct _ycore_ahead_t {
+  yaml_event_t event;
+  int64_t byte; /* byte offset of a DOCUMENT-END event */
+  long items;
+  int scalars;
+};
+
+/* A reader is a libyaml parser with a buffered input, checkpoints, follow
+   mode and lookahead.  The functions which may fail store a static error
+   message in ERROR. */
+typedef struct _ycore_reader_t ycore_reader_t;
+struct _ycore_reader_t {
+  yaml_parser_t parser; /* parser data */
+  int init; /* parser has been initialized? */
+  ycore_parsing_t parsing;
+  const char* error; /* message of the last error */
+  int fd; /* input file descriptor */
+  int closefd; /* close the file descriptor when done? */
+  unsigned char* rbuf; /* read buffer */
+  size_t rsize, rpos, rlen; /* size, position and length of read buffer */
+
+  /* Follow mode. */
+  int follow; /* follow a growing file? */
+  int started; /* STREAM-START event has been delivered? */
+  int watch; /* inotify descriptor or -1 */
+  double timeout; /* maximum time to wait for new documents (<0 for ever) */
+  int64_t pos; /* offset of next byte to read */
+  int64_t end; /* end of input of the current parser */
+  int64_t limit; /* end of complete documents */
+  int64_t scanned; /* start of the first line not yet scanned */
+  long endline, limitline, scannedline; /* lines of END, LIMIT and SCANNED */
+
+  /* Checkpoints. */
+  int track; /* track the byte offsets of the input? */
+  char* history; /* bytes read since the anchor */
+  size_t hlen, hsize; /* number of used and allocated bytes in history */
+  int64_t hbyte; /* byte offset of the anchor */
+  long hchar; /* character index of the anchor */
+  long nchars; /* character index of the end of the input read so far */
+  long ndocs; /* number of complete documents */
+  int64_t cpbyte; /* byte offset of the last checkpoint */
+  long cpchar, cpline, cpcolumn, cpdoc; /* rest of the last checkpoint */
+
+  /* Lookahead. */
+  ycore_ahead_t* ahead; /* ring buffer of parsed but undelivered events */
+  size_t nahead; /* number of buffered events */
+  size_t head; /* index of the first buffered event */
+  size_t maxahead; /* size of the ring buffer (a power of 2) */
+  int seqstart; /* last delivered event is a SEQUENCE-START? */
+  long items; /* number of items of this sequence (-1 if not measured) */
+  int scalars; /* all items of this sequence are scalars? */
+};
+
+/* Initialize a reader (which may be zero-filled) and free its resources. */
+extern void ycore_reader_init(ycore_reader_t* r);
+extern void ycore_reader_destroy(ycore_reader_t* r);
+
+/* Set the input of reader R to be file descriptor FD starting at byte
+   OFFSET (if not zero) and with a read buffer of BUFSIZE bytes (a default
+   size if less or equal zero).  Returns NULL on success, an error message
+   otherwise. */
+extern const char* ycore_reader_set_input(ycore_reader_t* r, int fd,
+                                          int closefd, int64_t offset,
+                                          long bufsize);
+
+/* Initialize the libyaml parser of reader R to read from its input (at
+   the last checkpoint if checkpoints are enabled).  Returns NULL on
+   success, an error message otherwise. */
+extern const char* ycore_reader_start(ycore_reader_t* r);
+
+/* Set reader R to read file FILENAME.  Returns NULL on success, an error
+   message otherwise. */
+extern const char* ycore_reader_open(ycore_reader_t* r, const char* filename);
+
+/* Enable checkpoints for reader R and, unless CP is NULL, resume at
+   checkpoint CP (byte offset, character index, line, column and number of
+   documents).  Must be called before setting the input.  Returns NULL on
+   success, an error message otherwise. */
+extern const char* ycore_reader_resume(ycore_reader_t* r,
+                                       const int64_t cp[5]);
+
+/* Set reader R, whose file descriptor has been set, in follow mode for
+   file FILENAME: the documents appended to the file are delivered as they
+   are completed, waiting at most TIMEOUT seconds (for ever if negative)
+   for new ones. */
+extern void ycore_reader_follow(ycore_reader_t* r, const char* filename,
+                                double timeout);
+
+/* Deliver the next event of reader R, the first buffered one if the
+   application has looked ahead.  Returns 1 on success, 0 if no event is
+   available after the timeout in follow mode (callers which need a
+   complete stream may then consider that a STREAM-END event occurred) and
+   -1 on error. */
+extern int ycore_reader_next(ycore_reader_t* r, yaml_event_t* event);
+
+/* Store in *PTR the K-th next buffered event (K >= 1) of reader R, parsing
+   and buffering the events as needed.  Same returned value as
+   ycore_reader_next(). */
+extern int ycore_reader_peek(ycore_reader_t* r, size_t k,
+                             ycore_ahead_t** ptr);
+
+/* Measure the sequence whose SEQUENCE-START event has just been delivered
+   by reader R: the events up to the matching SEQUENCE-END are buffered
+   and the number of items and whether they are all scalars are stored in
+   R->items and R->scalars.  If the sequence has more than
+   YCORE_MAX_MEASURED_EVENTS events, at most that many are buffered and
+   R->items is left to -1.  Same returned value as ycore_reader_next(). */
+extern size_t ycore_max_measured_events;
+extern int ycore_reader_measure(ycore_reader_t* r);
+
+/*---------------------------------------------------------------------------*/
+/* DOCUMENTS */
+
+/* Maximum number of levels of nesting when walking a tree of nodes. */
+#define YCORE_MAX_DEPTH 1000
+
+typedef struct _ycore_document_t ycore_document_t;
+struct _ycore_document_t {
+  yaml_document_t document; /* document data */
+  int init; /* document has been initialized? */
+  int nnodes; /* number of nodes */
+  int root; /* identifier of the root node */
+  uint64_t* digest; /* digests of the nodes (2 words per node) or NULL */
+  unsigned char* state; /* hashing state of the nodes */
+  yaml_node_pair_t** merged; /* resolved pairs of mappings with merge keys */
+  long* nmerged; /* number of resolved pairs */
+  char errmsg[160]; /* message of the last error */
+};
+
+/* Policies for duplicate mapping keys. */
+#define YCORE_DUPKEYS_NONE    0 /* no check, the last value wins */
+#define YCORE_DUPKEYS_ERROR   1 /* duplicate keys are an error */
+#define YCORE_DUPKEYS_FIRST   2 /* the first occurrence wins */
+#define YCORE_DUPKEYS_LAST    3 /* the last value wins (first position) */
+#define YCORE_DUPKEYS_COLLECT 4 /* the values are collected in a sequence */
+
+/* Free the resources of a document (which may be zero-filled). */
+extern void ycore_document_destroy(ycore_document_t* doc);
+
+/* Load the next document read by reader R into DOC (zero-filled).  If
+   there are no more documents, DOC->NNODES is zero.  Returns NULL on
+   success, an error message otherwise. */
+extern const char* ycore_load_document(ycore_reader_t* r,
+                                       ycore_document_t* doc);
+
+/* Add a scalar node to a document.  Contrarily to yaml_document_add_scalar()
+   whose LENGTH argument is an int, values longer than INT_MAX bytes are
+   supported.  Returns the node identifier, 0 on error. */
+extern int ycore_document_add_scalar(yaml_document_t* document,
+                                     const yaml_char_t* tag,
+                                     const yaml_char_t* value, size_t length,
+                                     yaml_scalar_style_t style);
+
+/* Yield the non-core tag of a node or NULL. */
+extern const char* ycore_node_tag(const yaml_node_t* node);
+
+/* Resolve the type of a scalar node (see ycore_resolve_scalar).  The
+   loader gives the default tag to plain scalars without explicit tag, this
+   is undone and the effective tag is stored in TAG. */
+extern int ycore_resolve_node(const yaml_node_t* node, char* buf, size_t size,
+                              const yaml_char_t** tag);
+
+/* Compute the digests of all the nodes of a document as yaml_hash does,
+   using the scratch buffer of hasher H.  Returns NULL on success, an
+   error message otherwise. */
+extern const char* ycore_hash_document(ycore_hasher_t* h,
+                                       ycore_document_t* doc);
+
+/* Hash value of a scalar mapping key, comparison of scalar mapping keys
+   and check whether a node is a merge key ("<<"). */
+extern size_t ycore_key_hash(const yaml_node_t* key);
+extern int ycore_same_key(const yaml_node_t* a, const yaml_node_t* b);
+extern int ycore_is_merge_key(const yaml_node_t* node);
+
+/* Apply POLICY (YCORE_DUPKEYS_NONE, ...) to the duplicate scalar keys of
+   the mappings of document DOC.  Returns NULL on success, an error
+   message otherwise. */
+extern const char* ycore_check_duplicates(ycore_document_t* doc, int policy);
+
+/* Store in *PAIRS and *COUNT the pairs of mapping node ID of document DOC
+   with the merge keys resolved.  Returns NULL on success, an error
+   message otherwise. */
+extern const char* ycore_mapping_pairs(ycore_document_t* doc, int id,
+                                       yaml_node_pair_t** pairs, long* count);
+
+/*---------------------------------------------------------------------------*/
+/* TAPES */
+
+/* A tape records a copy of the events of a node. */
+typedef struct _ycore_tape_t ycore_tape_t;
+struct _ycore_tape_t {
+  yaml_event_t* event; /* recorded events */
+  size_t count, size; /* number of recorded and allocated events */
+  long depth; /* nesting level of the recorded node */
+};
+
+/* Record a copy of event EV on tape T.  Returns NULL on success, an error
+   message otherwise. */
+extern const char* ycore_tape_record(ycore_tape_t* t, const yaml_event_t* ev);
+
+/* Delete the events of a tape (its storage is kept for reuse), and free
+   all its resources. */
+extern void ycore_tape_clear(ycore_tape_t* t);
+extern void ycore_tape_destroy(ycore_tape_t* t);
+
+/* Yield the index of the event following the node at index P in the N
+   recorded events EV. */
+extern long ycore_tape_skip(const yaml_event_t* ev, long n, long p);
+
+#endif /* YAML_CORE_H_ */
@@ -0,0 +1,1227 @@
+/*
+ * yaml_core_test.c --
+ *
+ * Tests of the core of the YAML plugin.  This program only depends on the
+ * core and on libyaml (not on Yorick), it is built and run by "make check"
+ * and reports the failed checks.  The exit status is non-zero if some checks
+ * failed.  With the argument "bench" (run by "make bench"), the workloads
+ * are 100 times larger and the timings of the tested operations are
+ * reported.  The tests of scalars larger than 2 GiB need about 5 GiB of
+ * memory and are only run if the environment variable YAML_CORE_TEST_LARGE
+ * is set.
+ *
+ *-----------------------------------------------------------------------------
+ *
+ * Copyright (C) 2018: Éric Thiébaut <eric.thiebaut@univ-lyon1.fr>
+ *
+ * See LICENSE.md for details.
+ *
+ */
+
+#if defined(__linux__) && ! defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
+#ifndef _FILE_OFFSET_BITS
+#  define _FILE_OFFSET_BITS 64 /* for files larger than 2 GiB */
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <yaml.h>
+
+#include "yaml_core.h"
+
+#define FALSE 0
+#define TRUE  1
+
+static long nchecks = 0; /* number of checks */
+static long nfailures = 0; /* number of failed checks */
+static char tmpdir[256]; /* directory for the temporary files */
+static long scale = 1; /* size factor of the workloads (100 to benchmark) */
+
+#define CHECK(expr) check((expr), #expr, __LINE__)
+
+static void
+check(int ok, const char* expr, int line)
+{
+  ++nchecks;
+  if (! ok) {
+    ++nfailures;
+    fprintf(stderr, "yaml_core_test.c:%d: check failed: %s\n", line, expr);
+  }
+}
+
+static double
+now(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1E-9*t.tv_nsec;
+}
+
+/* Print the timing of an operation which has processed COUNT units (only
+   in benchmark mode). */
+static void
+report(const char* what, double t0, double count, const char* unit)
+{
+  double t = now() - t0;
+  if (scale == 1) {
+    return;
+  }
+  printf("  %-40s %9.3f ms", what, 1E3*t);
+  if (count > 0 && t > 0) {
+    printf("  (%.3g %s/s)", count/t, unit);
+  }
+  printf("\n");
+}
+
+/* Yield the name of file NAME in the temporary directory (in a static
+   buffer). */
+static const char*
+temp_path(const char* name)
+{
+  static char path[512];
+  sprintf(path, "%s/%s", tmpdir, name);
+  return path;
+}
+
+static void
+write_file(const char* path, const char* text)
+{
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "failed to create \"%s\"\n", path);
+    exit(1);
+  }
+  fputs(text, file);
+  fclose(file);
+}
+
+/* Read a whole file into a null-terminated buffer, NULL on failure. */
+static char*
+read_file(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  char* buf;
+  long size;
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  rewind(file);
+  buf = (char*)malloc(size + 1);
+  if (buf != NULL && fread(buf, 1, size, file) != (size_t)size) {
+    free(buf);
+    buf = NULL;
+  }
+  if (buf != NULL) {
+    buf[size] = '\0';
+  }
+  fclose(file);
+  return buf;
+}
+
+/* Count the entries of the temporary directory. */
+static int
+count_files(void)
+{
+  DIR* dir = opendir(tmpdir);
+  struct dirent* ent;
+  int n = 0;
+  while (dir != NULL && (ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+      ++n;
+    }
+  }
+  if (dir != NULL) {
+    closedir(dir);
+  }
+  return n;
+}
+
+static void
+remove_files(void)
+{
+  DIR* dir = opendir(tmpdir);
+  struct dirent* ent;
+  while (dir != NULL && (ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+      unlink(temp_path(ent->d_name));
+    }
+  }
+  if (dir != NULL) {
+    closedir(dir);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* SCALARS */
+
+typedef struct _scalar_case_t scalar_case_t;
+struct _scalar_case_t {
+  const char* tag;
+  const char* value;
+  yaml_scalar_style_t style;
+  int kind; /* expected type */
+  const char* canonical; /* expected canonical form or NULL */
+};
+
+#define PLAIN  YAML_PLAIN_SCALAR_STYLE
+#define QUOTED YAML_SINGLE_QUOTED_SCALAR_STYLE
+
+static const scalar_case_t scalar_cases[] = {
+  {NULL, "", PLAIN, YCORE_HASH_NULL, "null"},
+  {NULL, "~", PLAIN, YCORE_HASH_NULL, "null"},
+  {NULL, "NULL", PLAIN, YCORE_HASH_NULL, "null"},
+  {NULL, "True", PLAIN, YCORE_HASH_BOOL, "true"},
+  {NULL, "FALSE", PLAIN, YCORE_HASH_BOOL, "false"},
+  {NULL, "yes", PLAIN, YCORE_HASH_STRING, NULL},
+  {NULL, "0x1F", PLAIN, YCORE_HASH_INT, "31"},
+  {NULL, "0o17", PLAIN, YCORE_HASH_INT, "15"},
+  {NULL, "-007", PLAIN, YCORE_HASH_INT, "-7"},
+  {NULL, "+12", PLAIN, YCORE_HASH_INT, "12"},
+  {NULL, "-0", PLAIN, YCORE_HASH_INT, "0"},
+  {NULL, "123456789012345678901234567890", PLAIN, YCORE_HASH_INT,
+   "123456789012345678901234567890"},
+  {NULL, "1e3", PLAIN, YCORE_HASH_FLOAT, "1000.0"},
+  {NULL, "0.5", PLAIN, YCORE_HASH_FLOAT, "0.5"},
+  {NULL, "-.INF", PLAIN, YCORE_HASH_FLOAT, "-.inf"},
+  {NULL, ".NaN", PLAIN, YCORE_HASH_FLOAT, ".nan"},
+  {NULL, "1e999", PLAIN, YCORE_HASH_FLOAT, ".inf"},
+  {NULL, "1.2.3", PLAIN, YCORE_HASH_STRING, NULL},
+  {NULL, "12", QUOTED, YCORE_HASH_STRING, NULL},
+  {YCORE_TAG_PREFIX "str", "12", PLAIN, YCORE_HASH_STRING, NULL},
+  {YCORE_TAG_PREFIX "int", "12", QUOTED, YCORE_HASH_INT, "12"},
+  {YCORE_TAG_PREFIX "int", "abc", PLAIN, YCORE_HASH_TAGGED, NULL},
+  {"!", "12", PLAIN, YCORE_HASH_STRING, NULL},
+  {"!custom", "12", PLAIN, YCORE_HASH_TAGGED, NULL},
+};
+
+static void
+test_scalars(void)
+{
+  size_t i, n = sizeof(scalar_cases)/sizeof(scalar_cases[0]);
+  const char* values[] = {"12", "-3.5", "true", "hello", "0x7f", "~"};
+  char buf[128];
+  double t0, x;
+  long j, nloops = 10000*scale, count = 0;
+
+  printf("scalars:\n");
+  for (i = 0; i < n; ++i) {
+    const scalar_case_t* c = &scalar_cases[i];
+    int kind;
+    buf[0] = '\0';
+    kind = ycore_resolve_scalar((const yaml_char_t*)c->tag,
+                                (const yaml_char_t*)c->value,
+                                strlen(c->value), c->style, buf,
+                                sizeof(buf));
+    if (kind != c->kind ||
+        (c->canonical != NULL && strcmp(buf, c->canonical) != 0)) {
+      fprintf(stderr, "  \"%s\" resolved as '%c' \"%s\"\n", c->value,
+              kind, buf);
+    }
+    CHECK(kind == c->kind);
+    CHECK(c->canonical == NULL || strcmp(buf, c->canonical) == 0);
+  }
+
+  /* Embedded null characters make a string. */
+  CHECK(ycore_resolve_scalar(NULL, (const yaml_char_t*)"1\0002", 3, PLAIN,
+                             buf, sizeof(buf)) == YCORE_HASH_STRING);
+
+  /* Numbers too long for the buffer are not numbers. */
+  CHECK(ycore_resolve_scalar(NULL, (const yaml_char_t*)"123456", 6, PLAIN,
+                             buf, 4) == YCORE_HASH_STRING);
+
+  /* Conversion of the leaves. */
+  CHECK(ycore_leaf_number(YCORE_BOOL_VALUE, "True") == 1.0);
+  CHECK(ycore_leaf_number(YCORE_BOOL_VALUE, "false") == 0.0);
+  CHECK(ycore_leaf_number(YCORE_INT_VALUE, "0x1F") == 31.0);
+  CHECK(ycore_leaf_number(YCORE_INT_VALUE, "0o17") == 15.0);
+  CHECK(ycore_leaf_number(YCORE_INT_VALUE, "-12") == -12.0);
+  x = ycore_leaf_number(YCORE_INT_VALUE, "-0");
+  CHECK(x == 0.0 && ! signbit(x));
+  CHECK(ycore_leaf_number(YCORE_FLOAT_VALUE, "2.5e1") == 25.0);
+  CHECK(ycore_leaf_number(YCORE_FLOAT_VALUE, "-.inf") == -HUGE_VAL);
+  CHECK(ycore_leaf_number(YCORE_FLOAT_VALUE, "+.Inf") == HUGE_VAL);
+  CHECK(isnan(ycore_leaf_number(YCORE_FLOAT_VALUE, ".NaN")));
+  CHECK(ycore_leaf_number(YCORE_STRING_VALUE, "12") == 0.0);
+
+  t0 = now();
+  for (j = 0; j < nloops; ++j) {
+    const char* v = values[j%6];
+    count += ycore_resolve_scalar(NULL, (const yaml_char_t*)v, strlen(v),
+                                  PLAIN, buf, sizeof(buf));
+  }
+  CHECK(count > 0);
+  report("ycore_resolve_scalar (10^6 scalars)", t0, nloops, "scalars");
+}
+
+/*---------------------------------------------------------------------------*/
+/* CANONICAL HASHING */
+
+/* Compute the digest of the YAML stream TEXT.  Returns NULL on success, an
+   error message otherwise. */
+static const char*
+hash_text(const char* text, size_t len, uint64_t digest[2])
+{
+  const char* errmsg = NULL;
+  yaml_parser_t parser;
+  yaml_event_t event;
+  ycore_hasher_t h;
+
+  if (! yaml_parser_initialize(&parser)) {
+    return "failed to initialize parser";
+  }
+  yaml_parser_set_input_string(&parser, (const unsigned char*)text, len);
+  ycore_hasher_init(&h);
+  while (errmsg == NULL && ! h.done) {
+    if (! yaml_parser_parse(&parser, &event)) {
+      errmsg = "parser error";
+      break;
+    }
+    errmsg = ycore_hasher_feed(&h, &event);
+    yaml_event_delete(&event);
+  }
+  if (errmsg == NULL) {
+    digest[0] = h.digest[0];
+    digest[1] = h.digest[1];
+  }
+  ycore_hasher_destroy(&h);
+  yaml_parser_delete(&parser);
+  return errmsg;
+}
+
+/* Check whether the YAML streams A and B have the same digest. */
+static int
+same_hash(const char* a, const char* b)
+{
+  uint64_t da[2], db[2];
+  if (hash_text(a, strlen(a), da) != NULL ||
+      hash_text(b, strlen(b), db) != NULL) {
+    return -1;
+  }
+  return (ycore_compare_digests(da, db) == 0);
+}
+
+static void
+test_hasher(void)
+{
+  uint64_t d[2];
+  char* text;
+  size_t i, n = 2000*scale, len = 0;
+  double t0;
+
+  printf("hasher:\n");
+  CHECK(same_hash("{a: 1, b: [x, 2]}", "b: [x, 0x2]\na: 01\n") == 1);
+  CHECK(same_hash("{a: 1}", "{a: '1'}") == 0);
+  CHECK(same_hash("[1, 2]", "[2, 1]") == 0);
+  CHECK(same_hash("a: &x [1, 2]\nb: *x\n", "a: [1, 2]\nb: [1, 2]\n") == 1);
+  CHECK(same_hash("x: !foo 1", "x: !bar 1") == 0);
+  CHECK(same_hash("--- 1\n--- 2\n", "--- 2\n--- 1\n") == 0);
+  CHECK(hash_text("a: *undefined\n", 14, d) != NULL);
+
+  /* A large mapping. */
+  text = (char*)malloc(32*n);
+  if (text == NULL) {
+    CHECK(text != NULL);
+    return;
+  }
+  for (i = 0; i < n; ++i) {
+    len += sprintf(text + len, "key%lu: [%lu, %lu.5, x]\n",
+                   (unsigned long)i, (unsigned long)i, (unsigned long)i);
+  }
+  t0 = now();
+  CHECK(hash_text(text, len, d) == NULL);
+  report("ycore_hasher_feed (mapping of 2e5 keys)", t0, len/1E6, "MB");
+  free(text);
+}
+
+/*---------------------------------------------------------------------------*/
+/* OUTPUT */
+
+/* Emit a stream of one document with a sequence of NITEMS scalars to
+   output OUT, without the STREAM-END event if COMPLETE is false.  The
+   output is flushed at the end of the stream.  Returns true on success. */
+static int
+emit_stream(ycore_output_t* out, long nitems, int complete)
+{
+  yaml_emitter_t emitter;
+  yaml_event_t event;
+  char buf[32];
+  long i;
+  int ok;
+
+  if (! yaml_emitter_initialize(&emitter)) {
+    return FALSE;
+  }
+  yaml_emitter_set_output(&emitter, ycore_output_write, out);
+  ok = (yaml_stream_start_event_initialize(&event, YAML_UTF8_ENCODING) &&
+        yaml_emitter_emit(&emitter, &event) &&
+        yaml_document_start_event_initialize(&event, NULL, NULL, NULL, 1) &&
+        yaml_emitter_emit(&emitter, &event) &&
+        yaml_sequence_start_event_initialize(&event, NULL, NULL, 1,
+                                             YAML_BLOCK_SEQUENCE_STYLE) &&
+        yaml_emitter_emit(&emitter, &event));
+  for (i = 0; ok && i < nitems; ++i) {
+    int len = sprintf(buf, "item %ld", i);
+    ok = (ycore_scalar_event_initialize(&event, NULL, NULL,
+                                        (const yaml_char_t*)buf, len, 1, 1,
+                                        YAML_ANY_SCALAR_STYLE) &&
+          yaml_emitter_emit(&emitter, &event));
+  }
+  ok = (ok &&
+        yaml_sequence_end_event_initialize(&event) &&
+        yaml_emitter_emit(&emitter, &event) &&
+        yaml_document_end_event_initialize(&event, 1) &&
+        yaml_emitter_emit(&emitter, &event));
+  if (ok && complete) {
+    ok = (yaml_stream_end_event_initialize(&event) &&
+          yaml_emitter_emit(&emitter, &event));
+    out->ended = ok;
+    ok = (ok && ycore_flush_output(out));
+  } else if (ok) {
+    ok = yaml_emitter_flush(&emitter);
+  }
+  yaml_emitter_delete(&emitter);
+  return ok;
+}
+
+/* Write FILENAME atomically with NITEMS items.  Returns NULL on success,
+   an error message otherwise. */
+static const char*
+write_atomic(const char* filename, long nitems, int atomic, int complete)
+{
+  ycore_output_t out;
+  const char* errmsg;
+  memset(&out, 0, sizeof(out));
+  out.fd = -1;
+  errmsg = ycore_open_atomic(&out, filename, atomic);
+  if (errmsg == NULL) {
+    errmsg = ycore_output_init(&out, out.fd, TRUE, 0, YCORE_SYNC_NEVER);
+  }
+  if (errmsg == NULL && ! emit_stream(&out, nitems, complete)) {
+    errmsg = "emitter error";
+  }
+  if (errmsg == NULL) {
+    errmsg = ycore_close_output(&out);
+  }
+  ycore_free_output(&out);
+  return errmsg;
+}
+
+static void
+test_output(void)
+{
+  ycore_output_t out;
+  const char* errmsg;
+  const char* path;
+  char name[32];
+  char* text;
+  struct stat st;
+  double t0;
+  long i, nitems = 10000*scale, nbatch = 100;
+  pid_t pid;
+  int fd, ok, status;
+
+  printf("output:\n");
+
+  /* Plain output through several small blocks. */
+  path = temp_path("plain.yaml");
+  fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  CHECK(fd >= 0);
+  memset(&out, 0, sizeof(out));
+  CHECK(ycore_output_init(&out, fd, TRUE, 4096, YCORE_SYNC_NEVER) == NULL);
+  t0 = now();
+  CHECK(emit_stream(&out, nitems, TRUE));
+  CHECK(ycore_close_output(&out) == NULL);
+  ycore_free_output(&out);
+  CHECK(stat(path, &st) == 0 && st.st_size > nitems*7);
+  report("ycore_output_write (10^6 items)", t0, st.st_size/1E6, "MB");
+  text = read_file(path);
+  sprintf(name, "- item %ld\n", nitems - 1);
+  CHECK(text != NULL && strncmp(text, "- item 0\n- item 1\n", 18) == 0 &&
+        strstr(text, name) != NULL);
+  free(text);
+  unlink(path);
+
+  /* Atomic output: the target is replaced at once. */
+  path = temp_path("atomic.yaml");
+  write_file(path, "old\n");
+  t0 = now();
+  CHECK(write_atomic(path, 3, YCORE_ATOMIC_NOW, TRUE) == NULL);
+  report("atomic commit", t0, 0, NULL);
+  text = read_file(path);
+  CHECK(text != NULL && strcmp(text, "- item 0\n- item 1\n- item 2\n") == 0);
+  free(text);
+  CHECK(count_files() == 1);
+
+  /* An incomplete stream leaves the target unchanged and no temporary
+     file. */
+  errmsg = write_atomic(path, 3, YCORE_ATOMIC_NOW, FALSE);
+  CHECK(errmsg != NULL && strstr(errmsg, "incomplete") != NULL);
+  text = read_file(path);
+  CHECK(text != NULL && strcmp(text, "- item 0\n- item 1\n- item 2\n") == 0);
+  free(text);
+  CHECK(count_files() == 1);
+  unlink(path);
+
+  /* Batched atomic outputs are committed together. */
+  t0 = now();
+  ok = TRUE;
+  for (i = 0; i < nbatch; ++i) {
+    sprintf(name, "batch%ld.yaml", i);
+    ok = (ok && write_atomic(temp_path(name), i, YCORE_ATOMIC_BATCH,
+                             TRUE) == NULL);
+  }
+  CHECK(ok);
+  CHECK(stat(temp_path("batch0.yaml"), &st) != 0);
+  CHECK(count_files() == nbatch);
+  CHECK(ycore_commit_pending() == NULL);
+  report("batched atomic commit (100 files)", t0, nbatch, "files");
+  text = read_file(temp_path("batch2.yaml"));
+  CHECK(text != NULL && strcmp(text, "- item 0\n- item 1\n") == 0);
+  free(text);
+  CHECK(count_files() == nbatch);
+
+  /* The queued files are committed before a file which is not batched. */
+  CHECK(write_atomic(temp_path("queued.yaml"), 1, YCORE_ATOMIC_BATCH,
+                     TRUE) == NULL);
+  CHECK(stat(temp_path("queued.yaml"), &st) != 0);
+  CHECK(write_atomic(temp_path("now.yaml"), 1, YCORE_ATOMIC_NOW,
+                     TRUE) == NULL);
+  CHECK(stat(temp_path("queued.yaml"), &st) == 0);
+  CHECK(count_files() == nbatch + 2);
+
+  /* The queued files are committed at exit. */
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    exit(write_atomic(temp_path("exit.yaml"), 1, YCORE_ATOMIC_BATCH,
+                      TRUE) == NULL ? 0 : 1);
+  }
+  CHECK(pid > 0 && waitpid(pid, &status, 0) == pid &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  CHECK(stat(temp_path("exit.yaml"), &st) == 0);
+  CHECK(count_files() == nbatch + 3);
+  remove_files();
+}
+
+/*---------------------------------------------------------------------------*/
+/* PARALLEL LOOPS */
+
+typedef struct _loop_t loop_t;
+struct _loop_t {
+  double* x;
+  size_t n;
+  int nested;
+};
+
+static void
+loop_body(void* data, size_t start, size_t stop)
+{
+  loop_t* l = (loop_t*)data;
+  size_t i;
+  for (i = start; i < stop; ++i) {
+    l->x[i] = sqrt((double)i) + l->x[i];
+  }
+}
+
+static void
+nested_body(void* data, size_t start, size_t stop)
+{
+  loop_t* l = (loop_t*)data;
+  size_t i;
+  for (i = start; i < stop; ++i) {
+    /* A loop started in the body of another one runs in the calling
+       thread. */
+    loop_t inner;
+    inner.x = l->x + i*l->n;
+    inner.n = l->n;
+    ycore_parallel_for(l->n, loop_body, &inner);
+  }
+}
+
+static int
+check_loop(const double* x, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; ++i) {
+    if (x[i] != sqrt((double)i)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static void*
+loop_thread(void* arg)
+{
+  loop_t* l = (loop_t*)arg;
+  int k;
+  for (k = 0; k < 20; ++k) {
+    memset(l->x, 0, l->n*sizeof(double));
+    ycore_parallel_for(l->n, loop_body, l);
+    if (! check_loop(l->x, l->n)) {
+      return arg;
+    }
+  }
+  return NULL;
+}
+
+static void
+test_parallel(void)
+{
+  size_t i, n = 100000*scale;
+  loop_t l, t[2];
+  pthread_t id[2];
+  void* res[2];
+  double* x;
+  double t0;
+  char what[64];
+  int nthreads = ycore_parallel_threads();
+
+  printf("parallel loops:\n");
+  x = (double*)calloc(n, sizeof(double));
+  if (x == NULL) {
+    CHECK(x != NULL);
+    return;
+  }
+  l.x = x;
+  l.n = n;
+
+  ycore_set_parallel_threads(1);
+  CHECK(ycore_parallel_threads() == 1);
+  t0 = now();
+  ycore_parallel_for(n, loop_body, &l);
+  report("ycore_parallel_for (1 thread)", t0, n, "iterations");
+  CHECK(check_loop(x, n));
+
+  ycore_set_parallel_threads(0);
+  CHECK(ycore_parallel_threads() >= 1);
+  memset(x, 0, n*sizeof(double));
+  t0 = now();
+  ycore_parallel_for(n, loop_body, &l);
+  sprintf(what, "ycore_parallel_for (%d thread%s)", ycore_parallel_threads(),
+          (ycore_parallel_threads() > 1 ? "s" : ""));
+  report(what, t0, n, "iterations");
+  CHECK(check_loop(x, n));
+
+  /* The other tests use several threads even on a single processor. */
+  ycore_set_parallel_threads(4);
+
+  /* Empty and tiny loops. */
+  ycore_parallel_for(0, loop_body, &l);
+  memset(x, 0, 3*sizeof(double));
+  ycore_parallel_for(3, loop_body, &l);
+  CHECK(check_loop(x, 3));
+
+  /* Nested loops: rows of 1000 elements. */
+  memset(x, 0, n*sizeof(double));
+  l.n = 1000;
+  ycore_parallel_for(n/1000, nested_body, &l);
+  for (i = 0; i < n/1000; ++i) {
+    if (! check_loop(x + i*1000, 1000)) {
+      break;
+    }
+  }
+  CHECK(i == n/1000);
+
+  /* Loops started by concurrent threads. */
+  for (i = 0; i < 2; ++i) {
+    t[i].x = x + i*(n/2);
+    t[i].n = n/2;
+    res[i] = &t[i];
+    CHECK(pthread_create(&id[i], NULL, loop_thread, &t[i]) == 0);
+  }
+  for (i = 0; i < 2; ++i) {
+    CHECK(pthread_join(id[i], &res[i]) == 0 && res[i] == NULL);
+  }
+  ycore_set_parallel_threads(nthreads);
+  free(x);
+}
+
+/* Write TEXT in file NAME of the cgroup fixture tree. */
+static void
+write_cgroup_file(const char* name, const char* text)
+{
+  char path[512];
+  sprintf(path, "cg/%s", name);
+  write_file(temp_path(path), text);
+}
+
+static void
+test_cgroup(void)
+{
+  /* Directories of the fixture tree (parents first) and its files. */
+  static const char* dirs[] = {
+    "", "proc", "proc/self", "sys", "sys/fs", "sys/fs/cgroup",
+    "sys/fs/cgroup/a", "sys/fs/cgroup/a/b", "sys/fs/cgroup/cpu",
+    "sys/fs/cgroup/cpu/job"
+  };
+  static const char* files[] = {
+    "proc/self/cgroup", "proc/self/mountinfo", "sys/fs/cgroup/a/cpu.max",
+    "sys/fs/cgroup/a/b/cpu.max", "sys/fs/cgroup/cpu/job/cpu.cfs_quota_us",
+    "sys/fs/cgroup/cpu/job/cpu.cfs_period_us"
+  };
+  const int ndirs = sizeof(dirs)/sizeof(dirs[0]);
+  const int nfiles = sizeof(files)/sizeof(files[0]);
+  char root[512], path[512];
+  int i;
+
+  printf("cgroup CPU quota:\n");
+  for (i = 0; i < ndirs; ++i) {
+    sprintf(path, "cg/%s", dirs[i]);
+    CHECK(mkdir(temp_path(path), 0700) == 0);
+  }
+  strcpy(root, temp_path("cg"));
+  ycore_cgroup_root = root;
+
+  /* No description of the cgroups. */
+  CHECK(ycore_cgroup_cpus() == 0);
+
+  /* cgroup v2: the quota of an ancestor applies. */
+  write_cgroup_file("proc/self/cgroup", "0::/a/b\n");
+  write_cgroup_file("proc/self/mountinfo",
+                    "22 1 8:1 / / rw - ext4 /dev/sda1 rw\n"
+                    "30 22 0:26 / /sys/fs/cgroup rw - cgroup2 cgroup2 rw\n");
+  write_cgroup_file("sys/fs/cgroup/a/b/cpu.max", "max 100000\n");
+  write_cgroup_file("sys/fs/cgroup/a/cpu.max", "250000 100000\n");
+  CHECK(ycore_cgroup_cpus() == 3);
+  write_cgroup_file("sys/fs/cgroup/a/b/cpu.max", "100000 100000\n");
+  CHECK(ycore_cgroup_cpus() == 1);
+
+  /* cgroup v2 without quota ("max"). */
+  write_cgroup_file("sys/fs/cgroup/a/b/cpu.max", "max 100000\n");
+  write_cgroup_file("sys/fs/cgroup/a/cpu.max", "max 100000\n");
+  CHECK(ycore_cgroup_cpus() == 0);
+
+  /* cgroup v1 with the "cpu" controller, the mounted directory being a
+     cgroup below the root of the hierarchy. */
+  write_cgroup_file("proc/self/cgroup",
+                    "5:memory:/slice/job\n4:cpu,cpuacct:/slice/job\n");
+  write_cgroup_file("proc/self/mountinfo",
+                    "22 1 8:1 / / rw - ext4 /dev/sda1 rw\n"
+                    "31 22 0:27 /slice /sys/fs/cgroup/cpu rw - cgroup cgroup "
+                    "rw,cpu,cpuacct\n");
+  write_cgroup_file("sys/fs/cgroup/cpu/job/cpu.cfs_quota_us", "150000\n");
+  write_cgroup_file("sys/fs/cgroup/cpu/job/cpu.cfs_period_us", "100000\n");
+  CHECK(ycore_cgroup_cpus() == 2);
+  write_cgroup_file("sys/fs/cgroup/cpu/job/cpu.cfs_quota_us", "-1\n");
+  CHECK(ycore_cgroup_cpus() == 0);
+
+  ycore_cgroup_root = "";
+  for (i = 0; i < nfiles; ++i) {
+    sprintf(path, "cg/%s", files[i]);
+    CHECK(unlink(temp_path(path)) == 0);
+  }
+  for (i = ndirs - 1; i >= 0; --i) {
+    sprintf(path, "cg/%s", dirs[i]);
+    CHECK(rmdir(temp_path(path)) == 0);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+/* READER AND DOCUMENTS */
+
+/* Open a reader of file PATH, with checkpoints resuming at CP if TRACK is
+   true (CP may be NULL). */
+static int
+open_reader(ycore_reader_t* r, const char* path, int track,
+            const int64_t* cp)
+{
+  const char* errmsg = NULL;
+  int fd = open(path, O_RDONLY);
+  ycore_reader_init(r);
+  if (fd < 0) {
+    return FALSE;
+  }
+  if (track) {
+    errmsg = ycore_reader_resume(r, cp);
+  }
+  if (errmsg == NULL) {
+    errmsg = ycore_reader_set_input(r, fd, TRUE, r->cpbyte, 0);
+  }
+  if (errmsg == NULL) {
+    errmsg = ycore_reader_start(r);
+  }
+  return (errmsg == NULL);
+}
+
+/* Deliver the next event of reader R and check its type. */
+static int
+next_event(ycore_reader_t* r, yaml_event_type_t type)
+{
+  yaml_event_t event;
+  int ok;
+  if (ycore_reader_next(r, &event) <= 0) {
+    return FALSE;
+  }
+  ok = (event.type == type);
+  yaml_event_delete(&event);
+  return ok;
+}
+
+/* Load a document from TEXT.  Returns true on success. */
+static int
+load_text(ycore_document_t* doc, const char* text)
+{
+  ycore_reader_t r;
+  const char* errmsg;
+  const char* path = temp_path("doc.yaml");
+  write_file(path, text);
+  memset(doc, 0, sizeof(*doc));
+  ycore_reader_init(&r);
+  errmsg = ycore_reader_open(&r, path);
+  if (errmsg == NULL) {
+    errmsg = ycore_load_document(&r, doc);
+  }
+  ycore_reader_destroy(&r);
+  unlink(path);
+  return (errmsg == NULL && doc->nnodes > 0);
+}
+
+/* Yield the value of key KEY of mapping node ID (with merge keys
+   resolved), NULL if not found. */
+static yaml_node_t*
+get_value(ycore_document_t* doc, int id, const char* key)
+{
+  yaml_node_pair_t* pairs;
+  long i, n;
+  if (ycore_mapping_pairs(doc, id, &pairs, &n) != NULL) {
+    return NULL;
+  }
+  for (i = 0; i < n; ++i) {
+    yaml_node_t* k = yaml_document_get_node(&doc->document, pairs[i].key);
+    if (k->type == YAML_SCALAR_NODE &&
+        strcmp((const char*)k->data.scalar.value, key) == 0) {
+      return yaml_document_get_node(&doc->document, pairs[i].value);
+    }
+  }
+  return NULL;
+}
+
+/* Yield the identifier of NODE, 0 if NULL. */
+static int
+node_id(ycore_document_t* doc, yaml_node_t* node)
+{
+  return (node != NULL ? 1 + (int)(node - doc->document.nodes.start) : 0);
+}
+
+static int
+is_scalar(const yaml_node_t* node, const char* value)
+{
+  return (node != NULL && node->type == YAML_SCALAR_NODE &&
+          strcmp((const char*)node->data.scalar.value, value) == 0);
+}
+
+static void
+test_reader(void)
+{
+  const char* text = "a: 1\n---\nb: [1, [2, 3], x]\n...\n---\nc: 3\n";
+  const char* path = temp_path("reader.yaml");
+  ycore_reader_t r;
+  ycore_document_t doc, other;
+  ycore_hasher_t h;
+  ycore_ahead_t* a;
+  yaml_event_t event;
+  yaml_node_pair_t* pairs;
+  yaml_event_type_t type;
+  int64_t cp[5];
+  long i, n = 0, nevents = 0;
+  int id;
+  double t0;
+  FILE* file;
+
+  printf("reader:\n");
+  write_file(path, text);
+
+  /* Events, lookahead and measuring. */
+  CHECK(open_reader(&r, path, TRUE, NULL));
+  CHECK(next_event(&r, YAML_STREAM_START_EVENT));
+  CHECK(ycore_reader_peek(&r, 3, &a) == 1 &&
+        a->event.type == YAML_SCALAR_EVENT &&
+        strcmp((const char*)a->event.data.scalar.value, "a") == 0);
+  CHECK(next_event(&r, YAML_DOCUMENT_START_EVENT));
+  CHECK(ycore_reader_measure(&r) < 0 && r.error != NULL);
+  for (i = 0; i < 5; ++i) {
+    CHECK(ycore_reader_next(&r, &event) == 1);
+    yaml_event_delete(&event);
+  }
+  CHECK(r.cpdoc == 1 && r.cpbyte == 5 && r.cpline == 1);
+  cp[0] = r.cpbyte;
+  cp[1] = r.cpchar;
+  cp[2] = r.cpline;
+  cp[3] = r.cpcolumn;
+  cp[4] = r.cpdoc;
+  CHECK(next_event(&r, YAML_DOCUMENT_START_EVENT));
+  CHECK(next_event(&r, YAML_MAPPING_START_EVENT));
+  CHECK(next_event(&r, YAML_SCALAR_EVENT));
+  CHECK(next_event(&r, YAML_SEQUENCE_START_EVENT));
+  CHECK(ycore_reader_measure(&r) == 1 && r.items == 3 && ! r.scalars);
+  CHECK(next_event(&r, YAML_SCALAR_EVENT));
+  CHECK(next_event(&r, YAML_SEQUENCE_START_EVENT));
+  CHECK(r.items == 2 && r.scalars);
+  ycore_reader_destroy(&r);
+
+  /* Measuring buffers a bounded number of events. */
+  ycore_max_measured_events = 6;
+  CHECK(open_reader(&r, path, TRUE, NULL));
+  do {
+    CHECK(ycore_reader_next(&r, &event) == 1);
+    type = event.type;
+    yaml_event_delete(&event);
+  } while (type != YAML_SEQUENCE_START_EVENT &&
+           type != YAML_STREAM_END_EVENT);
+  CHECK(ycore_reader_measure(&r) == 1 && r.items == -1 && r.nahead == 6);
+  CHECK(next_event(&r, YAML_SCALAR_EVENT));
+  CHECK(next_event(&r, YAML_SEQUENCE_START_EVENT));
+  CHECK(r.items == 2 && r.scalars);
+  ycore_reader_destroy(&r);
+  ycore_max_measured_events = 65536;
+
+  /* Resume at a checkpoint. */
+  CHECK(open_reader(&r, path, TRUE, cp));
+  CHECK(next_event(&r, YAML_STREAM_START_EVENT));
+  CHECK(next_event(&r, YAML_DOCUMENT_START_EVENT));
+  CHECK(next_event(&r, YAML_MAPPING_START_EVENT));
+  CHECK(ycore_reader_next(&r, &event) == 1 &&
+        event.type == YAML_SCALAR_EVENT &&
+        strcmp((const char*)event.data.scalar.value, "b") == 0 &&
+        event.start_mark.line == 2);
+  yaml_event_delete(&event);
+  ycore_reader_destroy(&r);
+  cp[1] = -1;
+  ycore_reader_init(&r);
+  CHECK(ycore_reader_resume(&r, cp) != NULL);
+  ycore_reader_destroy(&r);
+
+  /* Documents. */
+  ycore_reader_init(&r);
+  CHECK(ycore_reader_open(&r, path) == NULL);
+  for (i = 0; i < 4; ++i) {
+    memset(&doc, 0, sizeof(doc));
+    CHECK(ycore_load_document(&r, &doc) == NULL);
+    CHECK(i < 3 ? doc.nnodes > 0 : doc.nnodes == 0);
+    ycore_document_destroy(&doc);
+  }
+  CHECK(! next_event(&r, YAML_STREAM_END_EVENT));
+  ycore_reader_destroy(&r);
+  ycore_reader_init(&r);
+  CHECK(ycore_reader_open(&r, temp_path("missing.yaml")) != NULL);
+  ycore_reader_destroy(&r);
+  unlink(path);
+
+  /* Duplicate keys. */
+  CHECK(load_text(&doc, "x: 1\ny: 2\nx: 3\n"));
+  CHECK(ycore_check_duplicates(&doc, YCORE_DUPKEYS_ERROR) != NULL &&
+        strstr(doc.errmsg, "line 3") != NULL);
+  ycore_document_destroy(&doc);
+  CHECK(load_text(&doc, "x: 1\ny: 2\nx: 3\n"));
+  CHECK(ycore_check_duplicates(&doc, YCORE_DUPKEYS_LAST) == NULL);
+  CHECK(is_scalar(get_value(&doc, doc.root, "x"), "3"));
+  ycore_document_destroy(&doc);
+  CHECK(load_text(&doc, "x: 1\ny: 2\nx: 3\n"));
+  CHECK(ycore_check_duplicates(&doc, YCORE_DUPKEYS_COLLECT) == NULL);
+  CHECK(get_value(&doc, doc.root, "x") != NULL &&
+        get_value(&doc, doc.root, "x")->type == YAML_SEQUENCE_NODE);
+  ycore_document_destroy(&doc);
+
+  /* Merge keys. */
+  CHECK(load_text(&doc, "b: &b {x: 1, y: 2}\nd: {<<: *b, y: 3}\n"));
+  id = node_id(&doc, get_value(&doc, doc.root, "d"));
+  CHECK(is_scalar(get_value(&doc, id, "x"), "1"));
+  CHECK(is_scalar(get_value(&doc, id, "y"), "3"));
+  ycore_document_destroy(&doc);
+  CHECK(load_text(&doc, "d: {<<: 1}\n"));
+  id = node_id(&doc, get_value(&doc, doc.root, "d"));
+  CHECK(ycore_mapping_pairs(&doc, id, &pairs, &n) != NULL);
+  ycore_document_destroy(&doc);
+
+  /* Node digests do not depend on the order of keys. */
+  ycore_hasher_init(&h);
+  CHECK(load_text(&doc, "{a: 1, b: [2, x]}"));
+  CHECK(load_text(&other, "b: [0x2, x]\na: 1.0e0\n"));
+  CHECK(ycore_hash_document(&h, &doc) == NULL &&
+        ycore_hash_document(&h, &other) == NULL);
+  CHECK(ycore_compare_digests(doc.digest, other.digest) != 0);
+  ycore_document_destroy(&other);
+  CHECK(load_text(&other, "b: [0x2, x]\na: 01\n"));
+  CHECK(ycore_hash_document(&h, &other) == NULL);
+  CHECK(ycore_compare_digests(doc.digest, other.digest) == 0);
+  ycore_document_destroy(&doc);
+  ycore_document_destroy(&other);
+  ycore_hasher_destroy(&h);
+
+  /* Events of a large file. */
+  file = fopen(path, "w");
+  CHECK(file != NULL);
+  if (file == NULL) {
+    return;
+  }
+  for (i = 0; i < 1000*scale; ++i) {
+    fprintf(file, "- {id: %ld, name: item%ld, tags: [a, b, c]}\n", i, i);
+  }
+  n = ftell(file);
+  fclose(file);
+  CHECK(open_reader(&r, path, TRUE, NULL));
+  t0 = now();
+  while (ycore_reader_next(&r, &event) == 1) {
+    yaml_event_type_t type = event.type;
+    yaml_event_delete(&event);
+    ++nevents;
+    if (type == YAML_STREAM_END_EVENT) {
+      break;
+    }
+  }
+  report("ycore_reader_next (checkpoints)", t0, n/1E6, "MB");
+  CHECK(nevents == 1000*scale*12 + 6 && r.cpbyte == n);
+  ycore_reader_destroy(&r);
+  unlink(path);
+}
+
+/*---------------------------------------------------------------------------*/
+/* TAPES */
+
+static void
+test_tape(void)
+{
+  const char* path = temp_path("tape.yaml");
+  ycore_reader_t r;
+  ycore_tape_t t;
+  yaml_event_t event;
+  int status;
+
+  printf("tapes:\n");
+  write_file(path, "- [1, {a: 2}]\n- 3\n");
+  memset(&t, 0, sizeof(t));
+  CHECK(open_reader(&r, path, FALSE, NULL));
+  CHECK(next_event(&r, YAML_STREAM_START_EVENT));
+  CHECK(next_event(&r, YAML_DOCUMENT_START_EVENT));
+  CHECK(next_event(&r, YAML_SEQUENCE_START_EVENT));
+  do {
+    status = ycore_reader_next(&r, &event);
+    CHECK(status == 1);
+    if (status != 1) {
+      break;
+    }
+    CHECK(ycore_tape_record(&t, &event) == NULL);
+    yaml_event_delete(&event);
+  } while (t.depth > 0);
+  CHECK(t.count == 7 && t.depth == 0);
+  CHECK(t.count == 7 && ycore_tape_skip(t.event, t.count, 1) == 2 &&
+        ycore_tape_skip(t.event, t.count, 2) == 6 &&
+        ycore_tape_skip(t.event, t.count, 0) == 7);
+  CHECK(t.count > 4 && t.event[4].type == YAML_SCALAR_EVENT &&
+        strcmp((const char*)t.event[4].data.scalar.value, "2") == 0);
+  ycore_tape_clear(&t);
+  CHECK(t.count == 0 && t.event != NULL);
+  ycore_tape_destroy(&t);
+  ycore_reader_destroy(&r);
+  unlink(path);
+}
+
+/* LARGE FILES AND SCALARS */
+
+/* Check the events of a document "b: VALUE" delivered by reader R. */
+static int
+check_document(ycore_reader_t* r, const char* value)
+{
+  yaml_event_t event;
+  int ok;
+  if (! next_event(r, YAML_DOCUMENT_START_EVENT) ||
+      ! next_event(r, YAML_MAPPING_START_EVENT) ||
+      ! next_event(r, YAML_SCALAR_EVENT) ||
+      ycore_reader_next(r, &event) != 1) {
+    return FALSE;
+  }
+  ok = (event.type == YAML_SCALAR_EVENT &&
+        strcmp((const char*)event.data.scalar.value, value) == 0);
+  yaml_event_delete(&event);
+  return (ok && next_event(r, YAML_MAPPING_END_EVENT) &&
+          next_event(r, YAML_DOCUMENT_END_EVENT));
+}
+
+/* Read documents beyond 2 GiB in a sparse file, from a checkpoint and in
+   follow mode. */
+static void
+test_large_file(void)
+{
+  const char* text = "---\nb: 2\n...\n--- {b: 3}\n";
+  const char* path = temp_path("large.yaml");
+  const int64_t start = (int64_t)3 << 30;
+  int64_t cp[5], size;
+  ycore_reader_t r;
+  yaml_event_t event;
+  int fd;
+
+  printf("large files:\n");
+  fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if (fd < 0 || ftruncate(fd, (off_t)start) != 0 ||
+      pwrite(fd, text, strlen(text), (off_t)start) != (ssize_t)strlen(text)) {
+    printf("  skipped (no sparse file larger than 2 GiB)\n");
+    if (fd >= 0) {
+      close(fd);
+    }
+    unlink(path);
+    return;
+  }
+  size = start + strlen(text);
+
+  /* Resume at a checkpoint.  The file is filled with null bytes before it,
+     so the character index is the byte offset. */
+  cp[0] = cp[1] = start;
+  cp[2] = 10;
+  cp[3] = 0;
+  cp[4] = 1;
+  CHECK(open_reader(&r, path, TRUE, cp));
+  CHECK(next_event(&r, YAML_STREAM_START_EVENT));
+  CHECK(check_document(&r, "2"));
+  CHECK(r.cpbyte == start + 12 && r.cpchar == (long)(start + 12) &&
+        r.cpline == 12 && r.cpcolumn == 3 && r.cpdoc == 2);
+  CHECK(check_document(&r, "3"));
+  CHECK(next_event(&r, YAML_STREAM_END_EVENT));
+  CHECK(r.cpbyte == size && r.cpdoc == 3);
+  ycore_reader_destroy(&r);
+
+  /* Follow the file from the checkpoint, the last document is only
+     delivered when it is complete. */
+  ycore_reader_init(&r);
+  CHECK(ycore_reader_resume(&r, cp) == NULL);
+  r.fd = open(path, O_RDONLY);
+  r.closefd = TRUE;
+  CHECK(r.fd >= 0);
+  ycore_reader_follow(&r, path, 0.0);
+  CHECK(next_event(&r, YAML_STREAM_START_EVENT));
+  CHECK(check_document(&r, "2"));
+  CHECK(r.cpbyte == start + 12 && r.limit == start + 13);
+  CHECK(ycore_reader_next(&r, &event) == 0);
+  CHECK(pwrite(fd, "...\n", 4, (off_t)size) == 4);
+  CHECK(check_document(&r, "3"));
+  CHECK(r.cpbyte == size + 3 && r.cpdoc == 3);
+  ycore_reader_destroy(&r);
+  close(fd);
+  unlink(path);
+}
+
+/* Check that a scalar event and a scalar node built from the LEN bytes at
+   VALUE (which start with 'a' and end with 'z') have the same contents. */
+static void
+check_large_scalar(const yaml_char_t* value, size_t len, const char* what)
+{
+  char name[80];
+  yaml_document_t doc;
+  yaml_event_t event;
+  yaml_node_t* node;
+  double t0;
+  int id;
+
+  t0 = now();
+  CHECK(ycore_scalar_event_initialize(&event, NULL, NULL, value, len, 1, 1,
+                                      YAML_ANY_SCALAR_STYLE));
+  sprintf(name, "ycore_scalar_event_initialize (%s)", what);
+  report(name, t0, len/1E6, "MB");
+  CHECK(event.type == YAML_SCALAR_EVENT &&
+        event.data.scalar.length == len &&
+        event.data.scalar.value[0] == 'a' &&
+        event.data.scalar.value[len - 1] == 'z' &&
+        event.data.scalar.value[len] == '\0');
+  yaml_event_delete(&event);
+
+  CHECK(yaml_document_initialize(&doc, NULL, NULL, NULL, 1, 1));
+  t0 = now();
+  id = ycore_document_add_scalar(&doc, NULL, value, len,
+                                 YAML_ANY_SCALAR_STYLE);
+  sprintf(name, "ycore_document_add_scalar (%s)", what);
+  report(name, t0, len/1E6, "MB");
+  CHECK(id > 0);
+  node = (id > 0 ? yaml_document_get_node(&doc, id) : NULL);
+  CHECK(node != NULL && node->type == YAML_SCALAR_NODE &&
+        node->data.scalar.length == len &&
+        node->data.scalar.value[0] == 'a' &&
+        node->data.scalar.value[len - 1] == 'z' &&
+        node->data.scalar.value[len] == '\0');
+  yaml_document_delete(&doc);
+}
+
+/* Build events and nodes with scalars longer than what libyaml supports.
+   The limit is lowered to always test the code, the scalars just over
+   INT_MAX bytes need about 5 GiB of memory and are only tested if the
+   environment variable YAML_CORE_TEST_LARGE is set. */
+static void
+test_large_scalar(void)
+{
+  size_t len = (size_t)INT_MAX + 1;
+  yaml_char_t* value;
+
+  printf("large scalars:\n");
+  ycore_max_libyaml_length = 15;
+  check_large_scalar((const yaml_char_t*)"abcdefghijklmnopqrstuvwxyz", 26,
+                     "over a lowered limit");
+  check_large_scalar((const yaml_char_t*)"abcz", 4, "under a lowered limit");
+  ycore_max_libyaml_length = INT_MAX;
+
+  if (getenv("YAML_CORE_TEST_LARGE") == NULL) {
+    printf("  2 GiB scalars skipped (set YAML_CORE_TEST_LARGE to run)\n");
+    return;
+  }
+  value = (yaml_char_t*)malloc(len + 1);
+  if (value == NULL) {
+    printf("  2 GiB scalars skipped (insufficient memory)\n");
+    return;
+  }
+  memset(value, 'x', len);
+  value[0] = 'a';
+  value[len - 1] = 'z';
+  value[len] = '\0';
+  check_large_scalar(value, len, "2 GiB");
+  free(value);
+}
+
+/*---------------------------------------------------------------------------*/
+
+int
+main(int argc, char* argv[])
+{
+  const char* dir = getenv("TMPDIR");
+  double t0 = now();
+
+  if (argc == 2 && strcmp(argv[1], "bench") == 0) {
+    scale = 100;
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [bench]\n", argv[0]);
+    return 1;
+  }
+  sprintf(tmpdir, "%.200s/yaml_core_test.XXXXXX",
+          (dir != NULL && dir[0] != '\0' ? dir : "/tmp"));
+  if (mkdtemp(tmpdir) == NULL) {
+    fprintf(stderr, "failed to create temporary directory\n");
+    return 1;
+  }
+  test_scalars();
+  test_hasher();
+  test_output();
+  test_parallel();
+  test_cgroup();
+  test_reader();
+  test_tape();
+  test_large_file();
+  test_large_scalar();
+  remove_files();
+  rmdir(tmpdir);
+  printf("%ld checks, %ld failures, %.3f s\n", nchecks, nfailures,
+         now() - t0);
+  return (nfailures > 0 ? 1 : 0);
+}